@@ -0,0 +1,59 @@
+#ifndef CONTY_BPF_H
+#define CONTY_BPF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <unistd.h>
+
+/*
+ * Tracer configuration
+ *
+ * Every tracer attaches its eBPF programs, samples its histograms
+ * each cbc_interval seconds, appends them to its sink and detaches
+ * after cbc_duration seconds have elapsed
+ */
+struct conty_bpf_tracer {
+    unsigned int  cbc_interval;
+    unsigned int  cbc_duration;
+    /*
+     * Virtual filesystem latency tracer
+     */
+    const char   *cbc_vfs_sink;
+    pid_t         cbc_vfs_pid;
+    /*
+     * Optional sink for page cache hit ratios sampled alongside
+     * the virtual filesystem latencies
+     */
+    const char   *cbc_cache_sink;
+    /*
+     * CPU run queue latency tracer
+     */
+    const char   *cbc_rq_sink;
+    pid_t         cbc_rq_pid;
+    /*
+     * TCP round trip time tracer
+     */
+    const char   *cbc_tcp_sink;
+    unsigned int  cbc_tcp_src;
+    unsigned int  cbc_tcp_dst;
+    /*
+     * Block device latency tracer
+     */
+    const char   *cbc_blk_sink;
+    pid_t         cbc_blk_pid;
+};
+
+unsigned long long tick_get_ktime_ns(void);
+
+int conty_bpf_trace_vfsops(const struct conty_bpf_tracer *tracer);
+int conty_bpf_trace_cpurq(const struct conty_bpf_tracer *tracer);
+int conty_bpf_trace_tcprtt(const struct conty_bpf_tracer *tracer);
+int conty_bpf_trace_blkio(const struct conty_bpf_tracer *tracer);
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+#endif //CONTY_BPF_H
@@ -5,6 +5,7 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <unistd.h>
 
 typedef enum {
@@ -14,8 +15,65 @@ typedef enum {
     CONTY_STOPPED  = 3
 } conty_container_status_t;
 
+/*
+ * Phases of creating and starting a container, see conty_container_phase_ns.
+ * Those from user_map to pivot happen in the container process
+ */
+typedef enum {
+    CONTY_PHASE_CREATE               = 0,
+    CONTY_PHASE_SPAWN                = 1,
+    CONTY_PHASE_NET                  = 2,
+    CONTY_PHASE_RUNTIME_CREATE_HOOKS = 3,
+    CONTY_PHASE_USER_MAP             = 4,
+    CONTY_PHASE_ROOTFS               = 5,
+    CONTY_PHASE_DEV                  = 6,
+    CONTY_PHASE_MKDEV                = 7,
+    CONTY_PHASE_PROC_SYS             = 8,
+    CONTY_PHASE_CREATED_HOOKS        = 9,
+    CONTY_PHASE_PIVOT                = 10,
+    CONTY_PHASE_START                = 11,
+    CONTY_PHASE_STARTED_HOOKS        = 12
+} conty_container_phase_t;
+
+#define CONTY_PHASE_MAX (CONTY_PHASE_STARTED_HOOKS)
+
 struct conty_container;
+struct conty_pod;
+struct rusage;
 struct conty_container *conty_container_create(const char *id, const char *bundle);
+
+/*
+ * Namespaces in a configuration may refer to those of another container,
+ * with "container" instead of "path", or of any process, with "pid".
+ * The container joins all of them with a single setns on a pidfd for that
+ * process, without an intermediate process.
+ *
+ * Containers are referred to by their identifier, which the resolver turns
+ * into the pollable file descriptor of the container's process. The
+ * descriptor remains the resolver's. Returns a negative error code if there's
+ * no such container
+ */
+typedef int (*conty_container_resolver_t)(const char *id, void *data);
+void conty_container_set_resolver(conty_container_resolver_t cb, void *data);
+
+/*
+ * Have the runtime write the id mappings of containers with a user namespace
+ * through /proc/<pid>, instead of every container writing its own. Off by
+ * default, it costs an extra round trip with the container. Containers with an
+ * idmapped root filesystem always have their mappings written by the runtime
+ */
+void conty_container_set_runtime_id_maps(int enable);
+/*
+ * Rebuild a container that was created by a previous instance of the caller,
+ * from its process and the pollable file descriptor of that process.
+ * On success, the container takes ownership of pollfd, which may be negative
+ * if the container process is gone. veth is what conty_container_veth
+ * returned for the container back then, it may be empty.
+ * Restored containers can be killed and deleted but not started
+ */
+struct conty_container *conty_container_restore(const char *id, const char *bundle,
+                                                const char *veth, pid_t pid, int pollfd,
+                                                conty_container_status_t status);
 int conty_container_start(struct conty_container *container);
 int conty_container_kill(struct conty_container *container, int sig);
 int conty_container_delete(struct conty_container *container);
@@ -23,10 +81,142 @@ void conty_container_free(struct conty_container *container);
 const char *conty_container_id(const struct conty_container *cc);
 int conty_container_pollfd(const struct conty_container *cc);
 pid_t conty_container_pid(const struct conty_container *cc);
+/*
+ * Name of the host's end of the network device pair of the container, empty
+ * if it isn't connected to a bridge. The name can't be derived from the
+ * identifier alone, so it has to be kept to restore the container
+ */
+const char *conty_container_veth(const struct conty_container *cc);
 void conty_container_set_status(struct conty_container *cc,
                                 conty_container_status_t status);
 conty_container_status_t conty_container_status(const struct conty_container *container);
 const char *conty_container_status_str(const struct conty_container *container);
+/*
+ * Wall time the container spent waiting for its hooks, in nanoseconds
+ */
+uint64_t conty_container_hooks_ns(const struct conty_container *cc);
+/*
+ * Monotonic time a phase took, in nanoseconds, 0 if the container didn't go
+ * through it (yet). Create and start span the whole operation, from the call
+ * until the outcome is known, the other phases are part of them
+ */
+uint64_t conty_container_phase_ns(const struct conty_container *cc,
+                                  conty_container_phase_t phase);
+const char *conty_container_phase_str(conty_container_phase_t phase);
+
+/*
+ * Collect the exit status and resource usage of the container process once
+ * its pollfd is readable, without blocking. Returns -EAGAIN while the process
+ * is running and -ECHILD if it isn't the caller's child, which is the case
+ * for restored containers. Once reaped, the status is in the format of
+ * waitpid's and the usage that of wait4's, until then they're -1 and NULL
+ */
+int conty_container_reap(struct conty_container *cc);
+int conty_container_exit_status(const struct conty_container *cc);
+const struct rusage *conty_container_rusage(const struct conty_container *cc);
+
+/*
+ * Create and start without blocking, for callers that drive many containers
+ * from their own event loop. conty_container_create and conty_container_start
+ * do the same and wait for the outcome.
+ *
+ * Both return as soon as the container process was spawned or told to start.
+ * From then on, whenever the descriptor returned by conty_container_syncfd is
+ * readable, the caller calls conty_container_advance, which returns -EAGAIN
+ * until the operation is done and then 0 or a negative error code. Along with
+ * that, cb is called with the same outcome, and may free the container.
+ * Hooks and the network are still set up from within conty_container_advance.
+ *
+ * A container whose creation failed has no process anymore and is only
+ * good for conty_container_free
+ */
+typedef void (*conty_container_cb_t)(struct conty_container *cc, int err, void *data);
+struct conty_container *conty_container_create_async(struct conty_pod *pod, const char *id,
+                                                     const char *bundle,
+                                                     conty_container_cb_t cb, void *data);
+int conty_container_start_async(struct conty_container *cc);
+int conty_container_syncfd(const struct conty_container *cc);
+int conty_container_advance(struct conty_container *cc);
+
+/*
+ * Delete stopped containers on a background thread, so that their
+ * container_stopped hooks and whatever else goes away along with them don't
+ * hold up the caller, which is free to carry on with the next container.
+ *
+ * conty_container_delete_async hands a container over to the thread and
+ * returns -EAGAIN if the deleter isn't running, has too many containers on
+ * its hands already or the container has nothing to it that takes time, in
+ * which case the caller deletes the container itself. So do containers with
+ * plugins or hook servers among their container_stopped hooks, which stay
+ * on the caller's thread like the hooks of every other event.
+ * The container must be left alone until it's done. Whenever the descriptor
+ * returned by conty_deleter_fd is readable, the caller calls
+ * conty_deleter_next until it returns NULL. It returns the data of a container
+ * whose deletion is done, and the outcome of conty_container_delete in err.
+ * The container is freed by then, on the caller's thread.
+ *
+ * Containers must be handed over and collected from a single thread.
+ * Stopping the deleter waits for the containers in flight and frees them.
+ * The data of those the caller didn't collect goes to cb along with the
+ * outcome, so that it can be released. cb may be NULL if there's nothing to
+ * release
+ */
+typedef void (*conty_deleter_cb_t)(void *data, int err, void *arg);
+int conty_deleter_start(void);
+void conty_deleter_stop(conty_deleter_cb_t cb, void *arg);
+int conty_deleter_fd(void);
+int conty_container_delete_async(struct conty_container *cc, void *data);
+void *conty_deleter_next(int *err);
+
+/*
+ * A pod is a group of containers that share the net, ipc and uts namespaces
+ * of a holder process, which is created along with the pod and does nothing
+ * but keep them alive. The pod's bundle is an OCI configuration without
+ * "root" and "process" that lists the shared namespaces. Its "hostname",
+ * "network" and runtime_create hooks are applied once when the pod is
+ * created, its container_stopped hooks run once when it's deleted.
+ *
+ * Members are spawned directly into the pod's namespaces and must neither
+ * create nor join namespaces of the kinds the pod shares, nor have a network
+ * of their own. A pod can only be deleted once all its members are,
+ * freeing it kills the holder without running any hooks
+ */
+struct conty_pod *conty_pod_create(const char *id, const char *bundle);
+int conty_pod_delete(struct conty_pod *pod);
+void conty_pod_free(struct conty_pod *pod);
+const char *conty_pod_id(const struct conty_pod *pod);
+pid_t conty_pod_pid(const struct conty_pod *pod);
+struct conty_container *conty_container_create_in(struct conty_pod *pod, const char *id,
+                                                  const char *bundle);
+
+/*
+ * Unpack the layers of the image in the OCI image layout at layout into the
+ * layer store at store, skipping those that are already there.
+ * On success, layers holds the digests of the image's layers from the bottom
+ * to the top, for the "layers" of a root filesystem, and is freed by the caller.
+ * Returns the number of layers that had to be unpacked
+ */
+int conty_image_unpack(const char *store, const char *layout, char ***layers);
+
+/*
+ * Keep size pairs of virtual ethernet devices attached to bridge ready, so
+ * that connecting a container to that bridge only takes renaming one end
+ * and moving the other into the container. A background thread replaces
+ * the pairs that were taken. Containers must be created from a single
+ * thread while the pool is running
+ */
+int conty_net_pool_start(const char *bridge, unsigned int size);
+void conty_net_pool_stop(void);
+
+/*
+ * Keep stacks of size bytes, 8 MiB if 0, ready for the intermediate
+ * processes that move containers into existing namespaces, instead of
+ * mapping and faulting in a fresh one for every container. The stacks
+ * have a guard page below them and their top is faulted in up front.
+ * Containers are set up on a copy of them, so they mustn't be too small
+ */
+int conty_stack_pool_start(unsigned int stacks, size_t size);
+void conty_stack_pool_stop(void);
 
 #ifdef __cplusplus
 }; // extern "C"
@@ -0,0 +1,83 @@
+#ifndef CONTY_HOOK_H
+#define CONTY_HOOK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * Hook plugins are shared objects the runtime loads once and calls into
+ * directly, instead of forking and executing a hook binary for every event
+ * of every container. A plugin exports a struct conty_hook_plugin called
+ * CONTY_HOOK_PLUGIN_SYMBOL:
+ *
+ *     static int run(const struct conty_hook_state *state, char *const argv[])
+ *     {
+ *         ...
+ *     }
+ *
+ *     const struct conty_hook_plugin conty_hook_plugin = {
+ *         .chp_version = CONTY_HOOK_ABI_VERSION,
+ *         .chp_run     = run,
+ *     };
+ *
+ * and is configured like any other hook, with "plugin": true and its
+ * "path" pointing at the shared object.
+ *
+ * The callback runs on the runtime's own thread, so it must not block for
+ * long, exit or leave signal dispositions behind. Since it can't be killed,
+ * its "timeout" doesn't apply.
+ */
+
+#define CONTY_HOOK_ABI_VERSION   1
+#define CONTY_HOOK_PLUGIN_SYMBOL "conty_hook_plugin"
+
+/*
+ * State of the container at the time of the event, the same the
+ * hook binaries read from their standard input stream
+ */
+struct conty_hook_state {
+    pid_t       chs_pid;
+    const char *chs_container_id;
+    const char *chs_rootfs;
+    const char *chs_status;
+};
+
+struct conty_hook_plugin {
+    unsigned int chp_version;
+    /*
+     * argv is the "args" of the hook, possibly NULL.
+     * Returns 0 on success, the hook fails otherwise
+     */
+    int (*chp_run)(const struct conty_hook_state *state, char *const argv[]);
+};
+
+/*
+ * Hook servers are long-running processes listening on a Unix stream socket,
+ * configured with "socket": true and "path" pointing at the socket.
+ * The runtime keeps a single connection to every server and multiplexes
+ * the events of all containers over it, so a server must be prepared to
+ * receive further requests before it replied to the previous ones, and may
+ * reply in any order.
+ *
+ * Every message is a frame header followed by chf_len bytes of payload.
+ * Integers are little-endian. A request carries the JSON state a hook binary
+ * would read from its standard input stream, a NUL byte and then the "args"
+ * of the hook, each terminated by a NUL byte. The reply to a request has the
+ * tag of the request and a 32-bit status as its payload, 0 on success.
+ */
+struct conty_hook_frame {
+    uint32_t chf_len;
+    uint32_t chf_tag;
+};
+
+#define CONTY_HOOK_REPLY_LEN sizeof(int32_t)
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+#endif //CONTY_HOOK_H
@@ -1,14 +1,159 @@
 #include "clone.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sched.h>
+#include <sys/mman.h>
 #include <sys/signal.h>
+#include <sys/wait.h>
 
 #include <linux/types.h>
 #include <linux/sched.h>
 
 #include "resource.h"
+#include "log.h"
+
+#define STACK_GUARD_SIZE 4096
+
+/*
+ * Maps a stack of size bytes above a guard page and returns its lowest
+ * usable address. Overflowing into the guard page faults instead of
+ * silently scribbling over whatever is mapped below.
+ * The topmost prefault bytes, the ones that are actually used, are
+ * touched right away
+ */
+static void *stack_map(size_t size, size_t prefault)
+{
+    void *map;
+
+    map = mmap(NULL, STACK_GUARD_SIZE + size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (mprotect(map, STACK_GUARD_SIZE, PROT_NONE) != 0) {
+        munmap(map, STACK_GUARD_SIZE + size);
+        return NULL;
+    }
+
+    if (prefault)
+        memset((char *) map + STACK_GUARD_SIZE + size - prefault, 0, prefault);
+
+    return (char *) map + STACK_GUARD_SIZE;
+}
+
+static void stack_unmap(void *stack, size_t size)
+{
+    munmap((char *) stack - STACK_GUARD_SIZE, STACK_GUARD_SIZE + size);
+}
+
+/*
+ * Stacks of intermediate processes, see conty_stack_pool_start.
+ * Without a pool, every clone_old maps and unmaps a stack of its own
+ */
+#define STACK_DEFAULT_SIZE  (8 * 1024 * 1024)
+#define STACK_MIN_SIZE      (64 * 1024)
+#define STACK_PREFAULT_SIZE (256 * 1024)
+
+static struct {
+    pthread_mutex_t   sp_lock;
+    void            **sp_free;
+    unsigned int      sp_nfree;
+    unsigned int      sp_stacks;
+    size_t            sp_size;
+} stack_pool = { .sp_lock = PTHREAD_MUTEX_INITIALIZER, .sp_size = STACK_DEFAULT_SIZE };
+
+static void *stack_take(size_t *size)
+{
+    void *stack = NULL;
+
+    pthread_mutex_lock(&stack_pool.sp_lock);
+    if (stack_pool.sp_nfree > 0)
+        stack = stack_pool.sp_free[--stack_pool.sp_nfree];
+    *size = stack_pool.sp_size;
+    pthread_mutex_unlock(&stack_pool.sp_lock);
+
+    return stack ? stack : stack_map(*size, 0);
+}
+
+static void stack_give(void *stack, size_t size)
+{
+    pthread_mutex_lock(&stack_pool.sp_lock);
+    /*
+     * The pool may have been stopped or resized meanwhile
+     */
+    if (stack_pool.sp_nfree < stack_pool.sp_stacks && stack_pool.sp_size == size) {
+        stack_pool.sp_free[stack_pool.sp_nfree++] = stack;
+        stack = NULL;
+    }
+    pthread_mutex_unlock(&stack_pool.sp_lock);
+
+    if (stack)
+        stack_unmap(stack, size);
+}
+
+int conty_stack_pool_start(unsigned int stacks, size_t size)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    MEM_RESOURCE void **free_stacks = NULL;
+    unsigned int n;
+
+    if (stacks == 0)
+        return log_error_ret(-EINVAL, "stack pool must not be empty");
+
+    if (size == 0)
+        size = STACK_DEFAULT_SIZE;
+
+    size = (size + page - 1) & ~(page - 1);
+    if (size < STACK_MIN_SIZE)
+        return log_error_ret(-EINVAL, "stacks must have at least %d bytes", STACK_MIN_SIZE);
+
+    if (!(free_stacks = calloc(stacks, sizeof(void *))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    for (n = 0; n < stacks; n++) {
+        free_stacks[n] = stack_map(size, size < STACK_PREFAULT_SIZE ? size : STACK_PREFAULT_SIZE);
+        if (!free_stacks[n]) {
+            while (n-- > 0)
+                stack_unmap(free_stacks[n], size);
+            return log_error_ret(-ENOMEM, "cannot map stack pool");
+        }
+    }
+
+    conty_stack_pool_stop();
+
+    pthread_mutex_lock(&stack_pool.sp_lock);
+    stack_pool.sp_free   = move_ptr(free_stacks);
+    stack_pool.sp_nfree  = stacks;
+    stack_pool.sp_stacks = stacks;
+    stack_pool.sp_size   = size;
+    pthread_mutex_unlock(&stack_pool.sp_lock);
+
+    return 0;
+}
+
+void conty_stack_pool_stop(void)
+{
+    MEM_RESOURCE void **free_stacks = NULL;
+    unsigned int nfree;
+    size_t size;
+
+    pthread_mutex_lock(&stack_pool.sp_lock);
+    free_stacks = move_ptr(stack_pool.sp_free);
+    nfree = stack_pool.sp_nfree;
+    size  = stack_pool.sp_size;
+
+    stack_pool.sp_nfree  = 0;
+    stack_pool.sp_stacks = 0;
+    stack_pool.sp_size   = STACK_DEFAULT_SIZE;
+    pthread_mutex_unlock(&stack_pool.sp_lock);
+
+    while (nfree-- > 0)
+        stack_unmap(free_stacks[nfree], size);
+}
 
 pid_t clone3_ret(unsigned long flags, int *pidfd)
 {
@@ -36,21 +181,46 @@ pid_t clone3_cb(int (*fn)(void*), void *udata, unsigned long flags, int *pidfd)
 {
     pid_t child;
 
-    if ((child = clone3_ret(flags, pidfd)) == 0)
+    if ((child = clone3_ret(flags, pidfd)) == 0) {
+        conty_log_detach();
         _exit(fn(udata));
+    }
 
     return child;
 }
 
+struct clone_old_args {
+    int  (*co_fn)(void*);
+    void  *co_udata;
+};
+
+/*
+ * Our memory is a copy in the task, see conty_log_detach
+ */
+static int clone_old_trampoline(void *arg)
+{
+    struct clone_old_args *args = (struct clone_old_args *) arg;
+
+    conty_log_detach();
+    return args->co_fn(args->co_udata);
+}
+
 pid_t clone_old(int (*fn)(void*), void *udata, int flags, int *pidfd)
 {
-    /* Typical stack size on a Linux box is this plus we don't need more */
-    static const size_t STACK_SIZE = 8 * 1024 * 1024;
-    MEM_RESOURCE void *stack = NULL;
+    struct clone_old_args args = { .co_fn = fn, .co_udata = udata };
+    void *stack;
+    size_t size;
     pid_t child;
+    int err;
+
+    /*
+     * The stack is reused once we return, so a task that shares our memory
+     * has to be done with it by then
+     */
+    if ((flags & CLONE_VM) && !(flags & CLONE_VFORK))
+        return -EINVAL;
 
-    stack = malloc(STACK_SIZE);
-    if (!stack)
+    if (!(stack = stack_take(&size)))
         return -ENOMEM;
 
     /*
@@ -61,6 +231,108 @@ pid_t clone_old(int (*fn)(void*), void *udata, int flags, int *pidfd)
      * Some architectures don't necessitate this, but arm64 and x86_64 do and
      * that's who we're targeting
      */
-    child = clone(fn, stack + STACK_SIZE, flags | SIGCHLD, udata, pidfd);
-    return (child < 0) ? -errno : child;
+    if (flags & CLONE_VM)
+        child = clone(fn, (char *) stack + size, flags | SIGCHLD, udata, pidfd);
+    else
+        child = clone(clone_old_trampoline, (char *) stack + size, flags | SIGCHLD, &args, pidfd);
+    err = errno;
+
+    stack_give(stack, size);
+
+    return (child < 0) ? -err : child;
+}
+
+/*
+ * Plenty for the few calls between vfork and execve
+ */
+#define VFORK_STACK_SIZE  (64 * 1024)
+
+static __thread void *vfork_stack;
+
+struct vfork_args {
+    int      (*va_fn)(void*);
+    void      *va_udata;
+    sigset_t   va_mask;
+    int        va_err;
+};
+
+static int vfork_trampoline(void *arg)
+{
+    struct vfork_args *args = (struct vfork_args *) arg;
+    struct sigaction sa;
+
+    /*
+     * The handlers live in the memory we share with the caller
+     * and expect to run on one of its threads
+     */
+    for (int sig = 1; sig < _NSIG; sig++) {
+        if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_IGN &&
+            sa.sa_handler != SIG_DFL) {
+            sa.sa_handler = SIG_DFL;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &args->va_mask, NULL);
+
+    /*
+     * The caller is suspended until we're gone, so it's safe
+     * to report through its memory
+     */
+    args->va_err = args->va_fn(args->va_udata);
+    if (args->va_err >= 0)
+        args->va_err = -ECHILD;
+
+    _exit(127);
+}
+
+static void *vfork_stack_get(void)
+{
+    void *stack;
+
+    if (vfork_stack)
+        return vfork_stack;
+
+    if (!(stack = stack_map(VFORK_STACK_SIZE, 0)))
+        return NULL;
+
+    vfork_stack = (char *) stack + VFORK_STACK_SIZE;
+
+    return vfork_stack;
+}
+
+pid_t clone_vfork(int (*fn)(void*), void *udata, unsigned long flags, int *pidfd)
+{
+    struct vfork_args args = { .va_fn = fn, .va_udata = udata, .va_err = 0 };
+    sigset_t all;
+    void *stack;
+    pid_t child;
+    int err;
+
+    if (!(stack = vfork_stack_get()))
+        return -ENOMEM;
+
+    /*
+     * No signal handler may run in the task before it reset them
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &args.va_mask);
+
+    child = clone(vfork_trampoline, stack, (int) flags | CLONE_VM | CLONE_VFORK | SIGCHLD,
+                  &args, pidfd);
+    err = errno;
+
+    pthread_sigmask(SIG_SETMASK, &args.va_mask, NULL);
+
+    if (child < 0)
+        return -err;
+
+    if (args.va_err != 0) {
+        waitpid(child, NULL, 0);
+        if (pidfd && (flags & CLONE_PIDFD))
+            close(*pidfd);
+        return args.va_err;
+    }
+
+    return child;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <signal.h>
 #include <sys/syscall.h>
 
+#include <conty/conty.h>
+
 /*
  * Forward-declaring this here because <sched.h> and <linux/sched.h>
  * don't play well together and I don't want to expose either of them
@@ -53,9 +55,28 @@ pid_t clone3_ret(unsigned long flags, int *pidfd);
  * which requires a tiny bit of assembly that we don't want to write.
  * The glibc wrapper, however, does it for us:
  * https://code.woboq.org/userspace/glibc/sysdeps/unix/sysv/linux/x86_64/clone.S.html
+ *
+ * The stack comes from the pool started with conty_stack_pool_start, if any,
+ * and goes back to it when this returns. That's why CLONE_VM is only
+ * allowed along with CLONE_VFORK
  */
 pid_t clone_old(int (*fn)(void*), void *udata, int flags, int *pidfd);
 
+/*
+ * See clone3_cb.
+ * The new task shares the address space of the caller, which is suspended
+ * until the task calls execve or exits, exactly like vfork. Nothing is
+ * copied, so spawning takes the same time no matter how much memory the
+ * caller has mapped.
+ *
+ * fn runs on a small stack that every thread allocates once and reuses,
+ * with all signal handlers reset and the caller's signal mask. It must only
+ * make async-signal-safe calls, which rules out malloc and logging, and it
+ * must end in execve. If it returns instead, its return value, a negative
+ * error code, is returned to the caller once the task is reaped
+ */
+pid_t clone_vfork(int (*fn)(void*), void *udata, unsigned long flags, int *pidfd);
+
 /*
  * Send a signal to a process via a pollable file descriptor
  */
@@ -1,6 +1,10 @@
 #include "container.h"
 
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include "resource.h"
@@ -9,86 +13,410 @@
 #include "clone.h"
 #include "user.h"
 #include "mount.h"
+#include "layer.h"
+#include "lazy.h"
+#include "net.h"
+#include "pod.h"
+#include "init.h"
+#include "safestring.h"
 #include <sys/syscall.h>
 
 static int init_namespaces(struct conty_container *cc);
+static int ref_namespace(struct conty_container *cc, const struct oci_namespace *ons,
+                         const struct oci_namespace **ref);
+static int check_pod_member(const struct conty_container *cc);
+static int spawn_process(struct conty_container *cc);
+static void create_abort(struct conty_container *cc, char notify);
+static int container_wait(struct conty_container *cc);
+static int spawn_init(struct conty_container *cc);
 static int ns_sharer(void *arg);
 static int container_entrypoint(void *arg);
 static int run_hooks(struct conty_container *cc, int event);
+static int map_ids(struct conty_container *cc);
+static int init_scratch(struct conty_container *cc);
+static int rootfs_lower(const struct conty_container *cc, char *buf, size_t len);
+static void remove_scratch(struct conty_container *cc);
+
+/*
+ * Operation in flight and the event it waits for, see conty_container_advance
+ */
+enum {
+    STEP_NONE,
+    STEP_RT_CREATE,
+    STEP_CONT_CREATED,
+    STEP_CONT_STARTED
+};
+
+/*
+ * Phases the container process times on its own, reported to the runtime
+ * along with EVENT_CONT_CREATED
+ */
+#define CHILD_PHASES (CONTY_PHASE_PIVOT - CONTY_PHASE_USER_MAP + 1)
 
 static inline int clone_get_pid()
 {
     return (int) syscall(SYS_getpid);
 }
 
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Ends the phase that began at start, returns when the next one begins
+ */
+static inline uint64_t phase_done(uint64_t *phase, uint64_t start)
+{
+    uint64_t now = now_ns();
+
+    *phase = now - start;
+    return now;
+}
+
+/*
+ * Resolves the identifiers of containers that namespaces refer to
+ */
+static conty_container_resolver_t resolver;
+static void *resolver_data;
+
+void conty_container_set_resolver(conty_container_resolver_t cb, void *data)
+{
+    resolver      = cb;
+    resolver_data = data;
+}
+
+static int runtime_id_maps;
+
+void conty_container_set_runtime_id_maps(int enable)
+{
+    runtime_id_maps = enable;
+}
+
 struct conty_container *conty_container_create(const char *id, const char *bundle)
+{
+    return conty_container_create_in(NULL, id, bundle);
+}
+
+struct conty_container *conty_container_create_in(struct conty_pod *pod, const char *id,
+                                                  const char *bundle)
 {
     CONTAINER_RESOURCE struct conty_container *cc = NULL;
 
-    cc = malloc(sizeof(struct conty_container));
+    if (!(cc = conty_container_create_async(pod, id, bundle, NULL, NULL)))
+        return NULL;
+
+    if (container_wait(cc) != 0)
+        return NULL;
+
+    return move_ptr(cc);
+}
+
+struct conty_container *conty_container_create_async(struct conty_pod *pod, const char *id,
+                                                     const char *bundle,
+                                                     conty_container_cb_t cb, void *data)
+{
+    CONTAINER_RESOURCE struct conty_container *cc = NULL;
+    LOG_CONTAINER_SCOPE(id);
+
+    cc = calloc(1, sizeof(struct conty_container));
     if (!cc)
         return log_fatal_ret(NULL, "out of memory");
 
+    /*
+     * Counted from here on, freeing the container uncounts it
+     */
+    if ((cc->cc_pod = pod))
+        pod->cp_members++;
+
+    cc->cc_cb          = cb;
+    cc->cc_cb_data     = data;
+    cc->cc_phase_start = now_ns();
+
     if (conty_container_init(cc, id, bundle) != 0)
         return NULL;
 
-    if (conty_container_spawn(cc) != 0)
+    if (conty_container_spawn(cc) != 0) {
+        remove_scratch(cc);
         return NULL;
+    }
+
+    cc->cc_phase_ns[CONTY_PHASE_SPAWN] = now_ns() - cc->cc_phase_start;
 
     conty_sync_init_runtime(cc->cc_syncfds);
 
+    /*
+     * Write the identifier mappings while the container process is still
+     * starting up, so that they are usually in place by the time it asks
+     */
+    if ((cc->cc_ns_new & CLONE_NEWUSER) && cc->cc_id_map_by_runtime) {
+        if (map_ids(cc) != 0) {
+            create_abort(cc, 1);
+            return NULL;
+        }
+    }
+
+    /*
+     * From here on, the container's events are picked up
+     * whenever the caller finds them waiting
+     */
+    if (fcntl(cc->cc_syncfds[SYNC_FD_RT], F_SETFL, O_NONBLOCK) != 0) {
+        LOG_ERROR("cannot make synchronisation of %s non-blocking", cc->cc_id);
+        create_abort(cc, 1);
+        return NULL;
+    }
+
     /*
      * The container process is running, it's first job is to tell us that
      * we need to set up the runtime environment on the host, hence, we
      * wait for that event first
      */
-    if (conty_sync_await_container(cc->cc_syncfds, EVENT_RT_CREATE) != 0)
-        goto err_reap_and_exit;
+    cc->cc_step = STEP_RT_CREATE;
+
+    return move_ptr(cc);
+}
+
+/*
+ * The container process is told to give up if it's waiting for us,
+ * and reaped along with everything that was set up for it
+ */
+static void create_abort(struct conty_container *cc, char notify)
+{
+    if (notify)
+        conty_sync_wake_container(cc->cc_syncfds, EVENT_ERROR);
+
+    while (waitpid(cc->cc_pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+
+    remove_scratch(cc);
+}
+
+/*
+ * Runtime creation event received. Connect the container to the
+ * network of the host, if it wants to, and run hooks
+ */
+static int create_runtime(struct conty_container *cc)
+{
+    uint64_t start;
+    int err;
+
+    if (cc->cc_conf->oc_net.onet_bridge) {
+        start = now_ns();
+        if ((err = conty_net_setup(&cc->cc_conf->oc_net, cc->cc_id, cc->cc_pollfd,
+                                   cc->cc_veth)) != 0)
+            return err;
+        cc->cc_phase_ns[CONTY_PHASE_NET] = now_ns() - start;
+    }
+
+    return run_hooks(cc, EVENT_RT_CREATE);
+}
+
+/*
+ * Runs the step the container is waiting for. Messages are tagged with
+ * the container only in here, the callback may free it and its id
+ */
+static int advance_step(struct conty_container *cc)
+{
+    LOG_CONTAINER_SCOPE(cc->cc_id);
+    int err;
+
+    switch (cc->cc_step) {
+        case STEP_RT_CREATE:
+            err = conty_sync_await_container(cc->cc_syncfds, EVENT_RT_CREATE);
+            if (err == -EAGAIN)
+                return err;
+
+            if (err != 0) {
+                create_abort(cc, 0);
+                break;
+            }
+
+            if ((err = create_runtime(cc)) != 0) {
+                create_abort(cc, 1);
+                break;
+            }
+
+            /*
+             * Great, the runtime environment is set up, now instruct the container
+             * that it needs to proceed by pivoting into the new environment
+             * and acknowledging that the procedure completed successfully
+             */
+            if ((err = conty_sync_wake_container(cc->cc_syncfds, EVENT_CONT_CREATE)) != 0) {
+                create_abort(cc, 0);
+                break;
+            }
+
+            cc->cc_step = STEP_CONT_CREATED;
+            return -EAGAIN;
+        case STEP_CONT_CREATED:
+            /*
+             * conty-init has no phases to report
+             */
+            err = (int) conty_sync_await_container_data(cc->cc_syncfds, EVENT_CONT_CREATED,
+                                                        &cc->cc_phase_ns[CONTY_PHASE_USER_MAP],
+                                                        CHILD_PHASES * sizeof(uint64_t));
+            if (err == -EAGAIN)
+                return err;
+
+            if (err < 0) {
+                create_abort(cc, 0);
+                break;
+            }
+
+            err = 0;
+            cc->cc_phase_ns[CONTY_PHASE_CREATE] = now_ns() - cc->cc_phase_start;
+            break;
+        case STEP_CONT_STARTED:
+            /*
+             * If the container managed to call execve, then the synchronisation
+             * file descriptor on its end will be closed (because it was created
+             * with CLOEXEC set), thereby causing the read operation to return 0,
+             * i.e -ENODATA. If it failed to execute, it returns an EVENT_ERROR,
+             * which results in -EMSGSIZE, because we're not expecting an error
+             */
+            err = conty_sync_await_container(cc->cc_syncfds, EVENT_CONT_STARTED);
+            if (err == -EAGAIN)
+                return err;
+
+            if (err != -ENODATA) {
+                err = (err != 0) ? err : -EPROTO;
+                break;
+            }
+
+            /*
+             * Container was successfully started, so execute post start hooks
+             */
+            err = run_hooks(cc, EVENT_CONT_STARTED);
+            cc->cc_phase_ns[CONTY_PHASE_START] = now_ns() - cc->cc_phase_start;
+            break;
+        default:
+            return log_error_ret(-EINVAL, "container %s has nothing in flight", cc->cc_id);
+    }
+
+    return err;
+}
+
+int conty_container_advance(struct conty_container *cc)
+{
+    int err = advance_step(cc);
 
     /*
-     * Runtime creation event received. Run hooks
+     * Still in flight, or nothing was
      */
-    if (run_hooks(cc, EVENT_RT_CREATE) != 0)
-        goto err_notify_and_exit;
+    if (err == -EAGAIN || cc->cc_step == STEP_NONE)
+        return err;
+
+    cc->cc_step = STEP_NONE;
 
     /*
-     * Great, the runtime environment is set up, now instruct the container
-     * that it needs to proceed by pivoting into the new environment
-     * and acknowledging that the procedure completed successfully
+     * Last thing we do, the callback may well free the container
      */
-    if (conty_sync_container(cc->cc_syncfds, EVENT_CONT_CREATE) != 0)
-        goto err_reap_and_exit;
+    if (cc->cc_cb)
+        cc->cc_cb(cc, err, cc->cc_cb_data);
 
-    return move_ptr(cc);
+    return err;
+}
+
+/*
+ * Drives the operation in flight to its end, for the blocking API
+ */
+static int container_wait(struct conty_container *cc)
+{
+    struct pollfd pfd = { .fd = cc->cc_syncfds[SYNC_FD_RT], .events = POLLIN };
+    int err;
+
+    do {
+        while (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            err = log_error_ret(-errno, "cannot await container %s", cc->cc_id);
+            if (cc->cc_step != STEP_CONT_STARTED)
+                create_abort(cc, 1);
+            cc->cc_step = STEP_NONE;
+            return err;
+        }
+    } while ((err = conty_container_advance(cc)) == -EAGAIN);
+
+    return err;
+}
+
+int conty_container_syncfd(const struct conty_container *cc)
+{
+    return cc->cc_syncfds[SYNC_FD_RT];
+}
+
+struct conty_container *conty_container_restore(const char *id, const char *bundle,
+                                                const char *veth, pid_t pid, int pollfd,
+                                                conty_container_status_t status)
+{
+    CONTAINER_RESOURCE struct conty_container *cc = NULL;
+
+    cc = calloc(1, sizeof(struct conty_container));
+    if (!cc)
+        return log_fatal_ret(NULL, "out of memory");
+
+    cc->cc_pollfd     = -EBADF;
+    cc->cc_syncfds[0] = -EBADF;
+    cc->cc_syncfds[1] = -EBADF;
+    cc->cc_ns_ref     = -EBADF;
+    memset(cc->cc_ns_fds, -EBADF, CONTY_NS_LEN * sizeof(int));
+
+    /*
+     * The configuration is not parsed here, restoring thousands of containers
+     * must not cost thousands of JSON documents. The synchronisation channel
+     * died with the previous runtime, so a restored container can't be started
+     */
+    if (!(cc->cc_id = strdup(id)) || !(cc->cc_bundle = strdup(bundle)))
+        return log_fatal_ret(NULL, "out of memory");
+
+    if (strnprintf(cc->cc_veth, sizeof(cc->cc_veth), "%s", veth) < 0)
+        return log_error_ret(NULL, "invalid network device %s", veth);
+
+    cc->cc_pid    = pid;
+    cc->cc_status = status;
+    cc->cc_pollfd = pollfd;
 
-err_notify_and_exit:
-    conty_sync_wake_container(cc->cc_syncfds, EVENT_ERROR);
-err_reap_and_exit:
-    waitpid(cc->cc_pid, NULL, 0);
-    return NULL;
+    return move_ptr(cc);
 }
 
 int conty_container_start(struct conty_container *container)
 {
+    int err;
+
+    if ((err = conty_container_start_async(container)) != 0)
+        return err;
+
+    return container_wait(container);
+}
+
+int conty_container_start_async(struct conty_container *cc)
+{
+    LOG_CONTAINER_SCOPE(cc->cc_id);
+    int err;
+
     /*
-     * The container must be waiting to be started, so simply instruct
-     * it to execute.
-     *
-     * Now, if the container fails to execute, then it will return an EVENT_ERROR,
-     * which results in -EMSGSIZE, because we're not expecting an error.
-     *
-     * If it managed to call execve, then the synchronisation file descriptor
-     * on its end will be closed (because it was created with CLOEXEC set),
-     * thereby causing the read operation to return 0, i.e -ENODATA
+     * Restored containers lost their synchronisation channel
      */
-    if (conty_sync_container(container->cc_syncfds, EVENT_CONT_START) != -ENODATA)
-        return -1;
+    if (cc->cc_syncfds[SYNC_FD_RT] < 0)
+        return log_error_ret(-EBADF, "container %s can't be started", cc->cc_id);
+
+    if (cc->cc_step != STEP_NONE)
+        return log_error_ret(-EBUSY, "container %s is still being created", cc->cc_id);
 
     /*
-     * Container was successfully started, so execute post start hooks
+     * The container must be waiting to be started, so simply instruct
+     * it to execute
      */
-    if (run_hooks(container, EVENT_CONT_STARTED) != 0)
-        return -1;
+    cc->cc_phase_start = now_ns();
+
+    if ((err = conty_sync_wake_container(cc->cc_syncfds, EVENT_CONT_START)) != 0)
+        return err;
+
+    cc->cc_step = STEP_CONT_STARTED;
 
     return 0;
 }
@@ -106,31 +434,188 @@ int conty_container_kill(struct conty_container *container, int sig)
 
 int conty_container_delete(struct conty_container *container)
 {
-    int err = run_hooks(container, EVENT_CONT_STOPPED);
+    int err = conty_container_teardown(container);
+
     conty_container_free(container);
     return err;
 }
 
+int conty_container_teardown(struct conty_container *container)
+{
+    LOG_CONTAINER_SCOPE(container->cc_id);
+    int err = run_hooks(container, EVENT_CONT_STOPPED);
+
+    if (container->cc_conf && container->cc_veth[0] &&
+        conty_net_teardown(&container->cc_conf->oc_net, container->cc_veth) != 0)
+        LOG_WARN("cannot disconnect container %s from the network", container->cc_id);
+
+    LOG_DEBUG("container %s spent %.3f ms in hooks", container->cc_id,
+              (double) container->cc_hooks_ns / 1e6);
+
+    /*
+     * Discard the writable layer of the root filesystem, if the
+     * configuration could be parsed to tell us where it lives
+     */
+    if (container->cc_conf)
+        remove_scratch(container);
+
+    return err;
+}
+
+int conty_container_reap(struct conty_container *cc)
+{
+    siginfo_t info;
+    struct rusage usage;
+
+    if (cc->cc_reaped)
+        return 0;
+
+    if (cc->cc_pollfd < 0)
+        return -ECHILD;
+
+    /*
+     * The wrapper has no room for the resource usage, the system call does
+     */
+    memset(&info, 0, sizeof(info));
+    if (syscall(SYS_waitid, P_PIDFD, cc->cc_pollfd, &info, WEXITED | WNOHANG, &usage) != 0)
+        return -errno;
+
+    if (info.si_pid == 0)
+        return -EAGAIN;
+
+    /*
+     * Same encoding as waitpid's, so the usual macros apply
+     */
+    switch (info.si_code) {
+        case CLD_EXITED:
+            cc->cc_exit_status = W_EXITCODE(info.si_status, 0);
+            break;
+        case CLD_DUMPED:
+            cc->cc_exit_status = info.si_status | WCOREFLAG;
+            break;
+        default:
+            cc->cc_exit_status = info.si_status;
+            break;
+    }
+
+    cc->cc_rusage = usage;
+    cc->cc_reaped = 1;
+
+    return 0;
+}
+
+int conty_container_exit_status(const struct conty_container *cc)
+{
+    return cc->cc_reaped ? cc->cc_exit_status : -1;
+}
+
+const struct rusage *conty_container_rusage(const struct conty_container *cc)
+{
+    return cc->cc_reaped ? &cc->cc_rusage : NULL;
+}
+
 int conty_container_init(struct conty_container *cc, const char *id, const char *bundle)
 {
     int err;
     struct oci_conf *conf = NULL;
 
+    cc->cc_pollfd     = -EBADF;
+    cc->cc_syncfds[0] = -EBADF;
+    cc->cc_syncfds[1] = -EBADF;
+    cc->cc_ns_ref     = -EBADF;
+
     if (!(conf = oci_conf_deser_file(bundle)))
         return -EINVAL;
 
-    cc->cc_conf   = move_ptr(conf);
-    cc->cc_id     = id;
-    cc->cc_pollfd = -EBADF;
+    cc->cc_conf = move_ptr(conf);
+
+    /*
+     * Callers usually pass identifiers that live in request buffers,
+     * so keep a copy that lives as long as the container
+     */
+    if (!(cc->cc_id = strdup(id)) || !(cc->cc_bundle = strdup(bundle)))
+        return log_fatal_ret(-ENOMEM, "out of memory");
 
     if ((err = conty_sync_init(cc->cc_syncfds)) != 0)
         return err;
 
-    return init_namespaces(cc);
+    if ((err = init_namespaces(cc)) != 0)
+        return err;
+
+    if (cc->cc_pod && (err = check_pod_member(cc)) != 0)
+        return err;
+
+    if (cc->cc_ns_new & CLONE_NEWUSER) {
+        if ((err = conty_id_map_from_oci(&cc->cc_uid_map, &cc->cc_conf->oc_uids)) != 0)
+            return err;
+
+        if ((err = conty_id_map_from_oci(&cc->cc_gid_map, &cc->cc_conf->oc_gids)) != 0)
+            return err;
+
+        /*
+         * Writing the mappings from the outside costs an extra round trip
+         * with the container. It was only measured to be slower on a single
+         * CPU, so it's up to the caller.
+         *
+         * Idmapped root filesystems are always prepared by the runtime
+         * right after it has written the mappings
+         */
+        cc->cc_id_map_by_runtime = runtime_id_maps || cc->cc_conf->oc_rootfs.orfs_idmap;
+    }
+
+    if (cc->cc_conf->oc_rootfs.orfs_idmap &&
+        (cc->cc_ns_new & (CLONE_NEWUSER | CLONE_NEWNS)) != (CLONE_NEWUSER | CLONE_NEWNS))
+        return log_error_ret(-EINVAL, "idmapped rootfs needs new user and mount namespaces");
+
+    if (cc->cc_conf->oc_rootfs.orfs_overlay)
+        return init_scratch(cc);
+
+    return 0;
 }
 
 int conty_container_spawn(struct conty_container *cc)
 {
+    int pod_saved[CONTY_NS_LEN], ref_saved[CONTY_NS_LEN], err;
+
+    if (!cc->cc_pod && !cc->cc_ns_ref_thread)
+        return spawn_process(cc);
+
+    /*
+     * The container process inherits the namespaces of the thread
+     * that clones it, so members of a pod and containers that refer
+     * to the namespaces of another take a detour through them instead
+     * of joining them on their own. Both never enter the same kind
+     */
+    if (cc->cc_pod && (err = conty_ns_enter(cc->cc_pod->cp_pollfd, cc->cc_pod->cp_ns,
+                                            pod_saved)) != 0)
+        return err;
+
+    if (cc->cc_ns_ref_thread &&
+        (err = conty_ns_enter(cc->cc_ns_ref, cc->cc_ns_ref_thread, ref_saved)) != 0)
+        goto out;
+
+    err = spawn_process(cc);
+
+    if (cc->cc_ns_ref_thread)
+        conty_ns_leave(ref_saved);
+out:
+    if (cc->cc_pod)
+        conty_ns_leave(pod_saved);
+
+    return err;
+}
+
+static int spawn_process(struct conty_container *cc)
+{
+    int err;
+
+    /*
+     * Fork only if conty-init can't take the container, anything else
+     * went wrong for real and forking would only hide it
+     */
+    if ((err = spawn_init(cc)) != -EAGAIN)
+        return err;
+
     if (cc->cc_ns_has_fds) {
         /*
          * If the container needs to join a set of existing namespaces,
@@ -178,12 +663,18 @@ void conty_container_free(struct conty_container *container)
     if (container) {
         if (container->cc_conf)
             oci_conf_free(container->cc_conf);
+        free(container->cc_id);
+        free(container->cc_bundle);
         if (container->cc_pollfd >= 0)
             close(container->cc_pollfd);
         if (container->cc_syncfds[0] >= 0)
             close(container->cc_syncfds[0]);
         if (container->cc_syncfds[1] >= 0)
             close(container->cc_syncfds[1]);
+        if (container->cc_ns_ref >= 0)
+            close(container->cc_ns_ref);
+        if (container->cc_pod)
+            container->cc_pod->cp_members--;
         free(container);
         container = NULL;
     }
@@ -205,6 +696,49 @@ pid_t conty_container_pid(const struct conty_container *cc)
     return cc->cc_pid;
 }
 
+const char *conty_container_veth(const struct conty_container *cc)
+{
+    return cc->cc_veth;
+}
+
+uint64_t conty_container_hooks_ns(const struct conty_container *cc)
+{
+    return cc->cc_hooks_ns;
+}
+
+uint64_t conty_container_phase_ns(const struct conty_container *cc,
+                                  conty_container_phase_t phase)
+{
+    if (phase < CONTY_PHASE_CREATE || phase > CONTY_PHASE_MAX)
+        return 0;
+
+    return cc->cc_phase_ns[phase];
+}
+
+const char *conty_container_phase_str(conty_container_phase_t phase)
+{
+    static const char *phase_str[CONTY_PHASE_MAX + 1] = {
+            [CONTY_PHASE_CREATE]               = "create",
+            [CONTY_PHASE_SPAWN]                = "spawn",
+            [CONTY_PHASE_NET]                  = "net",
+            [CONTY_PHASE_RUNTIME_CREATE_HOOKS] = "runtime_create_hooks",
+            [CONTY_PHASE_USER_MAP]             = "user_map",
+            [CONTY_PHASE_ROOTFS]               = "rootfs",
+            [CONTY_PHASE_DEV]                  = "dev",
+            [CONTY_PHASE_MKDEV]                = "mkdev",
+            [CONTY_PHASE_PROC_SYS]             = "proc_sys",
+            [CONTY_PHASE_CREATED_HOOKS]        = "container_created_hooks",
+            [CONTY_PHASE_PIVOT]                = "pivot",
+            [CONTY_PHASE_START]                = "start",
+            [CONTY_PHASE_STARTED_HOOKS]        = "container_started_hooks"
+    };
+
+    if (phase < CONTY_PHASE_CREATE || phase > CONTY_PHASE_MAX)
+        return "unknown";
+
+    return phase_str[phase];
+}
+
 const char *conty_container_id(const struct conty_container *cc)
 {
     return cc->cc_id;
@@ -232,10 +766,22 @@ static int container_entrypoint(void *arg)
     struct oci_conf *conf = cc->cc_conf;
     struct oci_process *proc = &conf->oc_proc;
     struct conty_rootfs rootfs;
+    FD_RESOURCE int treefd = -EBADF;
+    uint64_t *phases = cc->cc_phase_ns;
+    uint64_t start;
 
     conty_sync_init_container(cc->cc_syncfds);
     cc->cc_pid = clone_get_pid();
 
+    /*
+     * Namespaces that only a single-threaded process can enter,
+     * all in one go and before anything else
+     */
+    if (cc->cc_ns_ref_child && setns(cc->cc_ns_ref, (int) cc->cc_ns_ref_child) != 0) {
+        LOG_ERROR("cannot enter namespaces of container %s", cc->cc_id);
+        goto err_notify_runtime;
+    }
+
     /*
      * First, the child will wake the parent and instruct it to run
      * the runtime hooks.
@@ -245,22 +791,38 @@ static int container_entrypoint(void *arg)
         goto err_out;
 
     if (cc->cc_ns_new & CLONE_NEWUSER) {
+        start = now_ns();
+
         /*
          * The caller has requested the creation of a new user namespace,
-         * so we set up the uid/gid mappings between the host and the container
+         * so we set up the uid/gid mappings between the host and the container,
+         * or wait for the runtime to do so from the outside
          *
          * The kernel will then be able to do proper authorization
          * It is very important we set up the user namespace first, because
          * it is superordinate to all subsequently created namespaces
          */
-        if (conty_id_map_write_oci_uids(&conf->oc_uids) != 0)
-            goto err_notify_runtime;
+        if (cc->cc_id_map_by_runtime && conf->oc_rootfs.orfs_idmap) {
+            /*
+             * The runtime also sends us the idmapped root filesystem
+             */
+            if (conty_sync_await_runtime_fd(cc->cc_syncfds, EVENT_ID_MAPPED, &treefd) != 0)
+                goto err_out;
+        } else if (cc->cc_id_map_by_runtime) {
+            if (conty_sync_await_runtime(cc->cc_syncfds, EVENT_ID_MAPPED) != 0)
+                goto err_out;
+        } else {
+            if (conty_id_map_write_uids(&cc->cc_uid_map) != 0)
+                goto err_notify_runtime;
 
-        if (conty_id_disable_setgroups() != 0)
-            goto err_notify_runtime;
+            if (conty_id_disable_setgroups() != 0)
+                goto err_notify_runtime;
 
-        if (conty_id_map_write_oci_gids(&conf->oc_gids) != 0)
-            goto err_notify_runtime;
+            if (conty_id_map_write_gids(&cc->cc_gid_map) != 0)
+                goto err_notify_runtime;
+        }
+
+        phase_done(&phases[CONTY_PHASE_USER_MAP], start);
     }
 
     if (cc->cc_ns_new & CLONE_NEWNS) {
@@ -271,12 +833,31 @@ static int container_entrypoint(void *arg)
          */
         struct oci_rootfs *oci_root = &conf->oc_rootfs;
 
-        if (conty_rootfs_init(&rootfs, oci_root->orfs_path, oci_root->orfs_readonly) != 0)
+        start = now_ns();
+
+        if (oci_root->orfs_overlay) {
+            char scratch[PATH_MAX], lower[PATH_MAX];
+
+            if (strnprintf(scratch, sizeof(scratch), "%s/%s",
+                           oci_root->orfs_scratch, cc->cc_id) < 0)
+                goto err_notify_runtime;
+
+            if (rootfs_lower(cc, lower, sizeof(lower)) != 0)
+                goto err_notify_runtime;
+
+            if (conty_rootfs_init_overlay(&rootfs, lower, scratch,
+                                          oci_root->orfs_tmpfs, oci_root->orfs_readonly) != 0)
+                goto err_notify_runtime;
+        } else if (conty_rootfs_init(&rootfs, oci_root->orfs_path, oci_root->orfs_readonly) != 0)
             goto err_notify_runtime;
 
+        rootfs.cro_treefd = treefd;
+
         if (conty_rootfs_mount(&rootfs) != 0)
             goto err_notify_runtime;
 
+        start = phase_done(&phases[CONTY_PHASE_ROOTFS], start);
+
         /*
          * Next, we create the device mount points under the new root
          * This includes /dev/shm and /dev/mqueue to ensure that
@@ -291,6 +872,8 @@ static int container_entrypoint(void *arg)
         if (conty_rootfs_mount_mqueue(&rootfs) != 0)
             goto err_notify_runtime;
 
+        start = phase_done(&phases[CONTY_PHASE_DEV], start);
+
         /*
          * We need to create a multitude of device nodes that are used
          * by almost all programming language runtimes for various reasons
@@ -303,6 +886,8 @@ static int container_entrypoint(void *arg)
         if (conty_rootfs_mkdev(&rootfs) != 0)
             goto err_notify_runtime;
 
+        start = phase_done(&phases[CONTY_PHASE_MKDEV], start);
+
         if (cc->cc_ns_new & CLONE_NEWPID) {
             /*
              * We need to mount procfs to avoid leaking process information
@@ -324,6 +909,8 @@ static int container_entrypoint(void *arg)
             if (conty_rootfs_mount_sys(&rootfs) != 0)
                 goto err_notify_runtime;
         }
+
+        phase_done(&phases[CONTY_PHASE_PROC_SYS], start);
     }
 
     if (cc->cc_ns_new & CLONE_NEWUTS) {
@@ -358,16 +945,24 @@ static int container_entrypoint(void *arg)
         /*
          * Replace the old root filesystem with the new one
          */
+        start = now_ns();
         if (conty_rootfs_pivot(&rootfs) != 0)
             goto err_notify_runtime;
+        phase_done(&phases[CONTY_PHASE_PIVOT], start);
     }
 
     /*
      * Alright, we've pivoted into the new environment.
      * What's left is for the runtime to instruct us to
-     * actually execute the user-defined binary via an EVENT_START
+     * actually execute the user-defined binary via an EVENT_START.
+     * It learns how long everything took along the way
      */
-    if (conty_sync_runtime(cc->cc_syncfds, EVENT_CONT_CREATED) != 0)
+    if (conty_sync_wake_runtime_data(cc->cc_syncfds, EVENT_CONT_CREATED,
+                                     &phases[CONTY_PHASE_USER_MAP],
+                                     CHILD_PHASES * sizeof(uint64_t)) != 0)
+        goto err_out;
+
+    if (conty_sync_await_runtime(cc->cc_syncfds, EVENT_CONT_START) != 0)
         goto err_out;
 
     /*
@@ -393,6 +988,104 @@ err_out:
     return -1;
 }
 
+#ifdef CONTY_INIT_PATH
+struct init_exec {
+    char **ie_argv;
+    char **ie_envp;
+    int    ie_syncfd;
+};
+
+/*
+ * Runs between vfork and execve, see clone_vfork
+ */
+static int init_exec(void *arg)
+{
+    struct init_exec *ie = (struct init_exec *) arg;
+
+    if (ie->ie_syncfd == CONTY_INIT_SYNCFD) {
+        if (fcntl(CONTY_INIT_SYNCFD, F_SETFD, 0) != 0)
+            return -errno;
+    } else if (dup2(ie->ie_syncfd, CONTY_INIT_SYNCFD) < 0)
+        return -errno;
+
+    execve(CONTY_INIT_PATH, ie->ie_argv, ie->ie_envp);
+    return -errno;
+}
+
+static int init_present = -1;
+
+static char init_available(void)
+{
+    if (init_present < 0) {
+        init_present = access(CONTY_INIT_PATH, X_OK) == 0;
+        if (!init_present)
+            LOG_WARN("%s is missing, containers are forked", CONTY_INIT_PATH);
+    }
+
+    return (char) init_present;
+}
+#endif
+
+/*
+ * A container that creates no namespaces and runs no hooks inside has
+ * nothing to do between being created and started, so conty-init waits
+ * in its place, and spawning it doesn't have to copy our address space.
+ * Returns -EAGAIN if the container has to be forked after all
+ */
+static int spawn_init(struct conty_container *cc)
+{
+#ifdef CONTY_INIT_PATH
+    const struct oci_process *proc = &cc->cc_conf->oc_proc;
+    const struct oci_event_hooks *hooks = &cc->cc_conf->oc_hooks;
+    MEM_RESOURCE char **argv = NULL;
+    struct init_exec ie;
+    size_t argc = 0;
+    int err;
+
+    if (cc->cc_ns_new || cc->cc_ns_has_fds || cc->cc_ns_ref_child ||
+        !SLIST_EMPTY(&hooks->oehk_on_container_created) ||
+        !SLIST_EMPTY(&hooks->oehk_on_container_start) || !init_available())
+        return -EAGAIN;
+
+    while (proc->oproc_argv[argc])
+        argc++;
+
+    if (!(argv = calloc(argc + 3, sizeof(char *))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    argv[0] = (char *) CONTY_INIT_PATH;
+    argv[1] = proc->oproc_cwd;
+    memcpy(&argv[2], proc->oproc_argv, argc * sizeof(char *));
+
+    ie.ie_argv   = argv;
+    ie.ie_envp   = proc->oproc_envp;
+    ie.ie_syncfd = cc->cc_syncfds[SYNC_FD_CONT];
+
+    cc->cc_pid = clone_vfork(init_exec, &ie, CLONE_PIDFD, &cc->cc_pollfd);
+    if (cc->cc_pid < 0) {
+        err           = cc->cc_pid;
+        cc->cc_pid    = 0;
+        cc->cc_pollfd = -EBADF;
+
+        /*
+         * conty-init went away since we looked for it
+         */
+        if (err == -ENOENT || err == -EACCES) {
+            LOG_WARN("cannot run %s (%s), containers are forked", CONTY_INIT_PATH,
+                     strerror(-err));
+            init_present = 0;
+            return -EAGAIN;
+        }
+
+        return log_error_ret(err, "cannot spawn container");
+    }
+
+    return 0;
+#else
+    return -EAGAIN;
+#endif
+}
+
 static int ns_sharer(void *arg)
 {
     struct conty_container *cc = (struct conty_container *) arg;
@@ -421,9 +1114,10 @@ static int ns_sharer(void *arg)
 
 static int init_namespaces(struct conty_container *cc)
 {
-    int ns, fd;
+    int ns, fd, err;
     unsigned long ns_set = 0, flag;
     struct oci_namespace *ons_cur, *ons_tmp;
+    const struct oci_namespace *ref = NULL;
     struct oci_namespaces *namespaces = &cc->cc_conf->oc_namespaces;
 
     cc->cc_ns_has_fds = 0;
@@ -440,7 +1134,15 @@ static int init_namespaces(struct conty_container *cc)
             continue;
         }
 
-        if (!ons_cur->ons_path)
+        if (ons_cur->ons_container || ons_cur->ons_pid) {
+            if ((err = ref_namespace(cc, ons_cur, &ref)) != 0)
+                return err;
+
+            if (flag & CONTY_NS_THREAD)
+                cc->cc_ns_ref_thread |= flag;
+            else
+                cc->cc_ns_ref_child |= flag;
+        } else if (!ons_cur->ons_path)
             cc->cc_ns_new |= flag;
         else {
             fd = open(ons_cur->ons_path, O_RDONLY | O_CLOEXEC);
@@ -454,15 +1156,325 @@ static int init_namespaces(struct conty_container *cc)
         ns_set |= flag;
     }
 
+    /*
+     * The container process enters these after it was cloned into its new
+     * namespaces, which would then belong to the wrong user namespace or
+     * be out of reach of the new user namespace, respectively
+     */
+    if ((cc->cc_ns_ref_child & CLONE_NEWUSER) && cc->cc_ns_new)
+        return log_error_ret(-EINVAL, "container %s can't create namespaces in a user "
+                                      "namespace it joins", cc->cc_id);
+
+    if ((cc->cc_ns_ref_child & CLONE_NEWNS) && (cc->cc_ns_new & CLONE_NEWUSER))
+        return log_error_ret(-EINVAL, "container %s can't join a mount namespace "
+                                      "from a new user namespace", cc->cc_id);
+
     return 0;
 }
 
-static int run_hooks(struct conty_container *cc, int event)
+/*
+ * Namespaces that refer to another container or process are all entered
+ * through a single pidfd, so they must all refer to the same one
+ */
+static int ref_namespace(struct conty_container *cc, const struct oci_namespace *ons,
+                         const struct oci_namespace **ref)
+{
+    int fd;
+
+    if (*ref) {
+        if ((*ref)->ons_pid != ons->ons_pid ||
+            !(*ref)->ons_container != !ons->ons_container ||
+            ((*ref)->ons_container && strcmp((*ref)->ons_container, ons->ons_container) != 0))
+            return log_error_ret(-EINVAL, "namespaces of container %s refer to "
+                                          "more than one other", cc->cc_id);
+        return 0;
+    }
+
+    if (ons->ons_container) {
+        if (!resolver)
+            return log_error_ret(-EOPNOTSUPP, "cannot resolve container %s", ons->ons_container);
+
+        /*
+         * The descriptor remains the resolver's
+         */
+        if ((fd = resolver(ons->ons_container, resolver_data)) < 0)
+            return log_error_ret(fd, "cannot find container %s", ons->ons_container);
+
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    } else {
+        fd = (int) syscall(SYS_pidfd_open, ons->ons_pid, 0);
+    }
+
+    if (fd < 0)
+        return log_error_ret(-errno, "cannot refer to namespaces of %s",
+                             ons->ons_container ? ons->ons_container : "process");
+
+    cc->cc_ns_ref = fd;
+    *ref = ons;
+
+    return 0;
+}
+
+static int check_pod_member(const struct conty_container *cc)
 {
+    const struct conty_pod *pod = cc->cc_pod;
+    unsigned long own = cc->cc_ns_new | cc->cc_ns_ref_thread | cc->cc_ns_ref_child;
+
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++) {
+        if (cc->cc_ns_fds[ns] >= 0)
+            own |= conty_ns_flags[ns];
+    }
+
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++) {
+        if (own & pod->cp_ns & conty_ns_flags[ns])
+            return log_error_ret(-EINVAL, "container %s can't have a %s namespace of its own in pod %s",
+                                 cc->cc_id, conty_ns_str[ns], pod->cp_id);
+    }
+
+    if (cc->cc_conf->oc_net.onet_bridge)
+        return log_error_ret(-EINVAL, "container %s uses the network of pod %s",
+                             cc->cc_id, pod->cp_id);
+
+    return 0;
+}
+
+static int map_ids(struct conty_container *cc)
+{
+    FD_RESOURCE int procfd = -EBADF;
+    char path[32];
     int err;
+
+    /*
+     * The container process is our unreaped child, so its pid
+     * can't have been recycled under our feet
+     */
+    if ((err = strnprintf(path, sizeof(path), "/proc/%d", cc->cc_pid)) < 0)
+        return err;
+
+    procfd = open(path, O_DIRECTORY | O_PATH | O_CLOEXEC);
+    if (procfd < 0)
+        return log_error_ret(-errno, "cannot open %s", path);
+
+    if ((err = conty_id_map_write_at(procfd, &cc->cc_uid_map, &cc->cc_gid_map)) != 0)
+        return err;
+
+    if (cc->cc_conf->oc_rootfs.orfs_idmap) {
+        FD_RESOURCE int usernsfd = -EBADF, treefd = -EBADF;
+        struct oci_rootfs *oci_root = &cc->cc_conf->oc_rootfs;
+
+        /*
+         * Only now that the user namespace has its mappings can we
+         * map the root filesystem through it
+         */
+        usernsfd = openat(procfd, "ns/user", O_RDONLY | O_CLOEXEC);
+        if (usernsfd < 0)
+            return log_error_ret(-errno, "cannot open user namespace of %s", path);
+
+        treefd = conty_rootfs_idmap_tree(oci_root->orfs_path, usernsfd,
+                                         oci_root->orfs_readonly);
+        if (treefd < 0)
+            return treefd;
+
+        return conty_sync_wake_container_fd(cc->cc_syncfds, EVENT_ID_MAPPED, treefd);
+    }
+
+    return conty_sync_wake_container(cc->cc_syncfds, EVENT_ID_MAPPED);
+}
+
+/*
+ * Host identifier that a container identifier maps to, or -1 if unmapped
+ */
+static unsigned int host_id(const struct oci_ids *ids, unsigned int id)
+{
+    struct oci_id_mapping *cur;
+
+    SLIST_FOREACH(cur, ids, oid_next) {
+        if (id >= cur->oid_container && id - cur->oid_container < cur->oid_count)
+            return cur->oid_host + (id - cur->oid_container);
+    }
+
+    return (unsigned int) -1;
+}
+
+static int init_scratch(struct conty_container *cc)
+{
+    struct oci_rootfs *oci_root = &cc->cc_conf->oc_rootfs;
+    uid_t uid = (uid_t) -1;
+    gid_t gid = (gid_t) -1;
+    char scratch[PATH_MAX], lower[PATH_MAX];
+    int err;
+
+    if (oci_root->orfs_idmap)
+        return log_error_ret(-EINVAL, "overlay rootfs can't be idmapped");
+
+    if (!(cc->cc_ns_new & CLONE_NEWNS))
+        return log_error_ret(-EINVAL, "overlay rootfs needs a new mount namespace");
+
+    /*
+     * The identifier becomes a path component
+     */
+    if (strchr(cc->cc_id, '/') || !strcmp(cc->cc_id, ".") || !strcmp(cc->cc_id, ".."))
+        return log_error_ret(-EINVAL, "invalid container identifier %s", cc->cc_id);
+
+    if ((err = strnprintf(scratch, sizeof(scratch), "%s/%s", oci_root->orfs_scratch, cc->cc_id)) < 0)
+        return log_error_ret(err, "cannot construct scratch path for %s", cc->cc_id);
+
+    /*
+     * Layers are unpacked ahead of time, e.g by conty_image_unpack,
+     * never while creating a container
+     */
+    if (oci_root->orfs_layers) {
+        struct conty_layer_store store;
+
+        if ((err = conty_layer_store_init(&store, oci_root->orfs_path)) != 0)
+            return err;
+
+        for (int i = 0; oci_root->orfs_layers[i]; i++) {
+            if ((err = conty_layer_present(&store, oci_root->orfs_layers[i])) <= 0)
+                return log_error_ret(err ? err : -ENOENT, "layer %s is not in %s",
+                                     oci_root->orfs_layers[i], oci_root->orfs_path);
+        }
+    }
+
+    /*
+     * The container's root must own the writable layer, otherwise
+     * it couldn't write to its own root filesystem
+     */
+    if (cc->cc_ns_new & CLONE_NEWUSER) {
+        uid = (uid_t) host_id(&cc->cc_conf->oc_uids, 0);
+        gid = (gid_t) host_id(&cc->cc_conf->oc_gids, 0);
+    }
+
+    if (oci_root->orfs_lazy) {
+        if ((err = strnprintf(lower, sizeof(lower), "%s/lower", scratch)) < 0)
+            return log_error_ret(err, "cannot construct lower path for %s", cc->cc_id);
+
+        /*
+         * A previous container of the same name may have left its mount behind
+         */
+        umount2(lower, MNT_DETACH);
+    }
+
+    if ((err = conty_rootfs_scratch_create(scratch, oci_root->orfs_tmpfs, uid, gid)) != 0)
+        return err;
+
+    if (oci_root->orfs_lazy) {
+        /*
+         * The archive is served and mounted from the host, the container
+         * inherits the mount when it's cloned and only pays for what it reads
+         */
+        if (mkdir(lower, 0755) != 0) {
+            err = log_error_ret(-errno, "cannot create %s", lower);
+            goto err_remove;
+        }
+
+        if ((cc->cc_lazy_pid = conty_lazy_mount(oci_root->orfs_path, lower, uid, gid)) < 0) {
+            err = cc->cc_lazy_pid;
+            cc->cc_lazy_pid = 0;
+            goto err_remove;
+        }
+    }
+
+    return 0;
+
+err_remove:
+    conty_rootfs_scratch_remove(scratch);
+    return err;
+}
+
+/*
+ * The overlay's lower layers are either a single directory, layers of
+ * an image taken from a layer store or a lazily mounted archive
+ */
+static int rootfs_lower(const struct conty_container *cc, char *buf, size_t len)
+{
+    const struct oci_rootfs *oci_root = &cc->cc_conf->oc_rootfs;
+    struct conty_layer_store store;
+    int err;
+
+    if (oci_root->orfs_lazy) {
+        if (strnprintf(buf, len, "%s/%s/lower", oci_root->orfs_scratch, cc->cc_id) < 0)
+            return log_error_ret(-ENAMETOOLONG, "lower path of %s too long", cc->cc_id);
+
+        return 0;
+    }
+
+    if (!oci_root->orfs_layers) {
+        if (strnprintf(buf, len, "%s", oci_root->orfs_path) < 0)
+            return log_error_ret(-ENAMETOOLONG, "rootfs path %s too long", oci_root->orfs_path);
+
+        return 0;
+    }
+
+    if ((err = conty_layer_store_init(&store, oci_root->orfs_path)) != 0)
+        return err;
+
+    return conty_layer_lowerdir(&store, oci_root->orfs_layers, buf, len);
+}
+
+static void remove_scratch(struct conty_container *cc)
+{
+    struct oci_rootfs *oci_root = &cc->cc_conf->oc_rootfs;
+    char scratch[PATH_MAX];
+
+    if (!oci_root->orfs_overlay)
+        return;
+
+    if (strnprintf(scratch, sizeof(scratch), "%s/%s", oci_root->orfs_scratch, cc->cc_id) < 0)
+        return;
+
+    if (oci_root->orfs_lazy) {
+        char lower[PATH_MAX];
+
+        /*
+         * The server exits by itself once the last user of the filesystem
+         * is gone, which is also how servers of restored containers go away
+         */
+        if (strnprintf(lower, sizeof(lower), "%s/lower", scratch) >= 0 &&
+            umount2(lower, MNT_DETACH) != 0)
+            LOG_WARN("cannot unmount %s", lower);
+
+        if (cc->cc_lazy_pid > 0) {
+            kill(cc->cc_lazy_pid, SIGTERM);
+            waitpid(cc->cc_lazy_pid, NULL, 0);
+            cc->cc_lazy_pid = 0;
+        }
+    }
+
+    if (conty_rootfs_scratch_remove(scratch) != 0)
+        LOG_WARN("cannot remove scratch directory %s", scratch);
+}
+
+/*
+ * Hooks that are timed as a phase of their own, the start hooks run
+ * in the container process once it has nothing left to report
+ */
+static int hooks_phase(int event)
+{
+    switch (event) {
+        case EVENT_RT_CREATE:
+            return CONTY_PHASE_RUNTIME_CREATE_HOOKS;
+        case EVENT_CONT_CREATED:
+            return CONTY_PHASE_CREATED_HOOKS;
+        case EVENT_CONT_STARTED:
+            return CONTY_PHASE_STARTED_HOOKS;
+        default:
+            return -1;
+    }
+}
+
+static int run_hooks(struct conty_container *cc, int event)
+{
+    int err = 0, phase;
     MAKE_RESOURCE(oci_process_state_free) struct oci_process_state *state = NULL;
-    struct oci_hook *cur, *tmp;
-    struct oci_event_hooks *hooks = &cc->cc_conf->oc_hooks;
+    struct oci_event_hooks *hooks;
+    uint64_t start, elapsed;
+    char infallible;
+
+    if (!cc->cc_conf && !(cc->cc_conf = oci_conf_deser_file(cc->cc_bundle)))
+        return -EINVAL;
+
+    hooks = &cc->cc_conf->oc_hooks;
     const struct oci_hooks hook_table[] = {
             [EVENT_RT_CREATE]    = hooks->oehk_on_runtime_create,
             [EVENT_CONT_CREATED] = hooks->oehk_on_container_created,
@@ -480,18 +1492,27 @@ static int run_hooks(struct conty_container *cc, int event)
     state->opst_container_id = strdup(cc->cc_id);
     state->opst_status       = strdup(conty_container_status_str(cc));
 
-    SLIST_FOREACH_SAFE(cur, &hook_table[event], ohk_next, tmp) {
-        if ((err = oci_hook_exec(cur, state)) != 0) {
-            /*
-             * STARTED and STOPPED hooks are infallible so simply
-             * log the error and continue as if nothing happened
-             */
-            if (event == EVENT_CONT_STARTED || event == EVENT_CONT_STOPPED)
-                LOG_WARN("hook %s failed", cur->ohk_path);
-            else
-                return err;
-        }
-    }
+    /*
+     * STARTED and STOPPED hooks are infallible so simply
+     * log the error and continue as if nothing happened
+     */
+    infallible = event == EVENT_CONT_STARTED || event == EVENT_CONT_STOPPED;
 
-    return 0;
+    if (SLIST_EMPTY(&hook_table[event]))
+        return 0;
+
+    start = now_ns();
+
+    err = oci_event_hooks_exec(hooks, &hook_table[event], state, infallible);
+
+    elapsed = now_ns() - start;
+    cc->cc_hooks_ns += elapsed;
+
+    if ((phase = hooks_phase(event)) >= 0)
+        cc->cc_phase_ns[phase] = elapsed;
+
+    LOG_DEBUG("%s hooks of container %s took %.3f ms", conty_sync_event_str(event),
+              cc->cc_id, (double) elapsed / 1e6);
+
+    return err;
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 #include <conty/conty.h>
 
 #include <unistd.h>
+#include <net/if.h>
+#include <sys/resource.h>
 
 #include "namespace.h"
 #include "oci.h"
+#include "user.h"
 
 #define CONTY_STATUS_MAX (CONTY_STOPPED)
 
@@ -14,7 +17,11 @@ struct conty_container {
     /*
      * Container identifier
      */
-    const char               *cc_id;
+    char                     *cc_id;
+    /*
+     * Path to the OCI configuration of the container
+     */
+    char                     *cc_bundle;
     conty_container_status_t  cc_status;
     /*
      * Container process identifier
@@ -45,15 +52,84 @@ struct conty_container {
          * an open file descriptor inside
          */
         char cc_ns_has_fds;
+        /*
+         * Pollable file descriptor for the process whose namespaces the
+         * container joins, if it refers to another container or process.
+         * The runtime's thread enters those it can before spawning the
+         * container, the container process enters the others
+         */
+        int           cc_ns_ref;
+        unsigned long cc_ns_ref_thread;
+        unsigned long cc_ns_ref_child;
     };
+    /*
+     * Identifier mappings for a new user namespace, formatted once
+     * when the container is initialised
+     */
+    struct conty_id_map cc_uid_map;
+    struct conty_id_map cc_gid_map;
+    /*
+     * Whether the runtime writes the mappings from the outside
+     * while the container process is starting up, instead of
+     * the container process writing its own
+     */
+    char cc_id_map_by_runtime;
+    /*
+     * Process serving a lazy root filesystem, 0 if there's none
+     * or it was started by a previous instance of the runtime
+     */
+    pid_t cc_lazy_pid;
+    /*
+     * Host's end of the pair connecting the container to its bridge,
+     * empty if it isn't connected
+     */
+    char cc_veth[IFNAMSIZ];
+    /*
+     * Wall time spent running hooks, over all events so far
+     */
+    uint64_t cc_hooks_ns;
+    /*
+     * Time spent in every phase of creating and starting the container, and
+     * when the create or start in flight began. The container process reports
+     * the phases it goes through along with EVENT_CONT_CREATED
+     */
+    uint64_t cc_phase_ns[CONTY_PHASE_MAX + 1];
+    uint64_t cc_phase_start;
+    /*
+     * Exit status and resource usage of the container process,
+     * once conty_container_reap collected them
+     */
+    char          cc_reaped;
+    int           cc_exit_status;
+    struct rusage cc_rusage;
+    /*
+     * Asynchronous create or start in flight, and whom to tell once
+     * it's done, see conty_container_advance
+     */
+    int                   cc_step;
+    conty_container_cb_t  cc_cb;
+    void                 *cc_cb_data;
+    /*
+     * Pod the container is a member of, if any
+     */
+    struct conty_pod *cc_pod;
     /*
      * OCI configuration
+     * Restored containers only parse it when they need to run hooks
      */
     struct oci_conf *cc_conf;
 };
 
+/*
+ * Members of a pod have cc_pod set before they're initialised
+ */
 int conty_container_init(struct conty_container *cc, const char *id, const char *bundle);
 int conty_container_spawn(struct conty_container *cc);
+/*
+ * Everything conty_container_delete does short of freeing the container,
+ * which the deleter leaves to the thread that handed the container over
+ */
+int conty_container_teardown(struct conty_container *cc);
 
 CREATE_CLEANER(struct conty_container *, conty_container_free);
 #define CONTAINER_RESOURCE MAKE_RESOURCE(conty_container_free)
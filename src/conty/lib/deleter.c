@@ -0,0 +1,225 @@
+#include <conty/conty.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "log.h"
+#include "resource.h"
+#include "ring.h"
+
+/*
+ * Most containers in flight at once, beyond that callers delete
+ * containers themselves until some of them are done
+ */
+#define DELETER_JOBS 1024
+
+struct delete_job {
+    struct conty_container *dj_cc;
+    void                   *dj_data;
+    int                     dj_err;
+};
+
+struct deleter {
+    /*
+     * Jobs go to the deleter thread through the first ring and come back
+     * through the second one. Only the caller's thread counts the jobs
+     * in flight, so neither ring ever fills up
+     */
+    struct conty_ring dl_todo;
+    struct conty_ring dl_done;
+    unsigned int      dl_pending;
+    int               dl_stop;
+    pthread_t         dl_thread;
+};
+
+static struct deleter *deleter;
+
+/*
+ * Plugins run on the caller's thread and the calls on a connection to a hook
+ * server must all come from one thread, see conty/hook.h and hooksock.h.
+ * Only binaries may run on the deleter's
+ */
+static int hooks_movable(const struct oci_hooks *hooks)
+{
+    const struct oci_hook *hook;
+
+    SLIST_FOREACH(hook, hooks, ohk_next) {
+        if (hook->ohk_kind != OCI_HOOK_EXEC)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Containers without stopped hooks, a network or a writable layer are gone
+ * as soon as they're freed, handing them over would only cost a wakeup.
+ * Restored ones have yet to find out, teardown would read their
+ * configuration anyway
+ */
+static int deleter_worth_it(struct conty_container *cc)
+{
+    const struct oci_conf *conf;
+
+    if (!cc->cc_conf && !(cc->cc_conf = oci_conf_deser_file(cc->cc_bundle)))
+        return 0;
+
+    conf = cc->cc_conf;
+    if (!hooks_movable(&conf->oc_hooks.oehk_on_container_stopped))
+        return 0;
+
+    return !SLIST_EMPTY(&conf->oc_hooks.oehk_on_container_stopped) ||
+           conf->oc_net.onet_bridge || conf->oc_rootfs.orfs_overlay;
+}
+
+static void *deleter_run(void *arg)
+{
+    struct deleter *dl = arg;
+    struct delete_job *job;
+    int efd = conty_ring_fd(&dl->dl_todo);
+
+    for (;;) {
+        while ((job = conty_ring_pop(&dl->dl_todo))) {
+            job->dj_err = conty_container_teardown(job->dj_cc);
+            conty_ring_push(&dl->dl_done, job);
+        }
+
+        /*
+         * Whatever was handed over before we were told
+         * to stop was popped by now
+         */
+        if (__atomic_load_n(&dl->dl_stop, __ATOMIC_ACQUIRE))
+            break;
+
+        conty_ring_eventfd_wait(efd, -1);
+    }
+
+    return NULL;
+}
+
+int conty_deleter_start(void)
+{
+    MEM_RESOURCE struct deleter *dl = NULL;
+    sigset_t all, mask;
+    int err;
+
+    if (deleter)
+        return log_error_ret(-EBUSY, "deleter already running");
+
+    if (!(dl = calloc(1, sizeof(*dl))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    if ((err = conty_ring_init(&dl->dl_todo, DELETER_JOBS)) != 0)
+        return err;
+
+    if ((err = conty_ring_init(&dl->dl_done, DELETER_JOBS)) != 0)
+        goto err_todo;
+
+    /*
+     * Signals are for the caller's thread, which may be waiting for them
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &mask);
+    err = -pthread_create(&dl->dl_thread, NULL, deleter_run, dl);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    if (err != 0) {
+        LOG_ERROR("cannot start deleter thread");
+        goto err_done;
+    }
+
+    deleter = move_ptr(dl);
+    return 0;
+
+err_done:
+    conty_ring_free(&dl->dl_done);
+err_todo:
+    conty_ring_free(&dl->dl_todo);
+    return err;
+}
+
+void conty_deleter_stop(conty_deleter_cb_t cb, void *arg)
+{
+    struct deleter *dl = deleter;
+    struct delete_job *job;
+    uint64_t one = 1;
+
+    if (!dl)
+        return;
+
+    deleter = NULL;
+    __atomic_store_n(&dl->dl_stop, 1, __ATOMIC_RELEASE);
+    if (write(conty_ring_fd(&dl->dl_todo), &one, sizeof(one)) < 0)
+        LOG_WARN("cannot wake up deleter");
+    pthread_join(dl->dl_thread, NULL);
+
+    while ((job = conty_ring_pop(&dl->dl_done))) {
+        conty_container_free(job->dj_cc);
+        if (cb)
+            cb(job->dj_data, job->dj_err, arg);
+        free(job);
+    }
+
+    conty_ring_free(&dl->dl_done);
+    conty_ring_free(&dl->dl_todo);
+    free(dl);
+}
+
+int conty_deleter_fd(void)
+{
+    return deleter ? conty_ring_fd(&deleter->dl_done) : -EBADF;
+}
+
+int conty_container_delete_async(struct conty_container *cc, void *data)
+{
+    struct delete_job *job;
+
+    if (!deleter || deleter->dl_pending >= DELETER_JOBS || !deleter_worth_it(cc))
+        return -EAGAIN;
+
+    if (!(job = malloc(sizeof(*job))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    job->dj_cc   = cc;
+    job->dj_data = data;
+    job->dj_err  = 0;
+
+    conty_ring_push(&deleter->dl_todo, job);
+    deleter->dl_pending++;
+
+    return 0;
+}
+
+void *conty_deleter_next(int *err)
+{
+    struct delete_job *job;
+    void *data;
+
+    if (!deleter)
+        return NULL;
+
+    /*
+     * Drain the descriptor only once the ring looks empty and have another
+     * look, anything pushed after that makes the descriptor readable again
+     */
+    if (!(job = conty_ring_pop(&deleter->dl_done))) {
+        conty_ring_eventfd_drain(conty_ring_fd(&deleter->dl_done));
+        if (!(job = conty_ring_pop(&deleter->dl_done)))
+            return NULL;
+    }
+
+    deleter->dl_pending--;
+
+    *err = job->dj_err;
+    data = job->dj_data;
+
+    conty_container_free(job->dj_cc);
+    free(job);
+
+    return data;
+}
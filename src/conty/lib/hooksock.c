@@ -0,0 +1,379 @@
+#include "hooksock.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <conty/hook.h>
+
+#include "log.h"
+#include "resource.h"
+
+struct hooksock_conn {
+    char                                *hs_path;
+    /*
+     * Serialises requests and reconnections. Requests are sent under this
+     * lock alone, so that a slow server only holds up its own callers.
+     * Taken before conns_lock, which guards everything else
+     */
+    pthread_mutex_t                      hs_lock;
+    /*
+     * Replaced with both locks held, so either one keeps it from changing
+     */
+    int                                  hs_fd;
+    /*
+     * The connection failed, the next request connects again
+     */
+    char                                 hs_broken;
+    uint32_t                             hs_tag;
+    /*
+     * Reply that was only partially received so far
+     */
+    unsigned char                        hs_reply[sizeof(struct conty_hook_frame) + CONTY_HOOK_REPLY_LEN];
+    size_t                               hs_replylen;
+    SLIST_HEAD(, conty_hooksock_call)    hs_calls;
+    SLIST_ENTRY(hooksock_conn)           hs_next;
+};
+
+/*
+ * Connections are made on first use and kept for the lifetime of the
+ * process. There are only ever a handful of hook servers
+ */
+static SLIST_HEAD(, hooksock_conn) conns = SLIST_HEAD_INITIALIZER(conns);
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct hooksock_conn *conn_get(const char *path)
+{
+    struct hooksock_conn *conn;
+
+    SLIST_FOREACH(conn, &conns, hs_next) {
+        if (!strcmp(conn->hs_path, path))
+            return conn;
+    }
+
+    if (!(conn = calloc(1, sizeof(struct hooksock_conn))) || !(conn->hs_path = strdup(path))) {
+        free(conn);
+        return log_fatal_ret(NULL, "out of memory");
+    }
+
+    pthread_mutex_init(&conn->hs_lock, NULL);
+    conn->hs_fd = -EBADF;
+    SLIST_INIT(&conn->hs_calls);
+    SLIST_INSERT_HEAD(&conns, conn, hs_next);
+
+    return conn;
+}
+
+/*
+ * Called with hs_lock held
+ */
+static int conn_connect(struct hooksock_conn *conn)
+{
+    FD_RESOURCE int fd = -EBADF;
+    FD_RESOURCE int old = -EBADF;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(conn->hs_path) >= sizeof(addr.sun_path))
+        return log_error_ret(-ENAMETOOLONG, "hook socket path %s too long", conn->hs_path);
+
+    strcpy(addr.sun_path, conn->hs_path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return log_error_ret(-errno, "cannot create hook socket");
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        return log_error_ret(-errno, "cannot connect to hook server %s", conn->hs_path);
+
+    pthread_mutex_lock(&conns_lock);
+    old = conn->hs_fd;
+    conn->hs_fd       = move_fd(fd);
+    conn->hs_replylen = 0;
+    conn->hs_broken   = 0;
+    pthread_mutex_unlock(&conns_lock);
+
+    return 0;
+}
+
+/*
+ * The server went away or broke the protocol, fail everything in flight.
+ * Called with conns_lock held. The descriptor is closed by the next request,
+ * which holds hs_lock, as a request may be being sent on it meanwhile
+ */
+static void conn_reset(struct hooksock_conn *conn, int err)
+{
+    struct conty_hooksock_call *call;
+
+    if (!conn->hs_broken)
+        LOG_WARN("lost connection to hook server %s", conn->hs_path);
+
+    conn->hs_broken = 1;
+
+    while ((call = SLIST_FIRST(&conn->hs_calls))) {
+        SLIST_REMOVE_HEAD(&conn->hs_calls, hc_next);
+        call->hc_done   = 1;
+        call->hc_status = err;
+    }
+}
+
+static int conn_sendall(struct hooksock_conn *conn, const void *buf, size_t len)
+{
+    ssize_t tx;
+
+    while (len > 0) {
+        tx = send(conn->hs_fd, buf, len, MSG_NOSIGNAL);
+        if (tx < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        buf  = (const char *) buf + tx;
+        len -= (size_t) tx;
+    }
+
+    return 0;
+}
+
+static int conn_request(struct hooksock_conn *conn, uint32_t tag, const char *state,
+                        size_t len, char **argv)
+{
+    MEM_RESOURCE char *buf = NULL;
+    struct conty_hook_frame frame;
+    size_t payload = len + 1, off;
+
+    for (int i = 0; argv && argv[i]; i++)
+        payload += strlen(argv[i]) + 1;
+
+    if (payload > UINT32_MAX)
+        return -E2BIG;
+
+    /*
+     * Assemble the frame in one go so that it goes out in a single write
+     */
+    if (!(buf = malloc(sizeof(frame) + payload)))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    frame.chf_len = htole32((uint32_t) payload);
+    frame.chf_tag = htole32(tag);
+    memcpy(buf, &frame, sizeof(frame));
+    off = sizeof(frame);
+
+    memcpy(buf + off, state, len);
+    buf[off + len] = '\0';
+    off += len + 1;
+
+    for (int i = 0; argv && argv[i]; i++) {
+        size_t arglen = strlen(argv[i]) + 1;
+        memcpy(buf + off, argv[i], arglen);
+        off += arglen;
+    }
+
+    return conn_sendall(conn, buf, off);
+}
+
+/*
+ * Expect a reply to the call before the request goes out,
+ * which may well be received before the send returns
+ */
+static void conn_track(struct hooksock_conn *conn, struct conty_hooksock_call *call)
+{
+    pthread_mutex_lock(&conns_lock);
+
+    *call = (struct conty_hooksock_call) {
+            .hc_conn = conn,
+            .hc_tag  = conn->hs_tag++,
+    };
+    SLIST_INSERT_HEAD(&conn->hs_calls, call, hc_next);
+
+    pthread_mutex_unlock(&conns_lock);
+}
+
+static void conn_fail(struct hooksock_conn *conn, int err)
+{
+    pthread_mutex_lock(&conns_lock);
+    conn_reset(conn, err);
+    pthread_mutex_unlock(&conns_lock);
+}
+
+int conty_hooksock_send(const char *path, const char *state, size_t len, char **argv,
+                        struct conty_hooksock_call *call)
+{
+    struct hooksock_conn *conn;
+    int err = 0;
+
+    pthread_mutex_lock(&conns_lock);
+    conn = conn_get(path);
+    pthread_mutex_unlock(&conns_lock);
+
+    if (!conn)
+        return -ENOMEM;
+
+    pthread_mutex_lock(&conn->hs_lock);
+
+    if ((conn->hs_fd < 0 || conn->hs_broken) && (err = conn_connect(conn)) != 0)
+        goto out;
+
+    conn_track(conn, call);
+
+    /*
+     * A server that restarted since the last request leaves us
+     * with a dead connection, which is worth a second attempt
+     */
+    if ((err = conn_request(conn, call->hc_tag, state, len, argv)) == -EPIPE ||
+        err == -ECONNRESET) {
+        conn_fail(conn, err);
+        if ((err = conn_connect(conn)) == 0) {
+            conn_track(conn, call);
+            err = conn_request(conn, call->hc_tag, state, len, argv);
+        }
+    }
+
+    if (err != 0) {
+        conn_fail(conn, err);
+        log_error_ret(err, "cannot send request to hook server %s", path);
+    }
+
+out:
+    pthread_mutex_unlock(&conn->hs_lock);
+    return err;
+}
+
+int conty_hooksock_fd(const struct conty_hooksock_call *call)
+{
+    return call->hc_conn->hs_fd;
+}
+
+static void conn_complete(struct hooksock_conn *conn, uint32_t tag, int32_t status)
+{
+    struct conty_hooksock_call *call;
+
+    SLIST_FOREACH(call, &conn->hs_calls, hc_next) {
+        if (call->hc_tag == tag) {
+            SLIST_REMOVE(&conn->hs_calls, call, conty_hooksock_call, hc_next);
+            call->hc_done   = 1;
+            call->hc_status = status == 0 ? 0 : -1;
+            return;
+        }
+    }
+
+    /*
+     * Reply to a cancelled call
+     */
+}
+
+/*
+ * Read whatever replies are available
+ */
+static int conn_drain(struct hooksock_conn *conn)
+{
+    struct conty_hook_frame frame;
+    int32_t status;
+    ssize_t rx;
+
+    while (conn->hs_fd >= 0 && !conn->hs_broken) {
+        rx = recv(conn->hs_fd, conn->hs_reply + conn->hs_replylen,
+                  sizeof(conn->hs_reply) - conn->hs_replylen, MSG_DONTWAIT);
+        if (rx < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+
+            conn_reset(conn, -errno);
+            return -ECONNRESET;
+        }
+
+        if (rx == 0) {
+            conn_reset(conn, -ECONNRESET);
+            return -ECONNRESET;
+        }
+
+        conn->hs_replylen += (size_t) rx;
+        if (conn->hs_replylen < sizeof(conn->hs_reply))
+            continue;
+
+        memcpy(&frame, conn->hs_reply, sizeof(frame));
+        memcpy(&status, conn->hs_reply + sizeof(frame), sizeof(status));
+        conn->hs_replylen = 0;
+
+        if (le32toh(frame.chf_len) != CONTY_HOOK_REPLY_LEN) {
+            LOG_ERROR("hook server %s sent a malformed reply", conn->hs_path);
+            conn_reset(conn, -EPROTO);
+            return -EPROTO;
+        }
+
+        conn_complete(conn, le32toh(frame.chf_tag), (int32_t) le32toh((uint32_t) status));
+    }
+
+    return 0;
+}
+
+int conty_hooksock_recv(struct conty_hooksock_call *call)
+{
+    pthread_mutex_lock(&conns_lock);
+
+    if (!call->hc_done)
+        conn_drain(call->hc_conn);
+
+    pthread_mutex_unlock(&conns_lock);
+
+    return call->hc_done;
+}
+
+void conty_hooksock_cancel(struct conty_hooksock_call *call)
+{
+    pthread_mutex_lock(&conns_lock);
+
+    if (!call->hc_done) {
+        SLIST_REMOVE(&call->hc_conn->hs_calls, call, conty_hooksock_call, hc_next);
+        call->hc_done   = 1;
+        call->hc_status = -ECANCELED;
+    }
+
+    pthread_mutex_unlock(&conns_lock);
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int conty_hooksock_exec(const char *path, const char *state, size_t len, char **argv,
+                        unsigned int timeout)
+{
+    struct conty_hooksock_call call;
+    long long deadline = now_ms() + 1000LL * timeout;
+    struct pollfd pfd;
+    int err;
+
+    if ((err = conty_hooksock_send(path, state, len, argv, &call)) != 0)
+        return err;
+
+    while (!conty_hooksock_recv(&call)) {
+        long long left = deadline - now_ms();
+
+        if (timeout && left <= 0) {
+            conty_hooksock_cancel(&call);
+            return log_error_ret(-ETIMEDOUT, "hook server %s timed out", path);
+        }
+
+        pfd = (struct pollfd) { .fd = conty_hooksock_fd(&call), .events = POLLIN };
+        if (poll(&pfd, 1, timeout ? (int) left : -1) < 0 && errno != EINTR) {
+            err = -errno;
+            conty_hooksock_cancel(&call);
+            return err;
+        }
+    }
+
+    return call.hc_status;
+}
@@ -0,0 +1,62 @@
+#ifndef CONTY_HOOKSOCK_H
+#define CONTY_HOOKSOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+struct hooksock_conn;
+
+/*
+ * Request to a hook server that awaits its reply
+ */
+struct conty_hooksock_call {
+    struct hooksock_conn                  *hc_conn;
+    uint32_t                               hc_tag;
+    /*
+     * Set along with the status once the reply arrived
+     * or the connection was lost
+     */
+    char                                   hc_done;
+    int                                    hc_status;
+    SLIST_ENTRY(conty_hooksock_call)       hc_next;
+};
+
+/*
+ * Send the serialized process state and the arguments of the hook to the
+ * hook server listening at path, connecting to it first if needed.
+ * The call stays in flight until it's received or cancelled
+ */
+int conty_hooksock_send(const char *path, const char *state, size_t len, char **argv,
+                        struct conty_hooksock_call *call);
+
+/*
+ * Descriptor that becomes readable when replies to calls on the
+ * connection of the given call arrive
+ */
+int conty_hooksock_fd(const struct conty_hooksock_call *call);
+
+/*
+ * Consume the replies that arrived on the connection of the call without
+ * blocking, which may complete other calls on the same connection as well.
+ * Returns 1 if the call is done, 0 if its reply is still outstanding.
+ *
+ * Calls on a connection must all be driven by the same thread, since a
+ * reply another thread consumed doesn't wake up the one waiting for it
+ */
+int conty_hooksock_recv(struct conty_hooksock_call *call);
+
+/*
+ * Forget about a call in flight, its reply is dropped if it ever arrives
+ */
+void conty_hooksock_cancel(struct conty_hooksock_call *call);
+
+/*
+ * Send the request and await its reply for at most timeout seconds,
+ * indefinitely if timeout is 0
+ */
+int conty_hooksock_exec(const char *path, const char *state, size_t len, char **argv,
+                        unsigned int timeout);
+
+#endif //CONTY_HOOKSOCK_H
@@ -0,0 +1,43 @@
+#include "init.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sync.h"
+
+int main(int argc, char *argv[], char *envp[])
+{
+    int fds[2] = { -EBADF, CONTY_INIT_SYNCFD };
+
+    if (argc < 3)
+        return EXIT_FAILURE;
+
+    /*
+     * The same steps as the container process would take, minus
+     * everything that concerns namespaces and hooks
+     */
+    if (conty_sync_wake_runtime(fds, EVENT_RT_CREATE) != 0)
+        return EXIT_FAILURE;
+
+    if (conty_sync_await_runtime(fds, EVENT_CONT_CREATE) != 0)
+        return EXIT_FAILURE;
+
+    if (conty_sync_runtime(fds, EVENT_CONT_CREATED) != 0)
+        return EXIT_FAILURE;
+
+    /*
+     * The runtime learns that we made it when the descriptor closes
+     */
+    if (fcntl(CONTY_INIT_SYNCFD, F_SETFD, FD_CLOEXEC) != 0)
+        goto err_notify_runtime;
+
+    if (chdir(argv[1]) != 0)
+        goto err_notify_runtime;
+
+    execve(argv[2], &argv[2], envp);
+
+err_notify_runtime:
+    conty_sync_wake_runtime(fds, EVENT_ERROR);
+    return EXIT_FAILURE;
+}
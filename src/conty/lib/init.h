@@ -0,0 +1,17 @@
+#ifndef CONTY_INIT_H
+#define CONTY_INIT_H
+
+/*
+ * conty-init stands in for the process of a container that has nothing
+ * to set up between being created and started, so that the runtime can
+ * spawn it with clone_vfork instead of copying its own address space:
+ *
+ *     conty-init <cwd> <path> [args...]
+ *
+ * It goes through the creation handshake with the runtime on
+ * CONTY_INIT_SYNCFD, waits to be started and then executes path with
+ * the given arguments and its own environment in cwd
+ */
+#define CONTY_INIT_SYNCFD 3
+
+#endif //CONTY_INIT_H
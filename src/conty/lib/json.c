@@ -70,6 +70,44 @@ static int deser_rootfs(json_object *root, struct oci_rootfs *rootfs)
     obj = json_object_object_get(root, "readonly");
     rootfs->orfs_readonly = obj && json_object_get_boolean(obj);
 
+    obj = json_object_object_get(root, "idmap");
+    rootfs->orfs_idmap = obj && json_object_get_boolean(obj);
+
+    obj = json_object_object_get(root, "overlay");
+    if (obj) {
+        json_object *scratch, *tmpfs;
+
+        scratch = json_object_object_get(obj, "scratch");
+        if (!scratch || !(rootfs->orfs_scratch = deser_path(scratch)))
+            return log_error_ret(-EINVAL, "oci: overlay scratch directory missing");
+
+        tmpfs = json_object_object_get(obj, "tmpfs");
+        rootfs->orfs_tmpfs   = tmpfs && json_object_get_boolean(tmpfs);
+        rootfs->orfs_overlay = 1;
+    }
+
+    obj = json_object_object_get(root, "layers");
+    if (obj) {
+        if (!(rootfs->orfs_layers = deser_strlist(obj)))
+            return log_error_ret(-EINVAL, "oci: invalid root filesystem layers");
+
+        if (!rootfs->orfs_overlay)
+            return log_error_ret(-EINVAL, "oci: root filesystem layers need an overlay");
+    }
+
+    obj = json_object_object_get(root, "lazy");
+    rootfs->orfs_lazy = obj && json_object_get_boolean(obj);
+    if (rootfs->orfs_lazy) {
+        if (!rootfs->orfs_overlay || rootfs->orfs_layers)
+            return log_error_ret(-EINVAL, "oci: lazy root filesystem needs an overlay of its own");
+
+        /*
+         * The archive is mounted in the scratch directory, which a tmpfs would hide
+         */
+        if (rootfs->orfs_tmpfs)
+            return log_error_ret(-EINVAL, "oci: lazy root filesystem can't have a tmpfs scratch");
+    }
+
     return 0;
 }
 
@@ -77,8 +115,8 @@ static int deser_namespaces(json_object *root, struct oci_namespaces *namespaces
 {
     size_t len;
     int i;
-    json_object *cur, *type, *path;
-    MEM_RESOURCE char *ons_type = NULL, *ons_path = NULL;
+    json_object *cur, *type, *path, *container, *pid;
+    MEM_RESOURCE char *ons_type = NULL, *ons_path = NULL, *ons_container = NULL;
     struct oci_namespace *ns;
 
     SLIST_INIT(namespaces);
@@ -103,12 +141,28 @@ static int deser_namespaces(json_object *root, struct oci_namespaces *namespaces
                 return log_error_ret(-EINVAL, "oci: namespace path invalid");
         }
 
+        container = json_object_object_get(cur, "container");
+        if (container) {
+            if (!(ons_container = deser_str(container)))
+                return log_error_ret(-EINVAL, "oci: namespace container invalid");
+        }
+
+        pid = json_object_object_get(cur, "pid");
+        if (pid && json_object_get_int(pid) <= 0)
+            return log_error_ret(-EINVAL, "oci: namespace pid invalid");
+
+        if (!!path + !!container + !!pid > 1)
+            return log_error_ret(-EINVAL, "oci: %s namespace has more than one of path, "
+                                          "container and pid", ons_type);
+
         ns = calloc(1, sizeof(struct oci_namespace));
         if (!ns)
             return log_fatal_ret(-ENOMEM, "oci: out of memory");
 
-        ns->ons_type = move_ptr(ons_type);
-        ns->ons_path = move_ptr(ons_path);
+        ns->ons_type      = move_ptr(ons_type);
+        ns->ons_path      = move_ptr(ons_path);
+        ns->ons_container = move_ptr(ons_container);
+        ns->ons_pid       = pid ? (pid_t) json_object_get_int(pid) : 0;
 
         SLIST_INSERT_HEAD(namespaces, ns, ons_next);
     }
@@ -156,15 +210,50 @@ static int deser_ids(json_object *root, struct oci_ids *uids)
     return 0;
 }
 
+static struct oci_hook *find_hook(struct oci_hooks *hooks, const char *name)
+{
+    struct oci_hook *hook;
+
+    SLIST_FOREACH(hook, hooks, ohk_next) {
+        if (hook->ohk_name && !strcmp(hook->ohk_name, name))
+            return hook;
+    }
+
+    return NULL;
+}
+
+/*
+ * Hooks can only run after hooks of the same event, and a name must
+ * identify a single hook
+ */
+static int check_hook_deps(struct oci_hooks *hooks)
+{
+    struct oci_hook *hook;
+
+    SLIST_FOREACH(hook, hooks, ohk_next) {
+        if (hook->ohk_name && find_hook(hooks, hook->ohk_name) != hook)
+            return log_error_ret(-EINVAL, "oci: hook name %s is not unique", hook->ohk_name);
+
+        for (int i = 0; hook->ohk_after && hook->ohk_after[i]; i++) {
+            if (!find_hook(hooks, hook->ohk_after[i]))
+                return log_error_ret(-EINVAL, "oci: hook %s runs after unknown hook %s",
+                                     hook->ohk_path, hook->ohk_after[i]);
+        }
+    }
+
+    return 0;
+}
+
 static int deser_hooks(json_object *root, struct oci_hooks *hooks)
 {
     size_t len;
     int i;
 
     json_object *cur, *tmp;
-    MEM_RESOURCE char *oh_path = NULL;
-    STRINGLIST_RESOURCE char **argv = NULL, **envp = NULL;
+    MEM_RESOURCE char *oh_path = NULL, *name = NULL;
+    STRINGLIST_RESOURCE char **argv = NULL, **envp = NULL, **after = NULL;
     unsigned int timeout = 0;
+    enum oci_hook_kind kind;
     struct oci_hook *hook;
 
     SLIST_INIT(hooks);
@@ -196,6 +285,30 @@ static int deser_hooks(json_object *root, struct oci_hooks *hooks)
         if (tmp)
             timeout = json_object_get_uint64(tmp);
 
+        kind = OCI_HOOK_EXEC;
+        tmp = json_object_object_get(cur, "plugin");
+        if (tmp && json_object_get_boolean(tmp))
+            kind = OCI_HOOK_PLUGIN;
+
+        tmp = json_object_object_get(cur, "socket");
+        if (tmp && json_object_get_boolean(tmp)) {
+            if (kind != OCI_HOOK_EXEC)
+                return log_error_ret(-EINVAL, "oci: hook %s is both a plugin and a socket", oh_path);
+            kind = OCI_HOOK_SOCKET;
+        }
+
+        tmp = json_object_object_get(cur, "name");
+        if (tmp) {
+            if (!(name = deser_str(tmp)))
+                return log_error_ret(-EINVAL, "oci: hook name invalid");
+        }
+
+        tmp = json_object_object_get(cur, "after");
+        if (tmp) {
+            if (!(after = deser_strlist(tmp)))
+                return log_error_ret(-EINVAL, "oci: hook after invalid");
+        }
+
         hook = calloc(1, sizeof(struct oci_hook));
         if (!hook)
             return log_fatal_ret(-ENOMEM, "oci: out of memory");
@@ -203,11 +316,33 @@ static int deser_hooks(json_object *root, struct oci_hooks *hooks)
         hook->ohk_argv    = move_ptr(argv);
         hook->ohk_envp    = move_ptr(envp);
         hook->ohk_timeout = timeout;
+        hook->ohk_kind    = kind;
         hook->ohk_path    = move_ptr(oh_path);
+        hook->ohk_name    = move_ptr(name);
+        hook->ohk_after   = move_ptr(after);
 
         SLIST_INSERT_HEAD(hooks, hook, ohk_next);
     }
 
+    return check_hook_deps(hooks);
+}
+
+/*
+ * Hooks of these events run in the container process. It has a copy of the
+ * runtime's hook server connections, which it must not talk over, and can't
+ * reach the servers' sockets anymore once it pivoted
+ */
+static int check_container_hooks(const char *event, const struct oci_hooks *hooks)
+{
+    struct oci_hook *hook;
+
+    SLIST_FOREACH(hook, hooks, ohk_next) {
+        if (hook->ohk_kind != OCI_HOOK_EXEC)
+            return log_error_ret(-EINVAL, "oci: %s hook %s runs in the container, "
+                                          "it can't be a plugin or a socket", event,
+                                          hook->ohk_path);
+    }
+
     return 0;
 }
 
@@ -218,10 +353,13 @@ static int deser_event_hooks(json_object *root, struct oci_event_hooks *hooks)
     const struct {
         const char *name;
         struct oci_hooks *hooks;
+        char in_container;
     } helper[] = {
             { .name = "on_runtime_create",  .hooks = &hooks->oehk_on_runtime_create },
-            { .name = "on_container_created", .hooks = &hooks->oehk_on_container_created },
-            { .name = "on_container_start",   .hooks = &hooks->oehk_on_container_start },
+            { .name = "on_container_created", .hooks = &hooks->oehk_on_container_created,
+              .in_container = 1 },
+            { .name = "on_container_start",   .hooks = &hooks->oehk_on_container_start,
+              .in_container = 1 },
             { .name = "on_contaner_started", .hooks = &hooks->oehk_on_container_started },
             { .name = "on_container_stopped", .hooks = &hooks->oehk_on_container_stopped },
     };
@@ -233,8 +371,15 @@ static int deser_event_hooks(json_object *root, struct oci_event_hooks *hooks)
             SLIST_INIT(helper[i].hooks);
         else if ((err = deser_hooks(tmp, helper[i].hooks)) != 0)
             return err;
+
+        if (helper[i].in_container &&
+            (err = check_container_hooks(helper[i].name, helper[i].hooks)) != 0)
+            return err;
     }
 
+    tmp = json_object_object_get(root, "parallel");
+    hooks->oehk_parallel = tmp && json_object_get_boolean(tmp);
+
     return 0;
 }
 
@@ -274,7 +419,65 @@ static int deser_proc(json_object *root, struct oci_process *proc)
     return 0;
 }
 
-static struct oci_conf *deser_conf(json_object *root)
+static int deser_network(json_object *root, struct oci_namespaces *namespaces,
+                         struct oci_network *net)
+{
+    json_object *tmp;
+    struct oci_namespace *ns;
+
+    SLIST_FOREACH(ns, namespaces, ons_next) {
+        if (!strcmp(ns->ons_type, "net"))
+            break;
+    }
+
+    if (!ns)
+        return log_error_ret(-EINVAL, "oci: network requires a net namespace");
+
+    tmp = json_object_object_get(root, "bridge");
+    if (!tmp || !(net->onet_bridge = deser_str(tmp)))
+        return log_error_ret(-EINVAL, "oci: network bridge missing");
+
+    tmp = json_object_object_get(root, "bridge_addresses");
+    if (tmp && !(net->onet_bridge_addrs = deser_strlist(tmp)))
+        return log_error_ret(-EINVAL, "oci: network bridge_addresses invalid");
+
+    tmp = json_object_object_get(root, "addresses");
+    if (tmp && !(net->onet_addrs = deser_strlist(tmp)))
+        return log_error_ret(-EINVAL, "oci: network addresses invalid");
+
+    tmp = json_object_object_get(root, "mtu");
+    net->onet_mtu = tmp ? json_object_get_uint64(tmp) : 0;
+
+    tmp = json_object_object_get(root, "delete_bridge");
+    net->onet_delete_bridge = tmp && json_object_get_boolean(tmp);
+
+    return 0;
+}
+
+/*
+ * Pods have neither a root filesystem nor a process of their own,
+ * only the namespaces they share and what goes with them
+ */
+static int check_pod(const struct oci_conf *conf)
+{
+    struct oci_namespace *ns;
+
+    SLIST_FOREACH(ns, &conf->oc_namespaces, ons_next) {
+        if (strcmp(ns->ons_type, "net") != 0 && strcmp(ns->ons_type, "ipc") != 0 &&
+            strcmp(ns->ons_type, "uts") != 0)
+            return log_error_ret(-EINVAL, "oci: pods can't share %s namespaces", ns->ons_type);
+
+        if (ns->ons_path || ns->ons_container || ns->ons_pid)
+            return log_error_ret(-EINVAL, "oci: pods can't join namespaces");
+    }
+
+    if (SLIST_EMPTY(&conf->oc_namespaces))
+        return log_error_ret(-EINVAL, "oci: pod shares no namespaces");
+
+    return 0;
+}
+
+static struct oci_conf *deser_conf(json_object *root, char pod)
 {
     MAKE_RESOURCE(oci_conf_free) struct oci_conf *conf = NULL;
 
@@ -282,13 +485,6 @@ static struct oci_conf *deser_conf(json_object *root)
     if (!conf)
         return NULL;
 
-    json_object *rootfs = json_object_object_get(root, "root");
-    if (!rootfs)
-        return log_error_ret_errno(NULL, EINVAL, "oci: root filesystem missing");
-
-    if (deser_rootfs(rootfs, &conf->oc_rootfs) != 0)
-        return NULL;
-
     json_object *namespaces = json_object_object_get(root, "namespaces");
     if (!namespaces)
         return log_error_ret_errno(NULL, EINVAL, "oci: namespaces missing");
@@ -296,20 +492,32 @@ static struct oci_conf *deser_conf(json_object *root)
     if (deser_namespaces(namespaces, &conf->oc_namespaces) != 0)
         return NULL;
 
-    json_object *proc = json_object_object_get(root, "process");
-    if (!proc)
-        return log_error_ret_errno(NULL, EINVAL, "oci: process missing");
-
-    if (deser_proc(proc, &conf->oc_proc) != 0)
+    if (pod && check_pod(conf) != 0)
         return NULL;
 
-    json_object *uids = json_object_object_get(root, "uid_mappings");
-    if (uids && deser_ids(uids, &conf->oc_uids) != 0)
-        return NULL;
+    if (!pod) {
+        json_object *rootfs = json_object_object_get(root, "root");
+        if (!rootfs)
+            return log_error_ret_errno(NULL, EINVAL, "oci: root filesystem missing");
 
-    json_object *gids = json_object_object_get(root, "gid_mappings");
-    if (gids && deser_ids(gids, &conf->oc_gids) != 0)
-        return NULL;
+        if (deser_rootfs(rootfs, &conf->oc_rootfs) != 0)
+            return NULL;
+
+        json_object *proc = json_object_object_get(root, "process");
+        if (!proc)
+            return log_error_ret_errno(NULL, EINVAL, "oci: process missing");
+
+        if (deser_proc(proc, &conf->oc_proc) != 0)
+            return NULL;
+
+        json_object *uids = json_object_object_get(root, "uid_mappings");
+        if (uids && deser_ids(uids, &conf->oc_uids) != 0)
+            return NULL;
+
+        json_object *gids = json_object_object_get(root, "gid_mappings");
+        if (gids && deser_ids(gids, &conf->oc_gids) != 0)
+            return NULL;
+    }
 
     json_object *hooks = json_object_object_get(root, "hooks");
     if (hooks && deser_event_hooks(hooks, &conf->oc_hooks) != 0)
@@ -321,11 +529,15 @@ static struct oci_conf *deser_conf(json_object *root)
             return NULL;
     }
 
+    json_object *net = json_object_object_get(root, "network");
+    if (net && deser_network(net, &conf->oc_namespaces, &conf->oc_net) != 0)
+        return NULL;
+
     return move_ptr(conf);
 }
 
 static struct oci_conf *deser_conf_buf(const char *buf,
-                                       json_object *(*cb)(const char *buf))
+                                       json_object *(*cb)(const char *buf), char pod)
 {
     struct oci_conf *conf;
     json_object *root;
@@ -334,19 +546,24 @@ static struct oci_conf *deser_conf_buf(const char *buf,
     if (!root)
         return log_error_ret(NULL, "oci: invalid json");
 
-    conf = deser_conf(root);
+    conf = deser_conf(root, pod);
     json_object_put(root);
     return conf;
 }
 
 struct oci_conf *oci_conf_deser(const char *buf)
 {
-    return deser_conf_buf(buf, json_tokener_parse);
+    return deser_conf_buf(buf, json_tokener_parse, 0);
 }
 
 struct oci_conf *oci_conf_deser_file(const char *path)
 {
-    return deser_conf_buf(path, json_object_from_file);
+    return deser_conf_buf(path, json_object_from_file, 0);
+}
+
+struct oci_conf *oci_pod_conf_deser_file(const char *path)
+{
+    return deser_conf_buf(path, json_object_from_file, 1);
 }
 
 char *oci_process_state_ser(const struct oci_process_state *state, size_t *len)
@@ -451,6 +668,8 @@ void oci_namespace_free(struct oci_namespace *ns)
             free(ns->ons_type);
         if (ns->ons_path)
             free(ns->ons_path);
+        if (ns->ons_container)
+            free(ns->ons_container);
         free(ns);
         ns = NULL;
     }
@@ -461,6 +680,9 @@ void oci_rootfs_free(struct oci_rootfs *rootfs)
     if (rootfs) {
         if (rootfs->orfs_path)
             free(rootfs->orfs_path);
+        if (rootfs->orfs_scratch)
+            free(rootfs->orfs_scratch);
+        stringlist_cleaner(rootfs->orfs_layers);
         free(rootfs);
         rootfs = NULL;
     }
@@ -499,6 +721,9 @@ void oci_hook_free(struct oci_hook *hook)
             free(hook->ohk_path);
         stringlist_cleaner(hook->ohk_argv);
         stringlist_cleaner(hook->ohk_envp);
+        if (hook->ohk_name)
+            free(hook->ohk_name);
+        stringlist_cleaner(hook->ohk_after);
         free(hook);
         hook = NULL;
     }
@@ -509,6 +734,9 @@ void oci_conf_free(struct oci_conf *conf)
     if (conf) {
         if (conf->oc_rootfs.orfs_path)
             free(conf->oc_rootfs.orfs_path);
+        if (conf->oc_rootfs.orfs_scratch)
+            free(conf->oc_rootfs.orfs_scratch);
+        stringlist_cleaner(conf->oc_rootfs.orfs_layers);
 
         if (conf->oc_proc.oproc_cwd)
             free(conf->oc_proc.oproc_cwd);
@@ -518,6 +746,11 @@ void oci_conf_free(struct oci_conf *conf)
         if (conf->oc_hostname)
             free(conf->oc_hostname);
 
+        if (conf->oc_net.onet_bridge)
+            free(conf->oc_net.onet_bridge);
+        stringlist_cleaner(conf->oc_net.onet_bridge_addrs);
+        stringlist_cleaner(conf->oc_net.onet_addrs);
+
         LIST_CLEAN(&conf->oc_namespaces, ons_next, oci_namespace_free);
         LIST_CLEAN(&conf->oc_hooks.oehk_on_runtime_create, ohk_next, oci_hook_free);
         LIST_CLEAN(&conf->oc_hooks.oehk_on_container_created, ohk_next, oci_hook_free);
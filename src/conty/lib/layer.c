@@ -0,0 +1,558 @@
+#include "layer.h"
+
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+
+#include <json.h>
+
+#include <conty/conty.h>
+
+#include "log.h"
+#include "mount.h"
+#include "resource.h"
+#include "safestring.h"
+
+extern char **environ;
+
+/*
+ * Image indices may nest, e.g a multi-platform image saved as a layout
+ */
+#define LAYOUT_MAX_DEPTH 4
+
+#if defined(__x86_64__)
+#define LAYOUT_ARCH "amd64"
+#elif defined(__aarch64__)
+#define LAYOUT_ARCH "arm64"
+#elif defined(__i386__)
+#define LAYOUT_ARCH "386"
+#endif
+
+#define WHITEOUT_PREFIX ".wh."
+#define WHITEOUT_OPAQUE ".wh..wh..opq"
+
+static inline void json_object_cleaner(json_object *obj)
+{
+    json_object_put(obj);
+}
+
+CREATE_CLEANER(json_object *, json_object_cleaner);
+#define JSON_RESOURCE MAKE_RESOURCE(json_object_cleaner)
+
+/*
+ * Digests become path components, so only accept <algorithm>:<hex>
+ * and return the length of the algorithm
+ */
+static int digest_split(const char *digest)
+{
+    const char *cur, *hex;
+
+    if (!digest || strlen(digest) > CONTY_LAYER_DIGEST_MAX)
+        return -EINVAL;
+
+    if (!(hex = strchr(digest, ':')) || hex == digest || hex[1] == '\0')
+        return -EINVAL;
+
+    for (cur = digest; cur < hex; cur++) {
+        if (!((*cur >= 'a' && *cur <= 'z') || (*cur >= '0' && *cur <= '9')))
+            return -EINVAL;
+    }
+
+    for (cur = hex + 1; *cur; cur++) {
+        if (!((*cur >= 'a' && *cur <= 'f') || (*cur >= '0' && *cur <= '9')))
+            return -EINVAL;
+    }
+
+    return (int) (hex - digest);
+}
+
+static int digest_path(char *buf, size_t len, const char *dir, const char *digest)
+{
+    int algolen;
+
+    if ((algolen = digest_split(digest)) < 0)
+        return log_error_ret(algolen, "layer: invalid digest %s", digest ? digest : "");
+
+    if (strnprintf(buf, len, "%s/%.*s/%s", dir, algolen, digest, digest + algolen + 1) < 0)
+        return log_error_ret(-ENAMETOOLONG, "layer: path of %s too long", digest);
+
+    return 0;
+}
+
+static int mkdir_exist_ok(const char *path, mode_t mode)
+{
+    if (mkdir(path, mode) != 0 && errno != EEXIST)
+        return log_error_ret(-errno, "layer: cannot create %s", path);
+
+    return 0;
+}
+
+int conty_layer_store_init(struct conty_layer_store *store, const char *root)
+{
+    /*
+     * Layer paths end up in overlay mount options
+     */
+    if (strpbrk(root, ":,"))
+        return log_error_ret(-EINVAL, "layer: store path %s can't contain ':' or ','", root);
+
+    if (strnprintf(store->cls_root, sizeof(store->cls_root), "%s", root) < 0)
+        return log_error_ret(-ENAMETOOLONG, "layer: store path %s too long", root);
+
+    return 0;
+}
+
+int conty_layer_path(const struct conty_layer_store *store, const char *digest,
+                     char *buf, size_t len)
+{
+    char layers[PATH_MAX];
+
+    if (strnprintf(layers, sizeof(layers), "%s/layers", store->cls_root) < 0)
+        return -ENAMETOOLONG;
+
+    return digest_path(buf, len, layers, digest);
+}
+
+int conty_layer_present(const struct conty_layer_store *store, const char *digest)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+    int err;
+
+    if ((err = conty_layer_path(store, digest, path, sizeof(path))) != 0)
+        return err;
+
+    if (stat(path, &sb) != 0)
+        return (errno == ENOENT) ? 0 : log_error_ret(-errno, "layer: cannot stat %s", path);
+
+    return S_ISDIR(sb.st_mode);
+}
+
+/*
+ * Whether the descriptor of a manifest in an index applies to us,
+ * which also skips attestations that docker stores as unknown/unknown
+ */
+static int layout_platform_match(json_object *desc)
+{
+    json_object *platform, *obj;
+
+    if (!(platform = json_object_object_get(desc, "platform")))
+        return 1;
+
+    obj = json_object_object_get(platform, "os");
+    if (obj && strcmp(json_object_get_string(obj), "linux") != 0)
+        return 0;
+
+#ifdef LAYOUT_ARCH
+    obj = json_object_object_get(platform, "architecture");
+    if (obj && strcmp(json_object_get_string(obj), LAYOUT_ARCH) != 0)
+        return 0;
+#endif
+
+    return 1;
+}
+
+/*
+ * Walk from the index of the layout down to the manifest of the image
+ */
+static json_object *layout_manifest(const char *layout)
+{
+    char path[PATH_MAX], blobs[PATH_MAX];
+    JSON_RESOURCE json_object *cur = NULL;
+    json_object *manifests, *desc = NULL, *digest;
+    size_t i, len;
+
+    if (strnprintf(path, sizeof(path), "%s/index.json", layout) < 0 ||
+        strnprintf(blobs, sizeof(blobs), "%s/blobs", layout) < 0)
+        return log_error_ret(NULL, "layer: layout path %s too long", layout);
+
+    if (!(cur = json_object_from_file(path)))
+        return log_error_ret(NULL, "layer: cannot read %s", path);
+
+    for (int depth = 0; depth < LAYOUT_MAX_DEPTH; depth++) {
+        if (json_object_object_get(cur, "layers"))
+            return move_ptr(cur);
+
+        if (!(manifests = json_object_object_get(cur, "manifests")))
+            return log_error_ret(NULL, "layer: %s is neither an index nor a manifest", path);
+
+        len = json_object_array_length(manifests);
+        for (i = 0; i < len; i++) {
+            desc = json_object_array_get_idx(manifests, i);
+            if (layout_platform_match(desc))
+                break;
+        }
+
+        if (i == len)
+            return log_error_ret(NULL, "layer: no manifest for this platform in %s", path);
+
+        digest = json_object_object_get(desc, "digest");
+        if (!digest || digest_path(path, sizeof(path), blobs, json_object_get_string(digest)) != 0)
+            return NULL;
+
+        json_object_put(cur);
+        if (!(cur = json_object_from_file(path)))
+            return log_error_ret(NULL, "layer: cannot read %s", path);
+    }
+
+    return log_error_ret(NULL, "layer: indices of %s nested too deep", layout);
+}
+
+static int layer_convert_whiteout(const char *path, const struct stat *sb,
+                                  int type, struct FTW *ftw)
+{
+    const char *name = path + ftw->base;
+    char target[PATH_MAX];
+
+    if (type != FTW_F || strncmp(name, WHITEOUT_PREFIX, sizeof(WHITEOUT_PREFIX) - 1) != 0)
+        return 0;
+
+    if (!strcmp(name, WHITEOUT_OPAQUE)) {
+        /*
+         * The directory hides whatever the layers below have in it
+         */
+        if (strnprintf(target, sizeof(target), "%.*s", ftw->base - 1, path) < 0)
+            return -1;
+
+        if (setxattr(target, "trusted.overlay.opaque", "y", 1, 0) != 0)
+            return log_error_ret(-1, "layer: cannot make %s opaque: %s", target, strerror(errno));
+
+        /*
+         * Overlays mounted inside a user namespace look for the user variant
+         */
+        if (setxattr(target, "user.overlay.opaque", "y", 1, 0) != 0)
+            return log_error_ret(-1, "layer: cannot make %s opaque: %s", target, strerror(errno));
+    } else {
+        /*
+         * Overlayfs hides entries of lower layers behind 0/0 character devices
+         */
+        if (strnprintf(target, sizeof(target), "%.*s%s", ftw->base, path,
+                       name + sizeof(WHITEOUT_PREFIX) - 1) < 0)
+            return -1;
+
+        if (mknod(target, S_IFCHR, makedev(0, 0)) != 0)
+            return log_error_ret(-1, "layer: cannot create whiteout %s: %s", target, strerror(errno));
+    }
+
+    if (unlink(path) != 0)
+        return log_error_ret(-1, "layer: cannot remove %s: %s", path, strerror(errno));
+
+    return 0;
+}
+
+struct layer_job {
+    const char *lj_digest;
+    pid_t       lj_pid;
+    int         lj_pidfd;
+    char        lj_tmp[PATH_MAX];
+};
+
+/*
+ * Start unpacking a layer blob into a staging directory of the store.
+ * tar takes care of ownership, modes, extended attributes and
+ * of whatever compression the layer uses
+ */
+static int layer_spawn(const struct conty_layer_store *store, const char *layout,
+                       struct layer_job *job)
+{
+    char blobs[PATH_MAX], blob[PATH_MAX];
+    char *argv[] = {
+            "tar", "--extract", "--numeric-owner", "--xattrs", "--xattrs-include=*",
+            "--file", blob, "--directory", job->lj_tmp, NULL
+    };
+    int err;
+
+    if (strnprintf(blobs, sizeof(blobs), "%s/blobs", layout) < 0)
+        return log_error_ret(-ENAMETOOLONG, "layer: layout path %s too long", layout);
+
+    if ((err = digest_path(blob, sizeof(blob), blobs, job->lj_digest)) != 0)
+        return err;
+
+    if (strnprintf(job->lj_tmp, sizeof(job->lj_tmp), "%s/tmp/layer-XXXXXX", store->cls_root) < 0)
+        return log_error_ret(-ENAMETOOLONG, "layer: store path too long");
+
+    if (!mkdtemp(job->lj_tmp))
+        return log_error_ret(-errno, "layer: cannot create staging directory");
+
+    /*
+     * The directory becomes / of the containers, unless the layer says otherwise
+     */
+    if (chmod(job->lj_tmp, 0755) != 0) {
+        err = log_error_ret(-errno, "layer: cannot chmod %s", job->lj_tmp);
+        goto err_remove;
+    }
+
+    if ((err = posix_spawnp(&job->lj_pid, "tar", NULL, NULL, argv, environ)) != 0) {
+        err = log_error_ret(-err, "layer: cannot spawn tar for %s", job->lj_digest);
+        goto err_remove;
+    }
+
+    if ((job->lj_pidfd = pidfd_open(job->lj_pid, 0)) < 0) {
+        err = log_error_ret(-errno, "layer: cannot open pidfd of %d", job->lj_pid);
+        kill(job->lj_pid, SIGKILL);
+        waitpid(job->lj_pid, NULL, 0);
+        goto err_remove;
+    }
+
+    return 0;
+
+err_remove:
+    conty_rootfs_scratch_remove(job->lj_tmp);
+    return err;
+}
+
+static void layer_cancel(struct layer_job *job)
+{
+    kill(job->lj_pid, SIGKILL);
+    waitpid(job->lj_pid, NULL, 0);
+    close(job->lj_pidfd);
+    conty_rootfs_scratch_remove(job->lj_tmp);
+}
+
+/*
+ * Reap the tar process of a job and move the layer into the store
+ */
+static int layer_finish(const struct conty_layer_store *store, struct layer_job *job)
+{
+    char path[PATH_MAX], *algo;
+    int status, err;
+
+    close(job->lj_pidfd);
+    if (waitpid(job->lj_pid, &status, 0) < 0) {
+        err = log_error_ret(-errno, "layer: cannot reap tar for %s", job->lj_digest);
+        goto err_remove;
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        err = log_error_ret(-EIO, "layer: cannot unpack %s", job->lj_digest);
+        goto err_remove;
+    }
+
+    if (nftw(job->lj_tmp, layer_convert_whiteout, 16, FTW_PHYS | FTW_MOUNT) != 0) {
+        err = -EIO;
+        goto err_remove;
+    }
+
+    if ((err = conty_layer_path(store, job->lj_digest, path, sizeof(path))) != 0)
+        goto err_remove;
+
+    algo = strrchr(path, '/');
+    *algo = '\0';
+    if ((err = mkdir_exist_ok(path, 0755)) != 0)
+        goto err_remove;
+    *algo = '/';
+
+    if (rename(job->lj_tmp, path) != 0) {
+        /*
+         * Somebody else unpacked the same layer in the meantime
+         */
+        if (errno == EEXIST || errno == ENOTEMPTY) {
+            conty_rootfs_scratch_remove(job->lj_tmp);
+            return 0;
+        }
+
+        err = log_error_ret(-errno, "layer: cannot move %s into the store", job->lj_digest);
+        goto err_remove;
+    }
+
+    return 0;
+
+err_remove:
+    conty_rootfs_scratch_remove(job->lj_tmp);
+    return err;
+}
+
+static char **manifest_layers(json_object *manifest)
+{
+    STRINGLIST_RESOURCE char **layers = NULL;
+    json_object *arr, *digest;
+    size_t len;
+
+    arr = json_object_object_get(manifest, "layers");
+    if (!arr || (len = json_object_array_length(arr)) == 0)
+        return log_error_ret(NULL, "layer: image has no layers");
+
+    if (!(layers = calloc(len + 1, sizeof(char *))))
+        return log_fatal_ret(NULL, "layer: out of memory");
+
+    for (size_t i = 0; i < len; i++) {
+        digest = json_object_object_get(json_object_array_get_idx(arr, i), "digest");
+        if (!digest || digest_split(json_object_get_string(digest)) < 0)
+            return log_error_ret(NULL, "layer: invalid digest of layer %zu", i);
+
+        if (!(layers[i] = strdup(json_object_get_string(digest))))
+            return log_fatal_ret(NULL, "layer: out of memory");
+    }
+
+    return move_ptr(layers);
+}
+
+/*
+ * Whether an earlier layer of the same image has the same digest,
+ * e.g the empty layers some builders emit for metadata-only steps
+ */
+static int layer_seen(char *const *layers, size_t i)
+{
+    for (size_t j = 0; j < i; j++) {
+        if (!strcmp(layers[j], layers[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+int conty_layer_store_unpack(const struct conty_layer_store *store, const char *layout,
+                             char ***layers)
+{
+    JSON_RESOURCE json_object *manifest = NULL;
+    STRINGLIST_RESOURCE char **digests = NULL;
+    MEM_RESOURCE struct layer_job *jobs = NULL;
+    MEM_RESOURCE struct pollfd *pfds = NULL;
+    char path[PATH_MAX];
+    size_t len, next = 0, running = 0, max;
+    long ncpu;
+    int unpacked = 0, err = 0;
+
+    if (!(manifest = layout_manifest(layout)) || !(digests = manifest_layers(manifest)))
+        return -EINVAL;
+
+    for (len = 0; digests[len]; len++)
+        ;
+
+    if (strnprintf(path, sizeof(path), "%s/layers", store->cls_root) < 0)
+        return log_error_ret(-ENAMETOOLONG, "layer: store path too long");
+
+    /*
+     * Layers are lower directories of containers whose root may be mapped
+     * to another user, so everyone must be able to walk down to them.
+     * Only layers that are still being unpacked are kept private
+     */
+    if ((err = mkdir_exist_ok(store->cls_root, 0755)) != 0 ||
+        (err = mkdir_exist_ok(path, 0755)) != 0)
+        return err;
+
+    if (strnprintf(path, sizeof(path), "%s/tmp", store->cls_root) < 0 ||
+        (err = mkdir_exist_ok(path, 0700)) != 0)
+        return err ? err : -ENAMETOOLONG;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    max  = ncpu > 0 ? (size_t) ncpu : 1;
+
+    jobs = calloc(max, sizeof(*jobs));
+    pfds = calloc(max, sizeof(*pfds));
+    if (!jobs || !pfds)
+        return log_fatal_ret(-ENOMEM, "layer: out of memory");
+
+    while (next < len || running > 0) {
+        /*
+         * Keep every CPU busy decompressing with the layers that are missing,
+         * an image that shares most of its layers only pays for the rest
+         */
+        while (running < max && next < len) {
+            const char *digest = digests[next];
+
+            if (layer_seen(digests, next++))
+                continue;
+
+            if ((err = conty_layer_present(store, digest)) < 0)
+                goto err_cancel;
+            if (err == 1)
+                continue;
+
+            jobs[running].lj_digest = digest;
+            if ((err = layer_spawn(store, layout, &jobs[running])) != 0)
+                goto err_cancel;
+
+            running++;
+            unpacked++;
+        }
+
+        if (running == 0)
+            break;
+
+        for (size_t i = 0; i < running; i++) {
+            pfds[i].fd     = jobs[i].lj_pidfd;
+            pfds[i].events = POLLIN;
+        }
+
+        if (poll(pfds, running, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            err = log_error_ret(-errno, "layer: cannot wait for tar");
+            goto err_cancel;
+        }
+
+        for (size_t i = running; i-- > 0;) {
+            if (!pfds[i].revents)
+                continue;
+
+            err = layer_finish(store, &jobs[i]);
+            jobs[i] = jobs[--running];
+            if (err != 0)
+                goto err_cancel;
+        }
+    }
+
+    *layers = move_ptr(digests);
+
+    return unpacked;
+
+err_cancel:
+    while (running > 0)
+        layer_cancel(&jobs[--running]);
+
+    return err;
+}
+
+int conty_layer_lowerdir(const struct conty_layer_store *store, char *const *layers,
+                         char *buf, size_t len)
+{
+    char path[PATH_MAX];
+    size_t n, off = 0;
+    int err;
+
+    for (n = 0; layers[n]; n++)
+        ;
+
+    if (n == 0)
+        return log_error_ret(-EINVAL, "layer: no layers");
+
+    /*
+     * Overlayfs expects the topmost layer first. The options of a mount
+     * are limited to a page, which fits a few dozen layers
+     */
+    while (n-- > 0) {
+        if ((err = conty_layer_path(store, layers[n], path, sizeof(path))) != 0)
+            return err;
+
+        err = strnprintf(buf + off, len - off, "%s%s", off ? ":" : "", path);
+        if (err < 0)
+            return log_error_ret(-E2BIG, "layer: too many layers for one overlay");
+
+        off += (size_t) err;
+    }
+
+    return 0;
+}
+
+int conty_image_unpack(const char *store, const char *layout, char ***layers)
+{
+    struct conty_layer_store cls;
+    int err;
+
+    if ((err = conty_layer_store_init(&cls, store)) != 0)
+        return err;
+
+    return conty_layer_store_unpack(&cls, layout, layers);
+}
@@ -0,0 +1,63 @@
+#ifndef CONTY_LAYER_H
+#define CONTY_LAYER_H
+
+#include <limits.h>
+#include <stddef.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/*
+ * Longest digest we accept, i.e sha512:<128 hex digits>
+ */
+#define CONTY_LAYER_DIGEST_MAX 135
+
+/*
+ * Content-addressed store of unpacked image layers
+ *
+ * Every layer is unpacked exactly once into <root>/layers/<algorithm>/<hex>,
+ * with its whiteouts already converted into the format overlayfs understands,
+ * and is then shared as a read-only lower layer by every image and container
+ * that references it. Layers are staged under <root>/tmp and renamed into
+ * place once complete, so a directory under layers is never partial
+ */
+struct conty_layer_store {
+    char cls_root[PATH_MAX];
+};
+
+/*
+ * Initialise the store at root, its directories are created by the first unpack
+ */
+int conty_layer_store_init(struct conty_layer_store *store, const char *root);
+
+/*
+ * Construct the path of the layer with the given digest,
+ * failing with -EINVAL if the digest is malformed
+ */
+int conty_layer_path(const struct conty_layer_store *store, const char *digest,
+                     char *buf, size_t len);
+
+/*
+ * Returns 1 if the layer has been unpacked, 0 if not or a negative error
+ */
+int conty_layer_present(const struct conty_layer_store *store, const char *digest);
+
+/*
+ * Unpack the layers of the image in the OCI image layout at layout that
+ * aren't in the store yet, up to one layer per CPU at a time.
+ *
+ * On success, layers holds the digests of all of the image's layers from the
+ * bottom to the top, and the number of layers that had to be unpacked is returned
+ */
+int conty_layer_store_unpack(const struct conty_layer_store *store, const char *layout,
+                             char ***layers);
+
+/*
+ * Construct the overlay lowerdir option for the given layers,
+ * which are ordered from the bottom to the top
+ */
+int conty_layer_lowerdir(const struct conty_layer_store *store, char *const *layers,
+                         char *buf, size_t len);
+
+#endif //CONTY_LAYER_H
@@ -0,0 +1,915 @@
+#include "lazy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fuse.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+
+#include "log.h"
+#include "resource.h"
+#include "safestring.h"
+
+#define TAR_BLOCK 512
+/*
+ * Bound for GNU long names and pax records, anything larger is garbage
+ */
+#define TAR_META_MAX (1 << 20)
+
+/*
+ * The archive never changes, so the kernel may cache entries and attributes
+ * for as long as it likes. Pick something long rather than forever
+ */
+#define LAZY_TIMEOUT 3600
+#define LAZY_MAX_PAGES 32
+#define LAZY_RX_SIZE (FUSE_MIN_READ_BUFFER + 4096)
+/*
+ * Offset of a directory stream past its last entry
+ */
+#define LAZY_DIR_END ((uint64_t) INT64_MAX)
+
+struct tar_header {
+    char th_name[100];
+    char th_mode[8];
+    char th_uid[8];
+    char th_gid[8];
+    char th_size[12];
+    char th_mtime[12];
+    char th_chksum[8];
+    char th_type;
+    char th_link[100];
+    char th_magic[6];
+    char th_version[2];
+    char th_uname[32];
+    char th_gname[32];
+    char th_devmajor[8];
+    char th_devminor[8];
+    char th_prefix[155];
+    char th_pad[12];
+};
+
+static uint64_t tar_num(const char *field, size_t len)
+{
+    uint64_t num = 0;
+    size_t i = 0;
+
+    /*
+     * GNU tar stores numbers that don't fit in octal as base-256
+     */
+    if (*field & 0x80) {
+        num = (unsigned char) *field & 0x3f;
+        for (i = 1; i < len; i++)
+            num = (num << 8) | (unsigned char) field[i];
+        return num;
+    }
+
+    while (i < len && field[i] == ' ')
+        i++;
+
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        num = (num << 3) | (uint64_t) (field[i] - '0');
+
+    return num;
+}
+
+static int tar_checksum_ok(const struct tar_header *hdr)
+{
+    const unsigned char *cur = (const unsigned char *) hdr;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < TAR_BLOCK; i++) {
+        if (i >= offsetof(struct tar_header, th_chksum) &&
+            i < offsetof(struct tar_header, th_type))
+            sum += ' ';
+        else
+            sum += cur[i];
+    }
+
+    return sum == tar_num(hdr->th_chksum, sizeof(hdr->th_chksum));
+}
+
+static int tar_is_end(const struct tar_header *hdr)
+{
+    const char *cur = (const char *) hdr;
+
+    for (size_t i = 0; i < TAR_BLOCK; i++) {
+        if (cur[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+static inline uint32_t toc_hash(uint32_t parent, const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < 4; i++) {
+        hash ^= (parent >> (i * 8)) & 0xff;
+        hash *= 16777619u;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void toc_slot_insert(struct conty_lazy_toc *toc, uint32_t id)
+{
+    const struct conty_lazy_node *node = &toc->lt_nodes[id];
+    uint32_t i = toc_hash(node->ln_parent, node->ln_name, strlen(node->ln_name));
+
+    for (i &= toc->lt_mask; toc->lt_slots[i]; i = (i + 1) & toc->lt_mask)
+        ;
+
+    toc->lt_slots[i] = id;
+}
+
+static int toc_grow(struct conty_lazy_toc *toc)
+{
+    struct conty_lazy_node *nodes;
+    uint32_t *slots, mask;
+
+    if (toc->lt_len == toc->lt_cap) {
+        nodes = realloc(toc->lt_nodes, 2 * toc->lt_cap * sizeof(*nodes));
+        if (!nodes)
+            return -ENOMEM;
+
+        toc->lt_nodes = nodes;
+        toc->lt_cap <<= 1;
+    }
+
+    /*
+     * Keep the table at most half full, lookups stay short
+     */
+    if (2 * (toc->lt_len + 1) > toc->lt_mask + 1) {
+        mask = (toc->lt_mask << 1) | 1;
+        if (!(slots = calloc((size_t) mask + 1, sizeof(*slots))))
+            return -ENOMEM;
+
+        free(toc->lt_slots);
+        toc->lt_slots = slots;
+        toc->lt_mask  = mask;
+
+        for (uint32_t id = CONTY_LAZY_ROOT + 1; id < toc->lt_len; id++)
+            toc_slot_insert(toc, id);
+    }
+
+    return 0;
+}
+
+static int toc_add(struct conty_lazy_toc *toc, uint32_t parent, const char *name,
+                   size_t len, uint32_t *id)
+{
+    struct conty_lazy_node *node;
+
+    if (toc_grow(toc) != 0)
+        return -ENOMEM;
+
+    *id  = toc->lt_len;
+    node = &toc->lt_nodes[*id];
+    memset(node, 0, sizeof(*node));
+
+    if (!(node->ln_name = strndup(name, len)))
+        return -ENOMEM;
+
+    /*
+     * Directories that the archive only implies
+     */
+    node->ln_mode    = S_IFDIR | 0755;
+    node->ln_parent  = parent;
+    node->ln_sibling = toc->lt_nodes[parent].ln_child;
+
+    toc->lt_nodes[parent].ln_child = *id;
+    toc->lt_len++;
+    toc_slot_insert(toc, *id);
+
+    return 0;
+}
+
+uint32_t conty_lazy_toc_lookup(const struct conty_lazy_toc *toc, uint32_t parent,
+                               const char *name, size_t len)
+{
+    const struct conty_lazy_node *node;
+    uint32_t i, id;
+
+    for (i = toc_hash(parent, name, len) & toc->lt_mask;; i = (i + 1) & toc->lt_mask) {
+        if (!(id = toc->lt_slots[i]))
+            return 0;
+
+        node = &toc->lt_nodes[id];
+        if (node->ln_parent == parent && !strncmp(node->ln_name, name, len) &&
+            node->ln_name[len] == '\0')
+            return id;
+    }
+}
+
+/*
+ * Resolve a path of the archive, optionally creating what's missing
+ */
+static int toc_path(struct conty_lazy_toc *toc, const char *path, int create, uint32_t *id)
+{
+    uint32_t cur = CONTY_LAZY_ROOT, next;
+    const char *end;
+    size_t len;
+    int err;
+
+    for (;;) {
+        while (*path == '/')
+            path++;
+
+        if (!*path) {
+            *id = cur;
+            return 0;
+        }
+
+        end = strchrnul(path, '/');
+        len = (size_t) (end - path);
+
+        if (len == 1 && path[0] == '.') {
+            path = end;
+            continue;
+        }
+
+        if (len == 2 && path[0] == '.' && path[1] == '.')
+            return -EINVAL;
+
+        if (!(next = conty_lazy_toc_lookup(toc, cur, path, len))) {
+            if (!create)
+                return -ENOENT;
+
+            if ((err = toc_add(toc, cur, path, len, &next)) != 0)
+                return err;
+        }
+
+        if (*end && !S_ISDIR(toc->lt_nodes[next].ln_mode))
+            return -ENOTDIR;
+
+        cur  = next;
+        path = end;
+    }
+}
+
+static int toc_entry(struct conty_lazy_toc *toc, const struct tar_header *hdr,
+                     const char *name, const char *link, off_t size, off_t data)
+{
+    struct conty_lazy_node *node, *target;
+    uint32_t id, target_id = 0;
+    mode_t type;
+    char *tmp;
+    int err;
+
+    switch (hdr->th_type) {
+    case '0':
+    case '\0':
+    case '7':
+        type = S_IFREG;
+        break;
+    case '1':
+        type = 0;
+        break;
+    case '2':
+        type = S_IFLNK;
+        break;
+    case '3':
+        type = S_IFCHR;
+        break;
+    case '4':
+        type = S_IFBLK;
+        break;
+    case '5':
+        type = S_IFDIR;
+        break;
+    case '6':
+        type = S_IFIFO;
+        break;
+    default:
+        LOG_WARN("lazy: skipping %s of type %c", name, hdr->th_type);
+        return 0;
+    }
+
+    /*
+     * Hard links share the contents of their target, but get their own inode
+     */
+    if (!type && (err = toc_path(toc, link, 0, &target_id)) != 0) {
+        if (err == -ENOMEM)
+            return err;
+
+        LOG_WARN("lazy: skipping hard link %s to %s", name, link);
+        return 0;
+    }
+
+    if ((err = toc_path(toc, name, 1, &id)) != 0) {
+        if (err == -ENOMEM)
+            return err;
+
+        LOG_WARN("lazy: skipping %s", name);
+        return 0;
+    }
+
+    node = &toc->lt_nodes[id];
+    if ((id == CONTY_LAZY_ROOT && type != S_IFDIR) || id == target_id)
+        return 0;
+
+    free(node->ln_link);
+    node->ln_link = NULL;
+
+    if (!type) {
+        target = &toc->lt_nodes[target_id];
+        tmp    = target->ln_link;
+
+        node->ln_mode  = target->ln_mode;
+        node->ln_uid   = target->ln_uid;
+        node->ln_gid   = target->ln_gid;
+        node->ln_rdev  = target->ln_rdev;
+        node->ln_mtime = target->ln_mtime;
+        node->ln_size  = target->ln_size;
+        node->ln_data  = target->ln_data;
+    } else {
+        tmp = (type == S_IFLNK) ? (char *) link : NULL;
+
+        node->ln_mode  = type | ((mode_t) tar_num(hdr->th_mode, sizeof(hdr->th_mode)) & 07777);
+        node->ln_uid   = (uid_t) tar_num(hdr->th_uid, sizeof(hdr->th_uid));
+        node->ln_gid   = (gid_t) tar_num(hdr->th_gid, sizeof(hdr->th_gid));
+        node->ln_mtime = (time_t) tar_num(hdr->th_mtime, sizeof(hdr->th_mtime));
+        node->ln_rdev  = makedev(tar_num(hdr->th_devmajor, sizeof(hdr->th_devmajor)),
+                                 tar_num(hdr->th_devminor, sizeof(hdr->th_devminor)));
+        node->ln_size  = (type == S_IFREG) ? size : 0;
+        node->ln_data  = data;
+    }
+
+    if (tmp) {
+        if (!(node->ln_link = strdup(tmp)))
+            return -ENOMEM;
+
+        node->ln_size = (off_t) strlen(tmp);
+    }
+
+    return 0;
+}
+
+static char *tar_read_meta(int fd, off_t off, uint64_t size)
+{
+    char *buf;
+
+    if (size > TAR_META_MAX)
+        return log_error_ret(NULL, "lazy: metadata entry of %llu bytes", (unsigned long long) size);
+
+    if (!(buf = malloc(size + 1)))
+        return log_fatal_ret(NULL, "lazy: out of memory");
+
+    if (pread(fd, buf, size, off) != (ssize_t) size) {
+        free(buf);
+        return log_error_ret(NULL, "lazy: truncated archive");
+    }
+
+    buf[size] = '\0';
+    return buf;
+}
+
+/*
+ * Pick the path, link target and size out of the records of a pax header,
+ * which look like "<length> <key>=<value>\n"
+ */
+static int pax_parse(char *buf, size_t len, char **path, char **link, int64_t *size)
+{
+    char *cur = buf, *end = buf + len, *key, *val, *next;
+    unsigned long reclen;
+
+    while (cur < end && *cur) {
+        reclen = strtoul(cur, &key, 10);
+        if (key == cur || *key != ' ' || reclen == 0 || reclen > (size_t) (end - cur))
+            return log_error_ret(-EINVAL, "lazy: invalid pax record");
+
+        next = cur + reclen;
+        key++;
+        if (next[-1] != '\n' || !(val = memchr(key, '=', (size_t) (next - key))))
+            return log_error_ret(-EINVAL, "lazy: invalid pax record");
+
+        *val++ = '\0';
+        next[-1] = '\0';
+
+        if (!strcmp(key, "path")) {
+            free(*path);
+            if (!(*path = strdup(val)))
+                return -ENOMEM;
+        } else if (!strcmp(key, "linkpath")) {
+            free(*link);
+            if (!(*link = strdup(val)))
+                return -ENOMEM;
+        } else if (!strcmp(key, "size")) {
+            *size = strtoll(val, NULL, 10);
+        }
+
+        cur = next;
+    }
+
+    return 0;
+}
+
+int conty_lazy_toc_build(struct conty_lazy_toc *toc, int archivefd)
+{
+    struct tar_header hdr;
+    char *longname = NULL, *longlink = NULL, *meta;
+    char name[sizeof(hdr.th_prefix) + sizeof(hdr.th_name) + 2];
+    char link[sizeof(hdr.th_link) + 1];
+    int64_t paxsize = -1;
+    uint64_t size;
+    off_t off = 0, data;
+    ssize_t rx;
+    int err = 0;
+
+    memset(toc, 0, sizeof(*toc));
+    toc->lt_cap   = 64;
+    toc->lt_mask  = 127;
+    toc->lt_nodes = calloc(toc->lt_cap, sizeof(*toc->lt_nodes));
+    toc->lt_slots = calloc(toc->lt_mask + 1, sizeof(*toc->lt_slots));
+    if (!toc->lt_nodes || !toc->lt_slots) {
+        conty_lazy_toc_free(toc);
+        return log_fatal_ret(-ENOMEM, "lazy: out of memory");
+    }
+
+    /*
+     * Node 0 terminates lists, the root is FUSE's root node
+     */
+    toc->lt_nodes[CONTY_LAZY_ROOT].ln_mode = S_IFDIR | 0755;
+    toc->lt_nodes[CONTY_LAZY_ROOT].ln_name = strdup("");
+    toc->lt_len = CONTY_LAZY_ROOT + 1;
+
+    for (;;) {
+        /*
+         * Only headers are read, contents are skipped over
+         */
+        rx = pread(archivefd, &hdr, TAR_BLOCK, off);
+        if (rx == 0 || (rx == TAR_BLOCK && tar_is_end(&hdr)))
+            break;
+
+        if (rx != TAR_BLOCK || !tar_checksum_ok(&hdr)) {
+            err = log_error_ret(-EINVAL, "lazy: invalid tar header at %lld", (long long) off);
+            goto out;
+        }
+
+        size = tar_num(hdr.th_size, sizeof(hdr.th_size));
+        data = off + TAR_BLOCK;
+
+        switch (hdr.th_type) {
+        case 'L':
+        case 'K':
+            if (!(meta = tar_read_meta(archivefd, data, size))) {
+                err = -EINVAL;
+                goto out;
+            }
+
+            if (hdr.th_type == 'L') {
+                free(longname);
+                longname = meta;
+            } else {
+                free(longlink);
+                longlink = meta;
+            }
+            break;
+        case 'x':
+            if (!(meta = tar_read_meta(archivefd, data, size))) {
+                err = -EINVAL;
+                goto out;
+            }
+
+            err = pax_parse(meta, size, &longname, &longlink, &paxsize);
+            free(meta);
+            if (err != 0)
+                goto out;
+            break;
+        case 'g':
+            break;
+        default:
+            if (paxsize >= 0)
+                size = (uint64_t) paxsize;
+
+            if (!longname && hdr.th_prefix[0] && !memcmp(hdr.th_magic, "ustar", 5))
+                snprintf(name, sizeof(name), "%.155s/%.100s", hdr.th_prefix, hdr.th_name);
+            else
+                snprintf(name, sizeof(name), "%.100s", hdr.th_name);
+            snprintf(link, sizeof(link), "%.100s", hdr.th_link);
+
+            err = toc_entry(toc, &hdr, longname ? longname : name,
+                            longlink ? longlink : link, (off_t) size, data);
+            if (err != 0) {
+                LOG_FATAL("lazy: out of memory");
+                goto out;
+            }
+
+            free(longname);
+            free(longlink);
+            longname = longlink = NULL;
+            paxsize  = -1;
+
+            /*
+             * Hard links, directories and the like have no contents
+             */
+            if (hdr.th_type != '\0' && strchr("123456", hdr.th_type))
+                size = 0;
+        }
+
+        off = data + (off_t) ((size + TAR_BLOCK - 1) & ~((uint64_t) TAR_BLOCK - 1));
+    }
+
+out:
+    free(longname);
+    free(longlink);
+    if (err != 0)
+        conty_lazy_toc_free(toc);
+
+    return err;
+}
+
+void conty_lazy_toc_free(struct conty_lazy_toc *toc)
+{
+    if (toc->lt_nodes) {
+        for (uint32_t id = CONTY_LAZY_ROOT; id < toc->lt_len; id++) {
+            free(toc->lt_nodes[id].ln_name);
+            free(toc->lt_nodes[id].ln_link);
+        }
+    }
+
+    free(toc->lt_nodes);
+    free(toc->lt_slots);
+    memset(toc, 0, sizeof(*toc));
+}
+
+struct lazy_server {
+    struct conty_lazy_toc ls_toc;
+    int                   ls_fusefd;
+    int                   ls_archivefd;
+    uid_t                 ls_uid;
+    gid_t                 ls_gid;
+    /*
+     * Buffers for requests and replies, allocated before forking
+     * so that serving requests never allocates
+     */
+    char                 *ls_rx;
+    char                 *ls_tx;
+    size_t                ls_txcap;
+};
+
+static void lazy_reply(const struct lazy_server *ls, const struct fuse_in_header *in,
+                       int error, const void *data, size_t len)
+{
+    struct fuse_out_header out = {
+            .len    = (uint32_t) (sizeof(out) + (error ? 0 : len)),
+            .error  = error,
+            .unique = in->unique,
+    };
+    struct iovec iov[2] = {
+            { .iov_base = &out, .iov_len = sizeof(out) },
+            { .iov_base = (void *) data, .iov_len = len },
+    };
+
+    /*
+     * The kernel only fails this if the request was interrupted
+     * or the filesystem is gone, neither of which we can do anything about
+     */
+    if (writev(ls->ls_fusefd, iov, (error || !len) ? 1 : 2) < 0 && errno != ENOENT)
+        LOG_WARN("lazy: cannot reply to request %llu", (unsigned long long) in->unique);
+}
+
+static void lazy_attr(const struct lazy_server *ls, uint32_t id, struct fuse_attr *attr)
+{
+    const struct conty_lazy_node *node = &ls->ls_toc.lt_nodes[id];
+
+    memset(attr, 0, sizeof(*attr));
+    attr->ino     = id;
+    attr->size    = (uint64_t) node->ln_size;
+    attr->blocks  = (attr->size + 511) / 512;
+    attr->atime   = (uint64_t) node->ln_mtime;
+    attr->mtime   = (uint64_t) node->ln_mtime;
+    attr->ctime   = (uint64_t) node->ln_mtime;
+    attr->mode    = node->ln_mode;
+    attr->nlink   = S_ISDIR(node->ln_mode) ? 2 : 1;
+    attr->uid     = node->ln_uid + ls->ls_uid;
+    attr->gid     = node->ln_gid + ls->ls_gid;
+    attr->rdev    = (uint32_t) node->ln_rdev;
+    attr->blksize = 4096;
+}
+
+static void lazy_lookup(const struct lazy_server *ls, const struct fuse_in_header *in,
+                        const char *name)
+{
+    struct fuse_entry_out out = {
+            .entry_valid = LAZY_TIMEOUT,
+            .attr_valid  = LAZY_TIMEOUT,
+    };
+
+    /*
+     * A zero node identifier caches the miss too, which saves
+     * the round trips of the dynamic linker probing for libraries
+     */
+    out.nodeid = conty_lazy_toc_lookup(&ls->ls_toc, (uint32_t) in->nodeid, name, strlen(name));
+    if (out.nodeid)
+        lazy_attr(ls, (uint32_t) out.nodeid, &out.attr);
+
+    lazy_reply(ls, in, 0, &out, sizeof(out));
+}
+
+static void lazy_read(const struct lazy_server *ls, const struct fuse_in_header *in,
+                      const struct fuse_read_in *rd)
+{
+    const struct conty_lazy_node *node = &ls->ls_toc.lt_nodes[in->nodeid];
+    size_t len = rd->size;
+    ssize_t rx;
+
+    if (!S_ISREG(node->ln_mode))
+        return lazy_reply(ls, in, -EINVAL, NULL, 0);
+
+    if ((off_t) rd->offset >= node->ln_size)
+        return lazy_reply(ls, in, 0, NULL, 0);
+
+    if ((off_t) len > node->ln_size - (off_t) rd->offset)
+        len = (size_t) (node->ln_size - (off_t) rd->offset);
+    if (len > ls->ls_txcap)
+        len = ls->ls_txcap;
+
+    /*
+     * This is where the contents are fetched, on first access only,
+     * afterwards the page cache of the file serves them
+     */
+    rx = pread(ls->ls_archivefd, ls->ls_tx, len, node->ln_data + (off_t) rd->offset);
+    if (rx < 0)
+        return lazy_reply(ls, in, -errno, NULL, 0);
+
+    lazy_reply(ls, in, 0, ls->ls_tx, (size_t) rx);
+}
+
+/*
+ * Offsets 0 and 1 are . and .., past them the offset
+ * of an entry is its node identifier plus 2
+ */
+static void lazy_readdir(const struct lazy_server *ls, const struct fuse_in_header *in,
+                         const struct fuse_read_in *rd)
+{
+    const struct conty_lazy_node *nodes = ls->ls_toc.lt_nodes, *dir = &nodes[in->nodeid];
+    struct fuse_dirent *dirent;
+    const char *name;
+    size_t len = 0, cap = rd->size < ls->ls_txcap ? rd->size : ls->ls_txcap, namelen, entlen;
+    uint64_t off = rd->offset, next, ino;
+    uint32_t id;
+
+    if (!S_ISDIR(dir->ln_mode))
+        return lazy_reply(ls, in, -ENOTDIR, NULL, 0);
+
+    while (off != LAZY_DIR_END) {
+        if (off == 0) {
+            name = ".";
+            ino  = in->nodeid;
+            next = 1;
+        } else if (off == 1) {
+            name = "..";
+            ino  = dir->ln_parent ? dir->ln_parent : CONTY_LAZY_ROOT;
+            next = dir->ln_child ? dir->ln_child + 2 : LAZY_DIR_END;
+        } else {
+            id = (uint32_t) (off - 2);
+            if (off - 2 >= ls->ls_toc.lt_len || nodes[id].ln_parent != in->nodeid)
+                break;
+
+            name = nodes[id].ln_name;
+            ino  = id;
+            next = nodes[id].ln_sibling ? nodes[id].ln_sibling + 2 : LAZY_DIR_END;
+        }
+
+        namelen = strlen(name);
+        entlen  = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+        if (len + entlen > cap)
+            break;
+
+        dirent = (struct fuse_dirent *) (ls->ls_tx + len);
+        dirent->ino     = ino;
+        dirent->off     = next;
+        dirent->namelen = (uint32_t) namelen;
+        dirent->type    = (nodes[ino].ln_mode & S_IFMT) >> 12;
+        memcpy(dirent->name, name, namelen);
+        memset(dirent->name + namelen, 0, entlen - FUSE_NAME_OFFSET - namelen);
+
+        len += entlen;
+        off  = next;
+    }
+
+    lazy_reply(ls, in, 0, ls->ls_tx, len);
+}
+
+/*
+ * Returns 1 once the kernel tells us to shut down
+ */
+static int lazy_handle(const struct lazy_server *ls, const struct fuse_in_header *in,
+                       const void *arg)
+{
+    const struct conty_lazy_node *node;
+
+    if (in->opcode != FUSE_INIT && (in->nodeid == 0 || in->nodeid >= ls->ls_toc.lt_len)) {
+        lazy_reply(ls, in, -ENOENT, NULL, 0);
+        return 0;
+    }
+
+    node = &ls->ls_toc.lt_nodes[in->nodeid];
+
+    switch (in->opcode) {
+    case FUSE_INIT: {
+        const struct fuse_init_in *init = arg;
+        struct fuse_init_out out = {
+                .major         = FUSE_KERNEL_VERSION,
+                .minor         = FUSE_KERNEL_MINOR_VERSION,
+                .max_readahead = init->max_readahead,
+                .max_write     = 4096,
+                .max_pages     = LAZY_MAX_PAGES,
+                .flags         = init->flags & (FUSE_ASYNC_READ | FUSE_CACHE_SYMLINKS |
+                                                FUSE_MAX_PAGES | FUSE_PARALLEL_DIROPS),
+        };
+
+        lazy_reply(ls, in, 0, &out, sizeof(out));
+        break;
+    }
+    case FUSE_LOOKUP:
+        lazy_lookup(ls, in, arg);
+        break;
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+        /*
+         * Nodes live as long as the table of contents, nothing to forget
+         */
+        break;
+    case FUSE_GETATTR: {
+        struct fuse_attr_out out = { .attr_valid = LAZY_TIMEOUT };
+
+        lazy_attr(ls, (uint32_t) in->nodeid, &out.attr);
+        lazy_reply(ls, in, 0, &out, sizeof(out));
+        break;
+    }
+    case FUSE_OPEN:
+    case FUSE_OPENDIR: {
+        const struct fuse_open_in *open_in = arg;
+        struct fuse_open_out out = { .open_flags = FOPEN_KEEP_CACHE };
+
+        if ((open_in->flags & O_ACCMODE) != O_RDONLY)
+            lazy_reply(ls, in, -EROFS, NULL, 0);
+        else
+            lazy_reply(ls, in, 0, &out, sizeof(out));
+        break;
+    }
+    case FUSE_READ:
+        lazy_read(ls, in, arg);
+        break;
+    case FUSE_READDIR:
+        lazy_readdir(ls, in, arg);
+        break;
+    case FUSE_READLINK:
+        if (!node->ln_link)
+            lazy_reply(ls, in, -EINVAL, NULL, 0);
+        else
+            lazy_reply(ls, in, 0, node->ln_link, strlen(node->ln_link));
+        break;
+    case FUSE_STATFS: {
+        struct fuse_statfs_out out = {
+                .st = {
+                        .bsize   = 4096,
+                        .frsize  = 4096,
+                        .namelen = 255,
+                        .files   = ls->ls_toc.lt_len,
+                }
+        };
+
+        lazy_reply(ls, in, 0, &out, sizeof(out));
+        break;
+    }
+    case FUSE_RELEASE:
+    case FUSE_RELEASEDIR:
+    case FUSE_FLUSH:
+        lazy_reply(ls, in, 0, NULL, 0);
+        break;
+    case FUSE_DESTROY:
+        lazy_reply(ls, in, 0, NULL, 0);
+        return 1;
+    default:
+        lazy_reply(ls, in, -ENOSYS, NULL, 0);
+    }
+
+    return 0;
+}
+
+static int lazy_serve(const struct lazy_server *ls)
+{
+    const struct fuse_in_header *in = (const struct fuse_in_header *) ls->ls_rx;
+    ssize_t rx;
+
+    for (;;) {
+        rx = read(ls->ls_fusefd, ls->ls_rx, LAZY_RX_SIZE);
+        if (rx < 0) {
+            /*
+             * ENODEV means that the filesystem has been unmounted,
+             * i.e the container is gone
+             */
+            if (errno == EINTR || errno == EAGAIN || errno == ENOENT)
+                continue;
+
+            return (errno == ENODEV) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if ((size_t) rx < sizeof(*in))
+            continue;
+
+        if (lazy_handle(ls, in, in + 1))
+            return EXIT_SUCCESS;
+    }
+}
+
+/*
+ * The server is forked from the runtime and must not keep
+ * other containers' descriptors, e.g their synchronisation sockets, alive
+ */
+static void lazy_close_fds(int a, int b)
+{
+    int lo = a < b ? a : b, hi = a < b ? b : a;
+
+    if (lo > 3)
+        close_range(3, (unsigned int) lo - 1, 0);
+    if (hi > lo + 1)
+        close_range((unsigned int) lo + 1, (unsigned int) hi - 1, 0);
+    close_range((unsigned int) hi + 1, ~0U, 0);
+}
+
+pid_t conty_lazy_mount(const char *archive, const char *dst, uid_t uid, gid_t gid)
+{
+    struct lazy_server ls = {
+            .ls_fusefd    = -EBADF,
+            .ls_archivefd = -EBADF,
+            .ls_uid       = (uid == (uid_t) -1) ? 0 : uid,
+            .ls_gid       = (gid == (gid_t) -1) ? 0 : gid,
+    };
+    char opts[128];
+    pid_t pid;
+    int err;
+
+    if ((ls.ls_archivefd = open(archive, O_RDONLY | O_CLOEXEC)) < 0)
+        return log_error_ret(-errno, "lazy: cannot open %s", archive);
+
+    if ((err = conty_lazy_toc_build(&ls.ls_toc, ls.ls_archivefd)) != 0) {
+        close(ls.ls_archivefd);
+        return err;
+    }
+
+    ls.ls_txcap = LAZY_MAX_PAGES * (size_t) sysconf(_SC_PAGESIZE);
+    ls.ls_rx    = malloc(LAZY_RX_SIZE);
+    ls.ls_tx    = malloc(ls.ls_txcap);
+    if (!ls.ls_rx || !ls.ls_tx) {
+        err = log_fatal_ret(-ENOMEM, "lazy: out of memory");
+        goto out;
+    }
+
+    if ((ls.ls_fusefd = open("/dev/fuse", O_RDWR | O_CLOEXEC)) < 0) {
+        err = log_error_ret(-errno, "lazy: cannot open /dev/fuse");
+        goto out;
+    }
+
+    err = strnprintf(opts, sizeof(opts),
+                     "fd=%d,rootmode=%o,user_id=0,group_id=0,allow_other,default_permissions",
+                     ls.ls_fusefd, S_IFDIR);
+    if (err < 0)
+        goto out;
+
+    if (mount(archive, dst, "fuse", MS_RDONLY, opts) != 0) {
+        err = log_error_ret(-errno, "lazy: cannot mount %s at %s", archive, dst);
+        goto out;
+    }
+
+    if ((pid = fork()) < 0) {
+        err = log_error_ret(-errno, "lazy: cannot fork server for %s", archive);
+        umount2(dst, MNT_DETACH);
+        goto out;
+    }
+
+    if (pid == 0) {
+        prctl(PR_SET_NAME, "conty-lazy");
+        lazy_close_fds(ls.ls_fusefd, ls.ls_archivefd);
+        _exit(lazy_serve(&ls));
+    }
+
+    err = pid;
+
+out:
+    conty_lazy_toc_free(&ls.ls_toc);
+    free(ls.ls_rx);
+    free(ls.ls_tx);
+    if (ls.ls_fusefd >= 0)
+        close(ls.ls_fusefd);
+    close(ls.ls_archivefd);
+
+    return err;
+}
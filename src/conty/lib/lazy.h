@@ -0,0 +1,72 @@
+#ifndef CONTY_LAZY_H
+#define CONTY_LAZY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Entry of the table of contents of a tar archive.
+ * Entries are identified by their index, which doubles as their inode number
+ */
+struct conty_lazy_node {
+    char     *ln_name;
+    char     *ln_link;
+    uint32_t  ln_parent;
+    /*
+     * First child and next sibling, 0 terminates the list
+     */
+    uint32_t  ln_child;
+    uint32_t  ln_sibling;
+    mode_t    ln_mode;
+    uid_t     ln_uid;
+    gid_t     ln_gid;
+    dev_t     ln_rdev;
+    time_t    ln_mtime;
+    off_t     ln_size;
+    /*
+     * Offset of the contents of a regular file in the archive
+     */
+    off_t     ln_data;
+};
+
+/*
+ * Table of contents of a tar archive, built by reading its headers only
+ */
+struct conty_lazy_toc {
+    struct conty_lazy_node *lt_nodes;
+    uint32_t                lt_len;
+    uint32_t                lt_cap;
+    /*
+     * Open addressing table from (parent, name) to node
+     */
+    uint32_t               *lt_slots;
+    uint32_t                lt_mask;
+};
+
+#define CONTY_LAZY_ROOT 1
+
+int conty_lazy_toc_build(struct conty_lazy_toc *toc, int archivefd);
+
+/*
+ * Returns the child of parent called name, 0 if there's no such child
+ */
+uint32_t conty_lazy_toc_lookup(const struct conty_lazy_toc *toc, uint32_t parent,
+                               const char *name, size_t len);
+
+void conty_lazy_toc_free(struct conty_lazy_toc *toc);
+
+/*
+ * Mount the uncompressed tar archive at archive read-only at dst.
+ * Only the headers of the archive are read up front, the contents of a file
+ * are read from the archive when the file is, so the mount is ready in time
+ * proportional to the number of entries rather than the size of the archive.
+ *
+ * Requests are served by a child process that exits once the filesystem goes
+ * away. Ownership of the entries is shifted by uid and gid, the host
+ * identifiers of the container's root, unless they are -1.
+ *
+ * Returns the identifier of the child process
+ */
+pid_t conty_lazy_mount(const char *archive, const char *dst, uid_t uid, gid_t gid);
+
+#endif //CONTY_LAZY_H
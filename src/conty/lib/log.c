@@ -1,5 +1,20 @@
 #include "log.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/uio.h>
+
+#include "ring.h"
+
 static const char *conty_log_levels[CONTY_LOG_FATAL+1] = {
         [CONTY_LOG_TRACE] = "TRACE",
         [CONTY_LOG_DEBUG] = "DEBUG",
@@ -9,16 +24,78 @@ static const char *conty_log_levels[CONTY_LOG_FATAL+1] = {
         [CONTY_LOG_FATAL] = "FATAL",
 };
 
+#define load_acquire(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define load_relaxed(ptr)       __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define full_fence()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/*
+ * Longest record, longer messages are cut short
+ */
+#define LOG_RECORD_MAX 2048
+
+/*
+ * Bytes buffered per thread, a power of two. Threads that fill theirs
+ * wait for the logger, LOG_FULL_WAIT_NS at a time
+ */
+#define LOG_BUF_SIZE      (64 * 1024)
+#define LOG_FULL_WAIT_NS  (50 * 1000)
+
+/*
+ * How long the logger lets messages pile up after it wrote some
+ */
+#define LOG_LINGER_MS 10
+
+/*
+ * Messages of a thread, in a byte ring of a single producer and
+ * the logger's thread as its consumer
+ */
+struct log_buf {
+    /*
+     * Consumer side
+     */
+    struct {
+        size_t lb_head;
+    } __cacheline_aligned;
+    /*
+     * Producer side
+     */
+    struct {
+        size_t lb_tail;
+        size_t lb_head_cache;
+    } __cacheline_aligned;
+    struct {
+        struct log_buf *lb_next;
+        int             lb_orphan;
+        char            lb_data[LOG_BUF_SIZE];
+    } __cacheline_aligned;
+};
+
 /*
  * Logger object
- * Currently the logger isn't protected by a lock so messages
- * will most definitely be interleaved
+ *
+ * Level, quiet and binary are set up front and read without a lock.
+ * The lock guards the list of buffers, which is only taken when a thread
+ * logs for the first time and when the logger's thread walks the list,
+ * never while a message is logged
  */
 static struct {
-    void        *udata;
-    int          level;
-    int          quiet;
-} CONTY_LOGGER;
+    int              level;
+    int              quiet;
+    int              binary;
+    int              running;
+    int              stopping;
+    int              idle;
+    int              efd;
+    pthread_t        thread;
+    pthread_key_t    key;
+    pthread_mutex_t  lock;
+    struct log_buf  *bufs;
+} CONTY_LOGGER = { .efd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct log_buf *log_buf;
+static __thread const char *log_container;
+static __thread char log_scratch[LOG_RECORD_MAX] __attribute__((aligned(8)));
 
 void conty_log_set_level(int level)
 {
@@ -30,33 +107,422 @@ void conty_log_set_quiet(int quiet)
     CONTY_LOGGER.quiet = quiet;
 }
 
-static void conty_log_stdout_cb(struct conty_log_event *event)
+void conty_log_set_binary(int binary)
+{
+    CONTY_LOGGER.binary = binary;
+}
+
+const char *conty_log_set_container(const char *id)
+{
+    const char *prev = log_container;
+
+    log_container = id;
+    return prev;
+}
+
+static void log_wake(void)
+{
+    uint64_t one = 1;
+
+    while (write(CONTY_LOGGER.efd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * Wait until the logger is woken up, or timeout milliseconds passed
+ */
+static void log_wait(int timeout)
+{
+    struct pollfd pollfd = { .fd = CONTY_LOGGER.efd, .events = POLLIN, .revents = 0 };
+    uint64_t cnt;
+
+    if (poll(&pollfd, 1, timeout) > 0)
+        while (read(CONTY_LOGGER.efd, &cnt, sizeof(cnt)) < 0 && errno == EINTR)
+            ;
+}
+
+static void log_write(const char *record, size_t len)
+{
+    ssize_t tx;
+
+    while (len > 0) {
+        tx = write(STDERR_FILENO, record, len);
+        if (tx < 0 && errno == EINTR)
+            continue;
+        if (tx <= 0)
+            return;
+        record += tx;
+        len    -= (size_t) tx;
+    }
+}
+
+/*
+ * The thread's buffer, which it registers the first time it logs
+ */
+static struct log_buf *log_buf_get(void)
+{
+    struct log_buf *lb;
+
+    if (log_buf)
+        return log_buf;
+
+    if (posix_memalign((void **) &lb, CONTY_CACHELINE_SIZE, sizeof(*lb)) != 0)
+        return NULL;
+
+    lb->lb_head       = 0;
+    lb->lb_tail       = 0;
+    lb->lb_head_cache = 0;
+    lb->lb_orphan     = 0;
+
+    pthread_mutex_lock(&CONTY_LOGGER.lock);
+    lb->lb_next = CONTY_LOGGER.bufs;
+    CONTY_LOGGER.bufs = lb;
+    pthread_mutex_unlock(&CONTY_LOGGER.lock);
+
+    pthread_setspecific(CONTY_LOGGER.key, lb);
+
+    return (log_buf = lb);
+}
+
+/*
+ * Buffers of threads that are gone are freed by the
+ * logger, once it wrote what's left in them
+ */
+static void log_buf_orphan(void *data)
+{
+    struct log_buf *lb = (struct log_buf *) data;
+
+    store_release(&lb->lb_orphan, 1);
+}
+
+/*
+ * Returns 0, or -EPIPE if the logger stopped while
+ * we were waiting for room in the buffer
+ */
+static int log_buf_push(struct log_buf *lb, const char *record, size_t len, int urgent)
+{
+    struct timespec wait = { .tv_sec = 0, .tv_nsec = LOG_FULL_WAIT_NS };
+    size_t tail = lb->lb_tail;
+    size_t off  = tail & (LOG_BUF_SIZE - 1);
+    size_t first;
+    int idle;
+
+    while (tail + len - lb->lb_head_cache > LOG_BUF_SIZE) {
+        lb->lb_head_cache = load_acquire(&lb->lb_head);
+        if (tail + len - lb->lb_head_cache <= LOG_BUF_SIZE)
+            break;
+
+        if (!load_relaxed(&CONTY_LOGGER.running))
+            return -EPIPE;
+
+        log_wake();
+        nanosleep(&wait, NULL);
+    }
+
+    first = (len < LOG_BUF_SIZE - off) ? len : LOG_BUF_SIZE - off;
+    memcpy(lb->lb_data + off, record, first);
+    memcpy(lb->lb_data, record + first, len - first);
+
+    store_release(&lb->lb_tail, tail + len);
+
+    /*
+     * The logger goes idle before it checks the buffers one last time,
+     * so either it sees the record or we see it idle and wake it
+     */
+    full_fence();
+    idle = load_relaxed(&CONTY_LOGGER.idle) &&
+           __atomic_exchange_n(&CONTY_LOGGER.idle, 0, __ATOMIC_SEQ_CST);
+    if (idle || urgent)
+        log_wake();
+
+    return 0;
+}
+
+static size_t log_format_text(int level, const char *file, int line,
+                              const char *fmt, va_list args)
 {
-    fprintf(event->udata, "%-5s %s:%d: ",
-            conty_log_levels[event->lvl], event->file, event->line);
-    vfprintf(event->udata, event->fmt, event->varargs);
-    fprintf(event->udata, "\n");
-    fflush(event->udata);
+    size_t cap = sizeof(log_scratch) - 1;
+    size_t len;
+    int n;
+
+    if (log_container)
+        n = snprintf(log_scratch, cap, "%-5s %s:%d: [%s] ", conty_log_levels[level],
+                     file, line, log_container);
+    else
+        n = snprintf(log_scratch, cap, "%-5s %s:%d: ", conty_log_levels[level], file, line);
+
+    len = (n < 0) ? 0 : ((size_t) n < cap ? (size_t) n : cap - 1);
+
+    n = vsnprintf(log_scratch + len, cap - len, fmt, args);
+    if (n > 0)
+        len += ((size_t) n < cap - len) ? (size_t) n : cap - len - 1;
+
+    log_scratch[len++] = '\n';
+
+    return len;
 }
 
-static void conty_log_event_init(struct conty_log_event *event, void *data)
+static size_t log_format_binary(int level, const char *file, int line,
+                                const char *fmt, va_list args)
 {
-    event->udata = data;
+    struct conty_log_record *rec = (struct conty_log_record *) log_scratch;
+    size_t cap = sizeof(log_scratch) - sizeof(*rec);
+    size_t filelen = strlen(file);
+    size_t idlen = log_container ? strlen(log_container) : 0;
+    char *data = log_scratch + sizeof(*rec);
+    struct timespec now;
+    size_t len, msglen;
+    int n;
+
+    filelen = (filelen < cap / 4) ? filelen : cap / 4;
+    idlen   = (idlen < cap / 4) ? idlen : cap / 4;
+
+    memcpy(data, file, filelen);
+    if (idlen)
+        memcpy(data + filelen, log_container, idlen);
+
+    len = filelen + idlen;
+    n = vsnprintf(data + len, cap - len, fmt, args);
+    msglen = (n < 0) ? 0 : ((size_t) n < cap - len ? (size_t) n : cap - len - 1);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    rec->lr_len     = (uint32_t) ((sizeof(*rec) + len + msglen + 7) & ~(size_t) 7);
+    rec->lr_line    = (uint32_t) line;
+    rec->lr_time    = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+    rec->lr_level   = (uint16_t) level;
+    rec->lr_filelen = (uint16_t) filelen;
+    rec->lr_idlen   = (uint16_t) idlen;
+    rec->lr_msglen  = (uint16_t) msglen;
+
+    memset(data + len + msglen, 0, rec->lr_len - sizeof(*rec) - len - msglen);
+
+    return rec->lr_len;
 }
 
 void conty_log(int level, const char *file, int line, const char *fmt, ...)
 {
-    struct conty_log_event event = {
-            .fmt  = fmt,
-            .file = file,
-            .line = line,
-            .lvl  = level
-    };
-
-    if (CONTY_LOGGER.quiet == 0 && level >= CONTY_LOGGER.level) {
-        conty_log_event_init(&event, stderr);
-        va_start(event.varargs, fmt);
-        conty_log_stdout_cb(&event);
-        va_end(event.varargs);
+    struct log_buf *lb;
+    va_list args;
+    size_t len;
+
+    if (CONTY_LOGGER.quiet != 0 || level < CONTY_LOGGER.level)
+        return;
+
+    va_start(args, fmt);
+    if (CONTY_LOGGER.binary)
+        len = log_format_binary(level, file, line, fmt, args);
+    else
+        len = log_format_text(level, file, line, fmt, args);
+    va_end(args);
+
+    if (load_relaxed(&CONTY_LOGGER.running) && (lb = log_buf_get()) &&
+        log_buf_push(lb, log_scratch, len, level >= CONTY_LOG_ERROR) == 0)
+        return;
+
+    /*
+     * The whole message in a single write, so that it isn't
+     * interleaved with the messages of other threads
+     */
+    log_write(log_scratch, len);
+}
+
+/*
+ * Write everything the buffers hold, IOV_MAX pieces at a time,
+ * and free the buffers of threads that are gone
+ * Returns the number of bytes written
+ *
+ * The lock is only held while walking the list, not while writing, so
+ * threads that log for the first time aren't stuck behind a slow stderr.
+ * We're the only one to unlink and free buffers, and new ones only go to
+ * the front, so the buffers we hold on to stay where they are meanwhile
+ */
+static size_t log_flush(void)
+{
+    struct log_buf *bufs[IOV_MAX / 2];
+    size_t tails[IOV_MAX / 2];
+    struct iovec iov[IOV_MAX];
+    struct log_buf **link, *lb;
+    size_t total = 0, head, off, len;
+    unsigned int nbufs;
+    int niov, orphan;
+    ssize_t tx;
+
+    pthread_mutex_lock(&CONTY_LOGGER.lock);
+    link = &CONTY_LOGGER.bufs;
+
+    while (*link) {
+        nbufs = 0;
+        niov  = 0;
+
+        while (*link && nbufs < IOV_MAX / 2) {
+            lb     = *link;
+            orphan = load_acquire(&lb->lb_orphan);
+            head   = lb->lb_head;
+            tails[nbufs] = load_acquire(&lb->lb_tail);
+
+            if (head == tails[nbufs]) {
+                /*
+                 * The thread's gone and so are its messages
+                 */
+                if (orphan) {
+                    *link = lb->lb_next;
+                    free(lb);
+                } else {
+                    link = &lb->lb_next;
+                }
+                continue;
+            }
+
+            off = head & (LOG_BUF_SIZE - 1);
+            len = tails[nbufs] - head;
+
+            iov[niov].iov_base = lb->lb_data + off;
+            iov[niov].iov_len  = (len < LOG_BUF_SIZE - off) ? len : LOG_BUF_SIZE - off;
+            niov++;
+
+            if (iov[niov - 1].iov_len < len) {
+                iov[niov].iov_base = lb->lb_data;
+                iov[niov].iov_len  = len - iov[niov - 1].iov_len;
+                niov++;
+            }
+
+            bufs[nbufs++] = lb;
+            total += len;
+            link   = &lb->lb_next;
+        }
+
+        pthread_mutex_unlock(&CONTY_LOGGER.lock);
+
+        /*
+         * Short writes pick up where they stopped, a failing
+         * descriptor has the messages dropped
+         */
+        for (int i = 0; i < niov; ) {
+            tx = writev(STDERR_FILENO, iov + i, niov - i);
+            if (tx < 0 && errno == EINTR)
+                continue;
+            if (tx <= 0)
+                break;
+
+            for (; i < niov && (size_t) tx >= iov[i].iov_len; i++)
+                tx -= (ssize_t) iov[i].iov_len;
+
+            if (i < niov) {
+                iov[i].iov_base = (char *) iov[i].iov_base + tx;
+                iov[i].iov_len -= (size_t) tx;
+            }
+        }
+
+        for (unsigned int i = 0; i < nbufs; i++)
+            store_release(&bufs[i]->lb_head, tails[i]);
+
+        pthread_mutex_lock(&CONTY_LOGGER.lock);
+    }
+
+    pthread_mutex_unlock(&CONTY_LOGGER.lock);
+
+    return total;
+}
+
+static void *log_run(void *arg)
+{
+    (void) arg;
+
+    while (!load_acquire(&CONTY_LOGGER.stopping)) {
+        /*
+         * Let more messages pile up while there are some
+         */
+        if (log_flush() > 0) {
+            log_wait(LOG_LINGER_MS);
+            continue;
+        }
+
+        __atomic_store_n(&CONTY_LOGGER.idle, 1, __ATOMIC_SEQ_CST);
+        if (log_flush() > 0) {
+            __atomic_store_n(&CONTY_LOGGER.idle, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        log_wait(-1);
+    }
+
+    return NULL;
+}
+
+/*
+ * A child of fork(2) only has the thread that forked
+ */
+static void log_atfork_child(void)
+{
+    conty_log_detach();
+}
+
+int conty_log_start(void)
+{
+    static int once;
+    sigset_t all, mask;
+    int err;
+
+    if (CONTY_LOGGER.running)
+        return 0;
+
+    if (!once) {
+        if ((err = -pthread_key_create(&CONTY_LOGGER.key, log_buf_orphan)) != 0)
+            return err;
+
+        pthread_atfork(NULL, NULL, log_atfork_child);
+        atexit(conty_log_stop);
+        once = 1;
     }
-}
\ No newline at end of file
+
+    if ((CONTY_LOGGER.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        return -errno;
+
+    CONTY_LOGGER.stopping = 0;
+    CONTY_LOGGER.idle     = 0;
+
+    /*
+     * Signals are for the caller's thread, which may be waiting for them
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &mask);
+    err = -pthread_create(&CONTY_LOGGER.thread, NULL, log_run, NULL);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    if (err != 0) {
+        close(CONTY_LOGGER.efd);
+        CONTY_LOGGER.efd = -1;
+        return err;
+    }
+
+    store_release(&CONTY_LOGGER.running, 1);
+
+    return 0;
+}
+
+void conty_log_stop(void)
+{
+    if (!CONTY_LOGGER.running)
+        return;
+
+    store_release(&CONTY_LOGGER.running, 0);
+    store_release(&CONTY_LOGGER.stopping, 1);
+    log_wake();
+
+    pthread_join(CONTY_LOGGER.thread, NULL);
+
+    log_flush();
+
+    close(CONTY_LOGGER.efd);
+    CONTY_LOGGER.efd = -1;
+}
+
+void conty_log_detach(void)
+{
+    /*
+     * The buffers are copies that nobody will ever write, leave them be
+     */
+    CONTY_LOGGER.running = 0;
+    log_buf              = NULL;
+}
@@ -1,23 +1,26 @@
 #ifndef CONTY_LOG_H
 #define CONTY_LOG_H
 
+#include <stdint.h>
 #include <stdio.h>
-#include <stdarg.h>
-#include <time.h>
 
-/*
- * Log event object
- */
-struct conty_log_event {
-    va_list     varargs;
-    const char *fmt;
-    const char *file;
-    void       *udata;
-    int         line;
-    int         lvl;
+enum {
+    CONTY_LOG_TRACE,
+    CONTY_LOG_DEBUG,
+    CONTY_LOG_INFO,
+    CONTY_LOG_WARN,
+    CONTY_LOG_ERROR,
+    CONTY_LOG_FATAL
 };
 
-typedef void (*conty_log_cb)(struct conty_log_event *event);
+/*
+ * Calls below this level are compiled out, arguments and all, and cost
+ * nothing at run time. Builds that define nothing keep every call and
+ * leave it to conty_log_set_level
+ */
+#ifndef CONTY_LOG_LEVEL_MIN
+#define CONTY_LOG_LEVEL_MIN CONTY_LOG_TRACE
+#endif
 
 /*
  * Disables the logger
@@ -26,25 +29,87 @@ void conty_log_set_quiet(int quiet);
 
 /*
  * Set the log level
- * Only logs at the current level or below will be written
+ * Only logs at the current level or above will be written
  */
 void conty_log_set_level(int level);
 
-enum {
-    CONTY_LOG_TRACE,
-    CONTY_LOG_DEBUG,
-    CONTY_LOG_INFO,
-    CONTY_LOG_WARN,
-    CONTY_LOG_ERROR,
-    CONTY_LOG_FATAL
+/*
+ * Hand the writing over to a background thread
+ *
+ * Until then, and in every process cloned or forked afterwards, each message
+ * is written with a write(2) of its own by the thread that logs it. Once the
+ * logger is started, threads copy their messages into a ring buffer of
+ * their own and the logger's thread writes what piled up in all of them
+ * with a single writev(2) every so often. Errors and fatal messages wake it
+ * up right away. The logger is stopped when the process exits
+ * Returns 0, or a negative errno if the thread can't be started
+ */
+int conty_log_start(void);
+
+/*
+ * Write everything that's still buffered and go back to writing
+ * synchronously. Threads must be done logging by then
+ */
+void conty_log_stop(void);
+
+/*
+ * Called in a process that was cloned without sharing our memory, which
+ * has no logger thread and must write its messages itself. fork(2)
+ * takes care of it on its own
+ */
+void conty_log_detach(void);
+
+/*
+ * Write struct conty_log_record instead of lines of text
+ */
+void conty_log_set_binary(int binary);
+
+/*
+ * Binary record, followed by lr_filelen bytes of the file name,
+ * lr_idlen bytes of the container identifier and lr_msglen bytes
+ * of the message, none of which are NUL-terminated. Records are
+ * padded to 8 bytes, lr_len counts the padding
+ */
+struct conty_log_record {
+    uint32_t lr_len;
+    uint32_t lr_line;
+    uint64_t lr_time;
+    uint16_t lr_level;
+    uint16_t lr_filelen;
+    uint16_t lr_idlen;
+    uint16_t lr_msglen;
 };
 
-#define LOG_TRACE(...) conty_log(CONTY_LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_DEBUG(...) conty_log(CONTY_LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...) conty_log(CONTY_LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_WARN(...) conty_log(CONTY_LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERROR(...) conty_log(CONTY_LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_FATAL(...) conty_log(CONTY_LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+/*
+ * Set the container the calling thread is working on, which every
+ * message it logs is tagged with. id must outlive it, NULL clears it
+ * Returns the previous one
+ */
+const char *conty_log_set_container(const char *id);
+
+static inline void conty_log_container_restore(const char **id)
+{
+    conty_log_set_container(*id);
+}
+
+/*
+ * Tag messages with the container id until the end of the scope
+ */
+#define LOG_CONTAINER_SCOPE(id)                                       \
+    __attribute__((cleanup(conty_log_container_restore))) const char \
+        *__log_container__ = conty_log_set_container(id)
+
+#define conty_log_at(level, ...)                                  \
+    ((level) >= CONTY_LOG_LEVEL_MIN                               \
+         ? conty_log(level, __FILE__, __LINE__, __VA_ARGS__)      \
+         : (void) 0)
+
+#define LOG_TRACE(...) conty_log_at(CONTY_LOG_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) conty_log_at(CONTY_LOG_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) conty_log_at(CONTY_LOG_INFO, __VA_ARGS__)
+#define LOG_WARN(...) conty_log_at(CONTY_LOG_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) conty_log_at(CONTY_LOG_ERROR, __VA_ARGS__)
+#define LOG_FATAL(...) conty_log_at(CONTY_LOG_FATAL, __VA_ARGS__)
 
 /*
  * Log an error message and return a value __ret__
@@ -88,6 +153,7 @@ enum {
         __int_ret__;                                      \
     })
 
-void conty_log(int level, const char *file, int line, const char *fmt, ...);
+void conty_log(int level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
 
 #endif //CONTY_LOG_H
@@ -1,6 +1,7 @@
 #include "mount.h"
 
 #include <fcntl.h>
+#include <ftw.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/syscall.h>
@@ -36,10 +37,114 @@ int conty_rootfs_init(struct conty_rootfs *rfs, const char *dst, char readonly)
 
     memset(rfs->cro_buf, 0, sizeof(rfs->cro_buf));
     rfs->cro_readonly = readonly;
+    rfs->cro_treefd   = -EBADF;
+    rfs->cro_overlay  = 0;
+    rfs->cro_tmpfs    = 0;
 
     return 0;
 }
 
+int conty_rootfs_init_overlay(struct conty_rootfs *rfs, const char *lower,
+                              const char *scratch, char tmpfs, char readonly)
+{
+    char merged[PATH_MAX];
+    int err;
+
+    err = strnprintf(merged, sizeof(merged), "%s/merged", scratch);
+    if (err < 0)
+        return log_error_ret(err, "could not construct overlay destination path");
+
+    if ((err = conty_rootfs_init(rfs, merged, readonly)) != 0)
+        return err;
+
+    err = strnprintf(rfs->cro_lower, sizeof(rfs->cro_lower), "%s", lower);
+    if (err < 0)
+        return log_error_ret(err, "could not construct overlay lower path");
+
+    err = strnprintf(rfs->cro_scratch, sizeof(rfs->cro_scratch), "%s", scratch);
+    if (err < 0)
+        return log_error_ret(err, "could not construct overlay scratch path");
+
+    rfs->cro_overlay = 1;
+    rfs->cro_tmpfs   = tmpfs;
+
+    return 0;
+}
+
+static const char *overlay_dirs[] = { "upper", "work", "merged" };
+
+static int scratch_mkdirs(const char *scratch, uid_t uid, gid_t gid)
+{
+    char path[PATH_MAX];
+    int err;
+
+    for (size_t i = 0; i < sizeof(overlay_dirs) / sizeof(overlay_dirs[0]); i++) {
+        err = strnprintf(path, sizeof(path), "%s/%s", scratch, overlay_dirs[i]);
+        if (err < 0)
+            return log_error_ret(err, "cannot construct path %s/%s", scratch, overlay_dirs[i]);
+
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
+            return log_error_ret(-errno, "cannot create %s", path);
+
+        if (uid != (uid_t) -1 && lchown(path, uid, gid) != 0)
+            return log_error_ret(-errno, "cannot chown %s", path);
+    }
+
+    return 0;
+}
+
+int conty_rootfs_scratch_create(const char *scratch, char tmpfs, uid_t uid, gid_t gid)
+{
+    int err;
+
+    if (mkdir(scratch, 0755) != 0) {
+        if (errno != EEXIST)
+            return log_error_ret(-errno, "cannot create %s", scratch);
+
+        /*
+         * A container with the same identifier didn't clean up after itself,
+         * don't let its upper layer leak into ours
+         */
+        LOG_WARN("removing stale scratch directory %s", scratch);
+        if ((err = conty_rootfs_scratch_remove(scratch)) != 0)
+            return err;
+
+        if (mkdir(scratch, 0755) != 0)
+            return log_error_ret(-errno, "cannot create %s", scratch);
+    }
+
+    /*
+     * Layers in a tmpfs are created by the container once it has mounted it
+     */
+    if (tmpfs)
+        return 0;
+
+    return scratch_mkdirs(scratch, uid, gid);
+}
+
+static int scratch_remove_entry(const char *path, const struct stat *sb,
+                                int type, struct FTW *ftw)
+{
+    if (remove(path) != 0 && errno != ENOENT)
+        return log_error_ret(-errno, "cannot remove %s", path);
+    return 0;
+}
+
+int conty_rootfs_scratch_remove(const char *scratch)
+{
+    int err;
+
+    /*
+     * Depth first, so directories are empty by the time we remove them,
+     * and without following symbolic links planted by the container
+     */
+    err = nftw(scratch, scratch_remove_entry, 16, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+    if (err < 0 && errno == ENOENT)
+        return 0;
+
+    return (err == 0) ? 0 : -EIO;
+}
+
 int conty_rootfs_pivot(const struct conty_rootfs *rfs)
 {
     LOG_INFO("pivoting rootfs %s", rfs->cro_dst);
@@ -104,8 +209,43 @@ int conty_rootfs_pivot(const struct conty_rootfs *rfs)
     return 0;
 }
 
+static int rootfs_mount_overlay(const struct conty_rootfs *rfs)
+{
+    char opts[PATH_MAX];
+    unsigned long mflags = rfs->cro_readonly ? MS_RDONLY : 0;
+    int err;
+
+    if (rfs->cro_tmpfs) {
+        /*
+         * The writable layer lives in memory and disappears
+         * along with our mount namespace
+         */
+        if (mount("tmpfs", rfs->cro_scratch, "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755") != 0)
+            return log_error_ret(-errno, "could not mount tmpfs at %s", rfs->cro_scratch);
+
+        if ((err = scratch_mkdirs(rfs->cro_scratch, (uid_t) -1, (gid_t) -1)) != 0)
+            return err;
+    }
+
+    err = strnprintf(opts, sizeof(opts), "lowerdir=%s,upperdir=%s/upper,workdir=%s/work",
+                     rfs->cro_lower, rfs->cro_scratch, rfs->cro_scratch);
+    if (err < 0)
+        return log_error_ret(err, "overlay options for %s too long", rfs->cro_lower);
+
+    /*
+     * Setting up the overlay is independent of the size of the image,
+     * and every container using the same lower layer shares its page cache
+     */
+    if (mount("overlay", rfs->cro_dst, "overlay", mflags, opts) != 0)
+        return log_error_ret(-errno, "could not mount overlay at %s", rfs->cro_dst);
+
+    return 0;
+}
+
 int conty_rootfs_mount(const struct conty_rootfs *rfs)
 {
+    int err;
+
     /*
      * Reconfigure the root file system as private so that
      * the bind mount of the new root filesystem does not trigger a mount
@@ -114,12 +254,25 @@ int conty_rootfs_mount(const struct conty_rootfs *rfs)
     if (mount("", "/", "", MS_PRIVATE | MS_REC, NULL) != 0)
         return log_error_ret(-errno, "could not mount --make-rslave /");
 
-    /*
-     * Convert the dentry holding the root filesystem into a mount point
-     */
-    unsigned long mflags = MS_BIND | MS_REC;
-    if (mount(rfs->cro_dst, rfs->cro_dst, "bind", mflags, NULL) != 0)
-        return log_error_ret(-errno, "could not mount --rbind %s", rfs->cro_dst);
+    if (rfs->cro_overlay) {
+        if ((err = rootfs_mount_overlay(rfs)) != 0)
+            return err;
+    } else if (rfs->cro_treefd >= 0) {
+        /*
+         * The runtime has already prepared the mount, attach it on top
+         * of the destination in our mount namespace
+         */
+        if (move_mount(rfs->cro_treefd, "", AT_FDCWD, rfs->cro_dst,
+                       MOVE_MOUNT_F_EMPTY_PATH) != 0)
+            return log_error_ret(-errno, "could not attach rootfs at %s", rfs->cro_dst);
+    } else {
+        /*
+         * Convert the dentry holding the root filesystem into a mount point
+         */
+        unsigned long mflags = MS_BIND | MS_REC;
+        if (mount(rfs->cro_dst, rfs->cro_dst, "bind", mflags, NULL) != 0)
+            return log_error_ret(-errno, "could not mount --rbind %s", rfs->cro_dst);
+    }
 
     /*
      * Make sure that the new mount point also does not trigger any events
@@ -131,6 +284,28 @@ int conty_rootfs_mount(const struct conty_rootfs *rfs)
     return 0;
 }
 
+int conty_rootfs_idmap_tree(const char *path, int usernsfd, char readonly)
+{
+    FD_RESOURCE int treefd = -EBADF;
+    struct mount_attr attr = {
+            .attr_set  = MOUNT_ATTR_IDMAP | (readonly ? MOUNT_ATTR_RDONLY : 0),
+            .userns_fd = (__u64) usernsfd,
+    };
+
+    treefd = open_tree(AT_FDCWD, path, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (treefd < 0)
+        return log_error_ret(-errno, "cannot clone mount tree of %s", path);
+
+    /*
+     * Idmapping can only be applied to detached mounts that haven't been
+     * attached anywhere yet, which is exactly what the clone gives us
+     */
+    if (mount_setattr(treefd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr)) != 0)
+        return log_error_ret(-errno, "cannot idmap mount of %s", path);
+
+    return move_fd(treefd);
+}
+
 int conty_rootfs_mount_dev(struct conty_rootfs *rfs)
 {
     LOG_INFO("preparing dev at %s/dev", rfs->cro_dst);
@@ -2,6 +2,7 @@
 #define CONTY_MOUNT_H
 
 #include <limits.h>
+#include <sys/types.h>
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -24,15 +25,70 @@ struct conty_rootfs {
      * Flag that indicates if the root filesystem should be writable
      */
     char cro_readonly;
+    /*
+     * Detached mount of the root filesystem prepared by the runtime,
+     * e.g an idmapped one, that is attached instead of bind mounting
+     * the destination onto itself
+     */
+    int cro_treefd;
+    /*
+     * Shared lower layer and per-container scratch directory
+     * of an overlay root filesystem. The scratch directory holds the upper,
+     * work and merged directories, the latter being cro_dst
+     */
+    char cro_lower[PATH_MAX];
+    char cro_scratch[PATH_MAX];
+    char cro_overlay;
+    /*
+     * Whether the scratch directory is backed by a tmpfs mounted
+     * in the container's mount namespace
+     */
+    char cro_tmpfs;
 };
 
 int conty_rootfs_init(struct conty_rootfs *rfs, const char *dst, char readonly);
 
+/*
+ * Initialise an overlay root filesystem with lower as its read-only
+ * lower layer and scratch as the directory for the writable layer
+ */
+int conty_rootfs_init_overlay(struct conty_rootfs *rfs, const char *lower,
+                              const char *scratch, char tmpfs, char readonly);
+
+/*
+ * Create the scratch directory of an overlay root filesystem on the host,
+ * along with its layer directories unless they live in a tmpfs.
+ * The layers are handed to uid and gid, i.e the owner of the root
+ * filesystem from the point of view of the container
+ *
+ * Leftovers of a previous container with the same scratch directory are removed
+ */
+int conty_rootfs_scratch_create(const char *scratch, char tmpfs, uid_t uid, gid_t gid);
+
+/*
+ * Recursively remove the scratch directory of an overlay root filesystem
+ */
+int conty_rootfs_scratch_remove(const char *scratch);
+
 /*
  * Mounts the root filesystem
  */
 int conty_rootfs_mount(const struct conty_rootfs *rfs);
 
+/*
+ * Create a detached recursive bind mount of path whose identifiers are mapped
+ * through the user namespace referred to by usernsfd, i.e files owned by
+ * identifier 0 on disk appear as owned by whatever 0 maps to in that namespace
+ *
+ * This allows any number of containers with different mappings to share the
+ * same root filesystem without changing its ownership on disk.
+ * The caller needs CAP_SYS_ADMIN in the user namespace that owns the
+ * filesystem of path, so this is done by the runtime rather than the container.
+ *
+ * Returns a file descriptor to the detached mount
+ */
+int conty_rootfs_idmap_tree(const char *path, int usernsfd, char readonly);
+
 /*
  * Creates a mount point under /dev in the root filesystem
  */
@@ -0,0 +1,68 @@
+#include "namespace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "safestring.h"
+
+static void close_saved(int saved[CONTY_NS_LEN])
+{
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++) {
+        if (saved[ns] >= 0)
+            close(saved[ns]);
+        saved[ns] = -EBADF;
+    }
+}
+
+int conty_ns_enter(int pidfd, unsigned long flags, int saved[CONTY_NS_LEN])
+{
+    char path[64];
+    int err;
+
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++)
+        saved[ns] = -EBADF;
+
+    if (flags & ~(unsigned long) CONTY_NS_THREAD)
+        return log_error_ret(-EINVAL, "cannot enter namespaces %#lx on a thread", flags);
+
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++) {
+        if (!(flags & conty_ns_flags[ns]))
+            continue;
+
+        if ((err = strnprintf(path, sizeof(path), "/proc/thread-self/ns/%s", conty_ns_str[ns])) < 0)
+            goto err_close;
+
+        if ((saved[ns] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            err = log_error_ret(-errno, "cannot open %s", path);
+            goto err_close;
+        }
+    }
+
+    /*
+     * Either all or none of the namespaces are entered
+     */
+    if (setns(pidfd, (int) flags) != 0) {
+        err = log_error_ret(-errno, "cannot enter namespaces %#lx", flags);
+        goto err_close;
+    }
+
+    return 0;
+
+err_close:
+    close_saved(saved);
+    return err;
+}
+
+void conty_ns_leave(int saved[CONTY_NS_LEN])
+{
+    for (conty_ns_t ns = 0; ns < CONTY_NS_LEN; ns++) {
+        if (saved[ns] >= 0 && conty_ns_set(saved[ns], ns) != 0) {
+            LOG_FATAL("cannot return to %s namespace", conty_ns_str[ns]);
+            abort();
+        }
+    }
+
+    close_saved(saved);
+}
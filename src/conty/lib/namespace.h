@@ -50,4 +50,24 @@ static inline int conty_ns_set(int fd, int type)
     return (setns(fd, (!type) ? 0 : conty_ns_flags[type]) < 0) ? -errno : 0;
 }
 
+/*
+ * Move the calling thread into the namespaces in flags of the process
+ * referred to by pidfd, with a single setns, so that the processes it
+ * clones start out in them. Descriptors to the namespaces the thread
+ * leaves are stored in saved, which must be passed to conty_ns_leave.
+ *
+ * Other threads stay where they are. Only namespaces that a thread of
+ * a multithreaded process can enter on its own are supported, that is
+ * net, ipc, uts and pid, which only applies to the processes it clones
+ */
+#define CONTY_NS_THREAD (CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS | CLONE_NEWPID)
+
+int conty_ns_enter(int pidfd, unsigned long flags, int saved[CONTY_NS_LEN]);
+
+/*
+ * Move the calling thread back into the namespaces it left with conty_ns_enter
+ * Aborts if it can't, the thread would create containers in the wrong place
+ */
+void conty_ns_leave(int saved[CONTY_NS_LEN]);
+
 #endif //CONTY_NAMESPACE_H
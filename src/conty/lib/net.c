@@ -0,0 +1,881 @@
+#include "net.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <conty/conty.h>
+
+#include "log.h"
+#include "resource.h"
+#include "ring.h"
+#include "safestring.h"
+
+/*
+ * Large enough for the handful of messages a container needs
+ */
+#define NL_BATCH_SIZE 8192
+
+/*
+ * Names of host pairs tried for a container before giving up
+ */
+#define NET_VETH_ATTEMPTS 8
+
+struct nl_batch {
+    int       nb_fd;
+    uint32_t  nb_seq;
+    unsigned  nb_count;
+    size_t    nb_len;
+    /*
+     * Set if a message didn't fit
+     */
+    char      nb_overflow;
+    char      nb_buf[NL_BATCH_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+};
+
+struct net_addr {
+    int           na_family;
+    unsigned char na_prefix;
+    union {
+        struct in_addr  na_in;
+        struct in6_addr na_in6;
+    };
+};
+
+static int nl_socket(void)
+{
+    int fd, one = 1;
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+        return log_error_ret(-errno, "cannot create rtnetlink socket");
+
+    /*
+     * Explain errors, without echoing the whole request back at us
+     */
+    setsockopt(fd, SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+    setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+    return fd;
+}
+
+static void nl_init(struct nl_batch *b, int fd)
+{
+    b->nb_fd       = fd;
+    b->nb_seq      = 1;
+    b->nb_count    = 0;
+    b->nb_len      = 0;
+    b->nb_overflow = 0;
+}
+
+static struct nlmsghdr *nl_msg(struct nl_batch *b, uint16_t type, uint16_t flags,
+                               const void *hdr, size_t hdrlen)
+{
+    struct nlmsghdr *nlh;
+    size_t len = NLMSG_LENGTH(hdrlen);
+
+    if (b->nb_overflow || b->nb_len + NLMSG_ALIGN(len) > sizeof(b->nb_buf)) {
+        b->nb_overflow = 1;
+        return NULL;
+    }
+
+    nlh = (struct nlmsghdr *) (b->nb_buf + b->nb_len);
+    memset(nlh, 0, NLMSG_ALIGN(len));
+    nlh->nlmsg_len   = (uint32_t) len;
+    nlh->nlmsg_type  = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    nlh->nlmsg_seq   = b->nb_seq + b->nb_count++;
+    memcpy(NLMSG_DATA(nlh), hdr, hdrlen);
+
+    b->nb_len += NLMSG_ALIGN(len);
+    return nlh;
+}
+
+/*
+ * Attributes are appended to the last message of the batch
+ */
+static struct rtattr *nl_attr(struct nl_batch *b, struct nlmsghdr *nlh, uint16_t type,
+                              const void *data, size_t len)
+{
+    struct rtattr *rta;
+    size_t total = RTA_SPACE(len);
+
+    if (!nlh || b->nb_len + total > sizeof(b->nb_buf)) {
+        b->nb_overflow = 1;
+        return NULL;
+    }
+
+    rta = (struct rtattr *) ((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    memset(rta, 0, total);
+    rta->rta_type = type;
+    rta->rta_len  = (unsigned short) RTA_LENGTH(len);
+    if (len)
+        memcpy(RTA_DATA(rta), data, len);
+
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + (uint32_t) total;
+    b->nb_len     += total;
+    return rta;
+}
+
+static struct rtattr *nl_attr_str(struct nl_batch *b, struct nlmsghdr *nlh, uint16_t type,
+                                  const char *str)
+{
+    return nl_attr(b, nlh, type, str, strlen(str) + 1);
+}
+
+static struct rtattr *nl_attr_u32(struct nl_batch *b, struct nlmsghdr *nlh, uint16_t type,
+                                  uint32_t val)
+{
+    return nl_attr(b, nlh, type, &val, sizeof(val));
+}
+
+static void nl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest)
+{
+    if (nest)
+        nest->rta_len = (unsigned short) ((char *) nlh + nlh->nlmsg_len - (char *) nest);
+}
+
+static const char *nl_extack(const struct nlmsghdr *nlh)
+{
+    const struct nlmsgerr *err = NLMSG_DATA(nlh);
+    const struct rtattr *rta;
+    int len;
+
+    if (!(nlh->nlmsg_flags & NLM_F_ACK_TLVS))
+        return NULL;
+
+    /*
+     * The request is capped, so the attributes follow the error right away
+     */
+    rta = (const struct rtattr *) ((const char *) err + NLMSG_ALIGN(sizeof(*err)));
+    len = (int) nlh->nlmsg_len - (int) NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*err)));
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NLMSGERR_ATTR_MSG)
+            return RTA_DATA(rta);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hand the whole batch to the kernel in one go and collect its answers.
+ * The kernel processes every message even if an earlier one failed,
+ * the first error other than ignore is returned
+ */
+static int nl_commit(struct nl_batch *b, int ignore)
+{
+    char buf[NL_BATCH_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    unsigned int acked = 0;
+    struct nlmsghdr *nlh;
+    ssize_t rx;
+    int err = 0;
+
+    if (b->nb_overflow)
+        return log_error_ret(-ENOBUFS, "rtnetlink batch too large");
+
+    if (b->nb_count == 0)
+        return 0;
+
+    if (sendto(b->nb_fd, b->nb_buf, b->nb_len, 0, (struct sockaddr *) &kernel, sizeof(kernel)) < 0)
+        return log_error_ret(-errno, "cannot send rtnetlink batch");
+
+    while (acked < b->nb_count) {
+        rx = recv(b->nb_fd, buf, sizeof(buf), 0);
+        if (rx < 0) {
+            if (errno == EINTR)
+                continue;
+            return log_error_ret(-errno, "cannot receive rtnetlink answers");
+        }
+
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, rx); nlh = NLMSG_NEXT(nlh, rx)) {
+            const struct nlmsgerr *nlerr = NLMSG_DATA(nlh);
+            const char *msg;
+
+            if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_seq < b->nb_seq ||
+                nlh->nlmsg_seq >= b->nb_seq + b->nb_count)
+                continue;
+
+            acked++;
+            if (nlerr->error == 0 || nlerr->error == ignore || err != 0)
+                continue;
+
+            err = nlerr->error;
+            msg = nl_extack(nlh);
+            LOG_ERROR("rtnetlink message %u of %u failed: %s%s%s", nlh->nlmsg_seq - b->nb_seq + 1,
+                      b->nb_count, strerror(-err), msg ? ": " : "", msg ? msg : "");
+        }
+    }
+
+    b->nb_seq  += b->nb_count;
+    b->nb_count = 0;
+    b->nb_len   = 0;
+
+    return err;
+}
+
+static int parse_addr(const char *str, struct net_addr *addr)
+{
+    char buf[INET6_ADDRSTRLEN + sizeof("/128")];
+    unsigned long prefix;
+    char *slash, *end;
+
+    if (strnprintf(buf, sizeof(buf), "%s", str) < 0 || !(slash = strchr(buf, '/')))
+        return log_error_ret(-EINVAL, "address %s is not of the form <ip>/<prefix>", str);
+
+    *slash = '\0';
+
+    if (inet_pton(AF_INET, buf, &addr->na_in) == 1)
+        addr->na_family = AF_INET;
+    else if (inet_pton(AF_INET6, buf, &addr->na_in6) == 1)
+        addr->na_family = AF_INET6;
+    else
+        return log_error_ret(-EINVAL, "invalid address %s", str);
+
+    errno  = 0;
+    prefix = strtoul(slash + 1, &end, 10);
+    if (errno || end == slash + 1 || *end || prefix > (addr->na_family == AF_INET ? 32 : 128))
+        return log_error_ret(-EINVAL, "invalid prefix of address %s", str);
+
+    addr->na_prefix = (unsigned char) prefix;
+    return 0;
+}
+
+static int add_addrs(struct nl_batch *b, int ifindex, char **addrs)
+{
+    struct net_addr addr;
+    struct ifaddrmsg ifa;
+    struct nlmsghdr *nlh;
+    size_t len;
+    int err;
+
+    for (int i = 0; addrs && addrs[i]; i++) {
+        if ((err = parse_addr(addrs[i], &addr)) != 0)
+            return err;
+
+        ifa = (struct ifaddrmsg) {
+            .ifa_family    = (unsigned char) addr.na_family,
+            .ifa_prefixlen = addr.na_prefix,
+            .ifa_index     = (unsigned int) ifindex,
+        };
+        len = addr.na_family == AF_INET ? sizeof(addr.na_in) : sizeof(addr.na_in6);
+
+        nlh = nl_msg(b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, &ifa, sizeof(ifa));
+        nl_attr(b, nlh, IFA_LOCAL, &addr.na_in6, len);
+        nl_attr(b, nlh, IFA_ADDRESS, &addr.na_in6, len);
+    }
+
+    return 0;
+}
+
+static void link_up(struct nl_batch *b, int ifindex)
+{
+    struct ifinfomsg ifi = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_index  = ifindex,
+        .ifi_flags  = IFF_UP,
+        .ifi_change = IFF_UP,
+    };
+
+    nl_msg(b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+}
+
+static void link_del_index(struct nl_batch *b, int ifindex)
+{
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_index = ifindex };
+
+    nl_msg(b, RTM_DELLINK, 0, &ifi, sizeof(ifi));
+}
+
+static void link_del(struct nl_batch *b, const char *name)
+{
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+
+    nl_attr_str(b, nl_msg(b, RTM_DELLINK, 0, &ifi, sizeof(ifi)), IFLA_IFNAME, name);
+}
+
+static void new_bridge(struct nl_batch *b, const struct oci_network *net)
+{
+    struct ifinfomsg ifi = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_flags  = IFF_UP,
+        .ifi_change = IFF_UP,
+    };
+    struct nlmsghdr *nlh;
+    struct rtattr *info;
+
+    nlh = nl_msg(b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+    nl_attr_str(b, nlh, IFLA_IFNAME, net->onet_bridge);
+    if (net->onet_mtu)
+        nl_attr_u32(b, nlh, IFLA_MTU, net->onet_mtu);
+
+    info = nl_attr(b, nlh, IFLA_LINKINFO, NULL, 0);
+    nl_attr_str(b, nlh, IFLA_INFO_KIND, "bridge");
+    nl_nest_end(nlh, info);
+}
+
+/*
+ * Create the pair with the host's end attached to the bridge and up,
+ * and the container's end right where it belongs
+ */
+static void new_veth(struct nl_batch *b, const struct oci_network *net, const char *host,
+                     int bridge, int netnsfd)
+{
+    struct ifinfomsg ifi = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_flags  = IFF_UP,
+        .ifi_change = IFF_UP,
+    };
+    struct ifinfomsg peer = { .ifi_family = AF_UNSPEC };
+    struct rtattr *info, *data, *peerinfo;
+    struct nlmsghdr *nlh;
+
+    nlh = nl_msg(b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+    nl_attr_str(b, nlh, IFLA_IFNAME, host);
+    nl_attr_u32(b, nlh, IFLA_MASTER, (uint32_t) bridge);
+    if (net->onet_mtu)
+        nl_attr_u32(b, nlh, IFLA_MTU, net->onet_mtu);
+
+    info = nl_attr(b, nlh, IFLA_LINKINFO, NULL, 0);
+    nl_attr_str(b, nlh, IFLA_INFO_KIND, "veth");
+    data = nl_attr(b, nlh, IFLA_INFO_DATA, NULL, 0);
+    peerinfo = nl_attr(b, nlh, VETH_INFO_PEER, &peer, sizeof(peer));
+    nl_attr_str(b, nlh, IFLA_IFNAME, CONTY_NET_PEER_NAME);
+    nl_attr_u32(b, nlh, IFLA_NET_NS_FD, (uint32_t) netnsfd);
+    if (net->onet_mtu)
+        nl_attr_u32(b, nlh, IFLA_MTU, net->onet_mtu);
+    nl_nest_end(nlh, peerinfo);
+    nl_nest_end(nlh, data);
+    nl_nest_end(nlh, info);
+}
+
+/*
+ * Both a descriptor to the container's network namespace and a socket
+ * that talks to that namespace's side of rtnetlink, which is bound to the
+ * namespace it was created in. Only the calling thread enters the
+ * container's namespace, and only for a moment
+ */
+static int open_container_netns(int pidfd, int *nsfd, int *nlfd)
+{
+    FD_RESOURCE int self = -EBADF;
+    int err = 0;
+
+    if ((self = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC)) < 0)
+        return log_error_ret(-errno, "cannot open network namespace");
+
+    if (setns(pidfd, CLONE_NEWNET) != 0)
+        return log_error_ret(-errno, "cannot enter network namespace of container");
+
+    if ((*nsfd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC)) < 0)
+        err = log_error_ret(-errno, "cannot open network namespace of container");
+    else if ((*nlfd = nl_socket()) < 0)
+        err = *nlfd;
+
+    if (setns(self, CLONE_NEWNET) != 0) {
+        LOG_FATAL("cannot return from network namespace of container");
+        abort();
+    }
+
+    if (err != 0 && *nsfd >= 0) {
+        close(*nsfd);
+        *nsfd = -EBADF;
+    }
+
+    return err;
+}
+
+static int ifindex_in(int fd, const char *name)
+{
+    struct ifreq ifr = { 0 };
+
+    if (strnprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name) < 0)
+        return -ENAMETOOLONG;
+
+    /*
+     * Resolved in the namespace of the socket
+     */
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) != 0)
+        return log_error_ret(-errno, "cannot find %s", name);
+
+    return ifr.ifr_ifindex;
+}
+
+/*
+ * Pair of virtual ethernet devices waiting in the pool, both ends on the
+ * host and down, the host's end attached to the bridge
+ */
+struct pool_veth {
+    int pv_host;
+    int pv_peer;
+};
+
+/*
+ * Most pairs created in a single batch
+ */
+#define POOL_BATCH 32
+
+struct net_pool {
+    char              np_bridge[IFNAMSIZ];
+    unsigned int      np_size;
+    /*
+     * Filled by the refill thread, drained by whoever creates containers
+     */
+    struct conty_ring np_ring;
+    /*
+     * Counters of the pairs that went into the pool and out of it
+     */
+    unsigned int      np_pushed;
+    unsigned int      np_taken;
+    /*
+     * Wakes the refill thread up once pairs were taken, or the pool came
+     * up empty because the bridge didn't exist yet
+     */
+    int               np_efd;
+    int               np_stop;
+    unsigned int      np_serial;
+    pthread_t         np_thread;
+};
+
+static struct net_pool *pool;
+
+static void pool_poke(struct net_pool *np)
+{
+    uint64_t one = 1;
+
+    if (write(np->np_efd, &one, sizeof(one)) < 0)
+        LOG_WARN("cannot wake up veth pool");
+}
+
+/*
+ * Create up to count pairs in a single batch and hand them over.
+ * Returns the number of pairs added to the pool
+ */
+static int pool_fill(struct net_pool *np, struct nl_batch *b, unsigned int count)
+{
+    char names[POOL_BATCH][2][IFNAMSIZ];
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+    struct ifinfomsg peer = { .ifi_family = AF_UNSPEC };
+    struct rtattr *info, *data, *peerinfo;
+    struct pool_veth *pv;
+    struct nlmsghdr *nlh;
+    int bridge, added = 0, err;
+
+    if (!(bridge = (int) if_nametoindex(np->np_bridge)))
+        return 0;
+
+    if (count > POOL_BATCH)
+        count = POOL_BATCH;
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int serial = np->np_serial++;
+
+        snprintf(names[i][0], IFNAMSIZ, "cp%x.%x", (unsigned int) getpid(), serial);
+        snprintf(names[i][1], IFNAMSIZ, "cq%x.%x", (unsigned int) getpid(), serial);
+
+        nlh = nl_msg(b, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi, sizeof(ifi));
+        nl_attr_str(b, nlh, IFLA_IFNAME, names[i][0]);
+        nl_attr_u32(b, nlh, IFLA_MASTER, (uint32_t) bridge);
+        info = nl_attr(b, nlh, IFLA_LINKINFO, NULL, 0);
+        nl_attr_str(b, nlh, IFLA_INFO_KIND, "veth");
+        data = nl_attr(b, nlh, IFLA_INFO_DATA, NULL, 0);
+        peerinfo = nl_attr(b, nlh, VETH_INFO_PEER, &peer, sizeof(peer));
+        nl_attr_str(b, nlh, IFLA_IFNAME, names[i][1]);
+        nl_nest_end(nlh, peerinfo);
+        nl_nest_end(nlh, data);
+        nl_nest_end(nlh, info);
+    }
+
+    err = nl_commit(b, 0);
+
+    for (unsigned int i = 0; i < count; i++) {
+        int host = (int) if_nametoindex(names[i][0]);
+        int peer = (int) if_nametoindex(names[i][1]);
+
+        if (!host || !peer)
+            continue;
+
+        if (err == 0 && (pv = malloc(sizeof(*pv)))) {
+            pv->pv_host = host;
+            pv->pv_peer = peer;
+            if (conty_ring_push(&np->np_ring, pv) == 0) {
+                added++;
+                continue;
+            }
+            free(pv);
+        }
+
+        /*
+         * Don't leave half a batch behind
+         */
+        link_del_index(b, host);
+    }
+
+    nl_commit(b, -ENODEV);
+    __atomic_add_fetch(&np->np_pushed, added, __ATOMIC_RELEASE);
+
+    return err != 0 ? err : added;
+}
+
+static void *pool_refill(void *arg)
+{
+    struct net_pool *np = arg;
+    struct nl_batch *b;
+    struct pollfd pfd = { .fd = np->np_efd, .events = POLLIN };
+    uint64_t pokes;
+    int fd, timeout;
+
+    if (!(b = malloc(sizeof(*b))) || (fd = nl_socket()) < 0) {
+        free(b);
+        LOG_ERROR("veth pool is not refilled");
+        return NULL;
+    }
+    nl_init(b, fd);
+
+    while (!__atomic_load_n(&np->np_stop, __ATOMIC_ACQUIRE)) {
+        unsigned int ready = __atomic_load_n(&np->np_pushed, __ATOMIC_RELAXED) -
+                             __atomic_load_n(&np->np_taken, __ATOMIC_ACQUIRE);
+
+        /*
+         * Back off for a while if the kernel won't give us devices,
+         * and wait to be poked while there's no bridge to attach them to
+         */
+        timeout = -1;
+        if (ready < np->np_size) {
+            int added = pool_fill(np, b, np->np_size - ready);
+            if (added > 0)
+                continue;
+            if (added < 0)
+                timeout = 1000;
+        }
+
+        if (poll(&pfd, 1, timeout) > 0 && read(np->np_efd, &pokes, sizeof(pokes)) < 0)
+            LOG_WARN("cannot read veth pool wakeups");
+    }
+
+    close(fd);
+    free(b);
+    return NULL;
+}
+
+int conty_net_pool_start(const char *bridge, unsigned int size)
+{
+    MEM_RESOURCE struct net_pool *np = NULL;
+    int err;
+
+    if (pool)
+        return log_error_ret(-EBUSY, "veth pool already running");
+
+    if (size == 0)
+        return log_error_ret(-EINVAL, "veth pool must not be empty");
+
+    if (!(np = calloc(1, sizeof(*np))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    if (strnprintf(np->np_bridge, sizeof(np->np_bridge), "%s", bridge) < 0)
+        return log_error_ret(-EINVAL, "invalid bridge name %s", bridge);
+
+    np->np_size = size;
+
+    if ((err = conty_ring_init(&np->np_ring, size)) != 0)
+        return err;
+
+    if ((np->np_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        err = log_error_ret(-errno, "cannot create veth pool wakeup fd");
+        goto err_ring;
+    }
+
+    if ((err = -pthread_create(&np->np_thread, NULL, pool_refill, np)) != 0) {
+        LOG_ERROR("cannot start veth pool refill thread");
+        goto err_efd;
+    }
+
+    pool = move_ptr(np);
+    return 0;
+
+err_efd:
+    close(np->np_efd);
+err_ring:
+    conty_ring_free(&np->np_ring);
+    return err;
+}
+
+void conty_net_pool_stop(void)
+{
+    struct net_pool *np = pool;
+    struct pool_veth *pv;
+    struct nl_batch *b;
+    int fd;
+
+    if (!np)
+        return;
+
+    pool = NULL;
+    __atomic_store_n(&np->np_stop, 1, __ATOMIC_RELEASE);
+    pool_poke(np);
+    pthread_join(np->np_thread, NULL);
+
+    /*
+     * Whatever is left in the pool goes away in one batch
+     */
+    b  = malloc(sizeof(*b));
+    fd = b ? nl_socket() : -ENOMEM;
+    if (fd >= 0)
+        nl_init(b, fd);
+
+    while ((pv = conty_ring_pop(&np->np_ring))) {
+        if (fd >= 0)
+            link_del_index(b, pv->pv_host);
+        free(pv);
+    }
+
+    if (fd >= 0) {
+        nl_commit(b, -ENODEV);
+        close(fd);
+    }
+
+    free(b);
+    close(np->np_efd);
+    conty_ring_free(&np->np_ring);
+    free(np);
+}
+
+unsigned int conty_net_pool_available(void)
+{
+    if (!pool)
+        return 0;
+
+    return __atomic_load_n(&pool->np_pushed, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&pool->np_taken, __ATOMIC_RELAXED);
+}
+
+/*
+ * Move a pair from the pool into place: the host's end gets the name of the
+ * container's pair and comes up, the other end moves into the container
+ * as CONTY_NET_PEER_NAME
+ */
+static int pool_attach(struct nl_batch *b, const char *bridge, const char *host, int netnsfd)
+{
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+    struct pool_veth *pv;
+    struct nlmsghdr *nlh;
+    int master, err;
+
+    if (!pool || strcmp(pool->np_bridge, bridge) != 0)
+        return -ENOENT;
+
+    /*
+     * Tell the refill thread that the bridge exists now
+     */
+    if (!(pv = conty_ring_pop(&pool->np_ring))) {
+        pool_poke(pool);
+        return -ENOENT;
+    }
+
+    /*
+     * The bridge may have been recreated since the pair was made
+     */
+    if (!(master = (int) if_nametoindex(bridge))) {
+        err = -ENODEV;
+        goto err_del;
+    }
+
+    ifi.ifi_index  = pv->pv_host;
+    ifi.ifi_flags  = IFF_UP;
+    ifi.ifi_change = IFF_UP;
+    nlh = nl_msg(b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+    nl_attr_str(b, nlh, IFLA_IFNAME, host);
+    nl_attr_u32(b, nlh, IFLA_MASTER, (uint32_t) master);
+
+    ifi = (struct ifinfomsg) { .ifi_family = AF_UNSPEC, .ifi_index = pv->pv_peer };
+    nlh = nl_msg(b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+    nl_attr_u32(b, nlh, IFLA_NET_NS_FD, (uint32_t) netnsfd);
+    nl_attr_str(b, nlh, IFLA_IFNAME, CONTY_NET_PEER_NAME);
+
+    err = nl_commit(b, 0);
+    if (err != 0) {
+err_del:
+        link_del_index(b, pv->pv_host);
+        nl_commit(b, -ENODEV);
+    }
+
+    /*
+     * Only now, so that the refill thread doesn't compete with us
+     * for the kernel's rtnetlink lock
+     */
+    __atomic_add_fetch(&pool->np_taken, 1, __ATOMIC_RELEASE);
+    pool_poke(pool);
+
+    free(pv);
+    return err;
+}
+
+int conty_net_veth_name(const char *id, unsigned int salt, char *buf, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const char *c = id; *c; c++)
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+
+    /*
+     * The first salt leaves the hash alone, so pairs of containers
+     * that never collided keep their names
+     */
+    for (; salt; salt >>= 8)
+        hash = (hash ^ (salt & 0xff)) * 16777619u;
+
+    return strnprintf(buf, len, "vc%08x", hash) < 0 ? -ENAMETOOLONG : 0;
+}
+
+/*
+ * Put the host's end of a pair in place under the given name, taking the
+ * pair from the pool if possible. A name that's taken fails with -EEXIST
+ * and leaves nothing behind
+ */
+static int attach_veth(struct nl_batch *host, const struct oci_network *net,
+                       const char *veth, int bridge, int nsfd)
+{
+    int err;
+
+    /*
+     * Pairs from the pool have the bridge's MTU, everything else gets
+     * a pair of its own
+     */
+    if (!net->onet_mtu) {
+        err = pool_attach(host, net->onet_bridge, veth, nsfd);
+        if (err == 0 || err == -EEXIST)
+            return err;
+    }
+
+    new_veth(host, net, veth, bridge, nsfd);
+    return nl_commit(host, 0);
+}
+
+int conty_net_setup(const struct oci_network *net, const char *id, int pidfd,
+                    char *veth)
+{
+    MEM_RESOURCE struct nl_batch *host = NULL, *cont = NULL;
+    FD_RESOURCE int hostfd = -EBADF, contfd = -EBADF, nsfd = -EBADF;
+    int bridge, peer, lo, err;
+    char created = 0;
+
+    veth[0] = '\0';
+    if (!(host = malloc(sizeof(*host))) || !(cont = malloc(sizeof(*cont))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    if ((hostfd = nl_socket()) < 0)
+        return hostfd;
+
+    if ((err = open_container_netns(pidfd, &nsfd, &contfd)) != 0)
+        return err;
+
+    nl_init(host, hostfd);
+    nl_init(cont, contfd);
+
+    /*
+     * The bridge is shared by all containers, so it usually exists already.
+     * Otherwise it has to be created on its own, to learn its index
+     */
+    if (!(bridge = (int) if_nametoindex(net->onet_bridge))) {
+        new_bridge(host, net);
+        if ((err = nl_commit(host, 0)) != 0 && err != -EEXIST)
+            return log_error_ret(err, "cannot create bridge %s", net->onet_bridge);
+
+        if (!(bridge = (int) if_nametoindex(net->onet_bridge)))
+            return log_error_ret(-ENODEV, "bridge %s vanished", net->onet_bridge);
+
+        /*
+         * Lost the race against another runtime, which does the addresses
+         */
+        if (err == 0) {
+            created = 1;
+            if ((err = add_addrs(host, bridge, net->onet_bridge_addrs)) != 0)
+                goto err_teardown;
+        }
+    }
+
+    /*
+     * The name of the pair is a short hash of the identifier, which another
+     * container may have already. Its pair must not be touched, so on failure
+     * the name is forgotten before tearing down
+     */
+    for (unsigned int salt = 0;; salt++) {
+        if ((err = conty_net_veth_name(id, salt, veth, IFNAMSIZ)) != 0)
+            goto err_teardown;
+
+        err = attach_veth(host, net, veth, bridge, nsfd);
+        if (err == 0)
+            break;
+
+        if (err != -EEXIST || salt == NET_VETH_ATTEMPTS - 1) {
+            veth[0] = '\0';
+            LOG_ERROR("cannot connect container %s to bridge %s", id, net->onet_bridge);
+            goto err_teardown;
+        }
+
+        LOG_WARN("%s is taken, trying another name for container %s", veth, id);
+    }
+
+    if ((peer = ifindex_in(contfd, CONTY_NET_PEER_NAME)) < 0 || (lo = ifindex_in(contfd, "lo")) < 0) {
+        err = peer < 0 ? peer : lo;
+        goto err_teardown;
+    }
+
+    if ((err = add_addrs(cont, peer, net->onet_addrs)) != 0)
+        goto err_teardown;
+
+    link_up(cont, lo);
+    link_up(cont, peer);
+    if ((err = nl_commit(cont, 0)) != 0) {
+        LOG_ERROR("cannot configure network of container %s", id);
+        goto err_teardown;
+    }
+
+    return 0;
+
+err_teardown:
+    nl_init(host, hostfd);
+    if (veth[0])
+        link_del(host, veth);
+    if (created)
+        link_del(host, net->onet_bridge);
+    nl_commit(host, -ENODEV);
+
+    return err;
+}
+
+int conty_net_teardown(const struct oci_network *net, const char *veth)
+{
+    MEM_RESOURCE struct nl_batch *b = NULL;
+    FD_RESOURCE int fd = -EBADF;
+
+    if (!(b = malloc(sizeof(*b))))
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    if ((fd = nl_socket()) < 0)
+        return fd;
+
+    /*
+     * The pair usually went away with the container's namespace already
+     */
+    nl_init(b, fd);
+    link_del(b, veth);
+    if (net->onet_delete_bridge)
+        link_del(b, net->onet_bridge);
+
+    return nl_commit(b, -ENODEV);
+}
@@ -0,0 +1,51 @@
+#ifndef CONTY_NET_H
+#define CONTY_NET_H
+
+#include <stddef.h>
+#include <net/if.h>
+
+#include "oci.h"
+
+/*
+ * Name of the container's end of the virtual ethernet pair
+ */
+#define CONTY_NET_PEER_NAME "eth0"
+
+/*
+ * Name of the host's end of the virtual ethernet pair of the container,
+ * derived from its identifier. Names are short, so two identifiers may
+ * end up with the same one, and a different salt picks another
+ */
+int conty_net_veth_name(const char *id, unsigned int salt, char *buf, size_t len);
+
+/*
+ * Connect the network namespace of the container process referred to by
+ * pidfd to the bridge of the configuration, creating the bridge first if
+ * it doesn't exist. The container's end of the pair of virtual ethernet
+ * devices is created in its namespace right away, where it's given its
+ * addresses and brought up along with the loopback device.
+ *
+ * The kernel is told about everything in batches of rtnetlink messages,
+ * one for the host and one for the container, plus one up front if the
+ * bridge has to be created. If a pool of pairs is running for the bridge,
+ * the pair is taken from there instead of being created.
+ *
+ * The name of the host's end is stored in veth, which has room for
+ * IFNAMSIZ bytes. If the name is taken, the next salt is tried, so the
+ * name has to be kept around to find the pair again on teardown.
+ */
+int conty_net_setup(const struct oci_network *net, const char *id, int pidfd,
+                    char *veth);
+
+/*
+ * Number of pairs waiting in the pool, see conty_net_pool_start
+ */
+unsigned int conty_net_pool_available(void);
+
+/*
+ * Remove the host's end of the pair named veth by conty_net_setup and,
+ * if asked to, the bridge. Devices that are already gone are not an error
+ */
+int conty_net_teardown(const struct oci_network *net, const char *veth);
+
+#endif //CONTY_NET_H
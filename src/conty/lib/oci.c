@@ -1,29 +1,92 @@
 #include "oci.h"
 
 #include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <sched.h>
 #include <string.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <sys/poll.h>
 
 #include "resource.h"
 #include "log.h"
 #include "clone.h"
+#include "plugin.h"
+#include "hooksock.h"
 
-int oci_hook_exec(struct oci_hook *hook, const struct oci_process_state *state)
+static void hook_kill(struct oci_hook_proc *proc);
+
+/*
+ * A hook that doesn't care about the state may well exit before we wrote it,
+ * which must neither take us down with SIGPIPE nor fail the hook
+ */
+static ssize_t hook_write_state(int fd, const char *buf, size_t len)
 {
-    MEM_RESOURCE char *buf = NULL;
-    FD_RESOURCE int hkfd, reader, writer = -EBADF;
+    sigset_t pipeset, oldset;
+    struct timespec zero = { 0 };
+    ssize_t tx;
+    int err;
+
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+
+    tx  = write(fd, buf, len);
+    err = errno;
+
+    if (tx < 0 && err == EPIPE) {
+        /*
+         * Swallow our SIGPIPE, unless the caller blocks it
+         * and collects it on its own
+         */
+        if (!sigismember(&oldset, SIGPIPE))
+            sigtimedwait(&pipeset, NULL, &zero);
+        tx = 0;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    errno = err;
+
+    return tx;
+}
+
+struct hook_exec {
+    const struct oci_hook *he_hook;
+    int                    he_reader;
+    int                    he_writer;
+};
+
+/*
+ * Runs between vfork and execve, see clone_vfork
+ */
+static int hook_exec(void *arg)
+{
+    struct hook_exec *he = (struct hook_exec *) arg;
+
+    close(he->he_writer);
+    /* Adjust stdin stream of hook */
+    if (dup2(he->he_reader, STDIN_FILENO) < 0)
+        return -errno;
+    close(he->he_reader);
+
+    execve(he->he_hook->ohk_path, he->he_hook->ohk_argv, he->he_hook->ohk_envp);
+    return -errno;
+}
+
+/*
+ * Start the hook with the serialized process state in its standard input stream
+ */
+static int hook_spawn(const struct oci_hook *hook, const char *buf, size_t buflen,
+                      struct oci_hook_proc *proc)
+{
+    FD_RESOURCE int hkfd = -EBADF, reader = -EBADF, writer = -EBADF;
+    struct hook_exec he;
     int ipc[2];
-    int sig = SIGTERM, err, status;
     pid_t hkpid;
-    size_t buflen;
-    struct pollfd pollfd;
-    unsigned int timeout = hook->ohk_timeout;
-
-    if (!(buf = oci_process_state_ser(state, &buflen)))
-        return -EINVAL;
+    ssize_t tx;
 
     /*
      * Construct a pipe that we'll use to redirect the standard input stream
@@ -34,33 +97,98 @@ int oci_hook_exec(struct oci_hook *hook, const struct oci_process_state *state)
 
     reader = ipc[0], writer = ipc[1];
 
-    hkpid = clone3_ret(CLONE_PIDFD, &hkfd);
+    /*
+     * The hook doesn't need a copy of our address space for the few
+     * instructions before it executes, and a failure to execute it
+     * is reported right here instead of as an exit status
+     */
+    he = (struct hook_exec) { .he_hook = hook, .he_reader = reader, .he_writer = writer };
+    hkpid = clone_vfork(hook_exec, &he, CLONE_PIDFD, &hkfd);
     if (hkpid < 0)
-        return log_error_ret(-errno, "cannot execute hook %s", hook->ohk_path);
-
-    if (hkpid == 0) {
-        close(writer);
-        /* Adjust stdin stream of hook */
-        dup2(reader, STDIN_FILENO);
-        close(reader);
-        /* Execute the hook */
-        execve(hook->ohk_path, hook->ohk_argv, hook->ohk_envp);
-        /* We should never reach this point */
-        _exit(-1);
-    }
+        return log_error_ret((int) hkpid, "cannot execute hook %s", hook->ohk_path);
 
     close(move_fd(reader));
+
+    proc->ohp_pid   = hkpid;
+    proc->ohp_pidfd = move_fd(hkfd);
+    proc->ohp_sig   = SIGTERM;
+
     /*
      * Write the process state into the hook
      */
-    ssize_t tx = write(writer, buf, buflen);
-    fd_cleaner_func(&writer);
+    tx = hook_write_state(writer, buf, buflen);
     if (tx < 0) {
-        err = -errno;
-        goto err_out;
+        int err = -errno;
+        hook_kill(proc);
+        return err;
     }
 
-    pollfd = (struct pollfd) { .fd = hkfd, .events = POLLIN, .revents = 0};
+    return 0;
+}
+
+/*
+ * Reap an exited hook, hooks succeed by exiting with 0
+ */
+static int hook_reap(struct oci_hook_proc *proc)
+{
+    int status;
+
+    close(proc->ohp_pidfd);
+    proc->ohp_pidfd = -EBADF;
+
+    if (waitpid(proc->ohp_pid, &status, 0) != proc->ohp_pid)
+        return -errno;
+
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static void hook_kill(struct oci_hook_proc *proc)
+{
+    if (pidfd_send_signal(proc->ohp_pidfd, SIGKILL, NULL, 0) != 0)
+        LOG_WARN("cannot kill hook process after error in parent");
+
+    if (waitpid(proc->ohp_pid, NULL, 0) != proc->ohp_pid)
+        LOG_WARN("cannot await hook process after error in parent");
+
+    close(proc->ohp_pidfd);
+    proc->ohp_pidfd = -EBADF;
+}
+
+/*
+ * The hook timed out, try to terminate it gracefully
+ * and nail it to the ground if that fails
+ */
+static int hook_timeout(struct oci_hook_proc *proc)
+{
+    if (pidfd_send_signal(proc->ohp_pidfd, proc->ohp_sig, NULL, 0) != 0)
+        return log_error_ret(-errno, "cannot terminate hook");
+
+    proc->ohp_sig = SIGKILL;
+    return 0;
+}
+
+int oci_hook_exec(struct oci_hook *hook, const struct oci_process_state *state)
+{
+    MEM_RESOURCE char *buf = NULL;
+    struct oci_hook_proc proc;
+    struct pollfd pollfd;
+    unsigned int timeout = hook->ohk_timeout;
+    size_t buflen;
+    int err;
+
+    if (hook->ohk_kind == OCI_HOOK_PLUGIN)
+        return conty_plugin_run(hook->ohk_path, state, hook->ohk_argv);
+
+    if (!(buf = oci_process_state_ser(state, &buflen)))
+        return -EINVAL;
+
+    if (hook->ohk_kind == OCI_HOOK_SOCKET)
+        return conty_hooksock_exec(hook->ohk_path, buf, buflen, hook->ohk_argv, timeout);
+
+    if ((err = hook_spawn(hook, buf, buflen, &proc)) != 0)
+        return err;
+
+    pollfd = (struct pollfd) { .fd = proc.ohp_pidfd, .events = POLLIN, .revents = 0};
     timeout *= 1000;
     for (;;) {
         err = poll(&pollfd, 1, (int) timeout);
@@ -70,30 +198,267 @@ int oci_hook_exec(struct oci_hook *hook, const struct oci_process_state *state)
         }
 
         if (err == 0) {
+            if ((err = hook_timeout(&proc)) != 0)
+                goto err_out;
+            timeout = 0;
+        }
+
+        if (err > 0)
+            return hook_reap(&proc);
+    }
+
+err_out:
+    hook_kill(&proc);
+    return err;
+}
+
+static long long hook_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+enum {
+    HOOK_PENDING,
+    HOOK_RUNNING,
+    HOOK_DONE
+};
+
+struct hook_job {
+    struct oci_hook             *hj_hook;
+    union {
+        struct oci_hook_proc        hj_proc;
+        struct conty_hooksock_call  hj_call;
+    };
+    int                          hj_state;
+    long long                    hj_deadline;
+};
+
+static int hook_ready(const struct hook_job *jobs, size_t njobs, const struct hook_job *job)
+{
+    char **after = job->hj_hook->ohk_after;
+
+    for (size_t i = 0; after && after[i]; i++) {
+        for (size_t j = 0; j < njobs; j++) {
+            if (jobs[j].hj_hook->ohk_name && !strcmp(jobs[j].hj_hook->ohk_name, after[i]) &&
+                jobs[j].hj_state != HOOK_DONE)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * A failed hook either fails the whole event, or is merely logged
+ * for the events that can't fail, exactly like executing them one by one
+ */
+static int hook_failed(const struct hook_job *job, int err, char infallible)
+{
+    if (!infallible)
+        return err;
+
+    LOG_WARN("hook %s failed", job->hj_hook->ohk_path);
+    return 0;
+}
+
+int oci_hooks_exec_parallel(const struct oci_hooks *hooks, const struct oci_process_state *state,
+                            char infallible)
+{
+    MEM_RESOURCE char *buf = NULL;
+    MEM_RESOURCE struct hook_job *jobs = NULL;
+    MEM_RESOURCE struct pollfd *pfds = NULL;
+    MEM_RESOURCE size_t *polled = NULL;
+    struct oci_hook *cur;
+    size_t njobs = 0, done = 0, npfds, i;
+    long long now, timeout;
+    size_t buflen;
+    int err = 0;
+
+    SLIST_FOREACH(cur, hooks, ohk_next)
+        njobs++;
+
+    if (njobs == 0)
+        return 0;
+
+    if (!(buf = oci_process_state_ser(state, &buflen)))
+        return -EINVAL;
+
+    jobs   = calloc(njobs, sizeof(*jobs));
+    pfds   = calloc(njobs, sizeof(*pfds));
+    polled = calloc(njobs, sizeof(*polled));
+    if (!jobs || !pfds || !polled)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    i = 0;
+    SLIST_FOREACH(cur, hooks, ohk_next)
+        jobs[i++].hj_hook = cur;
+
+    while (done < njobs) {
+        /*
+         * Start everything whose dependencies have finished. A hook that
+         * can't even be started is done, so rescan for its dependents
+         */
+        for (i = 0; i < njobs; i++) {
+            if (jobs[i].hj_state != HOOK_PENDING || !hook_ready(jobs, njobs, &jobs[i]))
+                continue;
+
             /*
-             * The hook timed out, try to terminate it gracefully
-             * and nail it to the ground if that fails
+             * Plugins are done as soon as they return
              */
-            if (pidfd_send_signal(hkfd, sig, NULL, 0) != 0)
-                return log_error_ret(-errno, "cannot terminate hook");
-            timeout = 0;
-            sig = SIGKILL;
+            if (jobs[i].hj_hook->ohk_kind == OCI_HOOK_PLUGIN) {
+                jobs[i].hj_state = HOOK_DONE;
+                done++;
+                err = conty_plugin_run(jobs[i].hj_hook->ohk_path, state, jobs[i].hj_hook->ohk_argv);
+                if (err != 0 && (err = hook_failed(&jobs[i], err, infallible)) != 0)
+                    goto err_kill;
+
+                i = (size_t) -1;
+                continue;
+            }
+
+            if (jobs[i].hj_hook->ohk_kind == OCI_HOOK_SOCKET)
+                err = conty_hooksock_send(jobs[i].hj_hook->ohk_path, buf, buflen,
+                                          jobs[i].hj_hook->ohk_argv, &jobs[i].hj_call);
+            else
+                err = hook_spawn(jobs[i].hj_hook, buf, buflen, &jobs[i].hj_proc);
+
+            if (err != 0) {
+                jobs[i].hj_state = HOOK_DONE;
+                done++;
+                if ((err = hook_failed(&jobs[i], err, infallible)) != 0)
+                    goto err_kill;
+
+                i = (size_t) -1;
+                continue;
+            }
+
+            jobs[i].hj_state    = HOOK_RUNNING;
+            jobs[i].hj_deadline = hook_now_ms() + 1000LL * jobs[i].hj_hook->ohk_timeout;
+
+            /*
+             * Hook servers without a timeout get all the time they need
+             */
+            if (jobs[i].hj_hook->ohk_kind == OCI_HOOK_SOCKET && !jobs[i].hj_hook->ohk_timeout)
+                jobs[i].hj_deadline = LLONG_MAX;
+        }
+
+        if (done == njobs)
+            break;
+
+        now     = hook_now_ms();
+        timeout = -1;
+        npfds   = 0;
+        for (i = 0; i < njobs; i++) {
+            if (jobs[i].hj_state != HOOK_RUNNING)
+                continue;
+
+            if (jobs[i].hj_hook->ohk_kind == OCI_HOOK_SOCKET)
+                pfds[npfds] = (struct pollfd) { .fd = conty_hooksock_fd(&jobs[i].hj_call), .events = POLLIN };
+            else
+                pfds[npfds] = (struct pollfd) { .fd = jobs[i].hj_proc.ohp_pidfd, .events = POLLIN };
+            polled[npfds] = i;
+            npfds++;
+
+            /*
+             * The reply may have been consumed along with that of another
+             * hook of the same server already
+             */
+            if (jobs[i].hj_deadline <= now ||
+                (jobs[i].hj_hook->ohk_kind == OCI_HOOK_SOCKET && jobs[i].hj_call.hc_done))
+                timeout = 0;
+            else if (timeout < 0 || jobs[i].hj_deadline - now < timeout)
+                timeout = jobs[i].hj_deadline - now;
+        }
+
+        if (npfds == 0) {
+            err = log_error_ret(-ELOOP, "hooks wait for each other");
+            goto err_kill;
+        }
+
+        if (poll(pfds, npfds, (int) timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            err = log_error_ret(-errno, "cannot wait for hooks");
+            goto err_kill;
         }
 
-        if (err > 0) {
-            if (waitpid(hkpid, &status, 0) != hkpid)
-                return -errno;
+        now = hook_now_ms();
+        for (i = 0; i < npfds; i++) {
+            struct hook_job *job = &jobs[polled[i]];
 
-            return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+            if (job->hj_hook->ohk_kind == OCI_HOOK_SOCKET) {
+                if (conty_hooksock_recv(&job->hj_call)) {
+                    job->hj_state = HOOK_DONE;
+                    done++;
+
+                    if ((err = job->hj_call.hc_status) != 0 &&
+                        (err = hook_failed(job, err, infallible)) != 0)
+                        goto err_kill;
+                } else if (now >= job->hj_deadline) {
+                    conty_hooksock_cancel(&job->hj_call);
+                    job->hj_state = HOOK_DONE;
+                    done++;
+
+                    LOG_ERROR("hook server %s timed out", job->hj_hook->ohk_path);
+                    if ((err = hook_failed(job, -ETIMEDOUT, infallible)) != 0)
+                        goto err_kill;
+                }
+            } else if (pfds[i].revents) {
+                job->hj_state = HOOK_DONE;
+                done++;
+
+                if ((err = hook_reap(&job->hj_proc)) != 0 &&
+                    (err = hook_failed(job, err, infallible)) != 0)
+                    goto err_kill;
+            } else if (now >= job->hj_deadline) {
+                if ((err = hook_timeout(&job->hj_proc)) != 0)
+                    goto err_kill;
+                /*
+                 * Like a single hook, the kill follows the termination
+                 * signal right away if the hook is still around
+                 */
+                job->hj_deadline = now;
+            }
         }
     }
 
-err_out:
-    if (pidfd_send_signal(hkfd, SIGKILL, NULL, 0) != 0)
-        LOG_WARN("cannot kill hook process after error in parent");
+    return 0;
 
-    if (waitpid(hkpid, NULL, 0) != hkpid)
-        LOG_WARN("cannot await hook process after error in parent");
+err_kill:
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].hj_state != HOOK_RUNNING)
+            continue;
+
+        if (jobs[i].hj_hook->ohk_kind == OCI_HOOK_SOCKET)
+            conty_hooksock_cancel(&jobs[i].hj_call);
+        else
+            hook_kill(&jobs[i].hj_proc);
+    }
 
     return err;
+}
+
+int oci_event_hooks_exec(const struct oci_event_hooks *conf, const struct oci_hooks *hooks,
+                         const struct oci_process_state *state, char infallible)
+{
+    struct oci_hook *cur, *tmp;
+    int err;
+
+    if (conf->oehk_parallel)
+        return oci_hooks_exec_parallel(hooks, state, infallible);
+
+    SLIST_FOREACH_SAFE(cur, hooks, ohk_next, tmp) {
+        if ((err = oci_hook_exec(cur, state)) != 0) {
+            if (!infallible)
+                return err;
+
+            LOG_WARN("hook %s failed", cur->ohk_path);
+        }
+    }
+
+    return 0;
 }
\ No newline at end of file
@@ -8,7 +8,14 @@
 
 struct oci_namespace {
     char                      *ons_type;
+    /*
+     * An existing namespace to join instead of creating one, given by
+     * at most one of the path of the namespace, the identifier of another
+     * container or the identifier of a process in it
+     */
     char                      *ons_path;
+    char                      *ons_container;
+    pid_t                      ons_pid;
     SLIST_ENTRY(oci_namespace) ons_next;
 };
 void oci_namespace_free(struct oci_namespace *ns);
@@ -23,10 +30,52 @@ struct oci_id_mapping {
 struct oci_rootfs {
     char *orfs_path;
     char  orfs_readonly;
+    /*
+     * Mount the root filesystem with the container's identifier mappings
+     * applied, instead of expecting it to be owned by the mapped identifiers
+     */
+    char  orfs_idmap;
+    /*
+     * Mount an overlay with the root filesystem as its shared, read-only
+     * lower layer and a per-container upper layer under orfs_scratch,
+     * either on disk or in a tmpfs that lives as long as the container
+     */
+    char  orfs_overlay;
+    char  orfs_tmpfs;
+    char *orfs_scratch;
+    /*
+     * Digests of image layers from the bottom to the top, in which case
+     * orfs_path is the layer store that the overlay takes them from
+     */
+    char **orfs_layers;
+    /*
+     * orfs_path is an uncompressed tar archive that is mounted lazily
+     * as the lower layer of the overlay, see conty_lazy_mount
+     */
+    char   orfs_lazy;
 };
 
 void oci_rootfs_free(struct oci_rootfs *rootfs);
 
+/*
+ * Connect the container's network namespace to a bridge on the host
+ * through a pair of virtual ethernet devices, see conty_net_setup
+ */
+struct oci_network {
+    char          *onet_bridge;
+    /*
+     * Addresses of the form <ip>/<prefix>, those of the bridge are only
+     * assigned if the bridge doesn't exist yet and has to be created
+     */
+    char         **onet_bridge_addrs;
+    char         **onet_addrs;
+    unsigned int   onet_mtu;
+    /*
+     * Remove the bridge along with the container
+     */
+    char           onet_delete_bridge;
+};
+
 struct oci_process {
     char  *oproc_cwd;
     char **oproc_argv;
@@ -44,11 +93,36 @@ struct oci_process_state {
 void oci_process_state_free(struct oci_process_state *state);
 CREATE_CLEANER(struct oci_process_state *, oci_process_state_free);
 
+enum oci_hook_kind {
+    /*
+     * Binary executed for every event
+     */
+    OCI_HOOK_EXEC = 0,
+    /*
+     * Shared object called into
+     */
+    OCI_HOOK_PLUGIN,
+    /*
+     * Socket of a hook server
+     */
+    OCI_HOOK_SOCKET
+};
+
 struct oci_hook {
     char                  *ohk_path;
     char                 **ohk_argv;
     char                 **ohk_envp;
     unsigned int           ohk_timeout;
+    /*
+     * What the path refers to, see conty/hook.h for plugins and servers
+     */
+    enum oci_hook_kind     ohk_kind;
+    /*
+     * Optional name of the hook, and the names of the hooks of the same
+     * event that must have finished before it starts if hooks run in parallel
+     */
+    char                  *ohk_name;
+    char                 **ohk_after;
     SLIST_ENTRY(oci_hook)  ohk_next;
 };
 void oci_hook_free(struct oci_hook *hook);
@@ -63,6 +137,10 @@ struct oci_event_hooks {
     struct oci_hooks oehk_on_container_start;
     struct oci_hooks oehk_on_container_started;
     struct oci_hooks oehk_on_container_stopped;
+    /*
+     * Run the hooks of an event concurrently instead of one by one
+     */
+    char             oehk_parallel;
 };
 
 struct oci_conf {
@@ -73,6 +151,7 @@ struct oci_conf {
     struct oci_event_hooks oc_hooks;
     struct oci_process     oc_proc;
     char                  *oc_hostname;
+    struct oci_network     oc_net;
 };
 
 /*
@@ -86,6 +165,13 @@ struct oci_conf *oci_conf_deser(const char *buf);
  */
 struct oci_conf *oci_conf_deser_file(const char *path);
 
+/*
+ * Deserialize the configuration of a pod from the file referred to by path.
+ * It has the format of an OCI configuration without "root", "process" and
+ * identifier mappings, and may only have new net, ipc and uts namespaces
+ */
+struct oci_conf *oci_pod_conf_deser_file(const char *path);
+
 /*
  * Serialize the process state into JSON
  */
@@ -98,10 +184,41 @@ struct oci_process_state *oci_process_state_deser(const char *buf);
 
 /*
  * Execute the given OCI hook, passing the process state into the
- * hook's standard input stream and awaiting it
+ * hook's standard input stream and awaiting it.
+ * Plugin hooks are called with the process state instead
  */
 int oci_hook_exec(struct oci_hook *hook, const struct oci_process_state *state);
 
+/*
+ * A running hook process
+ */
+struct oci_hook_proc {
+    pid_t ohp_pid;
+    int   ohp_pidfd;
+    /*
+     * Signal sent when the hook times out
+     */
+    int   ohp_sig;
+};
+
+/*
+ * Execute the given OCI hooks concurrently, each as soon as the hooks
+ * it runs after have finished. Timeouts apply to every hook on its own.
+ *
+ * Unless infallible is set, the first hook that fails kills the hooks
+ * that are still running and its error is returned
+ */
+int oci_hooks_exec_parallel(const struct oci_hooks *hooks, const struct oci_process_state *state,
+                            char infallible);
+
+/*
+ * Execute the hooks of one event of conf, in parallel if conf asks for it
+ * and one by one otherwise. Unless infallible is set, the first hook that
+ * fails stops the others
+ */
+int oci_event_hooks_exec(const struct oci_event_hooks *conf, const struct oci_hooks *hooks,
+                         const struct oci_process_state *state, char infallible);
+
 /*
  * Release the memory associated with the OCI configuration
  */
@@ -0,0 +1,108 @@
+#include "plugin.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <conty/hook.h>
+
+#include "log.h"
+#include "queue.h"
+
+struct plugin {
+    char                           *pl_path;
+    const struct conty_hook_plugin *pl_hook;
+    SLIST_ENTRY(plugin)             pl_next;
+};
+
+/*
+ * There are only ever a handful of plugins, a list will do
+ */
+static SLIST_HEAD(plugins, plugin) loaded = SLIST_HEAD_INITIALIZER(loaded);
+static pthread_mutex_t loaded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct conty_hook_plugin *plugin_load(const char *path)
+{
+    const struct conty_hook_plugin *hook;
+    struct plugin *pl;
+    void *handle;
+
+    if (!(pl = calloc(1, sizeof(struct plugin))) || !(pl->pl_path = strdup(path))) {
+        free(pl);
+        return log_fatal_ret(NULL, "out of memory");
+    }
+
+    /*
+     * Keep the symbols of the plugins to themselves so that two plugins
+     * built from the same sources don't end up calling into each other
+     */
+    if (!(handle = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+        LOG_ERROR("cannot load hook plugin %s: %s", path, dlerror());
+        goto err_free;
+    }
+
+    if (!(hook = dlsym(handle, CONTY_HOOK_PLUGIN_SYMBOL))) {
+        LOG_ERROR("%s is not a hook plugin", path);
+        goto err_close;
+    }
+
+    if (hook->chp_version != CONTY_HOOK_ABI_VERSION || !hook->chp_run) {
+        LOG_ERROR("hook plugin %s has version %u instead of %u", path,
+                  hook->chp_version, CONTY_HOOK_ABI_VERSION);
+        goto err_close;
+    }
+
+    pl->pl_hook = hook;
+    SLIST_INSERT_HEAD(&loaded, pl, pl_next);
+
+    return hook;
+
+err_close:
+    dlclose(handle);
+err_free:
+    free(pl->pl_path);
+    free(pl);
+    return NULL;
+}
+
+static const struct conty_hook_plugin *plugin_get(const char *path)
+{
+    const struct conty_hook_plugin *hook = NULL;
+    struct plugin *pl;
+
+    pthread_mutex_lock(&loaded_lock);
+
+    SLIST_FOREACH(pl, &loaded, pl_next) {
+        if (!strcmp(pl->pl_path, path)) {
+            hook = pl->pl_hook;
+            break;
+        }
+    }
+
+    if (!hook)
+        hook = plugin_load(path);
+
+    pthread_mutex_unlock(&loaded_lock);
+
+    return hook;
+}
+
+int conty_plugin_run(const char *path, const struct oci_process_state *state, char **argv)
+{
+    const struct conty_hook_plugin *hook;
+    struct conty_hook_state hs;
+
+    if (!(hook = plugin_get(path)))
+        return -ENOEXEC;
+
+    hs = (struct conty_hook_state) {
+        .chs_pid          = state->opst_pid,
+        .chs_container_id = state->opst_container_id,
+        .chs_rootfs       = state->opst_rootfs,
+        .chs_status       = state->opst_status,
+    };
+
+    return hook->chp_run(&hs, argv) == 0 ? 0 : -1;
+}
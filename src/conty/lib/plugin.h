@@ -0,0 +1,14 @@
+#ifndef CONTY_PLUGIN_H
+#define CONTY_PLUGIN_H
+
+#include "oci.h"
+
+/*
+ * Run the hook plugin in the shared object at path.
+ * Every shared object is loaded the first time one of its hooks runs and
+ * stays loaded for the lifetime of the process, so later containers only
+ * pay for the call
+ */
+int conty_plugin_run(const char *path, const struct oci_process_state *state, char **argv);
+
+#endif //CONTY_PLUGIN_H
@@ -0,0 +1,174 @@
+#include "pod.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "clone.h"
+#include "log.h"
+#include "namespace.h"
+#include "net.h"
+
+/*
+ * The holder only has to exist for the namespaces to, so it lets go of
+ * everything it inherited from the runtime and sleeps until it's killed
+ */
+static int pod_holder(void *arg)
+{
+    sigset_t set;
+
+    close_range(3, ~0U, 0);
+    prctl(PR_SET_NAME, "conty-pod", 0, 0, 0);
+
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+
+    for (;;)
+        pause();
+
+    return 0;
+}
+
+static void pod_kill(struct conty_pod *pod)
+{
+    if (pidfd_send_signal(pod->cp_pollfd, SIGKILL, NULL, 0) != 0)
+        LOG_WARN("cannot kill holder of pod %s", pod->cp_id);
+
+    while (waitpid(pod->cp_pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+
+    pod->cp_pid = 0;
+}
+
+static int pod_hostname(const struct conty_pod *pod)
+{
+    const char *hostname = pod->cp_conf->oc_hostname;
+    int saved[CONTY_NS_LEN], err = 0;
+
+    if ((err = conty_ns_enter(pod->cp_pollfd, CLONE_NEWUTS, saved)) != 0)
+        return err;
+
+    if (sethostname(hostname, strlen(hostname)) != 0)
+        err = log_error_ret(-errno, "cannot set hostname of pod %s", pod->cp_id);
+
+    conty_ns_leave(saved);
+
+    return err;
+}
+
+static int pod_hooks(const struct conty_pod *pod, const struct oci_hooks *hooks,
+                     const char *status, char infallible)
+{
+    MAKE_RESOURCE(oci_process_state_free) struct oci_process_state *state = NULL;
+
+    if (SLIST_EMPTY(hooks))
+        return 0;
+
+    state = calloc(1, sizeof(struct oci_process_state));
+    if (!state)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    /*
+     * Pods have no root filesystem, their hooks are given the bundle
+     */
+    state->opst_pid          = pod->cp_pid;
+    state->opst_rootfs       = strdup(pod->cp_bundle);
+    state->opst_container_id = strdup(pod->cp_id);
+    state->opst_status       = strdup(status);
+
+    if (!state->opst_rootfs || !state->opst_container_id || !state->opst_status)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    return oci_event_hooks_exec(&pod->cp_conf->oc_hooks, hooks, state, infallible);
+}
+
+struct conty_pod *conty_pod_create(const char *id, const char *bundle)
+{
+    POD_RESOURCE struct conty_pod *pod = NULL;
+    struct oci_namespace *ns;
+    struct oci_conf *conf;
+
+    pod = calloc(1, sizeof(struct conty_pod));
+    if (!pod)
+        return log_fatal_ret(NULL, "out of memory");
+
+    pod->cp_pollfd = -EBADF;
+
+    if (!(pod->cp_id = strdup(id)) || !(pod->cp_bundle = strdup(bundle)))
+        return log_fatal_ret(NULL, "out of memory");
+
+    if (!(pod->cp_conf = conf = oci_pod_conf_deser_file(bundle)))
+        return NULL;
+
+    SLIST_FOREACH(ns, &conf->oc_namespaces, ons_next)
+        pod->cp_ns |= conty_ns_flags[conty_ns_from_str(ns->ons_type)];
+
+    pod->cp_pid = clone3_cb(pod_holder, NULL, pod->cp_ns | CLONE_PIDFD, &pod->cp_pollfd);
+    if (pod->cp_pid < 0) {
+        pod->cp_pid = 0;
+        return log_error_ret(NULL, "cannot spawn holder of pod %s", id);
+    }
+
+    if (conf->oc_hostname && (pod->cp_ns & CLONE_NEWUTS) && pod_hostname(pod) != 0)
+        return NULL;
+
+    /*
+     * Once for all members
+     */
+    if (conf->oc_net.onet_bridge &&
+        conty_net_setup(&conf->oc_net, id, pod->cp_pollfd, pod->cp_veth) != 0)
+        return NULL;
+
+    if (pod_hooks(pod, &conf->oc_hooks.oehk_on_runtime_create, "created", 0) != 0) {
+        if (pod->cp_veth[0])
+            conty_net_teardown(&conf->oc_net, pod->cp_veth);
+        return NULL;
+    }
+
+    return move_ptr(pod);
+}
+
+int conty_pod_delete(struct conty_pod *pod)
+{
+    struct oci_conf *conf = pod->cp_conf;
+    int err;
+
+    if (pod->cp_members)
+        return log_error_ret(-EBUSY, "pod %s still has %u containers", pod->cp_id,
+                             pod->cp_members);
+
+    err = pod_hooks(pod, &conf->oc_hooks.oehk_on_container_stopped, "stopped", 1);
+
+    if (pod->cp_veth[0] && conty_net_teardown(&conf->oc_net, pod->cp_veth) != 0)
+        LOG_WARN("cannot disconnect pod %s from the network", pod->cp_id);
+
+    conty_pod_free(pod);
+    return err;
+}
+
+void conty_pod_free(struct conty_pod *pod)
+{
+    if (pod) {
+        if (pod->cp_pid > 0)
+            pod_kill(pod);
+        if (pod->cp_pollfd >= 0)
+            close(pod->cp_pollfd);
+        if (pod->cp_conf)
+            oci_conf_free(pod->cp_conf);
+        free(pod->cp_id);
+        free(pod->cp_bundle);
+        free(pod);
+    }
+}
+
+const char *conty_pod_id(const struct conty_pod *pod)
+{
+    return pod->cp_id;
+}
+
+pid_t conty_pod_pid(const struct conty_pod *pod)
+{
+    return pod->cp_pid;
+}
@@ -0,0 +1,39 @@
+#ifndef CONTY_POD_H
+#define CONTY_POD_H
+
+#include <conty/conty.h>
+
+#include <unistd.h>
+#include <net/if.h>
+
+#include "oci.h"
+#include "resource.h"
+
+struct conty_pod {
+    char            *cp_id;
+    char            *cp_bundle;
+    /*
+     * Holder process that owns the shared namespaces and does
+     * nothing else, and a pollable file descriptor for it
+     */
+    pid_t            cp_pid;
+    int              cp_pollfd;
+    /*
+     * Namespaces the members of the pod share
+     */
+    unsigned long    cp_ns;
+    /*
+     * Number of containers created in the pod and not yet deleted
+     */
+    unsigned int     cp_members;
+    /*
+     * Host's end of the pair the members share, see conty_net_setup
+     */
+    char             cp_veth[IFNAMSIZ];
+    struct oci_conf *cp_conf;
+};
+
+CREATE_CLEANER(struct conty_pod *, conty_pod_free);
+#define POD_RESOURCE MAKE_RESOURCE(conty_pod_free)
+
+#endif //CONTY_POD_H
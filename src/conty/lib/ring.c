@@ -0,0 +1,248 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+
+#include "log.h"
+
+#define load_acquire(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define load_relaxed(ptr)       __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define full_fence()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static size_t ring_capacity(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+    return cap;
+}
+
+static int ring_eventfd_open(void)
+{
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return (efd < 0) ? log_error_ret(-errno, "cannot create ring wakeup fd") : efd;
+}
+
+static void ring_eventfd_signal(int efd)
+{
+    uint64_t one = 1;
+    ssize_t tx;
+
+    do {
+        tx = write(efd, &one, sizeof(one));
+    } while (tx < 0 && errno == EINTR);
+}
+
+int conty_ring_eventfd_drain(int efd)
+{
+    uint64_t cnt;
+    ssize_t rx;
+
+    do {
+        rx = read(efd, &cnt, sizeof(cnt));
+    } while (rx < 0 && errno == EINTR);
+
+    return (rx < 0) ? -errno : 0;
+}
+
+int conty_ring_eventfd_wait(int efd, int timeout)
+{
+    int err;
+    struct pollfd pollfd = { .fd = efd, .events = POLLIN, .revents = 0 };
+
+    do {
+        err = poll(&pollfd, 1, timeout);
+    } while (err < 0 && errno == EINTR);
+
+    if (err < 0)
+        return -errno;
+
+    if (err == 0)
+        return -ETIMEDOUT;
+
+    return conty_ring_eventfd_drain(efd);
+}
+
+int conty_ring_init(struct conty_ring *ring, size_t capacity)
+{
+    size_t cap = ring_capacity(capacity);
+
+    ring->cr_head       = 0;
+    ring->cr_tail_cache = 0;
+    ring->cr_tail       = 0;
+    ring->cr_head_cache = 0;
+    ring->cr_mask       = cap - 1;
+
+    ring->cr_slots = calloc(cap, sizeof(void *));
+    if (!ring->cr_slots)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    if ((ring->cr_efd = ring_eventfd_open()) < 0) {
+        free(ring->cr_slots);
+        ring->cr_slots = NULL;
+        return ring->cr_efd;
+    }
+
+    return 0;
+}
+
+int conty_ring_push(struct conty_ring *ring, void *record)
+{
+    size_t tail = ring->cr_tail;
+
+    if (tail - ring->cr_head_cache > ring->cr_mask) {
+        ring->cr_head_cache = load_acquire(&ring->cr_head);
+        if (tail - ring->cr_head_cache > ring->cr_mask)
+            return -EAGAIN;
+    }
+
+    ring->cr_slots[tail & ring->cr_mask] = record;
+    store_release(&ring->cr_tail, tail + 1);
+
+    /*
+     * If the consumer had already consumed everything before our record,
+     * it is either asleep or about to go to sleep, so wake it up.
+     *
+     * The fence pairs with the one in conty_ring_pop: either we observe
+     * the consumer's head or the consumer observes our tail, so
+     * a wakeup is never lost
+     */
+    full_fence();
+    if (load_relaxed(&ring->cr_head) == tail)
+        ring_eventfd_signal(ring->cr_efd);
+
+    return 0;
+}
+
+void *conty_ring_pop(struct conty_ring *ring)
+{
+    size_t head = ring->cr_head;
+    void *record;
+
+    if (head == ring->cr_tail_cache) {
+        full_fence();
+        ring->cr_tail_cache = load_acquire(&ring->cr_tail);
+        if (head == ring->cr_tail_cache)
+            return NULL;
+    }
+
+    record = ring->cr_slots[head & ring->cr_mask];
+    store_release(&ring->cr_head, head + 1);
+
+    return record;
+}
+
+void conty_ring_free(struct conty_ring *ring)
+{
+    if (ring) {
+        if (ring->cr_efd >= 0)
+            close(ring->cr_efd);
+        free(ring->cr_slots);
+        ring->cr_slots = NULL;
+        ring->cr_efd = -EBADF;
+    }
+}
+
+int conty_mpsc_init(struct conty_mpsc *ring, size_t capacity)
+{
+    size_t cap = ring_capacity(capacity);
+
+    ring->cm_head = 0;
+    ring->cm_tail = 0;
+    ring->cm_mask = cap - 1;
+
+    ring->cm_slots = calloc(cap, sizeof(struct conty_mpsc_slot));
+    if (!ring->cm_slots)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    /*
+     * A slot is free for the producer that claims position pos
+     * if its sequence number equals pos, and holds a record for
+     * the consumer at position pos if it equals pos + 1
+     */
+    for (size_t i = 0; i < cap; i++)
+        ring->cm_slots[i].cms_seq = i;
+
+    if ((ring->cm_efd = ring_eventfd_open()) < 0) {
+        free(ring->cm_slots);
+        ring->cm_slots = NULL;
+        return ring->cm_efd;
+    }
+
+    return 0;
+}
+
+int conty_mpsc_push(struct conty_mpsc *ring, void *record)
+{
+    struct conty_mpsc_slot *slot;
+    size_t pos, seq;
+    intptr_t dif;
+
+    pos = load_relaxed(&ring->cm_tail);
+    for (;;) {
+        slot = &ring->cm_slots[pos & ring->cm_mask];
+        seq = load_acquire(&slot->cms_seq);
+        dif = (intptr_t) seq - (intptr_t) pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&ring->cm_tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            /*
+             * The consumer hasn't released this slot yet
+             */
+            return -EAGAIN;
+        } else {
+            pos = load_relaxed(&ring->cm_tail);
+        }
+    }
+
+    slot->cms_record = record;
+    store_release(&slot->cms_seq, pos + 1);
+
+    full_fence();
+    if (load_relaxed(&ring->cm_head) == pos)
+        ring_eventfd_signal(ring->cm_efd);
+
+    return 0;
+}
+
+void *conty_mpsc_pop(struct conty_mpsc *ring)
+{
+    size_t head = ring->cm_head;
+    struct conty_mpsc_slot *slot = &ring->cm_slots[head & ring->cm_mask];
+    void *record;
+
+    if (load_acquire(&slot->cms_seq) != head + 1) {
+        full_fence();
+        if (load_acquire(&slot->cms_seq) != head + 1)
+            return NULL;
+    }
+
+    record = slot->cms_record;
+    /*
+     * Hand the slot back to the producer that will claim it
+     * on the next lap around the ring
+     */
+    store_release(&slot->cms_seq, head + ring->cm_mask + 1);
+    store_release(&ring->cm_head, head + 1);
+
+    return record;
+}
+
+void conty_mpsc_free(struct conty_mpsc *ring)
+{
+    if (ring) {
+        if (ring->cm_efd >= 0)
+            close(ring->cm_efd);
+        free(ring->cm_slots);
+        ring->cm_slots = NULL;
+        ring->cm_efd = -EBADF;
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef CONTY_RING_H
+#define CONTY_RING_H
+
+#include <stddef.h>
+
+/*
+ * Size of a cache line on the architectures we're targeting.
+ * Indices owned by different threads live on separate cache lines
+ * so that the producer and the consumer don't keep invalidating
+ * each other's caches (false sharing)
+ */
+#define CONTY_CACHELINE_SIZE 64
+
+#define __cacheline_aligned __attribute__((aligned(CONTY_CACHELINE_SIZE)))
+
+/*
+ * Bounded lock-free single-producer/single-consumer ring of pointers
+ *
+ * The ring is paired with an eventfd that becomes readable whenever
+ * the ring transitions from empty to non-empty. A consumer can therefore
+ * register the descriptor with an event loop, drain it once it becomes
+ * readable and pop records until the ring is empty again without ever
+ * missing a wakeup.
+ */
+struct conty_ring {
+    /*
+     * Consumer side.
+     * The consumer caches the last tail it observed to avoid touching
+     * the producer's cache line on every pop
+     */
+    struct {
+        size_t cr_head;
+        size_t cr_tail_cache;
+    } __cacheline_aligned;
+    /*
+     * Producer side
+     */
+    struct {
+        size_t cr_tail;
+        size_t cr_head_cache;
+    } __cacheline_aligned;
+    /*
+     * Read-only after initialisation
+     */
+    struct {
+        size_t  cr_mask;
+        void  **cr_slots;
+        int     cr_efd;
+    } __cacheline_aligned;
+};
+
+/*
+ * Initialise a ring that holds at least capacity records
+ * The capacity is rounded up to the next power of two
+ */
+int conty_ring_init(struct conty_ring *ring, size_t capacity);
+
+/*
+ * Enqueue a record
+ * Returns -EAGAIN if the ring is full. Must only be called by the producer
+ */
+int conty_ring_push(struct conty_ring *ring, void *record);
+
+/*
+ * Dequeue a record
+ * Returns NULL if the ring is empty. Must only be called by the consumer
+ */
+void *conty_ring_pop(struct conty_ring *ring);
+
+/*
+ * Release the resources held by the ring
+ * Records that are still enqueued are not touched
+ */
+void conty_ring_free(struct conty_ring *ring);
+
+static inline int conty_ring_fd(const struct conty_ring *ring)
+{
+    return ring->cr_efd;
+}
+
+/*
+ * Bounded lock-free multi-producer/single-consumer ring of pointers
+ *
+ * Producers claim slots by advancing the tail with a compare and swap
+ * and publish records through a per-slot sequence number, so a producer
+ * that is preempted between claiming and publishing a slot never blocks
+ * the others. Wakeups work the same way as with the single-producer ring
+ */
+struct conty_mpsc_slot {
+    size_t  cms_seq;
+    void   *cms_record;
+};
+
+struct conty_mpsc {
+    struct {
+        size_t cm_head;
+    } __cacheline_aligned;
+    struct {
+        size_t cm_tail;
+    } __cacheline_aligned;
+    struct {
+        size_t                  cm_mask;
+        struct conty_mpsc_slot *cm_slots;
+        int                     cm_efd;
+    } __cacheline_aligned;
+};
+
+int conty_mpsc_init(struct conty_mpsc *ring, size_t capacity);
+
+/*
+ * Enqueue a record
+ * Returns -EAGAIN if the ring is full. Safe to call from any thread
+ */
+int conty_mpsc_push(struct conty_mpsc *ring, void *record);
+
+/*
+ * Dequeue a record
+ * Returns NULL if the ring is empty. Must only be called by the consumer
+ */
+void *conty_mpsc_pop(struct conty_mpsc *ring);
+
+void conty_mpsc_free(struct conty_mpsc *ring);
+
+static inline int conty_mpsc_fd(const struct conty_mpsc *ring)
+{
+    return ring->cm_efd;
+}
+
+/*
+ * Reset the wakeup file descriptor of a ring after it became readable
+ * The consumer must pop records until the ring is empty afterwards
+ */
+int conty_ring_eventfd_drain(int efd);
+
+/*
+ * Block until the wakeup file descriptor of a ring becomes readable
+ * or timeout milliseconds have passed, and reset it
+ */
+int conty_ring_eventfd_wait(int efd, int timeout);
+
+#endif //CONTY_RING_H
@@ -1,11 +1,18 @@
 #include "sync.h"
 
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+
 int conty_sync_wait(int fd, int event)
 {
     int tmp = -1;
     ssize_t rx;
 
     rx = conty_sync_read(fd, &tmp, sizeof(int));
+    if (rx == -EAGAIN)
+        return -EAGAIN;
+
     if (rx < 0)
         return log_error_ret(rx, "event could not be awaited");
 
@@ -33,4 +40,162 @@ int conty_sync_wake(int fd, int event)
         return log_error_ret(-EMSGSIZE, "woke child with unexpected event");
 
     return 0;
-}
\ No newline at end of file
+}
+
+ssize_t conty_sync_wait_data(int fd, int event, void *data, size_t len)
+{
+    int tmp = -1;
+    ssize_t rx;
+    struct iovec iov[2] = {
+            { .iov_base = &tmp, .iov_len = sizeof(tmp) },
+            { .iov_base = data, .iov_len = len }
+    };
+
+    /*
+     * Both come in a single write, so they're mostly read in one go. Peers that
+     * have nothing to say send the event alone
+     */
+    do {
+        rx = readv(fd, iov, 2);
+    } while (rx < 0 && errno == EINTR);
+
+    if (rx < 0 && errno == EAGAIN)
+        return -EAGAIN;
+
+    if (rx < 0)
+        return log_error_ret(-errno, "event could not be awaited");
+
+    if (rx == 0)
+        return -ENODATA;
+
+    if (rx < (ssize_t) sizeof(int) || tmp != event)
+        return log_error_ret(-EMSGSIZE, "wait returned unexpected event");
+
+    if ((rx -= (ssize_t) sizeof(int)) == 0)
+        return 0;
+
+    /*
+     * The stream may still hand the data over in pieces. The peer wrote
+     * all of it already, so on a non-blocking descriptor we wait for the rest
+     */
+    for (size_t got = (size_t) rx; got < len; got += (size_t) rx) {
+        rx = conty_sync_read(fd, (char *) data + got, len - got);
+        if (rx == -EAGAIN) {
+            struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pollfd, 1, -1) < 0 && errno != EINTR)
+                return log_error_ret(-errno, "cannot wait for the rest of the data");
+            rx = 0;
+            continue;
+        }
+
+        if (rx < 0)
+            return log_error_ret(rx, "data could not be read");
+
+        if (rx == 0)
+            return log_error_ret(-EMSGSIZE, "peer sent %zu of %zu bytes of data", got, len);
+    }
+
+    return (ssize_t) len;
+}
+
+int conty_sync_wake_data(int fd, int event, const void *data, size_t len)
+{
+    ssize_t tx;
+    struct iovec iov[2] = {
+            { .iov_base = &event, .iov_len = sizeof(event) },
+            { .iov_base = (void *) data, .iov_len = len }
+    };
+
+    do {
+        tx = writev(fd, iov, 2);
+    } while (tx < 0 && errno == EINTR);
+
+    if (tx < 0)
+        return log_error_ret(-errno, "could not wake peer with event");
+
+    if (tx != (ssize_t) (sizeof(int) + len))
+        return log_error_ret(-EMSGSIZE, "woke peer with partial event");
+
+    return 0;
+}
+
+/*
+ * Room for exactly one file descriptor, aligned as the kernel expects it
+ */
+union sync_cmsg {
+    char           buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+};
+
+int conty_sync_wait_fd(int fd, int event, int *payload)
+{
+    int tmp = -1;
+    ssize_t rx;
+    union sync_cmsg cmsg;
+    struct cmsghdr *hdr;
+    struct iovec iov = { .iov_base = &tmp, .iov_len = sizeof(tmp) };
+    struct msghdr msg = {
+            .msg_iov        = &iov,
+            .msg_iovlen     = 1,
+            .msg_control    = cmsg.buf,
+            .msg_controllen = sizeof(cmsg.buf),
+    };
+
+    *payload = -EBADF;
+
+    do {
+        rx = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (rx < 0 && errno == EINTR);
+
+    if (rx < 0)
+        return log_error_ret(-errno, "event could not be awaited");
+
+    if (rx == 0)
+        return -ENODATA;
+
+    hdr = CMSG_FIRSTHDR(&msg);
+    if (hdr && hdr->cmsg_level == SOL_SOCKET && hdr->cmsg_type == SCM_RIGHTS)
+        memcpy(payload, CMSG_DATA(hdr), sizeof(int));
+
+    if (rx != sizeof(int) || tmp != event || *payload < 0) {
+        if (*payload >= 0)
+            close(*payload);
+        *payload = -EBADF;
+        return log_error_ret(-EMSGSIZE, "wait returned unexpected event");
+    }
+
+    return 0;
+}
+
+int conty_sync_wake_fd(int fd, int event, int payload)
+{
+    ssize_t tx;
+    union sync_cmsg cmsg;
+    struct cmsghdr *hdr;
+    struct iovec iov = { .iov_base = &event, .iov_len = sizeof(event) };
+    struct msghdr msg = {
+            .msg_iov        = &iov,
+            .msg_iovlen     = 1,
+            .msg_control    = cmsg.buf,
+            .msg_controllen = sizeof(cmsg.buf),
+    };
+
+    memset(cmsg.buf, 0, sizeof(cmsg.buf));
+    hdr = CMSG_FIRSTHDR(&msg);
+    hdr->cmsg_level = SOL_SOCKET;
+    hdr->cmsg_type  = SCM_RIGHTS;
+    hdr->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(hdr), &payload, sizeof(int));
+
+    do {
+        tx = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (tx < 0 && errno == EINTR);
+
+    if (tx < 0)
+        return log_error_ret(-errno, "could not wake peer with event");
+
+    if (tx != sizeof(int))
+        return log_error_ret(-EMSGSIZE, "woke child with unexpected event");
+
+    return 0;
+}
@@ -17,7 +17,8 @@ enum {
     EVENT_CONT_START,
     EVENT_CONT_STARTED,
     EVENT_CONT_STOP,
-    EVENT_CONT_STOPPED
+    EVENT_CONT_STOPPED,
+    EVENT_ID_MAPPED
 };
 
 static inline const char *conty_sync_event_str(int event)
@@ -41,6 +42,8 @@ static inline const char *conty_sync_event_str(int event)
             return "EVENT_CONTAINER_STOP";
         case EVENT_CONT_STOPPED:
             return "EVENT_CONTAINER_STOPPED";
+        case EVENT_ID_MAPPED:
+            return "EVENT_ID_MAPPED";
         default:
             return "EVENT_UNKNOWN";
     }
@@ -114,6 +117,28 @@ int conty_sync_wait(int fd, int event);
  */
 int conty_sync_wake(int fd, int event);
 
+/*
+ * Wait for a particular event that carries a file descriptor from the peer
+ */
+int conty_sync_wait_fd(int fd, int event, int *payload);
+
+/*
+ * Wake the peer with an event and pass it a file descriptor along with it
+ */
+int conty_sync_wake_fd(int fd, int event, int payload);
+
+/*
+ * Wait for a particular event from the peer, followed by either no data at all
+ * or exactly len bytes of it. Returns how many bytes of data came along with the
+ * event, and fails with -EMSGSIZE if the peer hung up halfway through the data
+ */
+ssize_t conty_sync_wait_data(int fd, int event, void *data, size_t len);
+
+/*
+ * Wake the peer with an event followed by len bytes of data
+ */
+int conty_sync_wake_data(int fd, int event, const void *data, size_t len);
+
 /*
  * Wait for a particular event from the runtime
  */
@@ -132,6 +157,25 @@ static inline int conty_sync_await_container(int fds[2], int event)
     return conty_sync_wait(fds[SYNC_FD_RT], event);
 }
 
+/*
+ * Wait for a particular event from the container that may carry data
+ */
+static inline ssize_t conty_sync_await_container_data(int fds[2], int event, void *data,
+                                                      size_t len)
+{
+    LOG_TRACE("Parent awaiting event %s with data", conty_sync_event_str(event));
+    return conty_sync_wait_data(fds[SYNC_FD_RT], event, data, len);
+}
+
+/*
+ * Wait for a particular event from the runtime that carries a file descriptor
+ */
+static inline int conty_sync_await_runtime_fd(int fds[2], int event, int *payload)
+{
+    LOG_TRACE("Child awaiting event %s with descriptor", conty_sync_event_str(event));
+    return conty_sync_wait_fd(fds[SYNC_FD_CONT], event, payload);
+}
+
 /*
  * Wake the runtime with an event
  */
@@ -141,6 +185,16 @@ static inline int conty_sync_wake_runtime(int fds[2], int event)
     return conty_sync_wake(fds[SYNC_FD_CONT], event);
 }
 
+/*
+ * Wake the runtime with an event and pass it data along with it
+ */
+static inline int conty_sync_wake_runtime_data(int fds[2], int event, const void *data,
+                                               size_t len)
+{
+    LOG_TRACE("Child waking parent with event %s and data", conty_sync_event_str(event));
+    return conty_sync_wake_data(fds[SYNC_FD_CONT], event, data, len);
+}
+
 /*
  * Wake the container with an event
  */
@@ -150,6 +204,16 @@ static inline int conty_sync_wake_container(int fds[2], int event)
     return conty_sync_wake(fds[SYNC_FD_RT], event);
 }
 
+/*
+ * Wake the container with an event and pass it a file descriptor
+ */
+static inline int conty_sync_wake_container_fd(int fds[2], int event, int payload)
+{
+    LOG_TRACE("Parent waking child with event %s and descriptor",
+              conty_sync_event_str(event));
+    return conty_sync_wake_fd(fds[SYNC_FD_RT], event, payload);
+}
+
 /*
  * Synchronise state with the runtime
  */
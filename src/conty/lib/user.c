@@ -57,21 +57,31 @@ int conty_id_map_write_gids(const struct conty_id_map *map)
     return conty_id_map_write_path(map, "/proc/self/gid_map");
 }
 
-static int conty_id_map_write_ocids(const struct oci_ids *ids,
-                                    int (*cb)(const struct conty_id_map *map))
+int conty_id_map_from_oci(struct conty_id_map *map, const struct oci_ids *ids)
 {
     int err;
     struct oci_id_mapping *cur, *tmp;
-    struct conty_id_map map;
 
-    conty_id_map_init(&map);
+    conty_id_map_init(map);
 
     SLIST_FOREACH_SAFE(cur, ids, oid_next, tmp) {
-        err = conty_id_map_put(&map, cur->oid_container, cur->oid_host, cur->oid_count);
+        err = conty_id_map_put(map, cur->oid_container, cur->oid_host, cur->oid_count);
         if (err != 0)
             return err;
     }
 
+    return 0;
+}
+
+static int conty_id_map_write_ocids(const struct oci_ids *ids,
+                                    int (*cb)(const struct conty_id_map *map))
+{
+    int err;
+    struct conty_id_map map;
+
+    if ((err = conty_id_map_from_oci(&map, ids)) != 0)
+        return err;
+
     return cb(&map);
 }
 
@@ -85,6 +95,15 @@ int conty_id_map_write_oci_gids(const struct oci_ids *ids)
     return conty_id_map_write_ocids(ids, conty_id_map_write_gids);
 }
 
+static int conty_id_disable_setgroups_fd(int fd)
+{
+    char buf[] = "deny";
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+        return -1;
+
+    return 0;
+}
+
 int conty_id_disable_setgroups()
 {
     FD_RESOURCE int fd = -EBADF;
@@ -93,9 +112,40 @@ int conty_id_disable_setgroups()
     if (fd < 0)
         return -errno;
 
-    char buf[] = "deny";
-    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
-        return -1;
+    return conty_id_disable_setgroups_fd(fd);
+}
 
-    return 0;
+int conty_id_map_write_at(int procfd, const struct conty_id_map *uids,
+                          const struct conty_id_map *gids)
+{
+    int err;
+    FD_RESOURCE int uidfd = -EBADF, setgroupsfd = -EBADF, gidfd = -EBADF;
+
+    /*
+     * Single component lookups relative to the process directory,
+     * rather than walking /proc/self/... three times
+     */
+    uidfd = openat(procfd, "uid_map", O_WRONLY | O_CLOEXEC);
+    if (uidfd < 0)
+        return log_error_ret(-errno, "cannot open uid_map");
+
+    setgroupsfd = openat(procfd, "setgroups", O_WRONLY | O_CLOEXEC);
+    if (setgroupsfd < 0)
+        return log_error_ret(-errno, "cannot open setgroups");
+
+    gidfd = openat(procfd, "gid_map", O_WRONLY | O_CLOEXEC);
+    if (gidfd < 0)
+        return log_error_ret(-errno, "cannot open gid_map");
+
+    if ((err = conty_id_map_write_fd(uids, uidfd)) != 0)
+        return err;
+
+    /*
+     * Same order as inside the container: setgroups must be denied
+     * before an unprivileged process may write gid_map
+     */
+    if ((err = conty_id_disable_setgroups_fd(setgroupsfd)) != 0)
+        return log_error_ret(err, "cannot disable setgroups");
+
+    return conty_id_map_write_fd(gids, gidfd);
 }
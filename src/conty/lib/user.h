@@ -53,4 +53,19 @@ int conty_id_map_write_oci_gids(const struct oci_ids *ids);
  */
 int conty_id_disable_setgroups();
 
+/*
+ * Format the OCI identifier mappings into the map, so that they can be
+ * written with a single system call later on
+ */
+int conty_id_map_from_oci(struct conty_id_map *map, const struct oci_ids *ids);
+
+/*
+ * Write the uid mappings, disallow setgroups and write the gid mappings
+ * of another process, given a file descriptor to its /proc/<pid> directory
+ *
+ * The caller must live in the parent user namespace of the process
+ */
+int conty_id_map_write_at(int procfd, const struct conty_id_map *uids,
+                          const struct conty_id_map *gids);
+
 #endif //CONTY_USER_H
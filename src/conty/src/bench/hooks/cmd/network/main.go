@@ -2,6 +2,7 @@ package main
 
 import (
 	"flag"
+	"fmt"
 	"log"
 	"net"
 	"os"
@@ -25,49 +26,93 @@ func (i *ipAddresses) String() string {
 	return "192.168.0.101/24"
 }
 
-var (
-	module       string
-	bridge       string
-	bridgeIps    ipAddresses
-	containerIps ipAddresses
-	deleteBridge bool
-)
+// Builds the hook from the command line, or from the arguments of a
+// request when serving the runtime over a socket
+func parseHook(name string, args []string, errorHandling flag.ErrorHandling) (hooks.Hook, string, error) {
+	var (
+		module       string
+		bridge       string
+		bridgeIps    ipAddresses
+		containerIps ipAddresses
+		deleteBridge bool
+		listen       string
+	)
 
-func main() {
-	flag.StringVar(
+	flags := flag.NewFlagSet(name, errorHandling)
+	flags.StringVar(
 		&module,
 		"module",
 		"shared-bridge",
 		"The network module to use for connecting the container",
 	)
-	flag.StringVar(
+	flags.StringVar(
 		&bridge,
 		"bridge-name",
 		"",
 		"The name of the bridge to connect the container to",
 	)
-	flag.Var(&bridgeIps, "bridge-ips", "IP addresses of the form <ip>/<prefix>")
-	flag.Var(&containerIps, "container-ips", "IP addresses of the form <ip>/<prefix>")
-	flag.BoolVar(&deleteBridge, "delete-bridge", false, "Delete bridge if the container stops")
-	flag.Parse()
+	flags.Var(&bridgeIps, "bridge-ips", "IP addresses of the form <ip>/<prefix>")
+	flags.Var(&containerIps, "container-ips", "IP addresses of the form <ip>/<prefix>")
+	flags.BoolVar(&deleteBridge, "delete-bridge", false, "Delete bridge if the container stops")
+	flags.StringVar(
+		&listen,
+		"listen",
+		"",
+		"Serve the runtime on this Unix socket instead of handling a single event",
+	)
+	if err := flags.Parse(args); err != nil {
+		return nil, "", err
+	}
 
-	var hook hooks.Hook
+	if listen != "" {
+		return nil, listen, nil
+	}
 
 	switch module {
 	case "shared-bridge":
 		if bridge == "" {
-			log.Fatal("shared-bridge module requires bridge-name to be specified")
+			return nil, "", fmt.Errorf("shared-bridge module requires bridge-name to be specified")
 		}
-		hook = &hooks.BridgeHook{
+		return &hooks.BridgeHook{
 			Bridge:             bridge,
 			BridgeAddresses:    bridgeIps,
 			ContainerAddresses: containerIps,
-		}
+		}, "", nil
 	default:
-		log.Fatalf("module %s not supported", module)
+		return nil, "", fmt.Errorf("module %s not supported", module)
 	}
+}
 
-	if err := hooks.Run(hook, os.Stdin); err != nil {
+func main() {
+	hook, listen, err := parseHook(os.Args[0], os.Args[1:], flag.ExitOnError)
+	if err != nil {
 		log.Fatal(err)
 	}
+
+	if listen == "" {
+		if err := hooks.Run(hook, os.Stdin); err != nil {
+			log.Fatal(err)
+		}
+		return
+	}
+
+	// Keep the netlink handles and the process around between events,
+	// requests carry the same arguments the hook would be executed with
+	os.Remove(listen)
+	listener, err := net.Listen("unix", listen)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	log.Fatal(hooks.Serve(listener, func(args []string) (hooks.Hook, error) {
+		// Like the command line, the arguments start with the name of the hook
+		if len(args) > 0 {
+			args = args[1:]
+		}
+		hook, _, err := parseHook(os.Args[0], args, flag.ContinueOnError)
+		if err == nil && hook == nil {
+			err = fmt.Errorf("requests cannot start servers")
+		}
+		return hook, err
+	}))
 }
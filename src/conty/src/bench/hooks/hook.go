@@ -18,6 +18,11 @@ func Run(hook Hook, stateReader io.Reader) error {
 		return err
 	}
 
+	return RunState(hook, state)
+}
+
+// Runs the callback of the hook for the status of the container
+func RunState(hook Hook, state ContainerState) error {
 	var cb func(ContainerState) error
 
 	switch state.Status {
@@ -29,6 +34,8 @@ func Run(hook Hook, stateReader io.Reader) error {
 		cb = hook.OnContainerRunning
 	case ContainerStatusStopped:
 		cb = hook.OnContainerStopped
+	default:
+		return ErrContainerStateInvalid
 	}
 
 	return cb(state)
@@ -0,0 +1,102 @@
+package hooks
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"encoding/json"
+	"errors"
+	"io"
+	"log"
+	"net"
+	"sync"
+)
+
+var ErrRequestInvalid = errors.New("invalid hook request")
+
+// Largest request we are willing to read, the state and a few arguments
+// are nowhere near that
+const maxRequestLen = 1 << 20
+
+// Serve accepts connections from the runtime on the listener, see
+// include/conty/hook.h for the protocol. Every request is handled by its own
+// goroutine with the hook newHook builds from the arguments of the request,
+// so slow requests don't hold up the others on the same connection
+func Serve(listener net.Listener, newHook func(args []string) (Hook, error)) error {
+	for {
+		conn, err := listener.Accept()
+		if err != nil {
+			return err
+		}
+		go serveConn(conn, newHook)
+	}
+}
+
+func serveConn(conn net.Conn, newHook func(args []string) (Hook, error)) {
+	defer conn.Close()
+
+	var writeLock sync.Mutex
+	reader := bufio.NewReader(conn)
+
+	for {
+		var header [8]byte
+		if _, err := io.ReadFull(reader, header[:]); err != nil {
+			return
+		}
+
+		length := binary.LittleEndian.Uint32(header[0:4])
+		tag := binary.LittleEndian.Uint32(header[4:8])
+		if length > maxRequestLen {
+			log.Printf("request of %d bytes is too large", length)
+			return
+		}
+
+		payload := make([]byte, length)
+		if _, err := io.ReadFull(reader, payload); err != nil {
+			return
+		}
+
+		go func() {
+			var status int32
+
+			if err := handleRequest(payload, newHook); err != nil {
+				log.Printf("hook failed: %v", err)
+				status = 1
+			}
+
+			var reply [12]byte
+			binary.LittleEndian.PutUint32(reply[0:4], 4)
+			binary.LittleEndian.PutUint32(reply[4:8], tag)
+			binary.LittleEndian.PutUint32(reply[8:12], uint32(status))
+
+			writeLock.Lock()
+			defer writeLock.Unlock()
+			conn.Write(reply[:])
+		}()
+	}
+}
+
+func handleRequest(payload []byte, newHook func(args []string) (Hook, error)) error {
+	// The state comes first, followed by the NUL-terminated arguments
+	fields := bytes.Split(payload, []byte{0})
+	if len(fields) < 2 || len(fields[len(fields)-1]) != 0 {
+		return ErrRequestInvalid
+	}
+
+	var state ContainerState
+	if err := json.Unmarshal(fields[0], &state); err != nil {
+		return ErrContainerStateInvalid
+	}
+
+	args := make([]string, 0, len(fields)-2)
+	for _, arg := range fields[1 : len(fields)-1] {
+		args = append(args, string(arg))
+	}
+
+	hook, err := newHook(args)
+	if err != nil {
+		return err
+	}
+
+	return RunState(hook, state)
+}
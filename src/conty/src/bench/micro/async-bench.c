@@ -0,0 +1,232 @@
+#include "container.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "bench.h"
+
+#define ASYNC_BENCH_DIR        "/tmp/conty-async-bench"
+#define ASYNC_BENCH_CONTAINERS 32
+
+/*
+ * New network namespaces take a while, mostly spent
+ * waiting in the kernel rather than running
+ */
+static const char *conf =
+    "{"
+    "  \"process\": { \"args\": [\"%s\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\" }, { \"type\": \"uts\" }, { \"type\": \"ipc\" }]%s"
+    "}";
+
+/*
+ * Runs in the container process while it's being set up,
+ * standing in for anything it might have to wait for
+ */
+static const char *slow_hooks =
+    ","
+    "  \"hooks\": {"
+    "    \"on_container_created\": [{"
+    "      \"path\": \"/bin/sleep\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sleep\", \"0.02\"]"
+    "    }]"
+    "  }";
+
+struct job {
+    struct conty_container *j_cc;
+    char                    j_id[32];
+    int                     j_done;
+    int                     j_err;
+};
+
+static int write_conf(const char *path, const char *process, const char *hooks)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, conf, process, hooks);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static void job_done(struct conty_container *cc, int err, void *data)
+{
+    struct job *job = (struct job *) data;
+
+    job->j_done = 1;
+    job->j_err  = err;
+}
+
+/*
+ * Advances every container whose descriptor is readable until all jobs
+ * are done. The descriptor of a container that exec'd stays readable,
+ * so it's only watched while something is in flight
+ */
+static int drive(int epfd, struct job *jobs, size_t njobs)
+{
+    struct epoll_event events[ASYNC_BENCH_CONTAINERS], ev;
+    size_t pending = njobs;
+    struct job *job;
+    int nfds, fd;
+
+    for (size_t i = 0; i < njobs; i++) {
+        ev = (struct epoll_event) { .events = EPOLLIN, .data.ptr = &jobs[i] };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, conty_container_syncfd(jobs[i].j_cc), &ev) != 0)
+            return log_error_ret(-1, "cannot watch %s", jobs[i].j_id);
+    }
+
+    while (pending > 0) {
+        if ((nfds = epoll_wait(epfd, events, ASYNC_BENCH_CONTAINERS, 5000)) <= 0)
+            return log_error_ret(-1, "containers stopped making progress");
+
+        for (int i = 0; i < nfds; i++) {
+            job = (struct job *) events[i].data.ptr;
+            fd  = conty_container_syncfd(job->j_cc);
+
+            if (conty_container_advance(job->j_cc) == -EAGAIN)
+                continue;
+
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            pending--;
+
+            if (!job->j_done)
+                return log_error_ret(-1, "%s was done without calling back", job->j_id);
+            job->j_done = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int reap(struct conty_container *cc)
+{
+    pid_t pid = conty_container_pid(cc);
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "container %s did not exit cleanly", conty_container_id(cc));
+
+    conty_container_set_status(cc, CONTY_STOPPED);
+    return conty_container_delete(cc);
+}
+
+static double run_blocking(const char *bundle)
+{
+    struct conty_container *cc[ASYNC_BENCH_CONTAINERS];
+    char id[32];
+    double start;
+
+    start = now_ms();
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        snprintf(id, sizeof(id), "blocking-%d", i);
+        if (!(cc[i] = conty_container_create(id, bundle)))
+            return log_error_ret(-1, "cannot create %s", id);
+    }
+
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        if (conty_container_start(cc[i]) != 0)
+            return log_error_ret(-1, "cannot start %s", conty_container_id(cc[i]));
+    }
+    start = now_ms() - start;
+
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        if (reap(cc[i]) != 0)
+            return -1;
+    }
+
+    return start;
+}
+
+static double run_async(int epfd, const char *bundle)
+{
+    struct job jobs[ASYNC_BENCH_CONTAINERS];
+    double start;
+
+    memset(jobs, 0, sizeof(jobs));
+
+    start = now_ms();
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        snprintf(jobs[i].j_id, sizeof(jobs[i].j_id), "async-%d", i);
+
+        jobs[i].j_cc = conty_container_create_async(NULL, jobs[i].j_id, bundle, job_done,
+                                                    &jobs[i]);
+        if (!jobs[i].j_cc)
+            return log_error_ret(-1, "cannot create %s", jobs[i].j_id);
+    }
+
+    if (drive(epfd, jobs, ASYNC_BENCH_CONTAINERS) != 0)
+        return -1;
+
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        if (jobs[i].j_err != 0)
+            return log_error_ret(-1, "%s was not created", jobs[i].j_id);
+
+        if (conty_container_start_async(jobs[i].j_cc) != 0)
+            return log_error_ret(-1, "cannot start %s", jobs[i].j_id);
+    }
+
+    if (drive(epfd, jobs, ASYNC_BENCH_CONTAINERS) != 0)
+        return -1;
+    start = now_ms() - start;
+
+    for (int i = 0; i < ASYNC_BENCH_CONTAINERS; i++) {
+        if (jobs[i].j_err != 0)
+            return log_error_ret(-1, "%s was not started", jobs[i].j_id);
+
+        if (reap(jobs[i].j_cc) != 0)
+            return -1;
+    }
+
+    return start;
+}
+
+static int compare(int epfd, const char *name, const char *bundle)
+{
+    double blocking_ms, async_ms;
+
+    if ((blocking_ms = run_blocking(bundle)) < 0 || (async_ms = run_async(epfd, bundle)) < 0)
+        return -1;
+
+    printf("%d %s containers created and started\n", ASYNC_BENCH_CONTAINERS, name);
+    printf("  one after the other: %.3f ms\n", blocking_ms);
+    printf("  all at once:         %.3f ms\n", async_ms);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+    int epfd;
+
+    if (system("rm -rf " ASYNC_BENCH_DIR " && mkdir -p " ASYNC_BENCH_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", ASYNC_BENCH_DIR);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        goto out;
+
+    if (write_conf(ASYNC_BENCH_DIR "/true.json", "/bin/true", "") != 0 ||
+        write_conf(ASYNC_BENCH_DIR "/slow.json", "/bin/true", slow_hooks) != 0)
+        goto out_epfd;
+
+    if (compare(epfd, "plain", ASYNC_BENCH_DIR "/true.json") != 0 ||
+        compare(epfd, "slow", ASYNC_BENCH_DIR "/slow.json") != 0)
+        goto out_epfd;
+
+    ret = EXIT_SUCCESS;
+out_epfd:
+    close(epfd);
+out:
+    if (system("rm -rf " ASYNC_BENCH_DIR) != 0)
+        LOG_WARN("cannot remove %s", ASYNC_BENCH_DIR);
+
+    return ret;
+}
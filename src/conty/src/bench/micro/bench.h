@@ -0,0 +1,13 @@
+#ifndef CONTY_BENCH_H
+#define CONTY_BENCH_H
+
+#include <time.h>
+
+static inline double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+#endif //CONTY_BENCH_H
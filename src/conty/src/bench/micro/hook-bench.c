@@ -0,0 +1,122 @@
+#include "oci.h"
+
+#include <endian.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <conty/hook.h>
+
+#include "log.h"
+#include "bench.h"
+
+/*
+ * Path of the shared object built from tests/plugin-test-hook.c
+ */
+#ifndef HOOK_BENCH_PLUGIN
+#define HOOK_BENCH_PLUGIN "./hook-bench-plugin.so"
+#endif
+
+#define HOOK_BENCH_SOCK   "/tmp/conty-hook-bench.sock"
+#define HOOK_BENCH_ROUNDS 1000
+
+static struct oci_process_state bench_state = {
+        .opst_container_id = "some-container",
+        .opst_pid = 50,
+        .opst_rootfs = "/path/to/bundle",
+        .opst_status = "created"
+};
+
+/*
+ * Says yes to every request of a single connection
+ */
+static int serve(int lfd)
+{
+    static char buf[1 << 16];
+    struct conty_hook_frame frame;
+    struct {
+        struct conty_hook_frame frame;
+        int32_t status;
+    } msg = { .frame = { .chf_len = htole32(CONTY_HOOK_REPLY_LEN) } };
+    int cfd;
+
+    if ((cfd = accept(lfd, NULL, NULL)) < 0)
+        return 1;
+
+    while (recv(cfd, &frame, sizeof(frame), MSG_WAITALL) == sizeof(frame) &&
+           le32toh(frame.chf_len) <= sizeof(buf) &&
+           recv(cfd, buf, le32toh(frame.chf_len), MSG_WAITALL) == (ssize_t) le32toh(frame.chf_len)) {
+        msg.frame.chf_tag = frame.chf_tag;
+        if (write(cfd, &msg, sizeof(msg)) != sizeof(msg))
+            return 1;
+    }
+
+    return 0;
+}
+
+static pid_t start_server(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = HOOK_BENCH_SOCK };
+    int lfd;
+    pid_t pid;
+
+    unlink(HOOK_BENCH_SOCK);
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(lfd, 1) != 0)
+        return log_error_ret(-1, "cannot listen on %s", HOOK_BENCH_SOCK);
+
+    if ((pid = fork()) == 0)
+        _exit(serve(lfd));
+
+    close(lfd);
+    return pid;
+}
+
+static double per_call_us(struct oci_hook *hook, int rounds)
+{
+    double start = now_ms();
+
+    for (int i = 0; i < rounds; i++) {
+        if (oci_hook_exec(hook, &bench_state) != 0)
+            return -1;
+    }
+
+    return (now_ms() - start) * 1e3 / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    char *true_argv[2] = { "/bin/true", (char *) NULL };
+    struct oci_hook binary = {
+            .ohk_path = "/bin/true",
+            .ohk_argv = true_argv,
+            .ohk_timeout = 5
+    };
+    struct oci_hook plugin = { .ohk_path = HOOK_BENCH_PLUGIN, .ohk_kind = OCI_HOOK_PLUGIN };
+    struct oci_hook server = { .ohk_path = HOOK_BENCH_SOCK, .ohk_kind = OCI_HOOK_SOCKET };
+    double binary_us, plugin_us, server_us;
+    pid_t pid;
+
+    if ((pid = start_server()) < 0)
+        return EXIT_FAILURE;
+
+    binary_us = per_call_us(&binary, HOOK_BENCH_ROUNDS / 5);
+    plugin_us = per_call_us(&plugin, HOOK_BENCH_ROUNDS);
+    server_us = per_call_us(&server, HOOK_BENCH_ROUNDS);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(HOOK_BENCH_SOCK);
+
+    if (binary_us < 0 || plugin_us < 0 || server_us < 0)
+        return log_error_ret(EXIT_FAILURE, "hook failed");
+
+    printf("%-12s %8.3f us per event\n", "/bin/true", binary_us);
+    printf("%-12s %8.3f us per event\n", "plugin", plugin_us);
+    printf("%-12s %8.3f us per event\n", "hook server", server_us);
+
+    return EXIT_SUCCESS;
+}
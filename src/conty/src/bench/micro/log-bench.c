@@ -0,0 +1,79 @@
+#include "log.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define LOG_BENCH_FILE     "/tmp/conty-log-bench.log"
+#define LOG_BENCH_THREADS  4
+#define LOG_BENCH_MESSAGES 20000
+
+static void *log_thread(void *arg)
+{
+    int n = (int) (long) arg;
+
+    for (int i = 0; i < LOG_BENCH_MESSAGES; i++)
+        LOG_INFO("thread %d message %d", n, i);
+
+    return NULL;
+}
+
+/*
+ * Time every thread logging its messages to a file,
+ * with and without the background thread
+ */
+static double run_threads(int async)
+{
+    pthread_t threads[LOG_BENCH_THREADS];
+    int fd, saved;
+    double start;
+
+    if ((fd = open(LOG_BENCH_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+        return log_error_ret(-1, "cannot open %s", LOG_BENCH_FILE);
+
+    saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+
+    if (async && conty_log_start() != 0) {
+        dup2(saved, STDERR_FILENO);
+        return log_error_ret(-1, "cannot start logger");
+    }
+
+    start = now_ms();
+    for (long n = 0; n < LOG_BENCH_THREADS; n++)
+        pthread_create(&threads[n], NULL, log_thread, (void *) n);
+    for (int n = 0; n < LOG_BENCH_THREADS; n++)
+        pthread_join(threads[n], NULL);
+    start = now_ms() - start;
+
+    if (async)
+        conty_log_stop();
+
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    return start * 1e6 / (LOG_BENCH_THREADS * LOG_BENCH_MESSAGES);
+}
+
+int main(int argc, char *argv[])
+{
+    double sync_ns, async_ns;
+
+    sync_ns  = run_threads(0);
+    async_ns = run_threads(1);
+    unlink(LOG_BENCH_FILE);
+
+    if (sync_ns < 0 || async_ns < 0)
+        return EXIT_FAILURE;
+
+    printf("%d threads, %d messages each\n", LOG_BENCH_THREADS, LOG_BENCH_MESSAGES);
+    printf("  sync:  %.1f ns per message\n", sync_ns);
+    printf("  async: %.1f ns per message\n", async_ns);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include "container.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "bench.h"
+
+#define REAP_BENCH_DIR        "/tmp/conty-reap-bench"
+#define REAP_BENCH_CONTAINERS 16
+
+/*
+ * Stands in for whatever has to be cleaned up after a container,
+ * which the caller would rather not wait for
+ */
+static const char *conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }],"
+    "  \"hooks\": {"
+    "    \"on_container_stopped\": [{"
+    "      \"path\": \"/bin/sleep\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sleep\", \"0.02\"]"
+    "    }]"
+    "  }"
+    "}";
+
+static int wait_readable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    return poll(&pfd, 1, 5000) == 1 ? 0 : -1;
+}
+
+static int run_stopped(struct conty_container **cc, const char *prefix)
+{
+    char id[32];
+
+    for (int i = 0; i < REAP_BENCH_CONTAINERS; i++) {
+        snprintf(id, sizeof(id), "%s-%d", prefix, i);
+        if (!(cc[i] = conty_container_create(id, REAP_BENCH_DIR "/slow.json")))
+            return log_error_ret(-1, "cannot create %s", id);
+
+        if (conty_container_start(cc[i]) != 0 ||
+            wait_readable(conty_container_pollfd(cc[i])) != 0 ||
+            conty_container_reap(cc[i]) != 0)
+            return log_error_ret(-1, "cannot run %s", id);
+
+        conty_container_set_status(cc[i], CONTY_STOPPED);
+    }
+
+    return 0;
+}
+
+static double delete_blocking(void)
+{
+    struct conty_container *cc[REAP_BENCH_CONTAINERS];
+    double start;
+
+    if (run_stopped(cc, "blocking") != 0)
+        return -1;
+
+    start = now_ms();
+    for (int i = 0; i < REAP_BENCH_CONTAINERS; i++) {
+        if (conty_container_delete(cc[i]) != 0)
+            return log_error_ret(-1, "cannot delete container");
+    }
+
+    return now_ms() - start;
+}
+
+/*
+ * Returns how long the caller was held up, and the time it took
+ * until every container was gone in total
+ */
+static double delete_async(double *total)
+{
+    struct conty_container *cc[REAP_BENCH_CONTAINERS];
+    int deleted = 0, err;
+    double start, blocked;
+
+    if (run_stopped(cc, "async") != 0)
+        return -1;
+
+    start = now_ms();
+    for (int i = 0; i < REAP_BENCH_CONTAINERS; i++) {
+        if (conty_container_delete_async(cc[i], cc[i]) != 0)
+            return log_error_ret(-1, "cannot hand over container");
+    }
+    blocked = now_ms() - start;
+
+    while (deleted < REAP_BENCH_CONTAINERS) {
+        if (wait_readable(conty_deleter_fd()) != 0)
+            return log_error_ret(-1, "deleter stopped making progress");
+
+        while (conty_deleter_next(&err)) {
+            if (err != 0)
+                return log_error_ret(-1, "cannot delete container");
+            deleted++;
+        }
+    }
+    *total = now_ms() - start;
+
+    return blocked;
+}
+
+int main(int argc, char *argv[])
+{
+    double blocking_ms, async_ms, total_ms;
+    int ret = EXIT_FAILURE;
+    FILE *file;
+
+    if (system("rm -rf " REAP_BENCH_DIR " && mkdir -p " REAP_BENCH_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", REAP_BENCH_DIR);
+
+    if (!(file = fopen(REAP_BENCH_DIR "/slow.json", "w")) || fputs(conf, file) < 0 ||
+        fclose(file) != 0)
+        goto out;
+
+    if ((blocking_ms = delete_blocking()) < 0 || conty_deleter_start() != 0)
+        goto out;
+
+    async_ms = delete_async(&total_ms);
+    conty_deleter_stop(NULL, NULL);
+    if (async_ms < 0)
+        goto out;
+
+    printf("%d containers with slow container_stopped hooks deleted\n", REAP_BENCH_CONTAINERS);
+    printf("  in place:          %.3f ms\n", blocking_ms);
+    printf("  in the background: %.3f ms, %.3f ms until all were gone\n",
+           async_ms, total_ms);
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " REAP_BENCH_DIR) != 0)
+        LOG_WARN("cannot remove %s", REAP_BENCH_DIR);
+
+    return ret;
+}
@@ -0,0 +1,254 @@
+#include "registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "log.h"
+
+#define REGISTRY_BENCH_ID_FMT "conty-container-%08zu"
+
+struct uthash_hc {
+    char                   *hc_id;
+    struct conty_container *hc_cc;
+    UT_hash_handle          hh;
+};
+
+struct registry_bench {
+    double rb_insert_ns;
+    double rb_hit_ns;
+    double rb_miss_ns;
+    double rb_p99_ns;
+    double rb_max_ns;
+};
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+static char **make_ids(size_t n, size_t offset)
+{
+    char **ids = calloc(n, sizeof(char *));
+    if (!ids)
+        return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if (asprintf(&ids[i], REGISTRY_BENCH_ID_FMT, i + offset) < 0)
+            return NULL;
+    }
+
+    return ids;
+}
+
+/*
+ * Per-lookup latencies are measured on a sample of the keys because
+ * reading the clock costs about as much as a lookup
+ */
+static void percentiles(unsigned long long *samples, size_t n,
+                        struct registry_bench *rb)
+{
+    qsort(samples, n, sizeof(*samples), cmp_ull);
+    rb->rb_p99_ns = (double) samples[(n * 99) / 100];
+    rb->rb_max_ns = (double) samples[n - 1];
+}
+
+static int bench_registry(char **ids, char **missing, size_t n,
+                          unsigned long long *samples, size_t nsamples,
+                          struct registry_bench *rb)
+{
+    struct conty_rt_registry reg;
+    struct conty_container *cc;
+    unsigned long long start;
+    size_t found = 0;
+
+    if (conty_rt_registry_init(&reg, 0) != 0)
+        return -1;
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(ids[i]);
+        cc = (struct conty_container *) (ids[i]);
+        if (conty_rt_registry_insert(&reg, ids[i], len,
+                                     conty_rt_registry_hash(ids[i], len), cc) != 0)
+            return log_error_ret(-1, "registry: insert failed");
+    }
+    rb->rb_insert_ns = (double) (now_ns() - start) / n;
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(ids[i]);
+        struct conty_rt_hc *hc = conty_rt_registry_find(&reg, ids[i], len,
+                                                        conty_rt_registry_hash(ids[i], len));
+        found += hc && hc->hc_cc == (struct conty_container *) ids[i];
+    }
+    rb->rb_hit_ns = (double) (now_ns() - start) / n;
+
+    if (found != n)
+        return log_error_ret(-1, "registry: lost %zu containers", n - found);
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(missing[i]);
+        if (conty_rt_registry_find(&reg, missing[i], len,
+                                   conty_rt_registry_hash(missing[i], len)))
+            return log_error_ret(-1, "registry: found missing container");
+    }
+    rb->rb_miss_ns = (double) (now_ns() - start) / n;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        size_t k = (i * 7919) % n, len = strlen(ids[k]);
+        uint64_t hash = conty_rt_registry_hash(ids[k], len);
+
+        start = now_ns();
+        conty_rt_registry_find(&reg, ids[k], len, hash);
+        samples[i] = now_ns() - start;
+    }
+    percentiles(samples, nsamples, rb);
+
+    /*
+     * Removing every other container must leave the rest reachable
+     */
+    for (size_t i = 0; i < n; i += 2) {
+        size_t len = strlen(ids[i]);
+        cc = conty_rt_registry_remove(&reg, ids[i], len, conty_rt_registry_hash(ids[i], len));
+        if (cc != (struct conty_container *) ids[i])
+            return log_error_ret(-1, "registry: remove failed");
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(ids[i]);
+        struct conty_rt_hc *hc = conty_rt_registry_find(&reg, ids[i], len,
+                                                        conty_rt_registry_hash(ids[i], len));
+        if ((i % 2 == 0) != (hc == NULL))
+            return log_error_ret(-1, "registry: inconsistent after removal");
+    }
+
+    if (conty_rt_registry_len(&reg) != n / 2)
+        return log_error_ret(-1, "registry: invalid length after removal");
+
+    conty_rt_registry_free(&reg);
+    return 0;
+}
+
+/*
+ * The previous runtime registry: one allocation per container,
+ * chained buckets and the whole identifier hashed on every lookup
+ */
+static int bench_uthash(char **ids, char **missing, size_t n,
+                        unsigned long long *samples, size_t nsamples,
+                        struct registry_bench *rb)
+{
+    struct uthash_hc *table = NULL, *hc, *tmp;
+    unsigned long long start;
+    size_t found = 0;
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        hc = calloc(1, sizeof(struct uthash_hc));
+        if (!hc)
+            return -1;
+        hc->hc_id = strdup(ids[i]);
+        hc->hc_cc = (struct conty_container *) ids[i];
+        HASH_ADD_KEYPTR(hh, table, hc->hc_id, strlen(hc->hc_id), hc);
+    }
+    rb->rb_insert_ns = (double) (now_ns() - start) / n;
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_FIND_STR(table, ids[i], hc);
+        found += hc != NULL;
+    }
+    rb->rb_hit_ns = (double) (now_ns() - start) / n;
+
+    if (found != n)
+        return log_error_ret(-1, "uthash: lost %zu containers", n - found);
+
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        HASH_FIND_STR(table, missing[i], hc);
+        if (hc)
+            return -1;
+    }
+    rb->rb_miss_ns = (double) (now_ns() - start) / n;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        size_t k = (i * 7919) % n;
+
+        start = now_ns();
+        HASH_FIND_STR(table, ids[k], hc);
+        samples[i] = now_ns() - start;
+    }
+    percentiles(samples, nsamples, rb);
+
+    HASH_ITER(hh, table, hc, tmp) {
+        HASH_DEL(table, hc);
+        free(hc->hc_id);
+        free(hc);
+    }
+
+    return 0;
+}
+
+static void report(const char *name, size_t n, const struct registry_bench *rb)
+{
+    printf("%-8s %8zu containers: insert %7.1f ns, hit %7.1f ns, miss %7.1f ns, "
+           "p99 %7.1f ns, max %9.1f ns\n", name, n, rb->rb_insert_ns,
+           rb->rb_hit_ns, rb->rb_miss_ns, rb->rb_p99_ns, rb->rb_max_ns);
+}
+
+static int bench(size_t n)
+{
+    struct registry_bench rb;
+    size_t nsamples = (n < 100000) ? n : 100000;
+    unsigned long long *samples;
+    char **ids, **missing;
+
+    ids     = make_ids(n, 0);
+    missing = make_ids(n, n);
+    samples = calloc(nsamples, sizeof(*samples));
+    if (!ids || !missing || !samples)
+        return -1;
+
+    if (bench_registry(ids, missing, n, samples, nsamples, &rb) != 0)
+        return -1;
+    report("registry", n, &rb);
+
+    if (bench_uthash(ids, missing, n, samples, nsamples, &rb) != 0)
+        return -1;
+    report("uthash", n, &rb);
+
+    for (size_t i = 0; i < n; i++) {
+        free(ids[i]);
+        free(missing[i]);
+    }
+    free(ids);
+    free(missing);
+    free(samples);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 1000, 100000, 1000000 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (bench(sizes[i]) != 0)
+            return log_error_ret(EXIT_FAILURE, "bench failed with %zu containers",
+                                 sizes[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define RING_BENCH_MESSAGES (1 << 21)
+#define RING_BENCH_CAPACITY 1024
+#define RING_BENCH_MAX_PRODUCERS 4
+
+struct ring_bench {
+    struct conty_ring *rb_spsc;
+    struct conty_mpsc *rb_mpsc;
+    int                rb_cpu;
+    size_t             rb_messages;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpu < 0 || ncpu <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Records are plain integers smuggled through the pointer, starting at 1
+ * because NULL signifies an empty ring
+ */
+static void *spsc_producer(void *arg)
+{
+    struct ring_bench *rb = arg;
+
+    pin(rb->rb_cpu);
+    for (uintptr_t i = 1; i <= rb->rb_messages; i++) {
+        while (conty_ring_push(rb->rb_spsc, (void *) i) == -EAGAIN)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void *mpsc_producer(void *arg)
+{
+    struct ring_bench *rb = arg;
+
+    pin(rb->rb_cpu);
+    for (uintptr_t i = 1; i <= rb->rb_messages; i++) {
+        while (conty_mpsc_push(rb->rb_mpsc, (void *) i) == -EAGAIN)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static int bench_spsc(int producer_cpu, int consumer_cpu, int wakeups)
+{
+    struct conty_ring ring;
+    struct ring_bench rb = {
+            .rb_spsc     = &ring,
+            .rb_cpu      = producer_cpu,
+            .rb_messages = RING_BENCH_MESSAGES,
+    };
+    pthread_t producer;
+    uintptr_t record, expected = 1;
+    double start, elapsed;
+
+    if (conty_ring_init(&ring, RING_BENCH_CAPACITY) != 0)
+        return -1;
+
+    pin(consumer_cpu);
+    start = now_sec();
+
+    if (pthread_create(&producer, NULL, spsc_producer, &rb) != 0)
+        return -1;
+
+    while (expected <= rb.rb_messages) {
+        record = (uintptr_t) conty_ring_pop(&ring);
+        if (!record) {
+            if (wakeups)
+                conty_ring_eventfd_wait(conty_ring_fd(&ring), -1);
+            else
+                sched_yield();
+            continue;
+        }
+
+        /*
+         * Single producer, so records must arrive in order
+         */
+        if (record != expected)
+            return log_error_ret(-1, "spsc: expected %lu got %lu",
+                                 (unsigned long) expected, (unsigned long) record);
+        expected++;
+    }
+
+    elapsed = now_sec() - start;
+    pthread_join(producer, NULL);
+    conty_ring_free(&ring);
+
+    printf("spsc %-8s cpu %d -> cpu %d: %8.2f Mmsg/s\n",
+           wakeups ? "eventfd" : "spinning", producer_cpu, consumer_cpu,
+           (double) rb.rb_messages / elapsed / 1e6);
+    return 0;
+}
+
+static int bench_mpsc(int producers, int wakeups)
+{
+    struct ring_bench rb[RING_BENCH_MAX_PRODUCERS];
+    pthread_t threads[RING_BENCH_MAX_PRODUCERS];
+    struct conty_mpsc ring;
+    uintptr_t record;
+    uint64_t sum = 0, expected_sum;
+    size_t received = 0, total;
+    double start, elapsed;
+
+    if (conty_mpsc_init(&ring, RING_BENCH_CAPACITY) != 0)
+        return -1;
+
+    total = (size_t) producers * (RING_BENCH_MESSAGES / producers);
+    expected_sum = (uint64_t) producers *
+                   ((uint64_t) (RING_BENCH_MESSAGES / producers) *
+                    (RING_BENCH_MESSAGES / producers + 1) / 2);
+
+    pin(0);
+    start = now_sec();
+
+    for (int i = 0; i < producers; i++) {
+        rb[i].rb_mpsc     = &ring;
+        rb[i].rb_cpu      = i + 1;
+        rb[i].rb_messages = RING_BENCH_MESSAGES / producers;
+
+        if (pthread_create(&threads[i], NULL, mpsc_producer, &rb[i]) != 0)
+            return -1;
+    }
+
+    while (received < total) {
+        record = (uintptr_t) conty_mpsc_pop(&ring);
+        if (!record) {
+            if (wakeups)
+                conty_ring_eventfd_wait(conty_mpsc_fd(&ring), -1);
+            else
+                sched_yield();
+            continue;
+        }
+        sum += record;
+        received++;
+    }
+
+    elapsed = now_sec() - start;
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    conty_mpsc_free(&ring);
+
+    if (sum != expected_sum)
+        return log_error_ret(-1, "mpsc: lost records");
+
+    printf("mpsc %-8s %d producers:        %8.2f Mmsg/s\n",
+           wakeups ? "eventfd" : "spinning", producers,
+           (double) total / elapsed / 1e6);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int wakeups = 0; wakeups <= 1; wakeups++) {
+        /*
+         * Same core (if we only have one), neighbouring cores
+         * and the most distant core we know of
+         */
+        if (bench_spsc(0, 0, wakeups) != 0)
+            return log_error_ret(EXIT_FAILURE, "bench_spsc failed");
+
+        if (ncpu > 1 && bench_spsc(1, 0, wakeups) != 0)
+            return log_error_ret(EXIT_FAILURE, "bench_spsc failed");
+
+        if (ncpu > 2 && bench_spsc((int) ncpu - 1, 0, wakeups) != 0)
+            return log_error_ret(EXIT_FAILURE, "bench_spsc failed");
+    }
+
+    for (int wakeups = 0; wakeups <= 1; wakeups++) {
+        for (int producers = 1; producers <= RING_BENCH_MAX_PRODUCERS; producers *= 2) {
+            if (bench_mpsc(producers, wakeups) != 0)
+                return log_error_ret(EXIT_FAILURE, "bench_mpsc failed");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+#include "container.h"
+#include "clone.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "bench.h"
+
+#define SPAWN_BENCH_DIR    "/tmp/conty-spawn-bench"
+#define SPAWN_BENCH_ROUNDS 50
+
+/*
+ * Nothing to set up, conty-init stands in for it until it starts.
+ * Joins our own network namespace, since there has to be one
+ */
+static const char *plain_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\", \"pid\": %d }]"
+    "}";
+
+/*
+ * The cheapest namespace there is, but it has to be forked
+ */
+static const char *uts_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }]"
+    "}";
+
+/*
+ * Joins by path, through an intermediate process on a stack of its own
+ */
+static const char *joined_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\", \"path\": \"/proc/%d/ns/uts\" }]"
+    "}";
+
+static char *true_argv[] = { "/bin/true", NULL };
+static char *true_envp[] = { NULL };
+
+static int write_file(const char *path, const char *contents)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, contents, getpid());
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int exec_true(void *arg)
+{
+    execve(true_argv[0], true_argv, true_envp);
+    return -errno;
+}
+
+static int exit_now(void *arg)
+{
+    return 0;
+}
+
+static int reap(pid_t pid, int pidfd)
+{
+    int status;
+
+    close(pidfd);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "child %d did not exit cleanly", pid);
+
+    return 0;
+}
+
+static double spawn_fork(void)
+{
+    double total = 0, start;
+    int pidfd;
+    pid_t pid;
+
+    for (int i = 0; i < SPAWN_BENCH_ROUNDS; i++) {
+        start = now_ms();
+        if ((pid = clone3_cb(exec_true, NULL, CLONE_PIDFD, &pidfd)) < 0)
+            return log_error_ret(-1, "cannot fork");
+        total += now_ms() - start;
+
+        if (reap(pid, pidfd) != 0)
+            return -1;
+    }
+
+    return total / SPAWN_BENCH_ROUNDS;
+}
+
+static double spawn_vfork(void)
+{
+    double total = 0, start;
+    int pidfd;
+    pid_t pid;
+
+    for (int i = 0; i < SPAWN_BENCH_ROUNDS; i++) {
+        start = now_ms();
+        if ((pid = clone_vfork(exec_true, NULL, CLONE_PIDFD, &pidfd)) < 0)
+            return log_error_ret(-1, "cannot vfork");
+        total += now_ms() - start;
+
+        if (reap(pid, pidfd) != 0)
+            return -1;
+    }
+
+    return total / SPAWN_BENCH_ROUNDS;
+}
+
+static double spawn_intermediate(void)
+{
+    double total = 0, start;
+    pid_t pid;
+
+    for (int i = 0; i < SPAWN_BENCH_ROUNDS; i++) {
+        start = now_ms();
+        if ((pid = clone_old(exit_now, NULL, CLONE_VM | CLONE_VFORK, NULL)) < 0)
+            return log_error_ret(-1, "cannot clone");
+        total += now_ms() - start;
+
+        if (waitpid(pid, NULL, 0) != pid)
+            return log_error_ret(-1, "cannot reap %d", pid);
+    }
+
+    return total / SPAWN_BENCH_ROUNDS;
+}
+
+static double spawn_container(const char *bundle)
+{
+    struct conty_container *cc;
+    double total = 0, start;
+    int status;
+    pid_t pid;
+
+    for (int i = 0; i < SPAWN_BENCH_ROUNDS; i++) {
+        start = now_ms();
+        if (!(cc = conty_container_create("spawn-bench", bundle)))
+            return log_error_ret(-1, "cannot create container from %s", bundle);
+        total += now_ms() - start;
+
+        pid = conty_container_pid(cc);
+        if (conty_container_start(cc) != 0)
+            return log_error_ret(-1, "cannot start container from %s", bundle);
+
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return log_error_ret(-1, "container from %s did not exit cleanly", bundle);
+
+        conty_container_set_status(cc, CONTY_STOPPED);
+        if (conty_container_delete(cc) != 0)
+            return log_error_ret(-1, "cannot delete container from %s", bundle);
+    }
+
+    return total / SPAWN_BENCH_ROUNDS;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t rss_mib[] = { 0, 256, 1024 };
+    double fork_ms, vfork_ms, plain_ms, uts_ms;
+    int ret = EXIT_FAILURE;
+    void *ballast;
+    size_t len;
+
+    if (system("rm -rf " SPAWN_BENCH_DIR " && mkdir -p " SPAWN_BENCH_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", SPAWN_BENCH_DIR);
+
+    if (write_file(SPAWN_BENCH_DIR "/plain.json", plain_conf) != 0 ||
+        write_file(SPAWN_BENCH_DIR "/uts.json", uts_conf) != 0 ||
+        write_file(SPAWN_BENCH_DIR "/joined.json", joined_conf) != 0)
+        goto out;
+
+    /*
+     * Forking costs more the more the runtime has mapped,
+     * spawning through vfork shouldn't care
+     */
+    printf("%8s %10s %10s %12s %12s\n", "rss", "fork", "vfork", "container", "container");
+    printf("%8s %10s %10s %12s %12s\n", "", "", "", "(plain)", "(uts)");
+
+    for (size_t i = 0; i < sizeof(rss_mib) / sizeof(rss_mib[0]); i++) {
+        ballast = NULL;
+        len = rss_mib[i] << 20;
+
+        if (len) {
+            ballast = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ballast == MAP_FAILED) {
+                LOG_ERROR("cannot map %zu MiB", rss_mib[i]);
+                goto out;
+            }
+            memset(ballast, 0xa5, len);
+        }
+
+        fork_ms  = spawn_fork();
+        vfork_ms = spawn_vfork();
+        plain_ms = spawn_container(SPAWN_BENCH_DIR "/plain.json");
+        uts_ms   = spawn_container(SPAWN_BENCH_DIR "/uts.json");
+
+        if (ballast)
+            munmap(ballast, len);
+
+        if (fork_ms < 0 || vfork_ms < 0 || plain_ms < 0 || uts_ms < 0)
+            goto out;
+
+        printf("%4zu MiB %7.3f ms %7.3f ms %9.3f ms %9.3f ms\n", rss_mib[i], fork_ms, vfork_ms,
+               plain_ms, uts_ms);
+    }
+
+    /*
+     * Containers that join namespaces by path, with a fresh stack for
+     * every intermediate process and with stacks from the pool
+     */
+    static const struct {
+        const char   *name;
+        unsigned int  stacks;
+        size_t        size;
+    } pools[] = {
+        { "no pool",          0, 0 },
+        { "pool of 8 MiB",    2, 0 },
+        { "pool of 256 KiB",  2, 256 * 1024 },
+    };
+
+    printf("\n%-16s %12s %12s\n", "stacks", "clone_old", "container");
+
+    for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); i++) {
+        if (pools[i].stacks && conty_stack_pool_start(pools[i].stacks, pools[i].size) != 0) {
+            LOG_ERROR("cannot start %s", pools[i].name);
+            goto out;
+        }
+
+        vfork_ms = spawn_intermediate();
+        plain_ms = spawn_container(SPAWN_BENCH_DIR "/joined.json");
+
+        conty_stack_pool_stop();
+
+        if (vfork_ms < 0 || plain_ms < 0)
+            goto out;
+
+        printf("%-16s %9.3f ms %9.3f ms\n", pools[i].name, vfork_ms, plain_ms);
+    }
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " SPAWN_BENCH_DIR) != 0)
+        LOG_WARN("cannot remove %s", SPAWN_BENCH_DIR);
+
+    return ret;
+}
@@ -0,0 +1,74 @@
+#include "stats.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "bench.h"
+
+#define STATS_BENCH_SAMPLES 100000
+#define STATS_BENCH_HISTS   64
+
+/*
+ * What the loop pays for every duration it records
+ */
+static double record(void)
+{
+    struct conty_rt_hist hist;
+    double start;
+
+    memset(&hist, 0, sizeof(hist));
+
+    start = now_ms();
+    for (uint64_t i = 1; i <= STATS_BENCH_SAMPLES; i++)
+        conty_rt_hist_add(&hist, i * 1000);
+
+    return (now_ms() - start) * 1e6 / STATS_BENCH_SAMPLES;
+}
+
+/*
+ * Writes more histograms than a scrape of the runtime does
+ */
+static double scrape(size_t *len)
+{
+    struct conty_rt_text text = { 0 };
+    struct conty_rt_hist hist;
+    char labels[32];
+    double start;
+
+    memset(&hist, 0, sizeof(hist));
+    for (uint64_t ns = 1; ns < 1000000000ULL; ns *= 3)
+        conty_rt_hist_add(&hist, ns);
+
+    start = now_ms();
+    for (int i = 0; i < STATS_BENCH_HISTS; i++) {
+        snprintf(labels, sizeof(labels), "n=\"%d\"", i);
+        if (conty_rt_metric_hist(&text, "test_seconds", labels, &hist) != 0) {
+            conty_rt_text_free(&text);
+            return log_error_ret(-1, "cannot write histogram");
+        }
+    }
+    start = now_ms() - start;
+
+    *len = text.tx_len;
+    conty_rt_text_free(&text);
+
+    return start * 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    double record_ns, scrape_us;
+    size_t len;
+
+    record_ns = record();
+    if ((scrape_us = scrape(&len)) < 0)
+        return EXIT_FAILURE;
+
+    printf("%d durations recorded in %.3f ns each\n", STATS_BENCH_SAMPLES, record_ns);
+    printf("%d histograms, %zu bytes written in %.3f us\n", STATS_BENCH_HISTS, len, scrape_us);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#ifndef CONTY_BLK_H
+#define CONTY_BLK_H
+
+enum blk_metrics {
+    BLK_LATENCY,
+    BLK_QDEPTH,
+    BLK_SIZE,
+    MAX_BLK_METRIC
+};
+
+static const char *blk_metric_names[] = {
+        [BLK_LATENCY] = "latency",
+        [BLK_QDEPTH]  = "qdepth",
+        [BLK_SIZE]    = "size",
+};
+
+/*
+ * Histograms are kept per container and metric
+ */
+struct blk_hist_key {
+    __u32 container;
+    __u32 metric;
+};
+
+#endif //CONTY_BLK_H
@@ -0,0 +1,186 @@
+#include "vmlinux.h"
+
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "map.bpf.h"
+#include "scale.bpf.h"
+#include "histogram.h"
+#include "container.bpf.h"
+#include "blk.h"
+
+/*
+ * Target process identifier to trace
+ * If unset, requests of all containers and the host are traced
+ */
+const volatile pid_t target_pid = 0;
+
+/*
+ * Bookkeeping information of an in-flight block request
+ */
+struct rq_info {
+    u64 ts;
+    u32 container;
+    u32 issued;
+};
+
+static struct bench_hist zero;
+static s64 zero_inflight;
+
+/*
+ * Associative array that maps a request to the container that submitted it
+ * and the time it was issued to the device driver
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, BENCH_HIST_MAX_ENTRIES);
+    __type(key, u64);
+    __type(value, struct rq_info);
+} start SEC(".maps");
+
+/*
+ * Number of requests that a container has issued to the device driver
+ * but that haven't completed yet
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, BENCH_HIST_MAX_ENTRIES);
+    __type(key, u32);
+    __type(value, s64);
+} inflight SEC(".maps");
+
+/*
+ * Latency, queue depth and request size histograms per container
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, BENCH_HIST_MAX_ENTRIES);
+    __type(key, struct blk_hist_key);
+    __type(value, struct bench_hist);
+} hists SEC(".maps");
+
+static __always_inline void hist_add(u32 container, u32 metric, u64 val)
+{
+    struct blk_hist_key key = { .container = container, .metric = metric };
+    struct bench_hist *histp;
+    u64 slot;
+
+    histp = bpf_map_lookup_or_try_init(&hists, &key, &zero);
+    if (!histp)
+        return;
+
+    slot = log2l(val);
+    if (slot >= BENCH_HIST_MAX_SLOTS)
+        slot = BENCH_HIST_MAX_SLOTS - 1;
+
+    __sync_fetch_and_add(&histp->slots[slot], 1);
+}
+
+static __always_inline int filtered(void)
+{
+    return target_pid && target_pid != (bpf_get_current_pid_tgid() >> 32);
+}
+
+/*
+ * Requests that go through an I/O scheduler are inserted in the context of
+ * the submitting task, but may be issued later on by a kernel worker.
+ * We therefore remember the container at insertion time
+ */
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(block_rq_insert, struct request *rq)
+{
+    u64 key = (u64) rq;
+    struct rq_info info = {};
+
+    if (filtered())
+        return 0;
+
+    /*
+     * Requeued requests are inserted again, keep the entry they already have
+     * so that they aren't counted as in flight twice once they're reissued
+     */
+    info.container = current_container_key();
+    bpf_map_update_elem(&start, &key, &info, BPF_NOEXIST);
+    return 0;
+}
+
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(block_rq_issue, struct request *rq)
+{
+    u64 key = (u64) rq;
+    struct rq_info info = {}, *infop;
+    s64 *depthp, depth;
+
+    infop = bpf_map_lookup_elem(&start, &key);
+    if (!infop) {
+        /*
+         * Request bypassed the scheduler and is directly dispatched
+         * by the submitting task
+         */
+        if (filtered())
+            return 0;
+
+        info.container = current_container_key();
+        bpf_map_update_elem(&start, &key, &info, BPF_ANY);
+
+        infop = bpf_map_lookup_elem(&start, &key);
+        if (!infop)
+            return 0;
+    }
+
+    infop->ts = bpf_ktime_get_ns();
+
+    /*
+     * Requeued requests are issued more than once, but they only
+     * occupy a single slot in the device queue
+     */
+    if (infop->issued)
+        return 0;
+    infop->issued = 1;
+
+    depthp = bpf_map_lookup_or_try_init(&inflight, &infop->container, &zero_inflight);
+    if (!depthp)
+        return 0;
+
+    depth = __sync_fetch_and_add(depthp, 1) + 1;
+
+    hist_add(infop->container, BLK_QDEPTH, depth);
+    hist_add(infop->container, BLK_SIZE, rq->__data_len);
+    return 0;
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(block_rq_complete, struct request *rq, int error, unsigned int nr_bytes)
+{
+    u64 key = (u64) rq;
+    struct rq_info *infop;
+    s64 delta, *depthp;
+
+    infop = bpf_map_lookup_elem(&start, &key);
+    if (!infop)
+        return 0;
+
+    if (!infop->issued)
+        goto cleanup;
+
+    depthp = bpf_map_lookup_elem(&inflight, &infop->container);
+    if (depthp && *depthp > 0)
+        __sync_fetch_and_add(depthp, -1);
+
+    delta = (s64)(bpf_ktime_get_ns() - infop->ts);
+    if (delta < 0)
+        goto cleanup;
+
+    /*
+     * Convert the nanosecond representation to microseconds
+     */
+    delta /= 1000U;
+
+    hist_add(infop->container, BLK_LATENCY, delta);
+
+    cleanup:
+    bpf_map_delete_elem(&start, &key);
+    return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
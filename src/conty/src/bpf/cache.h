@@ -0,0 +1,19 @@
+#ifndef CONTY_CACHE_H
+#define CONTY_CACHE_H
+
+/*
+ * Maximum number of containers whose page cache activity is tracked
+ */
+#define CACHE_MAX_ENTRIES 10240
+
+/*
+ * Page cache counters of a container
+ */
+struct cache_stats {
+    __u64 cs_accesses;
+    __u64 cs_misses;
+    __u64 cs_faults;
+    __u64 cs_copy_ups;
+};
+
+#endif //CONTY_CACHE_H
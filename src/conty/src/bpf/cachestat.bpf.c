@@ -0,0 +1,106 @@
+#include "vmlinux.h"
+
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "map.bpf.h"
+#include "container.bpf.h"
+#include "cache.h"
+
+/*
+ * Target process identifier to trace
+ * If unset, page cache activity of all containers and the host is traced
+ */
+const volatile pid_t target_pid = 0;
+
+static struct cache_stats zero;
+
+/*
+ * Page cache counters per container
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, CACHE_MAX_ENTRIES);
+    __type(key, u32);
+    __type(value, struct cache_stats);
+} stats SEC(".maps");
+
+static __always_inline struct cache_stats *current_stats(void)
+{
+    u32 key;
+
+    if (target_pid && target_pid != (bpf_get_current_pid_tgid() >> 32))
+        return 0;
+
+    key = current_container_key();
+    return bpf_map_lookup_or_try_init(&stats, &key, &zero);
+}
+
+/*
+ * Every lookup that finds a page in the cache marks it as accessed,
+ * and so does every page that has just been read in. Misses are
+ * counted separately whenever a page is inserted into the cache
+ *
+ * Newer kernels implement the page variants on top of folios, so
+ * userspace loads exactly one program of each pair to avoid double counting
+ */
+SEC("kprobe/mark_page_accessed")
+int BPF_KPROBE(mark_page_accessed)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_accesses, 1);
+    return 0;
+}
+
+SEC("kprobe/folio_mark_accessed")
+int BPF_KPROBE(folio_mark_accessed)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_accesses, 1);
+    return 0;
+}
+
+SEC("kprobe/add_to_page_cache_lru")
+int BPF_KPROBE(add_to_page_cache_lru)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_misses, 1);
+    return 0;
+}
+
+SEC("kprobe/filemap_add_folio")
+int BPF_KPROBE(filemap_add_folio)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_misses, 1);
+    return 0;
+}
+
+SEC("kprobe/filemap_fault")
+int BPF_KPROBE(filemap_fault)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_faults, 1);
+    return 0;
+}
+
+/*
+ * Overlay filesystems copy a file from the lower to the upper layer
+ * the first time it is opened for writing, which shows up as extra
+ * reads and writes in the disk benchmarks
+ */
+SEC("kprobe/ovl_copy_up_flags")
+int BPF_KPROBE(ovl_copy_up_flags)
+{
+    struct cache_stats *s = current_stats();
+    if (s)
+        __sync_fetch_and_add(&s->cs_copy_ups, 1);
+    return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,23 @@
+#ifndef CONTY_CONTAINER_BPF_H
+#define CONTY_CONTAINER_BPF_H
+
+#include <bpf/bpf_core_read.h>
+
+/*
+ * Every container gets its own mount namespace, so we use the inode number
+ * of the mount namespace of a task to tell which container it belongs to.
+ * Tasks on the host all share the same key.
+ *
+ * The number matches the one shown by readlink /proc/<pid>/ns/mnt
+ */
+static __always_inline __u32 task_container_key(struct task_struct *task)
+{
+    return BPF_CORE_READ(task, nsproxy, mnt_ns, ns.inum);
+}
+
+static __always_inline __u32 current_container_key(void)
+{
+    return task_container_key((struct task_struct *) bpf_get_current_task());
+}
+
+#endif //CONTY_CONTAINER_BPF_H
@@ -1,13 +1,18 @@
 #include <conty/bpf.h>
 
 #include <unistd.h>
+#include <string.h>
 #include <pthread.h>
 
 #include "fs.h"
+#include "blk.h"
+#include "cache.h"
 #include "histogram.h"
 #include "vfslatency.skel.h"
 #include "tcplatency.skel.h"
 #include "rqlatency.skel.h"
+#include "blklatency.skel.h"
+#include "cachestat.skel.h"
 
 #define CONTY_BPF_TICK_NSEC_PER_SEC 1000000000ULL
 
@@ -53,10 +58,114 @@ static int write_vfslatency_samples(struct vfslatency_bpf *obj, FILE *sink)
     return 0;
 }
 
+/*
+ * Checks if the running kernel exports a symbol that a kprobe can attach to
+ */
+static int kallsyms_has(const char *name)
+{
+    FILE *kallsyms;
+    char line[512], sym[256];
+    int found = 0;
+
+    kallsyms = fopen("/proc/kallsyms", "r");
+    if (!kallsyms)
+        return 0;
+
+    while (!found && fgets(line, sizeof(line), kallsyms)) {
+        if (sscanf(line, "%*s %*s %255s", sym) == 1 && !strcmp(sym, name))
+            found = 1;
+    }
+
+    fclose(kallsyms);
+    return found;
+}
+
+static struct cachestat_bpf *open_cachestat(const struct conty_bpf_tracer *tracer)
+{
+    struct cachestat_bpf *obj;
+
+    obj = cachestat_bpf__open();
+    if (!obj)
+        return NULL;
+
+    obj->rodata->target_pid = tracer->cbc_vfs_pid;
+
+    /*
+     * The page variants are wrappers around the folio variants on kernels
+     * that have folios, so only attach to one of them
+     */
+    if (kallsyms_has("folio_mark_accessed"))
+        bpf_program__set_autoload(obj->progs.mark_page_accessed, false);
+    else
+        bpf_program__set_autoload(obj->progs.folio_mark_accessed, false);
+
+    if (kallsyms_has("filemap_add_folio"))
+        bpf_program__set_autoload(obj->progs.add_to_page_cache_lru, false);
+    else
+        bpf_program__set_autoload(obj->progs.filemap_add_folio, false);
+
+    /*
+     * Overlay is a module, so we can only count copy ups if it's loaded
+     */
+    if (!kallsyms_has("ovl_copy_up_flags"))
+        bpf_program__set_autoload(obj->progs.ovl_copy_up_flags, false);
+
+    if (cachestat_bpf__load(obj) != 0 || cachestat_bpf__attach(obj) != 0) {
+        cachestat_bpf__destroy(obj);
+        return NULL;
+    }
+
+    return obj;
+}
+
+static int write_cachestat_samples(struct cachestat_bpf *obj, FILE *sink)
+{
+    __u32 lookup_key = -1, next_key;
+    int err, fd = bpf_map__fd(obj->maps.stats);
+    struct cache_stats stats;
+    unsigned long long hits;
+    double ratio;
+
+    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+        err = bpf_map_lookup_elem(fd, &next_key, &stats);
+        if (err < 0) {
+            fprintf(stderr, "failed to lookup infos: %d\n", err);
+            return -1;
+        }
+
+        /*
+         * Every miss also marks the freshly read page as accessed
+         */
+        hits = (stats.cs_accesses > stats.cs_misses)
+                ? stats.cs_accesses - stats.cs_misses : 0;
+        ratio = stats.cs_accesses ? (double) hits / stats.cs_accesses : 0.0;
+
+        fprintf(sink, "%u, %llu, %llu, %.4f, %.4f, %llu, %llu\n",
+                next_key, stats.cs_accesses, stats.cs_misses,
+                ratio, stats.cs_accesses ? 1.0 - ratio : 0.0,
+                stats.cs_faults, stats.cs_copy_ups);
+
+        lookup_key = next_key;
+    }
+
+    lookup_key = -1;
+    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+        err = bpf_map_delete_elem(fd, &next_key);
+        if (err < 0) {
+            fprintf(stderr, "failed to cleanup infos: %d\n", err);
+            return -1;
+        }
+        lookup_key = next_key;
+    }
+
+    return 0;
+}
+
 int conty_bpf_trace_vfsops(const struct conty_bpf_tracer *tracer)
 {
     struct vfslatency_bpf *obj = NULL;
-    FILE *sink = NULL;
+    struct cachestat_bpf *cache = NULL;
+    FILE *sink = NULL, *cache_sink = NULL;
     int err = -1;
     __u64 end;
 
@@ -64,6 +173,20 @@ int conty_bpf_trace_vfsops(const struct conty_bpf_tracer *tracer)
     if (!sink)
         return err;
 
+    /*
+     * Page cache hit ratios are optional and sampled in the same intervals
+     * as the latency histograms
+     */
+    if (tracer->cbc_cache_sink) {
+        cache_sink = fopen(tracer->cbc_cache_sink, "a");
+        if (!cache_sink)
+            goto cleanup_sink;
+
+        cache = open_cachestat(tracer);
+        if (!cache)
+            goto cleanup_sink;
+    }
+
     obj = vfslatency_bpf__open();
     if (!obj)
         goto cleanup_sink;
@@ -88,12 +211,18 @@ int conty_bpf_trace_vfsops(const struct conty_bpf_tracer *tracer)
     end = tick_get_ktime_ns() + tracer->cbc_duration * CONTY_BPF_TICK_NSEC_PER_SEC;
 
     fprintf(sink, "OP, LOW, HIGH, COUNT\n");
+    if (cache_sink)
+        fprintf(cache_sink, "CONTAINER, ACCESSES, MISSES, HIT_RATIO, MISS_RATIO, FAULTS, COPY_UPS\n");
+
     for ( ;; ) {
         sleep(tracer->cbc_interval);
 
         if ((err = write_vfslatency_samples(obj, sink)) != 0)
             break;
 
+        if (cache && (err = write_cachestat_samples(cache, cache_sink)) != 0)
+            break;
+
         if (tick_get_ktime_ns() > end)
             break;
     }
@@ -101,6 +230,10 @@ int conty_bpf_trace_vfsops(const struct conty_bpf_tracer *tracer)
 cleanup_bpf:
     vfslatency_bpf__destroy(obj);
 cleanup_sink:
+    if (cache)
+        cachestat_bpf__destroy(cache);
+    if (cache_sink)
+        fclose(cache_sink);
     fclose(sink);
     return err;
 }
@@ -237,3 +370,102 @@ cleanup_sink:
     fclose(sink);
     return err;
 }
+
+static int write_blk_hists(struct bpf_map *map, FILE *sink)
+{
+    struct blk_hist_key lookup_key = { .container = -1, .metric = -1 }, next_key;
+    int err, fd = bpf_map__fd(map);
+    unsigned long long low, high;
+    unsigned int val, idx_max;
+
+    struct bench_hist hist;
+
+    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+        err = bpf_map_lookup_elem(fd, &next_key, &hist);
+        if (err < 0) {
+            fprintf(stderr, "failed to lookup infos: %d\n", err);
+            return -1;
+        }
+
+        if (next_key.metric >= MAX_BLK_METRIC)
+            goto next;
+
+        idx_max = 0;
+        for (int i = 0; i < BENCH_HIST_MAX_SLOTS; i++) {
+            val = hist.slots[i];
+            if (val > 0)
+                idx_max = i;
+        }
+
+        for (int i = 0; i <= idx_max; i++) {
+            val = hist.slots[i];
+            low = (1ULL << (i + 1)) >> 1;
+            high = (1ULL << (i + 1)) - 1;
+
+            fprintf(sink, "%u, %s, %llu, %llu, %d\n", next_key.container,
+                    blk_metric_names[next_key.metric], low, high, val);
+        }
+
+next:
+        lookup_key = next_key;
+    }
+
+    lookup_key = (struct blk_hist_key) { .container = -1, .metric = -1 };
+    while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+        err = bpf_map_delete_elem(fd, &next_key);
+        if (err < 0) {
+            fprintf(stderr, "failed to cleanup infos: %d\n", err);
+            return -1;
+        }
+        lookup_key = next_key;
+    }
+
+    return 0;
+}
+
+int conty_bpf_trace_blkio(const struct conty_bpf_tracer *tracer)
+{
+    struct blklatency_bpf *obj = NULL;
+    FILE *sink = NULL;
+    int err = -1;
+    __u64 end;
+
+    sink = fopen(tracer->cbc_blk_sink, "a");
+    if (!sink)
+        return err;
+
+    obj = blklatency_bpf__open();
+    if (!obj)
+        goto cleanup_sink;
+
+    obj->rodata->target_pid = tracer->cbc_blk_pid;
+
+    if ((err = blklatency_bpf__load(obj)) != 0)
+        goto cleanup_bpf;
+
+    if ((err = blklatency_bpf__attach(obj)) != 0)
+        goto cleanup_bpf;
+
+    end = tick_get_ktime_ns() + tracer->cbc_duration * CONTY_BPF_TICK_NSEC_PER_SEC;
+
+    /*
+     * Latencies are in microseconds, queue depths in requests
+     * and sizes in bytes
+     */
+    fprintf(sink, "CONTAINER, METRIC, LOW, HIGH, COUNT\n");
+    for ( ;; ) {
+        sleep(tracer->cbc_interval);
+
+        if ((err = write_blk_hists(obj->maps.hists, sink)) != 0)
+            break;
+
+        if (tick_get_ktime_ns() > end)
+            break;
+    }
+
+cleanup_bpf:
+    blklatency_bpf__destroy(obj);
+cleanup_sink:
+    fclose(sink);
+    return err;
+}
@@ -0,0 +1,70 @@
+#include <conty/conty.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <argp.h>
+
+static char doc[] = "conty-image -- Unpacks OCI image layouts into a layer store\v"
+                    "Prints the layers of the image for the root filesystem "
+                    "of a container configuration, e.g\n\n"
+                    "  \"root\": { \"path\": STORE, \"layers\": <output>, \"overlay\": {...} }";
+
+const char *argp_program_bug_address = "htw-berlin.de";
+const char *argp_program_version = "version 1.0";
+
+struct conty_image_args {
+    const char *cia_store;
+    const char *cia_layout;
+};
+
+static int conty_image_parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct conty_image_args *args = (struct conty_image_args *) state->input;
+
+    switch (key) {
+    case ARGP_KEY_ARG:
+        if (state->arg_num == 0)
+            args->cia_store = arg;
+        else if (state->arg_num == 1)
+            args->cia_layout = arg;
+        else
+            argp_usage(state);
+        break;
+    case ARGP_KEY_END:
+        if (!args->cia_layout)
+            argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = { NULL, conty_image_parse_opt, "STORE LAYOUT", doc };
+    struct conty_image_args args = { NULL, NULL };
+    char **layers = NULL;
+    int unpacked, i;
+
+    if (argp_parse(&argp, argc, argv, 0, 0, &args) != 0)
+        return 1;
+
+    if ((unpacked = conty_image_unpack(args.cia_store, args.cia_layout, &layers)) < 0)
+        return 1;
+
+    fprintf(stderr, "unpacked %d new layers\n", unpacked);
+
+    printf("[");
+    for (i = 0; layers[i]; i++) {
+        printf("%s\"%s\"", i ? ", " : "", layers[i]);
+        free(layers[i]);
+    }
+    printf("]\n");
+
+    free(layers);
+    return 0;
+}
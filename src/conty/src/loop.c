@@ -0,0 +1,647 @@
+#include "loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+
+#define LOOP_EVENTS 256
+
+#define RING_ENTRIES 256
+
+/*
+ * Every container may have an exit and a handshake outstanding,
+ * and they may all complete between two waits
+ */
+#define RING_CQ_ENTRIES 8192
+
+/*
+ * Tags the user data of sends, whose completions only matter to the receive
+ * linked to them. Events are word-aligned, so the low bit is free
+ */
+#define RING_SEND 1UL
+
+/*
+ * Registered with epoll
+ */
+#define EV_ADDED  (1 << 0)
+/*
+ * Connection waiting for a request, and one that has
+ * something to receive but wasn't waiting
+ */
+#define EV_ARMED  (1 << 2)
+#define EV_READY  (1 << 3)
+
+struct conty_rt_uring {
+    unsigned            *ur_sq_head;
+    unsigned            *ur_sq_tail;
+    unsigned             ur_sq_mask;
+    unsigned             ur_sq_entries;
+    struct io_uring_sqe *ur_sqes;
+    unsigned            *ur_cq_head;
+    unsigned            *ur_cq_tail;
+    unsigned             ur_cq_mask;
+    struct io_uring_cqe *ur_cqes;
+    /*
+     * Queued since the last submission
+     */
+    unsigned             ur_queued;
+    void                *ur_sq_ring;
+    size_t               ur_sq_len;
+    void                *ur_cq_ring;
+    size_t               ur_cq_len;
+    size_t               ur_sqes_len;
+};
+
+struct conty_rt_loop {
+    int                   lp_fd;
+    char                  lp_uring;
+    /*
+     * Multishot accept isn't supported by every kernel with io_uring
+     */
+    char                  lp_multishot;
+    struct conty_rt_uring lp_ring;
+    /*
+     * Connections to receive from before waiting again, with epoll
+     */
+    struct conty_rt_event *lp_ready;
+};
+
+static int uring_enter(struct conty_rt_loop *loop, unsigned int wait)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+    int ret;
+
+    ret = (int) syscall(__NR_io_uring_enter, loop->lp_fd, ring->ur_queued, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0)
+        return -errno;
+
+    ring->ur_queued -= (unsigned) ret;
+
+    return ret;
+}
+
+/*
+ * Make room for n requests, handing those that are queued
+ * to the kernel if the ring is too full
+ */
+static int uring_reserve(struct conty_rt_loop *loop, unsigned int n)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+    unsigned int used;
+    int err;
+
+    used = *ring->ur_sq_tail - __atomic_load_n(ring->ur_sq_head, __ATOMIC_ACQUIRE);
+    if (used + n <= ring->ur_sq_entries)
+        return 0;
+
+    if ((err = uring_enter(loop, 0)) < 0)
+        return log_error_ret(err, "cannot submit requests");
+
+    used = *ring->ur_sq_tail - __atomic_load_n(ring->ur_sq_head, __ATOMIC_ACQUIRE);
+
+    return (used + n <= ring->ur_sq_entries) ? 0 : -EBUSY;
+}
+
+static struct io_uring_sqe *uring_sqe(struct conty_rt_loop *loop, uint8_t opcode, int fd,
+                                      uint64_t data)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+    struct io_uring_sqe *sqe;
+
+    sqe = &ring->ur_sqes[*ring->ur_sq_tail & ring->ur_sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->user_data = data;
+
+    return sqe;
+}
+
+/*
+ * Publish the request, it's submitted with the next wait
+ */
+static void uring_queue(struct conty_rt_loop *loop)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+
+    __atomic_store_n(ring->ur_sq_tail, *ring->ur_sq_tail + 1, __ATOMIC_RELEASE);
+    ring->ur_queued++;
+}
+
+static int uring_accept(struct conty_rt_loop *loop, struct conty_rt_event *ev)
+{
+    struct io_uring_sqe *sqe;
+    int err;
+
+    if ((err = uring_reserve(loop, 1)) != 0)
+        return err;
+
+    sqe = uring_sqe(loop, IORING_OP_ACCEPT, ev->ev_fd, (uintptr_t) ev);
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (loop->lp_multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+
+    uring_queue(loop);
+
+    return 0;
+}
+
+static void uring_prep_recv(struct conty_rt_loop *loop, struct conty_rt_event *ev)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(loop, IORING_OP_RECV, ev->ev_fd, (uintptr_t) ev);
+    sqe->addr = (uintptr_t) ev->ev_rx;
+    sqe->len  = (uint32_t) ev->ev_rxlen;
+
+    uring_queue(loop);
+}
+
+/*
+ * The receive only starts once the send completed, and is canceled if it failed
+ */
+static void uring_prep_send(struct conty_rt_loop *loop, struct conty_rt_event *ev,
+                            const void *tx, size_t txlen)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(loop, IORING_OP_SEND, ev->ev_fd, (uintptr_t) ev | RING_SEND);
+    sqe->addr      = (uintptr_t) tx;
+    sqe->len       = (uint32_t) txlen;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags     = IOSQE_IO_LINK;
+
+    uring_queue(loop);
+}
+
+static void uring_prep_poll(struct conty_rt_loop *loop, struct conty_rt_event *ev)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(loop, IORING_OP_POLL_ADD, ev->ev_fd, (uintptr_t) ev);
+    sqe->poll32_events = POLLIN;
+
+    uring_queue(loop);
+}
+
+static int uring_handle(struct conty_rt_loop *loop, struct conty_rt_event *ev, int res,
+                        uint32_t flags, conty_rt_loop_cb cb, void *data)
+{
+    int err;
+
+    switch (ev->ev_kind) {
+        case CONTY_RT_EV_SERVER:
+        case CONTY_RT_EV_METRICS_SERVER:
+            /*
+             * Kernels without multishot accept reject the flag,
+             * accept one connection at a time on those
+             */
+            if (res == -EINVAL && loop->lp_multishot) {
+                LOG_INFO("Accepting one connection at a time");
+                loop->lp_multishot = 0;
+                return uring_accept(loop, ev);
+            }
+
+            if (!(flags & IORING_CQE_F_MORE) && (err = uring_accept(loop, ev)) != 0)
+                return err;
+            break;
+        case CONTY_RT_EV_CONN:
+        case CONTY_RT_EV_METRICS_CONN:
+            break;
+        default:
+            /*
+             * Everything else was polled for
+             */
+            if (res > 0)
+                res = 0;
+            break;
+    }
+
+    return cb(data, ev, res);
+}
+
+static int uring_run_once(struct conty_rt_loop *loop, conty_rt_loop_cb cb, void *data)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail;
+    uint64_t user_data;
+    uint32_t flags;
+    int res, err;
+
+    head = *ring->ur_cq_head;
+    tail = __atomic_load_n(ring->ur_cq_tail, __ATOMIC_ACQUIRE);
+
+    /*
+     * Submitting what was queued and waiting take a single system call
+     */
+    if (head == tail) {
+        if ((err = uring_enter(loop, 1)) < 0)
+            return err;
+
+        tail = __atomic_load_n(ring->ur_cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    for (; head != tail; head++) {
+        cqe       = &ring->ur_cqes[head & ring->ur_cq_mask];
+        user_data = cqe->user_data;
+        res       = cqe->res;
+        flags     = cqe->flags;
+
+        /*
+         * Hand the entry back before the callback queues more requests
+         */
+        __atomic_store_n(ring->ur_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (user_data & RING_SEND)
+            continue;
+
+        err = uring_handle(loop, (struct conty_rt_event *) (uintptr_t) user_data, res, flags,
+                           cb, data);
+        if (err != 0)
+            return err;
+    }
+
+    return 0;
+}
+
+/*
+ * The loop can't do without accept, recv, send and poll,
+ * but it can wait for exits through poll
+ */
+static int uring_probe(struct conty_rt_loop *loop)
+{
+    static const uint8_t required[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe;
+    int err = 0;
+
+    if (!(probe = calloc(1, len)))
+        return log_error_ret(-ENOMEM, "out of memory");
+
+    if (syscall(__NR_io_uring_register, loop->lp_fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        err = -errno;
+        goto out;
+    }
+
+#define op_supported(op) ((op) <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+
+    for (size_t i = 0; i < sizeof(required); i++) {
+        if (!op_supported(required[i])) {
+            err = -EOPNOTSUPP;
+            goto out;
+        }
+    }
+
+    loop->lp_multishot = 1;
+
+#undef op_supported
+
+out:
+    free(probe);
+    return err;
+}
+
+static void uring_close(struct conty_rt_loop *loop)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+
+    if (ring->ur_sqes)
+        munmap(ring->ur_sqes, ring->ur_sqes_len);
+    if (ring->ur_cq_ring && ring->ur_cq_ring != ring->ur_sq_ring)
+        munmap(ring->ur_cq_ring, ring->ur_cq_len);
+    if (ring->ur_sq_ring)
+        munmap(ring->ur_sq_ring, ring->ur_sq_len);
+}
+
+static void *uring_map(int fd, size_t len, off_t offset)
+{
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return (map == MAP_FAILED) ? NULL : map;
+}
+
+static int uring_open(struct conty_rt_loop *loop)
+{
+    struct conty_rt_uring *ring = &loop->lp_ring;
+    struct io_uring_params params;
+    unsigned *array;
+    char *sq, *cq;
+    int fd;
+
+    /*
+     * Only the loop submits, and completions wait until it asks for them
+     * rather than interrupting whatever it's doing. Older kernels don't know
+     * about either and get a plain ring
+     */
+    memset(&params, 0, sizeof(params));
+    params.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                        IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = RING_CQ_ENTRIES;
+
+    fd = (int) syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        params.flags      = IORING_SETUP_CQSIZE;
+        params.cq_entries = RING_CQ_ENTRIES;
+
+        fd = (int) syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    }
+
+    if (fd < 0)
+        return -errno;
+
+    loop->lp_fd = fd;
+
+    ring->ur_sq_len   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->ur_cq_len   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ur_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->ur_cq_len > ring->ur_sq_len)
+            ring->ur_sq_len = ring->ur_cq_len;
+        ring->ur_cq_len = ring->ur_sq_len;
+    }
+
+    if (!(ring->ur_sq_ring = uring_map(fd, ring->ur_sq_len, IORING_OFF_SQ_RING)))
+        return -errno;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->ur_cq_ring = ring->ur_sq_ring;
+    else if (!(ring->ur_cq_ring = uring_map(fd, ring->ur_cq_len, IORING_OFF_CQ_RING)))
+        return -errno;
+
+    if (!(ring->ur_sqes = uring_map(fd, ring->ur_sqes_len, IORING_OFF_SQES)))
+        return -errno;
+
+    sq = (char *) ring->ur_sq_ring;
+    cq = (char *) ring->ur_cq_ring;
+
+    ring->ur_sq_head    = (unsigned *) (sq + params.sq_off.head);
+    ring->ur_sq_tail    = (unsigned *) (sq + params.sq_off.tail);
+    ring->ur_sq_mask    = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->ur_sq_entries = params.sq_entries;
+    ring->ur_cq_head    = (unsigned *) (cq + params.cq_off.head);
+    ring->ur_cq_tail    = (unsigned *) (cq + params.cq_off.tail);
+    ring->ur_cq_mask    = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->ur_cqes       = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /*
+     * Requests are never submitted out of order, so the indirection
+     * array maps every slot to itself once and for all
+     */
+    array = (unsigned *) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+
+    return uring_probe(loop);
+}
+
+/*
+ * Descriptors are never removed from epoll, their registrations are disabled
+ * once they fired and go away when the descriptors are closed. One that is
+ * still there when another event takes over the descriptor is reused
+ */
+static int epoll_arm(struct conty_rt_loop *loop, struct conty_rt_event *ev, uint32_t events)
+{
+    struct epoll_event event = { .events = events, .data.ptr = ev };
+    int op = (ev->ev_flags & EV_ADDED) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (epoll_ctl(loop->lp_fd, op, ev->ev_fd, &event) != 0 &&
+        (errno != EEXIST || epoll_ctl(loop->lp_fd, EPOLL_CTL_MOD, ev->ev_fd, &event) != 0))
+        return -errno;
+
+    ev->ev_flags |= EV_ADDED;
+
+    return 0;
+}
+
+/*
+ * Connections are edge-triggered and stay registered, so waiting for the next
+ * request costs nothing. Whatever arrives while a connection isn't waiting,
+ * the client hanging up included, is received once it is
+ */
+static int epoll_recv(struct conty_rt_loop *loop, struct conty_rt_event *ev)
+{
+    struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = ev };
+
+    if (!(ev->ev_flags & EV_ADDED)) {
+        if (epoll_ctl(loop->lp_fd, EPOLL_CTL_ADD, ev->ev_fd, &event) != 0)
+            return -errno;
+        ev->ev_flags |= EV_ADDED;
+    }
+
+    if (ev->ev_flags & EV_READY) {
+        ev->ev_flags &= ~EV_READY;
+        ev->ev_next    = loop->lp_ready;
+        loop->lp_ready = ev;
+        return 0;
+    }
+
+    ev->ev_flags |= EV_ARMED;
+
+    return 0;
+}
+
+static int epoll_receive(struct conty_rt_event *ev)
+{
+    ssize_t rx;
+
+    do {
+        rx = read(ev->ev_fd, ev->ev_rx, ev->ev_rxlen);
+    } while (rx < 0 && errno == EINTR);
+
+    return (rx < 0) ? -errno : (int) rx;
+}
+
+static int epoll_run_once(struct conty_rt_loop *loop, conty_rt_loop_cb cb, void *data)
+{
+    struct epoll_event events[LOOP_EVENTS];
+    struct conty_rt_event *ev;
+    int nfds, res, err;
+
+    while ((ev = loop->lp_ready)) {
+        loop->lp_ready = ev->ev_next;
+        if ((err = cb(data, ev, epoll_receive(ev))) != 0)
+            return err;
+    }
+
+    if ((nfds = epoll_wait(loop->lp_fd, events, LOOP_EVENTS, -1)) < 0)
+        return -errno;
+
+    for (int i = 0; i < nfds; i++) {
+        ev = (struct conty_rt_event *) events[i].data.ptr;
+
+        switch (ev->ev_kind) {
+            case CONTY_RT_EV_SERVER:
+            case CONTY_RT_EV_METRICS_SERVER:
+                res = accept4(ev->ev_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (res < 0)
+                    res = -errno;
+                break;
+            case CONTY_RT_EV_CONN:
+            case CONTY_RT_EV_METRICS_CONN:
+                if (!(ev->ev_flags & EV_ARMED)) {
+                    ev->ev_flags |= EV_READY;
+                    continue;
+                }
+                ev->ev_flags &= ~EV_ARMED;
+                res = epoll_receive(ev);
+                break;
+            default:
+                res = 0;
+                break;
+        }
+
+        if ((err = cb(data, ev, res)) != 0)
+            return err;
+    }
+
+    return 0;
+}
+
+conty_rt_loop_t conty_rt_loop_open(char uring)
+{
+    struct conty_rt_loop *loop;
+    int err;
+
+    loop = calloc(1, sizeof(struct conty_rt_loop));
+    if (!loop)
+        return log_error_ret(NULL, "out of memory");
+
+    if (uring) {
+        if ((err = uring_open(loop)) == 0) {
+            loop->lp_uring = 1;
+            return loop;
+        }
+
+        LOG_WARN("cannot use io_uring (%s), falling back to epoll", strerror(-err));
+
+        uring_close(loop);
+        if (loop->lp_fd > 0)
+            close(loop->lp_fd);
+        memset(loop, 0, sizeof(struct conty_rt_loop));
+    }
+
+    if ((loop->lp_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(loop);
+        return log_error_ret(NULL, "cannot create epoll instance");
+    }
+
+    return loop;
+}
+
+const char *conty_rt_loop_backend(conty_rt_loop_t loop)
+{
+    return loop->lp_uring ? "io_uring" : "epoll";
+}
+
+int conty_rt_loop_accept(conty_rt_loop_t loop, struct conty_rt_event *ev)
+{
+    if (loop->lp_uring)
+        return uring_accept(loop, ev);
+
+    return epoll_arm(loop, ev, EPOLLIN);
+}
+
+int conty_rt_loop_recv(conty_rt_loop_t loop, struct conty_rt_event *ev, void *rx, size_t len)
+{
+    int err;
+
+    ev->ev_rx    = rx;
+    ev->ev_rxlen = len;
+
+    if (!loop->lp_uring)
+        return epoll_recv(loop, ev);
+
+    if ((err = uring_reserve(loop, 1)) != 0)
+        return err;
+
+    uring_prep_recv(loop, ev);
+
+    return 0;
+}
+
+int conty_rt_loop_reply(conty_rt_loop_t loop, struct conty_rt_event *ev, const void *tx,
+                        size_t txlen, void *rx, size_t rxlen)
+{
+    ssize_t sent;
+    int err;
+
+    if (!loop->lp_uring) {
+        do {
+            sent = send(ev->ev_fd, tx, txlen, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+
+        if (sent < 0)
+            return -errno;
+
+        return conty_rt_loop_recv(loop, ev, rx, rxlen);
+    }
+
+    /*
+     * Both or neither, a link can't span submissions
+     */
+    if ((err = uring_reserve(loop, 2)) != 0)
+        return err;
+
+    ev->ev_rx    = rx;
+    ev->ev_rxlen = rxlen;
+
+    uring_prep_send(loop, ev, tx, txlen);
+    uring_prep_recv(loop, ev);
+
+    return 0;
+}
+
+int conty_rt_loop_wait_exit(conty_rt_loop_t loop, struct conty_rt_event *ev)
+{
+    return conty_rt_loop_wait_sync(loop, ev);
+}
+
+int conty_rt_loop_wait_sync(conty_rt_loop_t loop, struct conty_rt_event *ev)
+{
+    int err;
+
+    if (!loop->lp_uring)
+        return epoll_arm(loop, ev, EPOLLIN | EPOLLONESHOT);
+
+    if ((err = uring_reserve(loop, 1)) != 0)
+        return err;
+
+    uring_prep_poll(loop, ev);
+
+    return 0;
+}
+
+int conty_rt_loop_run_once(conty_rt_loop_t loop, conty_rt_loop_cb cb, void *data)
+{
+    if (loop->lp_uring)
+        return uring_run_once(loop, cb, data);
+
+    return epoll_run_once(loop, cb, data);
+}
+
+void conty_rt_loop_close(conty_rt_loop_t loop)
+{
+    if (loop) {
+        if (loop->lp_uring)
+            uring_close(loop);
+        if (loop->lp_fd >= 0)
+            close(loop->lp_fd);
+        free(loop);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef CONTY_RT_LOOP_H
+#define CONTY_RT_LOOP_H
+
+#include <stddef.h>
+
+/*
+ * Event loop of the runtime
+ *
+ * Rather than reporting readiness, the loop performs the operation a
+ * descriptor is waiting for and reports its result: the accepted connection,
+ * the bytes received. With io_uring, all operations
+ * queued while handling a batch of completions are submitted along with
+ * the wait for the next batch, in a single system call. Without it, the
+ * loop falls back to epoll and performs the operations itself.
+ *
+ * Every operation completes exactly once, except for accept, which keeps
+ * completing until the loop is closed
+ */
+enum {
+    /*
+     * Accepting connections on the server socket
+     */
+    CONTY_RT_EV_SERVER,
+    /*
+     * Receiving a request from a client
+     */
+    CONTY_RT_EV_CONN,
+    /*
+     * Waiting for a container process to exit, the runtime reaps it
+     */
+    CONTY_RT_EV_EXIT,
+    /*
+     * Waiting for the synchronisation descriptor of a container
+     * that is being created or started to become readable
+     */
+    CONTY_RT_EV_SYNC,
+    /*
+     * Waiting for containers deleted in the background
+     */
+    CONTY_RT_EV_DELETE,
+    /*
+     * Accepting connections on the metrics socket, and receiving scrapes.
+     * The loop treats them like the server and its connections
+     */
+    CONTY_RT_EV_METRICS_SERVER,
+    CONTY_RT_EV_METRICS_CONN
+};
+
+struct conty_rt_server_buf;
+
+struct conty_rt_event {
+    int                         ev_kind;
+    int                         ev_fd;
+    /*
+     * Container of exits and handshakes, or the connection
+     * that a handshake replies to once it's done
+     */
+    struct conty_container     *ev_cc;
+    struct conty_rt_event      *ev_conn;
+    /*
+     * Requests of a connection are received into its buffer
+     */
+    struct conty_rt_server_buf *ev_buf;
+    /*
+     * Exits the runtime hasn't reaped yet
+     */
+    struct conty_rt_event      *ev_exited;
+    /*
+     * Private to the loop
+     */
+    int                         ev_flags;
+    void                       *ev_rx;
+    size_t                      ev_rxlen;
+    struct conty_rt_event      *ev_next;
+};
+
+struct conty_rt_loop;
+
+typedef struct conty_rt_loop *conty_rt_loop_t;
+
+/*
+ * Called for every completed operation, res is the accepted descriptor, the
+ * number of bytes received or zero, or a negative error number. A connection
+ * that received zero bytes was closed by the client, one that received
+ * -ECANCELED couldn't be replied to.
+ *
+ * Events may be freed from within the callback once their operation completed,
+ * a callback that returns non-zero stops the loop
+ */
+typedef int (*conty_rt_loop_cb)(void *data, struct conty_rt_event *ev, int res);
+
+/*
+ * Open a loop on io_uring if allowed to and if the kernel supports it,
+ * on epoll otherwise. Returns NULL on failure
+ */
+conty_rt_loop_t conty_rt_loop_open(char uring);
+
+const char *conty_rt_loop_backend(conty_rt_loop_t loop);
+
+/*
+ * Accept connections on the listening socket ev_fd
+ */
+int conty_rt_loop_accept(conty_rt_loop_t loop, struct conty_rt_event *ev);
+
+/*
+ * Receive up to len bytes into rx
+ */
+int conty_rt_loop_recv(conty_rt_loop_t loop, struct conty_rt_event *ev, void *rx, size_t len);
+
+/*
+ * Send txlen bytes from tx and then receive the next request into rx, the
+ * buffers must be left alone until the receive completes
+ */
+int conty_rt_loop_reply(conty_rt_loop_t loop, struct conty_rt_event *ev, const void *tx,
+                        size_t txlen, void *rx, size_t rxlen);
+
+/*
+ * Wait for the container process to exit, ev_fd is its pidfd.
+ * The exit is only reported, the process is left for the caller to reap
+ */
+int conty_rt_loop_wait_exit(conty_rt_loop_t loop, struct conty_rt_event *ev);
+
+/*
+ * Wait for the synchronisation descriptor ev_fd, or any other, to become readable
+ */
+int conty_rt_loop_wait_sync(conty_rt_loop_t loop, struct conty_rt_event *ev);
+
+/*
+ * Submit the operations queued so far, wait for at least one of them
+ * to complete and call cb for everything that did
+ */
+int conty_rt_loop_run_once(conty_rt_loop_t loop, conty_rt_loop_cb cb, void *data);
+
+void conty_rt_loop_close(conty_rt_loop_t loop);
+
+#endif //CONTY_RT_LOOP_H
@@ -0,0 +1,110 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Histograms are exposed with a bucket every other power of two
+ * from about a microsecond to about a minute, the finer buckets
+ * only serve the quantiles of the stats command. Bucket k ends
+ * below 2^(METRIC_LE_FIRST + k * METRIC_LE_STEP) nanoseconds
+ */
+#define METRIC_LE_FIRST 10
+#define METRIC_LE_STEP  2
+
+static const char *metric_le[] = {
+        "1.023e-06", "4.095e-06", "1.6383e-05", "6.5535e-05", "0.000262143",
+        "0.001048575", "0.004194303", "0.016777215", "0.067108863", "0.268435455",
+        "1.07374182", "4.2949673", "17.1798692", "68.7194767"
+};
+
+#define METRIC_TEXT_MIN 16384
+
+int conty_rt_text_printf(struct conty_rt_text *text, const char *fmt, ...)
+{
+    va_list args;
+    size_t cap;
+    char *buf;
+    int len;
+
+    for (;;) {
+        va_start(args, fmt);
+        len = vsnprintf(text->tx_buf ? text->tx_buf + text->tx_len : NULL,
+                        text->tx_cap - text->tx_len, fmt, args);
+        va_end(args);
+
+        if (len < 0)
+            return -EIO;
+
+        if (text->tx_len + (size_t) len < text->tx_cap)
+            break;
+
+        cap = text->tx_cap ? text->tx_cap : METRIC_TEXT_MIN;
+        while (cap <= text->tx_len + (size_t) len)
+            cap *= 2;
+
+        if (!(buf = realloc(text->tx_buf, cap)))
+            return -ENOMEM;
+
+        text->tx_buf = buf;
+        text->tx_cap = cap;
+    }
+
+    text->tx_len += (size_t) len;
+
+    return 0;
+}
+
+void conty_rt_text_free(struct conty_rt_text *text)
+{
+    free(text->tx_buf);
+    text->tx_buf = NULL;
+    text->tx_len = 0;
+    text->tx_cap = 0;
+}
+
+int conty_rt_metric_header(struct conty_rt_text *text, const char *name,
+                           const char *type, const char *help)
+{
+    return conty_rt_text_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+int conty_rt_metric_hist(struct conty_rt_text *text, const char *name,
+                         const char *labels, const struct conty_rt_hist *hist)
+{
+    const char *sep = labels[0] ? "," : "";
+    unsigned int bucket = 0, end;
+    uint64_t seen = 0;
+    int err;
+
+    /*
+     * Buckets are cumulative, the one that ends below 2^k
+     * counts every duration that's smaller
+     */
+    for (size_t k = 0; k < sizeof(metric_le) / sizeof(metric_le[0]); k++) {
+        end = conty_rt_hist_bucket(1ULL << (METRIC_LE_FIRST + k * METRIC_LE_STEP));
+        for (; bucket < end; bucket++)
+            seen += hist->hs_buckets[bucket];
+
+        err = conty_rt_text_printf(text, "%s_bucket{%s%sle=\"%s\"} %llu\n", name, labels,
+                                   sep, metric_le[k], (unsigned long long) seen);
+        if (err != 0)
+            return err;
+    }
+
+    err = conty_rt_text_printf(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+                               (unsigned long long) hist->hs_count);
+    if (err != 0)
+        return err;
+
+    if (!labels[0])
+        return conty_rt_text_printf(text, "%s_sum %.9f\n%s_count %llu\n",
+                                    name, (double) hist->hs_sum / 1e9,
+                                    name, (unsigned long long) hist->hs_count);
+
+    return conty_rt_text_printf(text, "%s_sum{%s} %.9f\n%s_count{%s} %llu\n",
+                                name, labels, (double) hist->hs_sum / 1e9,
+                                name, labels, (unsigned long long) hist->hs_count);
+}
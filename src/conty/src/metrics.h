@@ -0,0 +1,45 @@
+#ifndef CONTY_RT_METRICS_H
+#define CONTY_RT_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+/*
+ * Metrics in the Prometheus text exposition format
+ *
+ * The runtime keeps its counters and histograms in plain integers that only
+ * the loop's thread ever touches, so recording costs an increment and
+ * no atomic operation or lock. Scrapes are answered on the same thread,
+ * between two batches of completions, and see a consistent snapshot
+ */
+struct conty_rt_text {
+    char   *tx_buf;
+    size_t  tx_len;
+    size_t  tx_cap;
+};
+
+/*
+ * Append to the text, which grows as needed
+ * Returns 0, or -ENOMEM if it couldn't grow
+ */
+int conty_rt_text_printf(struct conty_rt_text *text, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void conty_rt_text_free(struct conty_rt_text *text);
+
+/*
+ * HELP and TYPE lines that precede the samples of a metric
+ */
+int conty_rt_metric_header(struct conty_rt_text *text, const char *name,
+                           const char *type, const char *help);
+
+/*
+ * Samples of a histogram of durations, in seconds. labels are
+ * written as they are, e.g. op="create", and may be empty
+ */
+int conty_rt_metric_hist(struct conty_rt_text *text, const char *name,
+                         const char *labels, const struct conty_rt_hist *hist);
+
+#endif //CONTY_RT_METRICS_H
@@ -0,0 +1,284 @@
+#include "registry.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+/*
+ * A metadata word holds the distance of an entry from its home slot plus one
+ * in the upper 8 bits, which leaves 0 to mark empty slots,
+ * and a fragment of the entry's hash in the lower 24 bits
+ */
+#define META_DIST_SHIFT 24
+#define META_DIST_MAX   0xFFu
+#define META_FRAG_MASK  0xFFFFFFu
+
+/*
+ * Grow once the registry is 7/8 full. Robin Hood probing keeps
+ * probe sequences short even at high load factors
+ */
+#define LOAD_NUM 7
+#define LOAD_DEN 8
+
+#define MIN_CAPACITY 16
+
+static inline uint32_t meta_make(uint32_t dist, uint64_t hash)
+{
+    return (dist << META_DIST_SHIFT) | ((uint32_t) (hash >> 40) & META_FRAG_MASK);
+}
+
+static inline uint32_t meta_dist(uint32_t meta)
+{
+    return meta >> META_DIST_SHIFT;
+}
+
+static inline uint32_t meta_frag(uint64_t hash)
+{
+    return (uint32_t) (hash >> 40) & META_FRAG_MASK;
+}
+
+uint64_t conty_rt_registry_hash(const char *id, size_t len)
+{
+    /*
+     * FNV-1a followed by the murmur3 finaliser, which spreads the
+     * entropy of short and similar identifiers across all bits.
+     * We need the low bits for the home slot and the high bits
+     * for the metadata fragment
+     */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) id[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static int registry_alloc(struct conty_rt_registry *reg, size_t slots)
+{
+    reg->rg_meta = calloc(slots, sizeof(uint32_t));
+    if (!reg->rg_meta)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    reg->rg_entries = malloc(slots * sizeof(struct conty_rt_hc));
+    if (!reg->rg_entries) {
+        free(reg->rg_meta);
+        reg->rg_meta = NULL;
+        return log_fatal_ret(-ENOMEM, "out of memory");
+    }
+
+    reg->rg_mask = slots - 1;
+    reg->rg_len  = 0;
+
+    return 0;
+}
+
+int conty_rt_registry_init(struct conty_rt_registry *reg, size_t capacity)
+{
+    size_t slots = MIN_CAPACITY;
+
+    while (slots * LOAD_NUM < capacity * LOAD_DEN)
+        slots <<= 1;
+
+    return registry_alloc(reg, slots);
+}
+
+/*
+ * Place an entry that is known not to be in the registry
+ *
+ * Returns -EOVERFLOW if an entry would end up too far away from its home slot,
+ * in which case entry holds the entry that is still homeless
+ */
+static int registry_place(struct conty_rt_registry *reg, struct conty_rt_hc *entry)
+{
+    struct conty_rt_hc tmp_entry;
+    uint32_t dist = 1, meta, tmp_meta;
+    size_t i = entry->hc_hash & reg->rg_mask;
+
+    meta = meta_make(dist, entry->hc_hash);
+    for (;;) {
+        tmp_meta = reg->rg_meta[i];
+
+        if (!tmp_meta) {
+            reg->rg_meta[i]    = meta;
+            reg->rg_entries[i] = *entry;
+            reg->rg_len++;
+            return 0;
+        }
+
+        /*
+         * Take from the rich and give to the poor: the resident entry
+         * is closer to its home slot than ours, so we take its slot
+         * and continue looking for a slot for the resident
+         */
+        if (meta_dist(tmp_meta) < dist) {
+            tmp_entry = reg->rg_entries[i];
+            reg->rg_meta[i]    = meta;
+            reg->rg_entries[i] = *entry;
+            *entry = tmp_entry;
+            dist = meta_dist(tmp_meta);
+        }
+
+        i = (i + 1) & reg->rg_mask;
+        if (++dist > META_DIST_MAX)
+            return -EOVERFLOW;
+
+        meta = meta_make(dist, entry->hc_hash);
+    }
+}
+
+static int registry_grow(struct conty_rt_registry *reg)
+{
+    struct conty_rt_registry old = *reg;
+    size_t slots = (old.rg_mask + 1) << 1;
+    int err;
+
+    for (;;) {
+        if ((err = registry_alloc(reg, slots)) != 0) {
+            *reg = old;
+            return err;
+        }
+
+        err = 0;
+        for (size_t i = 0; i <= old.rg_mask && err == 0; i++) {
+            if (old.rg_meta[i]) {
+                struct conty_rt_hc entry = old.rg_entries[i];
+                err = registry_place(reg, &entry);
+            }
+        }
+
+        if (err == 0)
+            break;
+
+        /*
+         * Pathological clustering, try again with even more room
+         */
+        conty_rt_registry_free(reg);
+        slots <<= 1;
+    }
+
+    conty_rt_registry_free(&old);
+    return 0;
+}
+
+struct conty_rt_hc *conty_rt_registry_find(const struct conty_rt_registry *reg,
+                                           const char *id, size_t len,
+                                           uint64_t hash)
+{
+    struct conty_rt_hc *entry;
+    uint32_t dist = 1, meta, frag = meta_frag(hash);
+    size_t i = hash & reg->rg_mask;
+
+    for (;;) {
+        meta = reg->rg_meta[i];
+
+        /*
+         * Empty slots have a distance of 0, so this also stops the lookup
+         * at the end of a cluster
+         */
+        if (meta_dist(meta) < dist)
+            return NULL;
+
+        if ((meta & META_FRAG_MASK) == frag) {
+            entry = &reg->rg_entries[i];
+            if (entry->hc_hash == hash && entry->hc_idlen == len &&
+                memcmp(entry->hc_id, id, len) == 0)
+                return entry;
+        }
+
+        i = (i + 1) & reg->rg_mask;
+        dist++;
+    }
+}
+
+int conty_rt_registry_insert(struct conty_rt_registry *reg, const char *id,
+                             size_t len, uint64_t hash,
+                             struct conty_container *cc)
+{
+    struct conty_rt_hc entry;
+    int err;
+
+    if (len >= CONTY_RT_ID_MAX)
+        return -ENAMETOOLONG;
+
+    if (conty_rt_registry_find(reg, id, len, hash))
+        return -EEXIST;
+
+    if ((reg->rg_len + 1) * LOAD_DEN > (reg->rg_mask + 1) * LOAD_NUM) {
+        if ((err = registry_grow(reg)) != 0)
+            return err;
+    }
+
+    entry.hc_hash  = hash;
+    entry.hc_cc    = cc;
+    entry.hc_idlen = (uint32_t) len;
+    entry.hc_busy  = 0;
+    memcpy(entry.hc_id, id, len);
+    entry.hc_id[len] = '\0';
+
+    while ((err = registry_place(reg, &entry)) == -EOVERFLOW) {
+        if ((err = registry_grow(reg)) != 0)
+            return err;
+    }
+
+    return err;
+}
+
+struct conty_container *conty_rt_registry_remove(struct conty_rt_registry *reg,
+                                                 const char *id, size_t len,
+                                                 uint64_t hash)
+{
+    struct conty_rt_hc *entry;
+    struct conty_container *cc;
+    size_t i, next;
+    uint32_t meta;
+
+    entry = conty_rt_registry_find(reg, id, len, hash);
+    if (!entry)
+        return NULL;
+
+    cc = entry->hc_cc;
+    i  = entry - reg->rg_entries;
+
+    /*
+     * Backward shift deletion: move the following entries of the cluster one
+     * slot closer to their home slot until we hit an empty slot or an entry
+     * that already sits in its home slot. This keeps lookups free of tombstones
+     */
+    for (;;) {
+        next = (i + 1) & reg->rg_mask;
+        meta = reg->rg_meta[next];
+
+        if (meta_dist(meta) <= 1)
+            break;
+
+        reg->rg_meta[i]    = meta - (1u << META_DIST_SHIFT);
+        reg->rg_entries[i] = reg->rg_entries[next];
+        i = next;
+    }
+
+    reg->rg_meta[i] = 0;
+    reg->rg_len--;
+
+    return cc;
+}
+
+void conty_rt_registry_free(struct conty_rt_registry *reg)
+{
+    if (reg) {
+        free(reg->rg_meta);
+        free(reg->rg_entries);
+        reg->rg_meta    = NULL;
+        reg->rg_entries = NULL;
+        reg->rg_len     = 0;
+    }
+}
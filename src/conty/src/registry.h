@@ -0,0 +1,117 @@
+#ifndef CONTY_RT_REGISTRY_H
+#define CONTY_RT_REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Maximum length of a container identifier, including the terminating byte
+ * Identifiers are stored inline, so this bounds the size of every entry
+ */
+#define CONTY_RT_ID_MAX 72
+
+/*
+ * Hashable container
+ */
+struct conty_rt_hc {
+    uint64_t                hc_hash;
+    struct conty_container *hc_cc;
+    uint32_t                hc_idlen;
+    char                    hc_id[CONTY_RT_ID_MAX];
+    /*
+     * Slot of the container in the state file, if the runtime keeps one
+     */
+    uint32_t                hc_slot;
+    /*
+     * Set while the container is being created, started or deleted
+     */
+    uint8_t                 hc_busy;
+};
+
+/*
+ * Container registry
+ *
+ * Open-addressing hash table with Robin Hood probing.
+ * Entries live in one contiguous array, while a parallel array of
+ * 32-bit metadata words holds the probe distance of every slot and a fragment
+ * of its hash. Lookups only scan the metadata words, so most of them touch
+ * a single cache line before comparing a single identifier.
+ *
+ * Robin Hood insertion keeps probe distances short and evenly distributed,
+ * which makes lookup latency predictable even for very large registries.
+ * Lookups of missing keys terminate early, as soon as they reach a slot
+ * whose entry is closer to its home slot than the key would be.
+ *
+ * Entries are moved around by insertions and removals, so pointers to them
+ * must not be held across modifications of the registry
+ */
+struct conty_rt_registry {
+    uint32_t           *rg_meta;
+    struct conty_rt_hc *rg_entries;
+    size_t              rg_mask;
+    size_t              rg_len;
+};
+
+/*
+ * Initialise the registry with room for at least capacity containers
+ */
+int conty_rt_registry_init(struct conty_rt_registry *reg, size_t capacity);
+
+/*
+ * Hash a container identifier
+ *
+ * Callers compute the hash once, e.g when parsing a request,
+ * and pass it to all subsequent operations
+ */
+uint64_t conty_rt_registry_hash(const char *id, size_t len);
+
+/*
+ * Look up the container with the given identifier
+ */
+struct conty_rt_hc *conty_rt_registry_find(const struct conty_rt_registry *reg,
+                                           const char *id, size_t len,
+                                           uint64_t hash);
+
+/*
+ * Register a container under the given identifier
+ *
+ * Returns -EEXIST if the identifier is already taken and -ENAMETOOLONG
+ * if it doesn't fit into an entry
+ */
+int conty_rt_registry_insert(struct conty_rt_registry *reg, const char *id,
+                             size_t len, uint64_t hash,
+                             struct conty_container *cc);
+
+/*
+ * Remove the container with the given identifier from the registry and
+ * return it, or NULL if there is no such container
+ */
+struct conty_container *conty_rt_registry_remove(struct conty_rt_registry *reg,
+                                                 const char *id, size_t len,
+                                                 uint64_t hash);
+
+/*
+ * Number of slots that can be iterated with conty_rt_registry_slot
+ */
+static inline size_t conty_rt_registry_slots(const struct conty_rt_registry *reg)
+{
+    return reg->rg_mask + 1;
+}
+
+/*
+ * Return the entry in slot i or NULL if the slot is empty
+ */
+static inline struct conty_rt_hc *conty_rt_registry_slot(const struct conty_rt_registry *reg,
+                                                         size_t i)
+{
+    return reg->rg_meta[i] ? &reg->rg_entries[i] : NULL;
+}
+
+static inline size_t conty_rt_registry_len(const struct conty_rt_registry *reg)
+{
+    return reg->rg_len;
+}
+
+void conty_rt_registry_free(struct conty_rt_registry *reg);
+
+#endif //CONTY_RT_REGISTRY_H
@@ -2,18 +2,23 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/epoll.h>
 #include <sys/wait.h>
 
-#include "hash.h"
+#include "registry.h"
 #include "runtime.h"
+#include "state.h"
 #include "log.h"
 
-#define MAX_EVENTS 256
-
 #define strnprintf(buf, size, ...)                                            \
     ({                                                                        \
         int __internal__ret;                                                  \
@@ -30,21 +35,16 @@ static void sig_int(int signo)
     exiting = 1;
 }
 
-struct conty_rt_event {
-    int                     ev_fd;
-    struct conty_container *ev_cc;
-};
-
-static struct conty_rt_event *conty_rt_event_create(void)
+static struct conty_rt_event *conty_rt_event_create(int kind)
 {
     struct conty_rt_event *event;
 
-    event = malloc(sizeof(struct conty_rt_event));
+    event = calloc(1, sizeof(struct conty_rt_event));
     if (!event)
         return log_error_ret(NULL, "out of memory");
 
-    event->ev_fd = -EBADF;
-    event->ev_cc = NULL;
+    event->ev_kind = kind;
+    event->ev_fd   = -EBADF;
 
     return event;
 }
@@ -54,6 +54,9 @@ static void conty_rt_event_free(struct conty_rt_event *event)
     if (event) {
         if (event->ev_fd >= 0)
             close(event->ev_fd);
+        if (event->ev_buf)
+            conty_rt_text_free(&event->ev_buf->sb_metrics);
+        free(event->ev_buf);
         free(event);
         event = NULL;
     }
@@ -67,12 +70,21 @@ static int conty_rt_kill_container(struct conty_rt *rt,
                                    struct conty_rt_server_buf *req);
 static int conty_rt_delete_container(struct conty_rt *rt,
                                      struct conty_rt_server_buf *req);
-
-static conty_rt_request_handler conty_rt_default_handlers[CONTY_RT_DELETE + 1] = {
-        [CONTY_RT_CREATE] = conty_rt_create_container,
-        [CONTY_RT_START]  = conty_rt_start_container,
-        [CONTY_RT_KILL]   = conty_rt_kill_container,
-        [CONTY_RT_DELETE] = conty_rt_delete_container
+static int conty_rt_create_pod(struct conty_rt *rt,
+                               struct conty_rt_server_buf *req);
+static int conty_rt_delete_pod(struct conty_rt *rt,
+                               struct conty_rt_server_buf *req);
+static int conty_rt_stats(struct conty_rt *rt,
+                          struct conty_rt_server_buf *req);
+
+static conty_rt_request_handler conty_rt_default_handlers[CONTY_RT_OP_MAX + 1] = {
+        [CONTY_RT_CREATE]     = conty_rt_create_container,
+        [CONTY_RT_START]      = conty_rt_start_container,
+        [CONTY_RT_KILL]       = conty_rt_kill_container,
+        [CONTY_RT_DELETE]     = conty_rt_delete_container,
+        [CONTY_RT_POD_CREATE] = conty_rt_create_pod,
+        [CONTY_RT_POD_DELETE] = conty_rt_delete_pod,
+        [CONTY_RT_STATS]      = conty_rt_stats
 };
 
 int conty_rt_server_init(struct conty_rt_server *server, const char *path)
@@ -99,6 +111,57 @@ int conty_rt_server_init(struct conty_rt_server *server, const char *path)
     return 0;
 }
 
+/*
+ * addr is an IPv4 address and a port, the address may be left out
+ */
+static int conty_rt_server_init_tcp(struct conty_rt_server *server, const char *addr)
+{
+    struct sockaddr_in in = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+    char host[INET_ADDRSTRLEN];
+    const char *sep;
+    unsigned long port;
+    char *end;
+    int fd, one = 1, err;
+
+    if (!(sep = strrchr(addr, ':')) || (size_t) (sep - addr) >= sizeof(host))
+        return -EINVAL;
+
+    errno = 0;
+    port = strtoul(sep + 1, &end, 10);
+    if (errno != 0 || *end != '\0' || end == sep + 1 || port == 0 || port > 65535)
+        return -EINVAL;
+
+    in.sin_port = htons((uint16_t) port);
+
+    if (sep != addr) {
+        memcpy(host, addr, (size_t) (sep - addr));
+        host[sep - addr] = '\0';
+        if (inet_pton(AF_INET, host, &in.sin_addr) != 1)
+            return -EINVAL;
+    }
+
+    /*
+     * There's no path to remove once the server is closed
+     */
+    memset(&server->rts_addr, 0, sizeof(server->rts_addr));
+    server->rts_addr.sun_family = AF_INET;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return log_error_ret(-errno, "cannot create socket server at %s", addr);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd, (struct sockaddr *) &in, sizeof(in)) != 0) {
+        err = -errno;
+        close(fd);
+        return log_error_ret(err, "cannot bind socket server to %s", addr);
+    }
+
+    server->rts_fd = fd;
+
+    return 0;
+}
+
 int conty_rt_server_listen(const struct conty_rt_server *server)
 {
     if (listen(server->rts_fd, 2) != 0)
@@ -120,68 +183,254 @@ void conty_rt_server_close(struct conty_rt_server *server)
 {
     if (server) {
         close(server->rts_fd);
-        unlink(server->rts_addr.sun_path);
+        if (server->rts_addr.sun_family == AF_UNIX)
+            unlink(server->rts_addr.sun_path);
     }
 }
 
-conty_rt_loop_t conty_rt_loop_open(void)
+static inline uint64_t conty_rt_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static inline int conty_rt_persistent(const struct conty_rt *rt)
 {
-    int res = epoll_create1(EPOLL_CLOEXEC);
-    return (res < 0) ? -errno : res;
+    return rt->rt_state.st_hdr != NULL;
 }
 
-int conty_rt_loop_add_fd(conty_rt_loop_t loop, int fd, uint32_t events, void *data)
+static void conty_rt_set_status(struct conty_rt *rt, struct conty_rt_hc *hc,
+                                conty_container_status_t status)
 {
-    struct epoll_event event;
+    conty_container_set_status(hc->hc_cc, status);
+    if (conty_rt_persistent(rt))
+        conty_rt_state_set_status(&rt->rt_state, hc->hc_slot, status);
+}
 
-    event.events = events;
-    if (data)
-        event.data.ptr = data;
-    else
-        event.data.fd = fd;
+static int conty_rt_watch_container(struct conty_rt *rt, struct conty_container *cc)
+{
+    struct conty_rt_event *event;
+    int err;
+
+    if (!(event = conty_rt_event_create(CONTY_RT_EV_EXIT)))
+        return -ENOMEM;
+
+    event->ev_fd = conty_container_pollfd(cc);
+    event->ev_cc = cc;
+
+    err = conty_rt_loop_wait_exit(rt->rt_loop, event);
+    if (err < 0) {
+        /*
+         * The descriptor belongs to the container
+         */
+        event->ev_fd = -EBADF;
+        conty_rt_event_free(event);
+    }
 
-    return (epoll_ctl(loop, EPOLL_CTL_ADD, fd, &event) < 0) ? -errno : 0;
+    return err;
 }
 
-int conty_rt_loop_del_fd(conty_rt_loop_t loop, int fd)
+/*
+ * Replies to conn once the container is done with its handshake
+ */
+static int conty_rt_await_container(struct conty_rt *rt, struct conty_container *cc,
+                                    struct conty_rt_event *conn)
 {
-    return (epoll_ctl(loop, EPOLL_CTL_DEL, fd, NULL) < 0) ? -errno : 0;
+    struct conty_rt_event *event;
+    int err;
+
+    if (!(event = conty_rt_event_create(CONTY_RT_EV_SYNC)))
+        return -ENOMEM;
+
+    event->ev_fd   = conty_container_syncfd(cc);
+    event->ev_cc   = cc;
+    event->ev_conn = conn;
+
+    if ((err = conty_rt_loop_wait_sync(rt->rt_loop, event)) < 0) {
+        event->ev_fd = -EBADF;
+        conty_rt_event_free(event);
+    }
+
+    return err;
 }
 
-void conty_rt_loop_close(conty_rt_loop_t loop)
+/*
+ * Rebuild the registry from the state file
+ *
+ * Every record costs a pidfd_open and a read of the process' stat file,
+ * the bundles are only parsed if and when the containers are deleted
+ */
+static int conty_rt_recover(struct conty_rt *rt)
 {
-    if (loop >= 0)
-        close(loop);
+    const struct conty_rt_record *rec;
+    struct conty_container *cc;
+    struct conty_rt_hc *hc;
+    conty_container_status_t status;
+    struct timespec start, end;
+    size_t recovered = 0;
+    uint64_t hash;
+    int pollfd, err;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < conty_rt_state_slots(&rt->rt_state); i++) {
+        if (!(rec = conty_rt_state_record(&rt->rt_state, i)))
+            continue;
+
+        status = rec->rec_status;
+
+        /*
+         * Open the pidfd before checking the start time, so that the pid
+         * can't be recycled between the check and the open
+         */
+        pollfd = (status == CONTY_STOPPED) ? -EBADF : pidfd_open(rec->rec_pid, 0);
+        if (pollfd >= 0 && conty_rt_proc_starttime(rec->rec_pid) != rec->rec_starttime) {
+            close(pollfd);
+            pollfd = -EBADF;
+        }
+
+        /*
+         * The container process exited while we were gone
+         */
+        if (pollfd < 0)
+            status = CONTY_STOPPED;
+
+        cc = conty_container_restore(rec->rec_id, rec->rec_bundle, rec->rec_veth,
+                                     rec->rec_pid, pollfd, status);
+        if (!cc) {
+            if (pollfd >= 0)
+                close(pollfd);
+            return -ENOMEM;
+        }
+
+        hash = conty_rt_registry_hash(rec->rec_id, rec->rec_idlen);
+        err = conty_rt_registry_insert(&rt->rt_containers, rec->rec_id,
+                                       rec->rec_idlen, hash, cc);
+        if (err != 0) {
+            conty_container_free(cc);
+            return log_error_ret(err, "cannot recover container %s", rec->rec_id);
+        }
+
+        hc = conty_rt_registry_find(&rt->rt_containers, rec->rec_id,
+                                    rec->rec_idlen, hash);
+        hc->hc_slot = (uint32_t) i;
+
+        if (status != (conty_container_status_t) rec->rec_status)
+            conty_rt_set_status(rt, hc, status);
+
+        if (pollfd >= 0 && (err = conty_rt_watch_container(rt, cc)) != 0)
+            return err;
+
+        recovered++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    LOG_INFO("Recovered %zu containers in %.3f ms", recovered,
+             (double) (end.tv_sec - start.tv_sec) * 1e3 +
+             (double) (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    return 0;
+}
+
+/*
+ * Containers may refer to the namespaces of other containers
+ * by their identifiers
+ */
+static int conty_rt_resolve(const char *id, void *data)
+{
+    struct conty_rt *rt = (struct conty_rt *) data;
+    size_t idlen = strlen(id);
+    struct conty_rt_hc *hc;
+    int pollfd;
+
+    hc = conty_rt_registry_find(&rt->rt_containers, id, idlen,
+                                conty_rt_registry_hash(id, idlen));
+    if (!hc)
+        return -ENOENT;
+
+    if ((pollfd = conty_container_pollfd(hc->hc_cc)) < 0 ||
+        conty_container_status(hc->hc_cc) == CONTY_STOPPED)
+        return -ESRCH;
+
+    return pollfd;
 }
 
-int conty_rt_init(struct conty_rt *rt, const char *server_path)
+int conty_rt_init(struct conty_rt *rt, const char *server_path,
+                  const char *state_path, char uring)
 {
+    size_t capacity = 0;
     int err;
 
+    rt->rt_state.st_hdr = NULL;
+    rt->rt_pods         = NULL;
+    rt->rt_npods        = 0;
+    rt->rt_exited       = NULL;
+    memset(rt->rt_phases, 0, sizeof(rt->rt_phases));
+    memset(&rt->rt_metrics, 0, sizeof(rt->rt_metrics));
+    rt->rt_metrics_server.rts_fd = -EBADF;
+
     if ((err = conty_rt_server_init(&rt->rt_server, server_path)) != 0)
         return err;
 
-    err = conty_rt_loop_open();
-    if (err < 0)
+    if (!(rt->rt_loop = conty_rt_loop_open(uring))) {
+        err = -ENOMEM;
         goto cleanup;
+    }
+
+    LOG_INFO("Running on %s", conty_rt_loop_backend(rt->rt_loop));
+
+    if (state_path) {
+        if ((err = conty_rt_state_open(&rt->rt_state, state_path)) != 0)
+            goto cleanup_loop;
 
-    rt->rt_loop       = err;
-    rt->rt_containers = NULL;
+        capacity = conty_rt_state_slots(&rt->rt_state) - rt->rt_state.st_nfree;
+    }
+
+    /*
+     * Size the registry up front so that recovery never rehashes
+     */
+    if ((err = conty_rt_registry_init(&rt->rt_containers, capacity)) != 0)
+        goto cleanup_state;
 
-    for (int i = CONTY_RT_CREATE; i <= CONTY_RT_DELETE; i++)
+    for (int i = CONTY_RT_CREATE; i <= CONTY_RT_OP_MAX; i++)
         rt->rt_handlers[i] = conty_rt_default_handlers[i];
 
+    if (state_path && (err = conty_rt_recover(rt)) != 0)
+        goto cleanup_registry;
+
+    conty_container_set_resolver(conty_rt_resolve, rt);
+
     return 0;
 
+cleanup_registry:
+    conty_rt_registry_free(&rt->rt_containers);
+cleanup_state:
+    conty_rt_state_close(&rt->rt_state);
+cleanup_loop:
+    conty_rt_loop_close(rt->rt_loop);
 cleanup:
     conty_rt_server_close(&rt->rt_server);
     return err;
 }
 
+int conty_rt_serve_metrics(struct conty_rt *rt, const char *addr)
+{
+    if (rt->rt_metrics_server.rts_fd >= 0)
+        return -EBUSY;
+
+    if (strchr(addr, '/'))
+        return conty_rt_server_init(&rt->rt_metrics_server, addr);
+
+    return conty_rt_server_init_tcp(&rt->rt_metrics_server, addr);
+}
+
 int conty_rt_register_handler(struct conty_rt *rt, int request,
                               conty_rt_request_handler h)
 {
-    if (request < CONTY_RT_CREATE || request > CONTY_RT_DELETE)
+    if (request < CONTY_RT_CREATE || request > CONTY_RT_OP_MAX)
         return -EINVAL;
 
     if (!h)
@@ -192,23 +441,17 @@ int conty_rt_register_handler(struct conty_rt *rt, int request,
     return 0;
 }
 
-static int conty_rt_request_read(struct conty_rt_server_buf *req, int cfd)
+/*
+ * Split the rx bytes received into the request's buffer
+ */
+static int conty_rt_request_parse(struct conty_rt_server_buf *req, int rx)
 {
-    ssize_t rx;
     char *tok, *save_ptr;
     int i;
 
-    memset(req, 0, sizeof(struct conty_rt_server_buf));
-
-    do {
-        rx = read(cfd, req->sb_rx, sizeof(req->sb_rx));
-    } while (rx < 0 && errno == EINTR);
-
-    if (rx < 0)
-        return -errno;
-
-    if (rx == 0)
-        return -ENODATA;
+    req->sb_rx[rx] = '\0';
+    req->sb_container_id = NULL;
+    memset(req->sb_params, 0, sizeof(req->sb_params));
 
     tok = strtok_r(req->sb_rx, " ", &save_ptr);
     if (!tok || (req->sb_op = conty_request_op_from_str(tok)) < CONTY_RT_CREATE)
@@ -216,10 +459,20 @@ static int conty_rt_request_read(struct conty_rt_server_buf *req, int cfd)
 
     LOG_INFO("Received request %s", tok);
 
+    /*
+     * Statistics of all containers rather than a single one
+     */
     req->sb_container_id = strtok_r(NULL, " ", &save_ptr);
+    if (!req->sb_container_id && req->sb_op == CONTY_RT_STATS)
+        return 0;
+
     if (!req->sb_container_id)
         return -ESRCH;
 
+    req->sb_container_idlen = strlen(req->sb_container_id);
+    req->sb_container_hash  = conty_rt_registry_hash(req->sb_container_id,
+                                                     req->sb_container_idlen);
+
     for (i = 0; i < 2; i++) {
         tok = strtok_r(NULL, " ", &save_ptr);
         if (!tok)
@@ -232,203 +485,682 @@ static int conty_rt_request_read(struct conty_rt_server_buf *req, int cfd)
     return 0;
 }
 
-static int conty_rt_handle_request(struct conty_rt *rt,
-                                   struct conty_rt_server_buf *buf,
-                                   int cfd)
+/*
+ * Send the response and wait for the next request, a connection
+ * that can't be replied to is closed. Without msg, the response
+ * was left in the connection's buffer already
+ */
+static int conty_rt_reply(struct conty_rt *rt, struct conty_rt_event *conn, const char *msg)
 {
-    ssize_t tx;
-    const char *msg;
+    struct conty_rt_server_buf *buf = conn->ev_buf;
     int err;
 
-    err = conty_rt_request_read(buf, cfd);
-    if (err == 0)
-        msg = "ok";
-    else if (err == -EOPNOTSUPP)
-        msg = "invalid command";
-    else if (err == -ESRCH)
-        msg = "container not found";
-    else
-        return err;
+    if (msg)
+        strnprintf(buf->sb_tx, sizeof(buf->sb_tx), "%s", msg);
 
-    strnprintf(buf->sb_tx, sizeof(buf->sb_tx), "%s", msg);
+    err = conty_rt_loop_reply(rt->rt_loop, conn, buf->sb_tx, sizeof(buf->sb_tx),
+                              buf->sb_rx, sizeof(buf->sb_rx) - 1);
+    if (err != 0)
+        conty_rt_event_free(conn);
+
+    return 0;
+}
+
+/*
+ * Count the request once it's answered, with err or with ok
+ */
+static int conty_rt_finish(struct conty_rt *rt, struct conty_rt_event *conn, int err)
+{
+    struct conty_rt_server_buf *buf = conn->ev_buf;
+    struct conty_rt_metrics *mt = &rt->rt_metrics;
+
+    mt->mt_requests[buf->sb_op][err != 0]++;
+    conty_rt_hist_add(&mt->mt_latency[buf->sb_op], conty_rt_now_ns() - buf->sb_received);
 
     if (err != 0)
-        goto write_response;
+        return conty_rt_reply(rt, conn, strerror(-err));
+
+    return conty_rt_reply(rt, conn, buf->sb_tx[0] ? NULL : "ok");
+}
+
+static int conty_rt_handle_request(struct conty_rt *rt, struct conty_rt_event *conn, int rx)
+{
+    struct conty_rt_server_buf *buf = conn->ev_buf;
+    int err;
+
+    buf->sb_received = conty_rt_now_ns();
+
+    err = conty_rt_request_parse(buf, rx);
+    if (err == -EOPNOTSUPP) {
+        rt->rt_metrics.mt_invalid++;
+        return conty_rt_reply(rt, conn, "invalid command");
+    } else if (err == -ESRCH) {
+        rt->rt_metrics.mt_requests[buf->sb_op][1]++;
+        return conty_rt_reply(rt, conn, "container not found");
+    }
+
+    buf->sb_tx[0] = '\0';
 
     err = rt->rt_handlers[buf->sb_op](rt, buf);
+    if (err == -EINPROGRESS)
+        return 0;
+
+    return conty_rt_finish(rt, conn, err);
+}
+
+/*
+ * kind tells connections to the runtime and to the metrics endpoint apart
+ */
+static int conty_rt_accept(struct conty_rt *rt, int fd, int kind)
+{
+    struct conty_rt_event *conn;
+    int err;
+
+    if (fd < 0)
+        return log_error_ret(fd, "cannot accept connection");
+
+    LOG_INFO("Accepting connection");
+
+    if (!(conn = conty_rt_event_create(kind))) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    conn->ev_fd = fd;
+
+    if (!(conn->ev_buf = calloc(1, sizeof(struct conty_rt_server_buf)))) {
+        conty_rt_event_free(conn);
+        return log_error_ret(-ENOMEM, "out of memory");
+    }
+
+    conn->ev_buf->sb_conn = conn;
+
+    err = conty_rt_loop_recv(rt->rt_loop, conn, conn->ev_buf->sb_rx,
+                             sizeof(conn->ev_buf->sb_rx) - 1);
     if (err != 0)
-        strnprintf(buf->sb_tx, sizeof(buf->sb_tx), "%s", strerror(-err));
-
-write_response:
-    do {
-        tx = write(cfd, buf->sb_tx, sizeof(buf->sb_tx));
-    } while (tx < 0 && errno == EINTR);
-    if (tx == 0)
-        return -ENODATA;
-    if (tx < 0)
-        return -errno;
+        conty_rt_event_free(conn);
+
+    return err;
+}
+
+static inline double conty_rt_timeval_ms(const struct timeval *tv)
+{
+    return (double) tv->tv_sec * 1e3 + (double) tv->tv_usec / 1e3;
+}
+
+static void conty_rt_reap(struct conty_rt *rt, struct conty_rt_event *ev)
+{
+    struct conty_container *cc = ev->ev_cc;
+    const char *id = conty_container_id(cc);
+    size_t idlen = strlen(id);
+    const struct rusage *usage;
+    struct conty_rt_hc *hc;
+    int err, status;
+
+    err = conty_container_reap(cc);
+    if (err == -EAGAIN) {
+        if ((err = conty_rt_loop_wait_exit(rt->rt_loop, ev)) == 0)
+            return;
+        LOG_ERROR("cannot watch container %s: %s", id, strerror(-err));
+        goto out;
+    }
+
+    if (err == 0) {
+        status = conty_container_exit_status(cc);
+        usage  = conty_container_rusage(cc);
+        LOG_INFO("Reaped container %s, %s %d, %.3f ms user and %.3f ms system time", id,
+                 WIFEXITED(status) ? "exit status" : "signal",
+                 WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status),
+                 conty_rt_timeval_ms(&usage->ru_utime), conty_rt_timeval_ms(&usage->ru_stime));
+    } else if (err == -ECHILD) {
+        /*
+         * Recovered from the state file, whoever inherited
+         * the process collects its exit status
+         */
+        LOG_INFO("Container %s exited", id);
+    } else {
+        LOG_ERROR("cannot reap container %s: %s", id, strerror(-err));
+    }
+
+    hc = conty_rt_registry_find(&rt->rt_containers, id, idlen,
+                                conty_rt_registry_hash(id, idlen));
+    conty_rt_set_status(rt, hc, CONTY_STOPPED);
+
+out:
+    /*
+     * The pollfd is closed along with the container on delete
+     */
+    ev->ev_fd = -EBADF;
+    conty_rt_event_free(ev);
+}
+
+/*
+ * Reap every container that exited since the last pass, once the loop is done
+ * with a batch of completions. However many exit at once, none of them costs
+ * more than a waitid, and delete requests are answered in the meantime
+ */
+static void conty_rt_reap_exited(struct conty_rt *rt)
+{
+    struct conty_rt_event *ev;
+
+    /*
+     * Exits are reported once the loop is done waiting,
+     * which is when it began with this batch
+     */
+    while ((ev = rt->rt_exited)) {
+        rt->rt_exited = ev->ev_exited;
+        conty_rt_reap(rt, ev);
+        conty_rt_hist_add(&rt->rt_metrics.mt_reap,
+                          conty_rt_now_ns() - rt->rt_metrics.mt_batch_start);
+    }
+}
+
+/*
+ * Forget about a container once the deleter is done with it
+ */
+static void conty_rt_forget(struct conty_rt *rt, const struct conty_rt_event *conn)
+{
+    const struct conty_rt_server_buf *req = conn->ev_buf;
+    struct conty_rt_hc *hc;
+
+    hc = conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
+    if (conty_rt_persistent(rt))
+        conty_rt_state_release(&rt->rt_state, hc->hc_slot);
+
+    conty_rt_registry_remove(&rt->rt_containers, req->sb_container_id,
+                             req->sb_container_idlen, req->sb_container_hash);
+}
+
+static int conty_rt_deleted(struct conty_rt *rt, struct conty_rt_event *conn, int err)
+{
+    conty_rt_forget(rt, conn);
+
+    return conty_rt_finish(rt, conn, err);
+}
+
+/*
+ * Containers whose deletion was still under way when the deleter stopped.
+ * The loop is gone, so their clients get no reply, but the state must not
+ * list them after a restart
+ */
+static void conty_rt_deleted_late(void *data, int err, void *arg)
+{
+    conty_rt_forget(arg, data);
+    conty_rt_event_free(data);
+}
+
+static int conty_rt_collect_deleted(struct conty_rt *rt, struct conty_rt_event *ev)
+{
+    struct conty_rt_event *conn;
+    int err;
+
+    while ((conn = conty_deleter_next(&err)))
+        conty_rt_deleted(rt, conn, err);
+
+    return conty_rt_loop_wait_sync(rt->rt_loop, ev);
+}
+
+/*
+ * Add the phases from first to last that the container went through
+ * to the statistics of all containers
+ */
+static void conty_rt_record_phases(struct conty_rt *rt, const struct conty_container *cc,
+                                   conty_container_phase_t first,
+                                   conty_container_phase_t last)
+{
+    uint64_t ns;
+
+    for (int phase = first; phase <= last; phase++) {
+        if ((ns = conty_container_phase_ns(cc, phase)) != 0)
+            conty_rt_hist_add(&rt->rt_phases[phase], ns);
+    }
+}
+
+/*
+ * Record a container once it's set up, or forget about it if it couldn't be
+ */
+static int conty_rt_created(struct conty_rt *rt, struct conty_container *cc,
+                            const struct conty_rt_server_buf *req, int err)
+{
+    struct conty_rt_hc *hc;
+    int slot = 0;
+
+    /*
+     * The container process is gone already
+     */
+    if (err != 0) {
+        err = -ECHILD;
+        goto err_remove;
+    }
+
+    if (conty_rt_persistent(rt)) {
+        slot = conty_rt_state_add(&rt->rt_state, req->sb_container_id,
+                                  req->sb_container_idlen, req->sb_params[0],
+                                  conty_container_veth(cc), conty_container_pid(cc),
+                                  CONTY_CREATED);
+        if (slot < 0) {
+            err = slot;
+            goto err_kill;
+        }
+    }
+
+    if ((err = conty_rt_watch_container(rt, cc)) != 0) {
+        if (conty_rt_persistent(rt))
+            conty_rt_state_release(&rt->rt_state, slot);
+        goto err_kill;
+    }
+
+    hc = conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
+    hc->hc_slot = (uint32_t) slot;
+    hc->hc_busy = 0;
+
+    conty_container_set_status(cc, CONTY_CREATED);
+    conty_rt_record_phases(rt, cc, CONTY_PHASE_CREATE, CONTY_PHASE_PIVOT);
 
     return 0;
+
+err_kill:
+    conty_container_kill(cc, SIGKILL);
+    waitpid(conty_container_pid(cc), NULL, 0);
+err_remove:
+    conty_rt_registry_remove(&rt->rt_containers, req->sb_container_id,
+                             req->sb_container_idlen, req->sb_container_hash);
+    conty_container_free(cc);
+    return err;
 }
 
-static int conty_rt_reap_container(struct conty_container *cc)
+static int conty_rt_started(struct conty_rt *rt, struct conty_container *cc,
+                            const struct conty_rt_server_buf *req, int err)
 {
-    pid_t reaped_pid;
-    pid_t pid = conty_container_pid(cc);
+    struct conty_rt_hc *hc;
 
-    do {
-        reaped_pid = waitpid(pid, NULL, 0);
-    } while (reaped_pid < 0 && errno == EINTR);
-    if (reaped_pid != pid)
-        return -errno;
+    hc = conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
+    hc->hc_busy = 0;
 
-    conty_container_set_status(cc, CONTY_STOPPED);
+    /*
+     * The process may have been reaped before we got to hear that it executed
+     */
+    if (err == 0 && conty_container_status(cc) == CONTY_CREATED)
+        conty_rt_set_status(rt, hc, CONTY_RUNNING);
+
+    if (err == 0)
+        conty_rt_record_phases(rt, cc, CONTY_PHASE_START, CONTY_PHASE_MAX);
+
+    return err;
+}
+
+/*
+ * Move the handshake of a container along, and reply to
+ * the request that started it once it's done
+ */
+static int conty_rt_advance(struct conty_rt *rt, struct conty_rt_event *ev)
+{
+    struct conty_container *cc = ev->ev_cc;
+    struct conty_rt_event *conn = ev->ev_conn;
+    conty_container_status_t status = conty_container_status(cc);
+    int err;
+
+    if ((err = conty_container_advance(cc)) == -EAGAIN)
+        return conty_rt_loop_wait_sync(rt->rt_loop, ev);
+
+    /*
+     * The descriptor belongs to the container
+     */
+    ev->ev_fd = -EBADF;
+    conty_rt_event_free(ev);
+
+    if (status == CONTY_CREATING)
+        err = conty_rt_created(rt, cc, conn->ev_buf, err);
+    else
+        err = conty_rt_started(rt, cc, conn->ev_buf, err);
+
+    return conty_rt_finish(rt, conn, err);
+}
+
+static inline int conty_rt_hook_phase(int phase)
+{
+    return phase == CONTY_PHASE_RUNTIME_CREATE_HOOKS || phase == CONTY_PHASE_CREATED_HOOKS ||
+           phase == CONTY_PHASE_STARTED_HOOKS;
+}
+
+/*
+ * Write every metric of the runtime to text
+ */
+static int conty_rt_metrics_write(struct conty_rt *rt, struct conty_rt_text *text)
+{
+    const struct conty_rt_metrics *mt = &rt->rt_metrics;
+    static const char *status_str[CONTY_STOPPED + 1] = {
+            [CONTY_CREATING] = "creating",
+            [CONTY_CREATED]  = "created",
+            [CONTY_RUNNING]  = "running",
+            [CONTY_STOPPED]  = "stopped"
+    };
+    size_t live[CONTY_STOPPED + 1] = { 0 };
+    const struct conty_rt_hc *hc;
+    const char *name;
+    char labels[64];
+    int err = 0;
+
+    err |= conty_rt_metric_header(text, "conty_requests_total", "counter",
+                                  "Requests answered, by operation and result.");
+    for (int op = CONTY_RT_CREATE; op <= CONTY_RT_OP_MAX; op++) {
+        name = conty_request_op_str(op);
+        err |= conty_rt_text_printf(text,
+                                    "conty_requests_total{op=\"%s\",result=\"ok\"} %llu\n"
+                                    "conty_requests_total{op=\"%s\",result=\"error\"} %llu\n",
+                                    name, (unsigned long long) mt->mt_requests[op][0],
+                                    name, (unsigned long long) mt->mt_requests[op][1]);
+    }
+
+    err |= conty_rt_metric_header(text, "conty_requests_invalid_total", "counter",
+                                  "Requests that weren't understood.");
+    err |= conty_rt_text_printf(text, "conty_requests_invalid_total %llu\n",
+                                (unsigned long long) mt->mt_invalid);
+
+    err |= conty_rt_metric_header(text, "conty_request_duration_seconds", "histogram",
+                                  "Time from receiving a request to answering it.");
+    for (int op = CONTY_RT_CREATE; op <= CONTY_RT_OP_MAX; op++) {
+        snprintf(labels, sizeof(labels), "op=\"%s\"", conty_request_op_str(op));
+        err |= conty_rt_metric_hist(text, "conty_request_duration_seconds", labels,
+                                    &mt->mt_latency[op]);
+    }
+
+    /*
+     * Counted as we go, scrapes are far apart and the registry
+     * only keeps the status of a container in the container itself
+     */
+    for (size_t i = 0; i < conty_rt_registry_slots(&rt->rt_containers); i++) {
+        if ((hc = conty_rt_registry_slot(&rt->rt_containers, i)))
+            live[conty_container_status(hc->hc_cc)]++;
+    }
+
+    err |= conty_rt_metric_header(text, "conty_containers", "gauge",
+                                  "Containers known to the runtime, by status.");
+    for (int status = CONTY_CREATING; status <= CONTY_STOPPED; status++)
+        err |= conty_rt_text_printf(text, "conty_containers{status=\"%s\"} %zu\n",
+                                    status_str[status], live[status]);
+
+    err |= conty_rt_metric_header(text, "conty_container_phase_duration_seconds", "histogram",
+                                  "Time containers spent in each phase of creating and starting.");
+    for (int phase = CONTY_PHASE_CREATE; phase <= CONTY_PHASE_MAX; phase++) {
+        if (conty_rt_hook_phase(phase))
+            continue;
+
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", conty_container_phase_str(phase));
+        err |= conty_rt_metric_hist(text, "conty_container_phase_duration_seconds", labels,
+                                    &rt->rt_phases[phase]);
+    }
+
+    /*
+     * Named after the hook rather than the phase, without the _hooks suffix
+     */
+    err |= conty_rt_metric_header(text, "conty_hook_duration_seconds", "histogram",
+                                  "Time containers spent running their hooks.");
+    for (int phase = CONTY_PHASE_CREATE; phase <= CONTY_PHASE_MAX; phase++) {
+        if (!conty_rt_hook_phase(phase))
+            continue;
+
+        name = conty_container_phase_str(phase);
+        snprintf(labels, sizeof(labels), "hook=\"%.*s\"",
+                 (int) (strlen(name) - (sizeof("_hooks") - 1)), name);
+        err |= conty_rt_metric_hist(text, "conty_hook_duration_seconds", labels,
+                                    &rt->rt_phases[phase]);
+    }
+
+    err |= conty_rt_metric_header(text, "conty_reap_delay_seconds", "histogram",
+                                  "Time from the loop reporting an exit to reaping the container.");
+    err |= conty_rt_metric_hist(text, "conty_reap_delay_seconds", "", &mt->mt_reap);
+
+    err |= conty_rt_metric_header(text, "conty_loop_batch_duration_seconds", "histogram",
+                                  "Time spent handling a batch of completions.");
+    err |= conty_rt_metric_hist(text, "conty_loop_batch_duration_seconds", "", &mt->mt_batch);
+
+    return err ? -ENOMEM : 0;
+}
+
+/*
+ * Room left in front of the metrics for the response's header,
+ * which is written once the length of the metrics is known
+ */
+#define CONTY_RT_HTTP_HDR 128
+
+static const char conty_rt_http_bad[] =
+    "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+
+/*
+ * Answer a scrape with every metric, the connection is kept open for the next
+ */
+static int conty_rt_scrape(struct conty_rt *rt, struct conty_rt_event *conn, int rx)
+{
+    struct conty_rt_server_buf *buf = conn->ev_buf;
+    struct conty_rt_text *text = &buf->sb_metrics;
+    const char *tx = conty_rt_http_bad;
+    size_t txlen = sizeof(conty_rt_http_bad) - 1;
+    char hdr[CONTY_RT_HTTP_HDR];
+    int len, err;
+
+    buf->sb_rx[rx] = '\0';
+
+    if (!strncmp(buf->sb_rx, "GET ", sizeof("GET ") - 1)) {
+        text->tx_len = 0;
+
+        if (conty_rt_text_printf(text, "%*s", CONTY_RT_HTTP_HDR, "") != 0 ||
+            conty_rt_metrics_write(rt, text) != 0) {
+            conty_rt_event_free(conn);
+            return log_error_ret(0, "cannot write metrics");
+        }
+
+        len = snprintf(hdr, sizeof(hdr),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                       "Content-Length: %zu\r\n\r\n", text->tx_len - CONTY_RT_HTTP_HDR);
+        if (len < 0 || len >= CONTY_RT_HTTP_HDR) {
+            conty_rt_event_free(conn);
+            return 0;
+        }
+
+        tx    = text->tx_buf + CONTY_RT_HTTP_HDR - len;
+        txlen = text->tx_len - CONTY_RT_HTTP_HDR + (size_t) len;
+        memcpy((char *) tx, hdr, (size_t) len);
+    }
+
+    err = conty_rt_loop_reply(rt->rt_loop, conn, tx, txlen, buf->sb_rx, sizeof(buf->sb_rx) - 1);
+    if (err != 0)
+        conty_rt_event_free(conn);
 
     return 0;
 }
 
+static int conty_rt_dispatch(void *data, struct conty_rt_event *ev, int res)
+{
+    struct conty_rt *rt = (struct conty_rt *) data;
+
+    /*
+     * First completion of this batch
+     */
+    if (!rt->rt_metrics.mt_batch_start)
+        rt->rt_metrics.mt_batch_start = conty_rt_now_ns();
+
+    switch (ev->ev_kind) {
+        case CONTY_RT_EV_SERVER:
+            return conty_rt_accept(rt, res, CONTY_RT_EV_CONN);
+        case CONTY_RT_EV_METRICS_SERVER:
+            return conty_rt_accept(rt, res, CONTY_RT_EV_METRICS_CONN);
+        case CONTY_RT_EV_CONN:
+            /*
+             * The client hung up, or the last response couldn't be sent
+             */
+            if (res <= 0) {
+                conty_rt_event_free(ev);
+                return 0;
+            }
+            return conty_rt_handle_request(rt, ev, res);
+        case CONTY_RT_EV_EXIT:
+            /*
+             * Reaped along with every other exit of this batch
+             */
+            ev->ev_exited = rt->rt_exited;
+            rt->rt_exited = ev;
+            return 0;
+        case CONTY_RT_EV_SYNC:
+            return conty_rt_advance(rt, ev);
+        case CONTY_RT_EV_DELETE:
+            return conty_rt_collect_deleted(rt, ev);
+        case CONTY_RT_EV_METRICS_CONN:
+            if (res <= 0) {
+                conty_rt_event_free(ev);
+                return 0;
+            }
+            return conty_rt_scrape(rt, ev, res);
+        default:
+            return -EINVAL;
+    }
+}
+
 int conty_rt_run(struct conty_rt *rt)
 {
-    int err, nfds, i;
-    struct conty_rt_event *cur = NULL, se, *new = NULL;
-    struct epoll_event events[MAX_EVENTS];
-    struct conty_rt_server_buf buf;
-    struct conty_rt_hc *hc;
+    struct conty_rt_event se = { .ev_kind = CONTY_RT_EV_SERVER };
+    struct conty_rt_event de = { .ev_kind = CONTY_RT_EV_DELETE };
+    struct conty_rt_event me = { .ev_kind = CONTY_RT_EV_METRICS_SERVER };
+    struct conty_rt_metrics *mt = &rt->rt_metrics;
+    int err;
 
     se.ev_fd = rt->rt_server.rts_fd;
-    se.ev_cc = NULL;
+    de.ev_fd = conty_deleter_fd();
+    me.ev_fd = rt->rt_metrics_server.rts_fd;
 
     if ((err = conty_rt_server_listen(&rt->rt_server)) != 0)
-        goto out;
+        return err;
 
-    err = conty_rt_loop_add_fd(rt->rt_loop, se.ev_fd, EPOLLIN, &se);
-    if (err < 0)
-        goto out;
+    if ((err = conty_rt_loop_accept(rt->rt_loop, &se)) != 0)
+        return err;
+
+    if (me.ev_fd >= 0) {
+        if ((err = conty_rt_server_listen(&rt->rt_metrics_server)) != 0 ||
+            (err = conty_rt_loop_accept(rt->rt_loop, &me)) != 0)
+            return err;
+    }
+
+    if (de.ev_fd >= 0 && (err = conty_rt_loop_wait_sync(rt->rt_loop, &de)) != 0)
+        return err;
 
     while (!exiting) {
-        nfds = epoll_wait(rt->rt_loop, events, MAX_EVENTS, -1);
-        if (nfds < 0) {
-            if (errno == EINTR)
-                continue;
-            goto out;
-        }
+        err = conty_rt_loop_run_once(rt->rt_loop, conty_rt_dispatch, rt);
+        conty_rt_reap_exited(rt);
 
-        for (i = 0; i < nfds; i++) {
-            if (events[i].events & EPOLLIN) {
-                cur = (struct conty_rt_event *) events[i].data.ptr;
-
-                if (cur->ev_cc) {
-                    LOG_INFO("Reaping container %s", conty_container_id(cur->ev_cc));
-
-                    if ((err = conty_rt_reap_container(cur->ev_cc)) != 0)
-                        return err;
-
-                    if ((err = conty_rt_loop_del_fd(rt->rt_loop, cur->ev_fd)) != 0)
-                        return -1;
-
-                    conty_rt_event_free(cur);
-                    continue;
-                }
-
-                if (cur->ev_fd == rt->rt_server.rts_fd) {
-                    LOG_INFO("Accepting connection");
-
-                    new = conty_rt_event_create();
-                    if (!new) {
-                        goto out;
-                    }
-
-                    new->ev_fd = conty_rt_server_accept_conn(&rt->rt_server);
-                    if (new->ev_fd < 0)
-                        goto out;
-
-                    err = conty_rt_loop_add_fd(rt->rt_loop, new->ev_fd,
-                                               EPOLLIN | EPOLLHUP | EPOLLERR,
-                                               new);
-                    if (err < 0)
-                        goto out;
-
-                    continue;
-                }
-
-                err = conty_rt_handle_request(rt, &buf, cur->ev_fd);
-                if (err == -ENODATA) {
-                    if (conty_rt_loop_del_fd(rt->rt_loop, cur->ev_fd) != 0)
-                        goto out;
-                    conty_rt_event_free(cur);
-                    continue;
-                } else if (err != 0)
-                    goto out;
-
-                if (buf.sb_op == CONTY_RT_CREATE) {
-                    new = conty_rt_event_create();
-                    if (!new)
-                        goto out;
-
-                    HASH_FIND_STR(rt->rt_containers, buf.sb_container_id, hc);
-                    if (!hc)
-                        goto out;
-
-                    new->ev_fd = conty_container_pollfd(hc->hc_cc);
-                    new->ev_cc = hc->hc_cc;
-
-                    err = conty_rt_loop_add_fd(rt->rt_loop, new->ev_fd,
-                                               EPOLLIN | EPOLLHUP | EPOLLERR,
-                                               new);
-                    if (err < 0)
-                        goto out;
-                }
-            }
+        if (mt->mt_batch_start) {
+            conty_rt_hist_add(&mt->mt_batch, conty_rt_now_ns() - mt->mt_batch_start);
+            mt->mt_batch_start = 0;
         }
+        if (err == -EINTR)
+            continue;
+        if (err != 0)
+            break;
     }
-out:
-    conty_rt_event_free(new);
-    return err;
+
+    return exiting ? 0 : err;
 }
 
 void conty_rt_free(struct conty_rt *rt)
 {
     if (rt) {
         conty_rt_server_close(&rt->rt_server);
+        if (rt->rt_metrics_server.rts_fd >= 0)
+            conty_rt_server_close(&rt->rt_metrics_server);
         conty_rt_loop_close(rt->rt_loop);
+        conty_rt_registry_free(&rt->rt_containers);
+        conty_rt_state_close(&rt->rt_state);
+
+        /*
+         * The members keep the namespaces alive without the holders
+         */
+        for (size_t i = 0; i < rt->rt_npods; i++)
+            conty_pod_free(rt->rt_pods[i]);
+        free(rt->rt_pods);
+    }
+}
+
+static struct conty_pod **conty_rt_find_pod(const struct conty_rt *rt, const char *id)
+{
+    for (size_t i = 0; i < rt->rt_npods; i++) {
+        if (!strcmp(conty_pod_id(rt->rt_pods[i]), id))
+            return &rt->rt_pods[i];
     }
+
+    return NULL;
 }
 
 static int conty_rt_create_container(struct conty_rt *rt,
                                      struct conty_rt_server_buf *req)
 {
+    int err;
     const char *bundle_path = req->sb_params[0];
+    const char *pod_id = req->sb_params[1];
     struct conty_container *cc = NULL;
     struct conty_rt_hc *hc = NULL;
+    struct conty_pod **pod = NULL;
 
     if (!bundle_path)
         return -EINVAL;
 
+    /*
+     * Pods and containers share a namespace of identifiers,
+     * both name network devices after them
+     */
+    if (conty_rt_find_pod(rt, req->sb_container_id))
+        return -EEXIST;
+
+    if (pod_id && !(pod = conty_rt_find_pod(rt, pod_id)))
+        return -ENOENT;
+
     if (access(bundle_path, R_OK) != 0)
         return -errno;
 
-    HASH_FIND_STR(rt->rt_containers, req->sb_container_id, hc);
-    if (hc)
+    if (req->sb_container_idlen >= CONTY_RT_ID_MAX)
+        return -ENAMETOOLONG;
+
+    if (conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                               req->sb_container_idlen, req->sb_container_hash))
         return -EEXIST;
 
-    hc = calloc(1, sizeof(struct conty_rt_hc));
-    if (!hc)
-        return -ENOMEM;
+    if (conty_rt_persistent(rt) && strlen(bundle_path) >= CONTY_RT_BUNDLE_MAX)
+        return -ENAMETOOLONG;
 
-    cc = conty_container_create(req->sb_container_id, bundle_path);
-    if (!cc) {
-        free(hc);
+    cc = conty_container_create_async(pod ? *pod : NULL, req->sb_container_id,
+                                      bundle_path, NULL, NULL);
+    if (!cc)
         return -ECHILD;
-    }
 
-    conty_container_set_status(cc, CONTY_CREATED);
+    /*
+     * The identifier is taken while the container is being set up,
+     * it's recorded in the state file once it's created
+     */
+    err = conty_rt_registry_insert(&rt->rt_containers, req->sb_container_id,
+                                   req->sb_container_idlen,
+                                   req->sb_container_hash, cc);
+    if (err != 0)
+        goto err_kill;
+
+    hc = conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
+    hc->hc_busy = 1;
 
-    hc->hc_cc = cc;
-    hc->hc_id = strdup(req->sb_container_id);
+    if ((err = conty_rt_await_container(rt, cc, req->sb_conn)) != 0) {
+        conty_rt_registry_remove(&rt->rt_containers, req->sb_container_id,
+                                 req->sb_container_idlen, req->sb_container_hash);
+        goto err_kill;
+    }
 
-    HASH_ADD_KEYPTR(hh, rt->rt_containers, hc->hc_id, strlen(hc->hc_id), hc);
+    return -EINPROGRESS;
 
-    return 0;
+err_kill:
+    conty_container_kill(cc, SIGKILL);
+    waitpid(conty_container_pid(cc), NULL, 0);
+    conty_container_free(cc);
+    return err;
 }
 
 static int conty_rt_start_container(struct conty_rt *rt,
@@ -438,19 +1170,26 @@ static int conty_rt_start_container(struct conty_rt *rt,
     const char *container_id = req->sb_container_id;
     struct conty_rt_hc *hc = NULL;
 
-    HASH_FIND_STR(rt->rt_containers, container_id, hc);
+    hc = conty_rt_registry_find(&rt->rt_containers, container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
     if (!hc)
         return -ENOENT;
 
     if (conty_container_status(hc->hc_cc) != CONTY_CREATED)
         return -EINVAL;
 
-    if ((err = conty_container_start(hc->hc_cc)) != 0)
+    if (hc->hc_busy)
+        return -EBUSY;
+
+    if ((err = conty_container_start_async(hc->hc_cc)) != 0)
         return err;
 
-    conty_container_set_status(hc->hc_cc, CONTY_RUNNING);
+    if ((err = conty_rt_await_container(rt, hc->hc_cc, req->sb_conn)) != 0)
+        return err;
 
-    return err;
+    hc->hc_busy = 1;
+
+    return -EINPROGRESS;
 }
 
 static int conty_rt_kill_container(struct conty_rt *rt,
@@ -467,7 +1206,8 @@ static int conty_rt_kill_container(struct conty_rt *rt,
     if ((sig = conty_signal(signal)) < 0)
         return -EINVAL;
 
-    HASH_FIND_STR(rt->rt_containers, container_id, hc);
+    hc = conty_rt_registry_find(&rt->rt_containers, container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
     if (!hc)
         return -ENOENT;
 
@@ -480,45 +1220,312 @@ static int conty_rt_kill_container(struct conty_rt *rt,
 static int conty_rt_delete_container(struct conty_rt *rt,
                                      struct conty_rt_server_buf *req)
 {
-    int err;
     const char *container_id = req->sb_container_id;
+    struct conty_container *cc = NULL;
     struct conty_rt_hc *hc = NULL;
 
-    HASH_FIND_STR(rt->rt_containers, container_id, hc);
+    hc = conty_rt_registry_find(&rt->rt_containers, container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
     if (!hc)
         return -ENOENT;
 
     if (conty_container_status(hc->hc_cc) != CONTY_STOPPED)
         return -EINVAL;
 
-    HASH_DEL(rt->rt_containers, hc);
+    /*
+     * Exited before the runtime heard back from its start,
+     * or being deleted already
+     */
+    if (hc->hc_busy)
+        return -EBUSY;
+
+    /*
+     * The identifier stays taken until the container is gone,
+     * its network devices and scratch directory are named after it
+     */
+    if (conty_container_delete_async(hc->hc_cc, req->sb_conn) == 0) {
+        hc->hc_busy = 1;
+        return -EINPROGRESS;
+    }
+
+    if (conty_rt_persistent(rt))
+        conty_rt_state_release(&rt->rt_state, hc->hc_slot);
+
+    /*
+     * Removal shifts entries around, so hc is invalid afterwards
+     */
+    cc = conty_rt_registry_remove(&rt->rt_containers, container_id,
+                                  req->sb_container_idlen, req->sb_container_hash);
+
+    return conty_container_delete(cc);
+}
+
+static int conty_rt_create_pod(struct conty_rt *rt,
+                               struct conty_rt_server_buf *req)
+{
+    const char *bundle_path = req->sb_params[0];
+    struct conty_pod **pods, *pod;
+
+    if (!bundle_path)
+        return -EINVAL;
+
+    if (access(bundle_path, R_OK) != 0)
+        return -errno;
+
+    if (conty_rt_find_pod(rt, req->sb_container_id) ||
+        conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                               req->sb_container_idlen, req->sb_container_hash))
+        return -EEXIST;
+
+    pods = realloc(rt->rt_pods, (rt->rt_npods + 1) * sizeof(struct conty_pod *));
+    if (!pods)
+        return log_error_ret(-ENOMEM, "out of memory");
 
-    err = conty_container_delete(hc->hc_cc);
+    rt->rt_pods = pods;
 
-    free(hc->hc_id);
-    free(hc);
+    if (!(pod = conty_pod_create(req->sb_container_id, bundle_path)))
+        return -ECHILD;
+
+    rt->rt_pods[rt->rt_npods++] = pod;
+
+    return 0;
+}
+
+static int conty_rt_delete_pod(struct conty_rt *rt,
+                               struct conty_rt_server_buf *req)
+{
+    struct conty_pod **pod;
+    int err;
+
+    if (!(pod = conty_rt_find_pod(rt, req->sb_container_id)))
+        return -ENOENT;
+
+    if ((err = conty_pod_delete(*pod)) == -EBUSY)
+        return err;
+
+    *pod = rt->rt_pods[--rt->rt_npods];
 
     return err;
 }
 
+/*
+ * Appends a line to the response, or truncates it if there's no room
+ */
+#define conty_rt_respond(req, off, ...)                                                  \
+    ({                                                                                   \
+        int __ret = snprintf((req)->sb_tx + (off), sizeof((req)->sb_tx) - (off),         \
+                             ##__VA_ARGS__);                                             \
+        (off) += (__ret < 0) ? 0 : (size_t) __ret;                                       \
+        if ((off) >= sizeof((req)->sb_tx))                                               \
+            (off) = sizeof((req)->sb_tx) - 1;                                            \
+    })
+
+static inline double conty_rt_ns_ms(uint64_t ns)
+{
+    return (double) ns / 1e6;
+}
+
+/*
+ * Statistics of the phases that containers went through, one per line
+ */
+static int conty_rt_stats_all(struct conty_rt *rt, struct conty_rt_server_buf *req)
+{
+    size_t off = 0;
+    int len;
+
+    for (int phase = CONTY_PHASE_CREATE; phase <= CONTY_PHASE_MAX; phase++) {
+        if (rt->rt_phases[phase].hs_count == 0)
+            continue;
+
+        conty_rt_respond(req, off, "%s ", conty_container_phase_str(phase));
+
+        len = conty_rt_hist_format(&rt->rt_phases[phase], req->sb_tx + off,
+                                   sizeof(req->sb_tx) - off);
+        if (len < 0)
+            return -ENOBUFS;
+        off += (size_t) len;
+
+        conty_rt_respond(req, off, "\n");
+    }
+
+    return 0;
+}
+
+/*
+ * The phases the container went through, in milliseconds, and
+ * how it exited and the resources it used once it's reaped
+ */
+static int conty_rt_stats(struct conty_rt *rt, struct conty_rt_server_buf *req)
+{
+    const struct rusage *usage;
+    struct conty_container *cc;
+    struct conty_rt_hc *hc;
+    size_t off = 0;
+    uint64_t ns;
+    int status;
+
+    if (!req->sb_container_id)
+        return conty_rt_stats_all(rt, req);
+
+    hc = conty_rt_registry_find(&rt->rt_containers, req->sb_container_id,
+                                req->sb_container_idlen, req->sb_container_hash);
+    if (!hc)
+        return -ENOENT;
+
+    cc = hc->hc_cc;
+
+    conty_rt_respond(req, off, "status %s\n", conty_container_status_str(cc));
+
+    for (int phase = CONTY_PHASE_CREATE; phase <= CONTY_PHASE_MAX; phase++) {
+        if ((ns = conty_container_phase_ns(cc, phase)) != 0)
+            conty_rt_respond(req, off, "%s %.3f\n", conty_container_phase_str(phase),
+                             conty_rt_ns_ms(ns));
+    }
+
+    if (!(usage = conty_container_rusage(cc)))
+        return 0;
+
+    status = conty_container_exit_status(cc);
+    if (WIFEXITED(status))
+        conty_rt_respond(req, off, "exit_status %d\n", WEXITSTATUS(status));
+    else
+        conty_rt_respond(req, off, "signal %d\n", WTERMSIG(status));
+
+    conty_rt_respond(req, off, "user %.3f\nsystem %.3f\nmax_rss_kib %ld\n",
+                     conty_rt_timeval_ms(&usage->ru_utime),
+                     conty_rt_timeval_ms(&usage->ru_stime), usage->ru_maxrss);
+
+    return 0;
+}
+
+/*
+ * -p bridge:size keeps a pool of size pairs attached to bridge
+ */
+static int start_net_pool(char *arg)
+{
+    char *sep, *end;
+    unsigned long size;
+
+    if (!(sep = strrchr(arg, ':')) || sep == arg)
+        return -EINVAL;
+
+    errno = 0;
+    size = strtoul(sep + 1, &end, 10);
+    if (errno != 0 || *end != '\0' || end == sep + 1 || size == 0 || size > 4096)
+        return -EINVAL;
+
+    *sep = '\0';
+
+    return conty_net_pool_start(arg, (unsigned int) size);
+}
+
+/*
+ * -s stacks[:KiB] keeps stacks for the processes that join namespaces,
+ * two of the default size unless told otherwise
+ */
+#define RT_STACKS 2
+
+static int start_stack_pool(const char *arg)
+{
+    unsigned long stacks, kib = 0;
+    char *end;
+
+    errno = 0;
+    stacks = strtoul(arg, &end, 10);
+    if (errno != 0 || end == arg || stacks == 0 || stacks > 64)
+        return -EINVAL;
+
+    if (*end == ':') {
+        arg = end + 1;
+        kib = strtoul(arg, &end, 10);
+        if (errno != 0 || end == arg || kib == 0 || kib > 1024 * 1024)
+            return -EINVAL;
+    }
+
+    if (*end != '\0')
+        return -EINVAL;
+
+    return conty_stack_pool_start((unsigned int) stacks, kib * 1024);
+}
+
 int main(int argc, char *argv[])
 {
-    int err;
-    if (argc != 2)
-        return EXIT_FAILURE;
+    int err, opt;
+    char pooled = 0, stacks = 0, uring = 1;
+    const char *metrics = NULL;
+
+    while ((opt = getopt(argc, argv, "em:p:s:u")) != -1) {
+        switch (opt) {
+            case 'e':
+                uring = 0;
+                break;
+            case 'm':
+                metrics = optarg;
+                break;
+            case 'p':
+                if (pooled || (err = start_net_pool(optarg)) != 0)
+                    return log_error_ret(EXIT_FAILURE, "cannot start pool %s", optarg);
+                pooled = 1;
+                break;
+            case 's':
+                if (stacks || (err = start_stack_pool(optarg)) != 0)
+                    return log_error_ret(EXIT_FAILURE, "cannot start stack pool %s", optarg);
+                stacks = 1;
+                break;
+            case 'u':
+                conty_container_set_runtime_id_maps(1);
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (argc - optind != 1 && argc - optind != 2)
+        goto usage;
+
+    if (!stacks && conty_stack_pool_start(RT_STACKS, 0) != 0)
+        LOG_WARN("cannot start stack pool, stacks are mapped on demand");
+
+    if (conty_deleter_start() != 0)
+        LOG_WARN("cannot start deleter, containers are deleted in place");
+
+    if (conty_log_start() != 0)
+        LOG_WARN("cannot start logger, messages are written in place");
 
     if (signal(SIGINT, sig_int) == SIG_ERR)
         return log_error_ret(EXIT_FAILURE, "cannot set signal handler");
 
-    const char *socket_path = argv[1];
+    const char *socket_path = argv[optind];
+    const char *state_path  = (argc - optind == 2) ? argv[optind + 1] : NULL;
     struct conty_rt rt;
 
-    if (conty_rt_init(&rt, socket_path) != 0)
-        return log_error_ret(EXIT_FAILURE, "cannot initialise runtime");
+    if ((err = conty_rt_init(&rt, socket_path, state_path, uring)) != 0) {
+        LOG_ERROR("cannot initialise runtime");
+        goto out;
+    }
+
+    if (metrics && (err = conty_rt_serve_metrics(&rt, metrics)) != 0) {
+        LOG_ERROR("cannot serve metrics on %s", metrics);
+        conty_rt_free(&rt);
+        goto out;
+    }
 
     err = conty_rt_run(&rt);
 
+    conty_deleter_stop(conty_rt_deleted_late, &rt);
     conty_rt_free(&rt);
 
+out:
+    if (pooled)
+        conty_net_pool_stop();
+    conty_stack_pool_stop();
+    conty_deleter_stop(NULL, NULL);
+    conty_log_stop();
+
     return (err != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "usage: %s [-e] [-m metrics socket or [address]:port] [-p bridge:size] "
+                    "[-s stacks[:KiB]] [-u] <socket> [state file]\n", argv[0]);
+    return EXIT_FAILURE;
 }
@@ -3,9 +3,15 @@
 
 #include <conty/conty.h>
 #include <signal.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/un.h>
 
-#include "hash.h"
+#include "loop.h"
+#include "metrics.h"
+#include "registry.h"
+#include "state.h"
+#include "stats.h"
 
 #define CONTY_RT_BUFSIZE 4096
 
@@ -13,15 +19,41 @@ enum {
     CONTY_RT_CREATE,
     CONTY_RT_START,
     CONTY_RT_KILL,
-    CONTY_RT_DELETE
+    CONTY_RT_DELETE,
+    CONTY_RT_POD_CREATE,
+    CONTY_RT_POD_DELETE,
+    CONTY_RT_STATS
 };
 
+#define CONTY_RT_OP_MAX (CONTY_RT_STATS)
+
 struct conty_rt_server_buf {
     char   sb_rx[CONTY_RT_BUFSIZE];
+    /*
+     * Handlers that have more to say than "ok" leave their response here
+     */
     char   sb_tx[CONTY_RT_BUFSIZE];
-    int    sb_op;
-    char  *sb_container_id;
-    char  *sb_params[3];
+    int       sb_op;
+    char     *sb_container_id;
+    size_t    sb_container_idlen;
+    /*
+     * Hash of the container identifier, computed once per request
+     */
+    uint64_t  sb_container_hash;
+    char     *sb_params[3];
+    /*
+     * Connection the request came in on. Handlers that return -EINPROGRESS
+     * reply to it later, nothing else is received on it until they do
+     */
+    struct conty_rt_event *sb_conn;
+    /*
+     * When the request was received, in nanoseconds
+     */
+    uint64_t  sb_received;
+    /*
+     * Scrapes of the metrics endpoint are answered from here instead of sb_tx
+     */
+    struct conty_rt_text   sb_metrics;
 };
 
 static inline int conty_request_op_from_str(const char *str)
@@ -38,9 +70,36 @@ static inline int conty_request_op_from_str(const char *str)
     if (!strncmp(str, "delete", sizeof("delete") - 1))
         return CONTY_RT_DELETE;
 
+    if (!strncmp(str, "pod-create", sizeof("pod-create") - 1))
+        return CONTY_RT_POD_CREATE;
+
+    if (!strncmp(str, "pod-delete", sizeof("pod-delete") - 1))
+        return CONTY_RT_POD_DELETE;
+
+    if (!strncmp(str, "stats", sizeof("stats") - 1))
+        return CONTY_RT_STATS;
+
     return -EINVAL;
 }
 
+static inline const char *conty_request_op_str(int op)
+{
+    static const char *op_str[CONTY_RT_OP_MAX + 1] = {
+            [CONTY_RT_CREATE]     = "create",
+            [CONTY_RT_START]      = "start",
+            [CONTY_RT_KILL]       = "kill",
+            [CONTY_RT_DELETE]     = "delete",
+            [CONTY_RT_POD_CREATE] = "pod-create",
+            [CONTY_RT_POD_DELETE] = "pod-delete",
+            [CONTY_RT_STATS]      = "stats"
+    };
+
+    if (op < CONTY_RT_CREATE || op > CONTY_RT_OP_MAX)
+        return "unknown";
+
+    return op_str[op];
+}
+
 static inline int conty_signal(const char *sig)
 {
     if (!strncmp(sig, "SIGKILL", sizeof("SIGKILL") - 1))
@@ -65,20 +124,30 @@ int conty_rt_server_listen(const struct conty_rt_server *server);
 int conty_rt_server_accept_conn(const struct conty_rt_server *server);
 void conty_rt_server_close(struct conty_rt_server *server);
 
-typedef int conty_rt_loop_t;
-
-conty_rt_loop_t conty_rt_loop_open(void);
-int conty_rt_loop_add_fd(conty_rt_loop_t loop, int fd, uint32_t events, void *data);
-int conty_rt_loop_del_fd(conty_rt_loop_t loop, int fd);
-void conty_rt_loop_close(conty_rt_loop_t loop);
-
 /*
- * Hashable container
+ * Counters of the runtime, only ever touched by the loop's thread
  */
-struct conty_rt_hc {
-    char                   *hc_id;
-    struct conty_container *hc_cc;
-    UT_hash_handle          hh;
+struct conty_rt_metrics {
+    /*
+     * Requests by operation, answered with ok or with an error,
+     * and those that weren't understood at all
+     */
+    uint64_t             mt_requests[CONTY_RT_OP_MAX + 1][2];
+    uint64_t             mt_invalid;
+    /*
+     * From receiving a request to replying to it
+     */
+    struct conty_rt_hist mt_latency[CONTY_RT_OP_MAX + 1];
+    /*
+     * From the loop reporting an exit to reaping the container
+     */
+    struct conty_rt_hist mt_reap;
+    /*
+     * Time spent handling a batch of completions, from
+     * the first callback to the end of the reaper's pass
+     */
+    struct conty_rt_hist mt_batch;
+    uint64_t             mt_batch_start;
 };
 
 struct conty_rt;
@@ -89,11 +158,49 @@ typedef int (*conty_rt_request_handler)(struct conty_rt *rt,
 struct conty_rt {
     struct conty_rt_server    rt_server;
     conty_rt_loop_t           rt_loop;
-    struct conty_rt_hc       *rt_containers;
-    conty_rt_request_handler  rt_handlers[CONTY_RT_DELETE + 1];
+    struct conty_rt_registry  rt_containers;
+    /*
+     * Persistent copy of rt_containers, st_hdr is NULL
+     * if the runtime was started without a state file
+     */
+    struct conty_rt_state     rt_state;
+    /*
+     * Pods are few and long-lived, and not recorded in the state file.
+     * Members recovered from the state file no longer belong to a pod
+     */
+    struct conty_pod        **rt_pods;
+    size_t                    rt_npods;
+    /*
+     * Exits reported by the loop since the last pass of the reaper
+     */
+    struct conty_rt_event    *rt_exited;
+    /*
+     * Time spent in every phase by all containers that
+     * were created or started successfully
+     */
+    struct conty_rt_hist      rt_phases[CONTY_PHASE_MAX + 1];
+    /*
+     * rts_fd is negative unless the runtime serves metrics
+     */
+    struct conty_rt_server    rt_metrics_server;
+    struct conty_rt_metrics   rt_metrics;
+    conty_rt_request_handler  rt_handlers[CONTY_RT_OP_MAX + 1];
 };
 
-int conty_rt_init(struct conty_rt *rt, const char *server_path);
+/*
+ * Initialise the runtime and, if state_path is set, recover the containers
+ * recorded in the state file by a previous instance of the runtime.
+ * The runtime runs on io_uring if uring is set and the kernel supports it
+ */
+int conty_rt_init(struct conty_rt *rt, const char *server_path,
+                  const char *state_path, char uring);
+
+/*
+ * Also serve metrics in the Prometheus text format on addr, which is either
+ * the path of a Unix socket or an IPv4 address and port, e.g. 127.0.0.1:9100.
+ * Without an address, as in :9100, the port is open on every interface
+ */
+int conty_rt_serve_metrics(struct conty_rt *rt, const char *addr);
 
 int conty_rt_register_handler(struct conty_rt *rt, int request,
                               conty_rt_request_handler h);
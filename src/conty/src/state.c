@@ -0,0 +1,283 @@
+#include "state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+#define STATE_MIN_CAPACITY 64
+
+static inline size_t state_file_size(size_t capacity)
+{
+    return sizeof(struct conty_rt_state_hdr) + capacity * sizeof(struct conty_rt_record);
+}
+
+static void state_map(struct conty_rt_state *st, void *map, size_t capacity)
+{
+    st->st_hdr      = map;
+    st->st_records  = (struct conty_rt_record *) (st->st_hdr + 1);
+    st->st_capacity = capacity;
+}
+
+/*
+ * Push the free slots in [from, to) such that lower slots are handed out first,
+ * which keeps live records packed at the start of the file
+ */
+static int state_push_free(struct conty_rt_state *st, size_t from, size_t to)
+{
+    uint32_t *free_slots = realloc(st->st_free, to * sizeof(uint32_t));
+    if (!free_slots)
+        return log_fatal_ret(-ENOMEM, "out of memory");
+
+    st->st_free = free_slots;
+    for (size_t i = to; i > from; i--) {
+        if (!st->st_records[i - 1].rec_used)
+            st->st_free[st->st_nfree++] = (uint32_t) (i - 1);
+    }
+
+    return 0;
+}
+
+/*
+ * A file is sized before its header is written, one
+ * we crashed in between has never held a record
+ */
+static int state_hdr_empty(const struct conty_rt_state_hdr *hdr)
+{
+    const char *bytes = (const char *) hdr;
+
+    for (size_t i = 0; i < sizeof(*hdr); i++)
+        if (bytes[i])
+            return 0;
+
+    return 1;
+}
+
+static int state_check_hdr(const struct conty_rt_state_hdr *hdr, size_t size)
+{
+    if (memcmp(hdr->sh_magic, CONTY_RT_STATE_MAGIC, sizeof(CONTY_RT_STATE_MAGIC)) != 0)
+        return log_error_ret(-EINVAL, "state: invalid magic");
+
+    if (hdr->sh_version != CONTY_RT_STATE_VERSION)
+        return log_error_ret(-EINVAL, "state: unsupported version %u", hdr->sh_version);
+
+    if (hdr->sh_record_size != sizeof(struct conty_rt_record))
+        return log_error_ret(-EINVAL, "state: invalid record size");
+
+    /*
+     * The file may be larger than the header says if we crashed
+     * while growing it, but never smaller
+     */
+    if (hdr->sh_capacity == 0 || state_file_size(hdr->sh_capacity) > size)
+        return log_error_ret(-EINVAL, "state: truncated file");
+
+    return 0;
+}
+
+int conty_rt_state_open(struct conty_rt_state *st, const char *path)
+{
+    struct conty_rt_state_hdr hdr;
+    struct stat sb;
+    size_t capacity;
+    void *map;
+    int fd, err, fresh;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return log_error_ret(-errno, "state: cannot open %s", path);
+
+    /*
+     * Two runtimes sharing a state file would corrupt each other's records
+     */
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        err = log_error_ret(-errno, "state: %s is in use", path);
+        goto err_close;
+    }
+
+    if (fstat(fd, &sb) != 0) {
+        err = log_error_ret(-errno, "state: cannot stat %s", path);
+        goto err_close;
+    }
+
+    fresh = (sb.st_size == 0);
+    if (!fresh) {
+        err = -EINVAL;
+        if ((size_t) sb.st_size < sizeof(hdr)) {
+            LOG_ERROR("state: truncated file");
+            goto err_close;
+        }
+
+        if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+            err = log_error_ret(-EIO, "state: cannot read header");
+            goto err_close;
+        }
+
+        fresh = state_hdr_empty(&hdr);
+        if (!fresh && (err = state_check_hdr(&hdr, (size_t) sb.st_size)) != 0)
+            goto err_close;
+
+        capacity = hdr.sh_capacity;
+    }
+
+    /*
+     * A file left behind without a header is started over
+     */
+    if (fresh) {
+        capacity = STATE_MIN_CAPACITY;
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) state_file_size(capacity)) != 0) {
+            err = log_error_ret(-errno, "state: cannot size %s", path);
+            goto err_close;
+        }
+    }
+
+    map = mmap(NULL, state_file_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        err = log_error_ret(-errno, "state: cannot map %s", path);
+        goto err_close;
+    }
+
+    state_map(st, map, capacity);
+    st->st_free  = NULL;
+    st->st_nfree = 0;
+
+    if (fresh) {
+        memcpy(st->st_hdr->sh_magic, CONTY_RT_STATE_MAGIC, sizeof(CONTY_RT_STATE_MAGIC));
+        st->st_hdr->sh_version     = CONTY_RT_STATE_VERSION;
+        st->st_hdr->sh_record_size = sizeof(struct conty_rt_record);
+        st->st_hdr->sh_capacity    = capacity;
+    }
+
+    if ((err = state_push_free(st, 0, capacity)) != 0) {
+        munmap(map, state_file_size(capacity));
+        goto err_close;
+    }
+
+    st->st_fd = fd;
+
+    return 0;
+
+err_close:
+    close(fd);
+    return err;
+}
+
+static int state_grow(struct conty_rt_state *st)
+{
+    size_t capacity = st->st_capacity << 1;
+    void *map;
+
+    if (ftruncate(st->st_fd, (off_t) state_file_size(capacity)) != 0)
+        return log_error_ret(-errno, "state: cannot grow file");
+
+    map = mremap(st->st_hdr, state_file_size(st->st_capacity),
+                 state_file_size(capacity), MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return log_error_ret(-errno, "state: cannot grow mapping");
+
+    state_map(st, map, capacity);
+    st->st_hdr->sh_capacity = capacity;
+
+    return state_push_free(st, capacity >> 1, capacity);
+}
+
+int conty_rt_state_add(struct conty_rt_state *st, const char *id, size_t idlen,
+                       const char *bundle, const char *veth, pid_t pid,
+                       conty_container_status_t status)
+{
+    struct conty_rt_record *rec;
+    size_t bundlelen = strlen(bundle), vethlen = strlen(veth);
+    uint32_t slot;
+    int err;
+
+    if (idlen >= CONTY_RT_ID_MAX || bundlelen >= CONTY_RT_BUNDLE_MAX || vethlen >= IFNAMSIZ)
+        return -ENAMETOOLONG;
+
+    if (st->st_nfree == 0 && (err = state_grow(st)) != 0)
+        return err;
+
+    slot = st->st_free[--st->st_nfree];
+    rec  = &st->st_records[slot];
+
+    rec->rec_status    = status;
+    rec->rec_pid       = pid;
+    rec->rec_idlen     = (uint32_t) idlen;
+    rec->rec_starttime = conty_rt_proc_starttime(pid);
+    memcpy(rec->rec_id, id, idlen);
+    rec->rec_id[idlen] = '\0';
+    memcpy(rec->rec_bundle, bundle, bundlelen + 1);
+    memcpy(rec->rec_veth, veth, vethlen + 1);
+
+    __atomic_store_n(&rec->rec_used, 1, __ATOMIC_RELEASE);
+
+    return (int) slot;
+}
+
+void conty_rt_state_set_status(struct conty_rt_state *st, uint32_t slot,
+                               conty_container_status_t status)
+{
+    __atomic_store_n(&st->st_records[slot].rec_status, status, __ATOMIC_RELEASE);
+}
+
+void conty_rt_state_release(struct conty_rt_state *st, uint32_t slot)
+{
+    /*
+     * The free stack has room for every slot, so this can't fail
+     */
+    __atomic_store_n(&st->st_records[slot].rec_used, 0, __ATOMIC_RELEASE);
+    st->st_free[st->st_nfree++] = slot;
+}
+
+void conty_rt_state_close(struct conty_rt_state *st)
+{
+    if (st && st->st_hdr) {
+        munmap(st->st_hdr, state_file_size(st->st_capacity));
+        close(st->st_fd);
+        free(st->st_free);
+        st->st_hdr     = NULL;
+        st->st_records = NULL;
+        st->st_free    = NULL;
+        st->st_fd      = -EBADF;
+    }
+}
+
+uint64_t conty_rt_proc_starttime(pid_t pid)
+{
+    char path[64], buf[1024], *cur;
+    unsigned long long starttime;
+    ssize_t rx;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return 0;
+
+    rx = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (rx <= 0)
+        return 0;
+    buf[rx] = '\0';
+
+    /*
+     * The command name may contain spaces and parentheses, so skip past
+     * the last parenthesis. The start time is the 20th field after it
+     */
+    if (!(cur = strrchr(buf, ')')))
+        return 0;
+
+    for (int field = 0; field < 20; field++) {
+        if (!(cur = strchr(cur + 1, ' ')))
+            return 0;
+    }
+
+    if (sscanf(cur, " %llu", &starttime) != 1)
+        return 0;
+
+    return starttime;
+}
@@ -0,0 +1,115 @@
+#ifndef CONTY_RT_STATE_H
+#define CONTY_RT_STATE_H
+
+#include <conty/conty.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <sys/types.h>
+
+#include "registry.h"
+
+/*
+ * Maximum length of a bundle path, including the terminating byte
+ */
+#define CONTY_RT_BUNDLE_MAX 512
+
+#define CONTY_RT_STATE_MAGIC   "CONTYST"
+#define CONTY_RT_STATE_VERSION 2
+
+/*
+ * A container as it is recorded in the state file
+ *
+ * rec_used is written last when a record is added and first when it is
+ * released, so a record torn by a crash is never mistaken for a container
+ */
+struct conty_rt_record {
+    uint32_t rec_used;
+    int32_t  rec_status;
+    int32_t  rec_pid;
+    uint32_t rec_idlen;
+    /*
+     * Start time of the container process in clock ticks after boot,
+     * which tells a recovered container apart from a process that
+     * happened to reuse its pid while the runtime was down
+     */
+    uint64_t rec_starttime;
+    char     rec_id[CONTY_RT_ID_MAX];
+    char     rec_bundle[CONTY_RT_BUNDLE_MAX];
+    /*
+     * Host's end of the container's network device pair, see
+     * conty_container_veth
+     */
+    char     rec_veth[IFNAMSIZ];
+};
+
+struct conty_rt_state_hdr {
+    char     sh_magic[8];
+    uint32_t sh_version;
+    uint32_t sh_record_size;
+    uint64_t sh_capacity;
+    char     sh_pad[40];
+};
+
+/*
+ * Persistent container state
+ *
+ * The state file is a fixed-size header followed by an array of fixed-size
+ * records, mapped shared into the runtime. Updates are plain stores into the
+ * mapping: the kernel owns the dirty pages, so they survive a crash or
+ * a restart of the runtime without any msync or write calls on the hot path.
+ * They don't survive a crash of the host, but then neither do the containers.
+ *
+ * Records are addressed by slot and free slots are kept on a stack,
+ * so adding and releasing a container is O(1). Pointers to records
+ * are invalidated when the file grows
+ */
+struct conty_rt_state {
+    int                        st_fd;
+    struct conty_rt_state_hdr *st_hdr;
+    struct conty_rt_record    *st_records;
+    size_t                     st_capacity;
+    uint32_t                  *st_free;
+    size_t                     st_nfree;
+};
+
+/*
+ * Open the state file at path, creating it if it doesn't exist
+ */
+int conty_rt_state_open(struct conty_rt_state *st, const char *path);
+
+/*
+ * Record a new container and return its slot
+ */
+int conty_rt_state_add(struct conty_rt_state *st, const char *id, size_t idlen,
+                       const char *bundle, const char *veth, pid_t pid,
+                       conty_container_status_t status);
+
+void conty_rt_state_set_status(struct conty_rt_state *st, uint32_t slot,
+                               conty_container_status_t status);
+
+void conty_rt_state_release(struct conty_rt_state *st, uint32_t slot);
+
+static inline size_t conty_rt_state_slots(const struct conty_rt_state *st)
+{
+    return st->st_capacity;
+}
+
+/*
+ * Return the record in slot i or NULL if the slot is free
+ */
+static inline const struct conty_rt_record *conty_rt_state_record(const struct conty_rt_state *st,
+                                                                  size_t i)
+{
+    const struct conty_rt_record *rec = &st->st_records[i];
+    return __atomic_load_n(&rec->rec_used, __ATOMIC_ACQUIRE) ? rec : NULL;
+}
+
+void conty_rt_state_close(struct conty_rt_state *st);
+
+/*
+ * Start time of a process in clock ticks after boot or 0 if it doesn't exist
+ */
+uint64_t conty_rt_proc_starttime(pid_t pid);
+
+#endif //CONTY_RT_STATE_H
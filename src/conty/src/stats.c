@@ -0,0 +1,63 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+/*
+ * Largest duration that falls into the bucket
+ */
+static uint64_t hist_bound(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < (1U << CONTY_RT_HIST_SUB))
+        return bucket;
+
+    shift = (bucket >> CONTY_RT_HIST_SUB) - 1;
+    return ((uint64_t) ((bucket & ((1U << CONTY_RT_HIST_SUB) - 1)) | (1U << CONTY_RT_HIST_SUB))
+            << shift) + ((1ULL << shift) - 1);
+}
+
+uint64_t conty_rt_hist_quantile(const struct conty_rt_hist *hist, double q)
+{
+    uint64_t rank, seen = 0, bound;
+
+    if (hist->hs_count == 0)
+        return 0;
+
+    /*
+     * Rank of the quantile among the recorded durations, from 1
+     */
+    rank = (uint64_t) (q * (double) hist->hs_count);
+    if ((double) rank < q * (double) hist->hs_count || rank < 1)
+        rank++;
+
+    for (unsigned int i = 0; i < CONTY_RT_HIST_BUCKETS; i++) {
+        seen += hist->hs_buckets[i];
+        if (seen < rank)
+            continue;
+
+        bound = hist_bound(i);
+        return bound < hist->hs_max ? bound : hist->hs_max;
+    }
+
+    return hist->hs_max;
+}
+
+int conty_rt_hist_format(const struct conty_rt_hist *hist, char *buf, size_t len)
+{
+    double mean = hist->hs_count ? (double) hist->hs_sum / (double) hist->hs_count : 0;
+    int ret;
+
+    ret = snprintf(buf, len, "count %llu mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f",
+                   (unsigned long long) hist->hs_count, mean / 1e6,
+                   (double) conty_rt_hist_quantile(hist, 0.50) / 1e6,
+                   (double) conty_rt_hist_quantile(hist, 0.90) / 1e6,
+                   (double) conty_rt_hist_quantile(hist, 0.99) / 1e6,
+                   (double) hist->hs_max / 1e6);
+
+    if (ret < 0 || (size_t) ret >= len)
+        return -EIO;
+
+    return ret;
+}
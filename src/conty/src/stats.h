@@ -0,0 +1,58 @@
+#ifndef CONTY_RT_STATS_H
+#define CONTY_RT_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Histogram of durations in nanoseconds
+ *
+ * Every power of two is split into four buckets, so recording a duration
+ * takes a count of leading zeros, a shift and an increment, and 252 buckets
+ * cover everything. Quantiles are known to within a quarter of their
+ * magnitude, which is plenty to tell which phase regressed and by how much
+ */
+#define CONTY_RT_HIST_SUB     2
+#define CONTY_RT_HIST_BUCKETS ((64 - CONTY_RT_HIST_SUB + 1) << CONTY_RT_HIST_SUB)
+
+struct conty_rt_hist {
+    uint64_t hs_count;
+    uint64_t hs_sum;
+    uint64_t hs_max;
+    uint64_t hs_buckets[CONTY_RT_HIST_BUCKETS];
+};
+
+static inline unsigned int conty_rt_hist_bucket(uint64_t ns)
+{
+    unsigned int msb;
+
+    if (ns < (1U << CONTY_RT_HIST_SUB))
+        return (unsigned int) ns;
+
+    msb = 63 - (unsigned int) __builtin_clzll(ns);
+    return ((msb - CONTY_RT_HIST_SUB + 1) << CONTY_RT_HIST_SUB) |
+           (unsigned int) ((ns >> (msb - CONTY_RT_HIST_SUB)) & ((1U << CONTY_RT_HIST_SUB) - 1));
+}
+
+static inline void conty_rt_hist_add(struct conty_rt_hist *hist, uint64_t ns)
+{
+    hist->hs_buckets[conty_rt_hist_bucket(ns)]++;
+    hist->hs_count++;
+    hist->hs_sum += ns;
+    if (ns > hist->hs_max)
+        hist->hs_max = ns;
+}
+
+/*
+ * Upper bound of the bucket that the q-quantile falls into,
+ * never more than the largest duration recorded
+ */
+uint64_t conty_rt_hist_quantile(const struct conty_rt_hist *hist, double q);
+
+/*
+ * Summarise the histogram on a single line, in milliseconds
+ * Returns the length of the summary, or -EIO if it doesn't fit
+ */
+int conty_rt_hist_format(const struct conty_rt_hist *hist, char *buf, size_t len);
+
+#endif //CONTY_RT_STATS_H
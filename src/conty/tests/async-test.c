@@ -0,0 +1,223 @@
+#include "container.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+#define ASYNC_TEST_DIR        "/tmp/conty-async-test"
+#define ASYNC_TEST_CONTAINERS 32
+
+/*
+ * New network namespaces take a while, mostly spent
+ * waiting in the kernel rather than running
+ */
+static const char *conf =
+    "{"
+    "  \"process\": { \"args\": [\"%s\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\" }, { \"type\": \"uts\" }, { \"type\": \"ipc\" }]%s"
+    "}";
+
+/*
+ * Runs in the container process while it's being set up,
+ * standing in for anything it might have to wait for
+ */
+static const char *slow_hooks =
+    ","
+    "  \"hooks\": {"
+    "    \"on_container_created\": [{"
+    "      \"path\": \"/bin/sleep\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sleep\", \"0.02\"]"
+    "    }]"
+    "  }";
+
+struct job {
+    struct conty_container *j_cc;
+    char                    j_id[32];
+    int                     j_done;
+    int                     j_err;
+};
+
+static int write_conf(const char *path, const char *process, const char *hooks)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, conf, process, hooks);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static void job_done(struct conty_container *cc, int err, void *data)
+{
+    struct job *job = (struct job *) data;
+
+    job->j_done = 1;
+    job->j_err  = err;
+}
+
+/*
+ * Advances every container whose descriptor is readable until all jobs
+ * are done. The descriptor of a container that exec'd stays readable,
+ * so it's only watched while something is in flight
+ */
+static int drive(int epfd, struct job *jobs, size_t njobs)
+{
+    struct epoll_event events[ASYNC_TEST_CONTAINERS], ev;
+    size_t pending = njobs;
+    struct job *job;
+    int nfds, fd;
+
+    for (size_t i = 0; i < njobs; i++) {
+        ev = (struct epoll_event) { .events = EPOLLIN, .data.ptr = &jobs[i] };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, conty_container_syncfd(jobs[i].j_cc), &ev) != 0)
+            return log_error_ret(-1, "cannot watch %s", jobs[i].j_id);
+    }
+
+    while (pending > 0) {
+        if ((nfds = epoll_wait(epfd, events, ASYNC_TEST_CONTAINERS, 5000)) <= 0)
+            return log_error_ret(-1, "containers stopped making progress");
+
+        for (int i = 0; i < nfds; i++) {
+            job = (struct job *) events[i].data.ptr;
+            fd  = conty_container_syncfd(job->j_cc);
+
+            if (conty_container_advance(job->j_cc) == -EAGAIN)
+                continue;
+
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            pending--;
+
+            if (!job->j_done)
+                return log_error_ret(-1, "%s was done without calling back", job->j_id);
+            job->j_done = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int reap(struct conty_container *cc)
+{
+    pid_t pid = conty_container_pid(cc);
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "container %s did not exit cleanly", conty_container_id(cc));
+
+    conty_container_set_status(cc, CONTY_STOPPED);
+    return conty_container_delete(cc);
+}
+
+/*
+ * Every container is created and started at once, and each one
+ * calls back exactly once for either
+ */
+static int run_async(int epfd, const char *bundle)
+{
+    struct job jobs[ASYNC_TEST_CONTAINERS];
+
+    memset(jobs, 0, sizeof(jobs));
+
+    for (int i = 0; i < ASYNC_TEST_CONTAINERS; i++) {
+        snprintf(jobs[i].j_id, sizeof(jobs[i].j_id), "async-%d", i);
+
+        jobs[i].j_cc = conty_container_create_async(NULL, jobs[i].j_id, bundle, job_done,
+                                                    &jobs[i]);
+        if (!jobs[i].j_cc)
+            return log_error_ret(-1, "cannot create %s", jobs[i].j_id);
+    }
+
+    if (drive(epfd, jobs, ASYNC_TEST_CONTAINERS) != 0)
+        return -1;
+
+    for (int i = 0; i < ASYNC_TEST_CONTAINERS; i++) {
+        if (jobs[i].j_err != 0)
+            return log_error_ret(-1, "%s was not created", jobs[i].j_id);
+
+        if (conty_container_start_async(jobs[i].j_cc) != 0)
+            return log_error_ret(-1, "cannot start %s", jobs[i].j_id);
+    }
+
+    if (drive(epfd, jobs, ASYNC_TEST_CONTAINERS) != 0)
+        return -1;
+
+    for (int i = 0; i < ASYNC_TEST_CONTAINERS; i++) {
+        if (jobs[i].j_err != 0)
+            return log_error_ret(-1, "%s was not started", jobs[i].j_id);
+
+        if (reap(jobs[i].j_cc) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A process that can't be executed fails the start, not the create
+ */
+static int run_failing(int epfd)
+{
+    struct job job = { .j_id = "failing" };
+
+    job.j_cc = conty_container_create_async(NULL, job.j_id, ASYNC_TEST_DIR "/missing.json",
+                                            job_done, &job);
+    if (!job.j_cc)
+        return log_error_ret(-1, "cannot create %s", job.j_id);
+
+    if (drive(epfd, &job, 1) != 0 || job.j_err != 0)
+        return log_error_ret(-1, "%s was not created", job.j_id);
+
+    if (conty_container_advance(job.j_cc) != -EINVAL)
+        return log_error_ret(-1, "%s advanced with nothing in flight", job.j_id);
+
+    if (conty_container_start_async(job.j_cc) != 0 || drive(epfd, &job, 1) != 0)
+        return -1;
+
+    if (job.j_err == 0)
+        return log_error_ret(-1, "%s started without a process", job.j_id);
+
+    waitpid(conty_container_pid(job.j_cc), NULL, 0);
+    conty_container_free(job.j_cc);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+    int epfd;
+
+    if (system("rm -rf " ASYNC_TEST_DIR " && mkdir -p " ASYNC_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", ASYNC_TEST_DIR);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        goto out;
+
+    if (write_conf(ASYNC_TEST_DIR "/true.json", "/bin/true", "") != 0 ||
+        write_conf(ASYNC_TEST_DIR "/slow.json", "/bin/true", slow_hooks) != 0 ||
+        write_conf(ASYNC_TEST_DIR "/missing.json", ASYNC_TEST_DIR "/missing", "") != 0)
+        goto out_epfd;
+
+    if (run_async(epfd, ASYNC_TEST_DIR "/true.json") != 0 ||
+        run_async(epfd, ASYNC_TEST_DIR "/slow.json") != 0 ||
+        run_failing(epfd) != 0)
+        goto out_epfd;
+
+    ret = EXIT_SUCCESS;
+out_epfd:
+    close(epfd);
+out:
+    if (system("rm -rf " ASYNC_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", ASYNC_TEST_DIR);
+
+    return ret;
+}
@@ -0,0 +1,235 @@
+#include "hooksock.h"
+
+#include <endian.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <conty/hook.h>
+
+#include "log.h"
+#include "oci.h"
+#include "test.h"
+
+#define HOOKSOCK_TEST_PATH "/tmp/conty-hooksock-test.sock"
+
+static struct oci_process_state test_state = {
+        .opst_container_id = "some-container",
+        .opst_pid = 50,
+        .opst_rootfs = "/path/to/bundle",
+        .opst_status = "created"
+};
+
+static int reply(int fd, uint32_t tag, int32_t status)
+{
+    struct {
+        struct conty_hook_frame frame;
+        int32_t status;
+    } msg = {
+        .frame  = { .chf_len = htole32(CONTY_HOOK_REPLY_LEN), .chf_tag = htole32(tag) },
+        .status = (int32_t) htole32((uint32_t) status)
+    };
+
+    return write(fd, &msg, sizeof(msg)) == sizeof(msg) ? 0 : -1;
+}
+
+/*
+ * Reads one request and replies according to its first argument: "ok"
+ * right away, "fail" with an error, "slow" after half a second, while
+ * serving other requests in the meantime, and "never" not at all.
+ * Exits with the number of connections it accepted
+ */
+static int serve(int lfd)
+{
+    static char buf[1 << 16];
+    struct conty_hook_frame frame;
+    uint32_t slow_tag = 0;
+    double slow_at = 0;
+    int cfd = -1, accepted = 0;
+
+    for (;;) {
+        struct pollfd pfd = { .fd = cfd >= 0 ? cfd : lfd, .events = POLLIN };
+        int timeout = slow_at ? (int) (slow_at - now_ms()) : -1;
+        const char *arg;
+
+        if (poll(&pfd, 1, slow_at && timeout < 0 ? 0 : timeout) == 0) {
+            reply(cfd, slow_tag, 0);
+            slow_at = 0;
+            continue;
+        }
+
+        if (cfd < 0) {
+            if ((cfd = accept(lfd, NULL, NULL)) < 0)
+                return accepted;
+            accepted++;
+            continue;
+        }
+
+        if (recv(cfd, &frame, sizeof(frame), MSG_WAITALL) != sizeof(frame) ||
+            le32toh(frame.chf_len) > sizeof(buf) ||
+            recv(cfd, buf, le32toh(frame.chf_len), MSG_WAITALL) != (ssize_t) le32toh(frame.chf_len)) {
+            close(cfd);
+            cfd = -1;
+            continue;
+        }
+
+        /*
+         * The state comes first
+         */
+        if (!strstr(buf, "some-container"))
+            return 100;
+
+        arg = buf + strlen(buf) + 1;
+        if (!strcmp(arg, "ok"))
+            reply(cfd, le32toh(frame.chf_tag), 0);
+        else if (!strcmp(arg, "fail"))
+            reply(cfd, le32toh(frame.chf_tag), 1);
+        else if (!strcmp(arg, "slow"))
+            slow_tag = le32toh(frame.chf_tag), slow_at = now_ms() + 500;
+    }
+}
+
+static pid_t start_server(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = HOOKSOCK_TEST_PATH };
+    int lfd;
+    pid_t pid;
+
+    unlink(HOOKSOCK_TEST_PATH);
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(lfd, 8) != 0)
+        return log_error_ret(-1, "cannot listen on %s", HOOKSOCK_TEST_PATH);
+
+    if ((pid = fork()) == 0)
+        _exit(serve(lfd));
+
+    close(lfd);
+    return pid;
+}
+
+static int stop_server(pid_t pid)
+{
+    int status;
+
+    kill(pid, SIGTERM);
+    if (waitpid(pid, &status, 0) != pid)
+        return -1;
+
+    return WIFSIGNALED(status) ? 0 : -1;
+}
+
+static const char *hooks_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }],"
+    "  \"hooks\": {"
+    "    \"%s\": [{ \"path\": \"" HOOKSOCK_TEST_PATH "\", \"%s\": true }]"
+    "  }"
+    "}";
+
+/*
+ * Hooks that run in the container process can't use the runtime's
+ * connections, so they must not be sockets or plugins
+ */
+static int test_container_hooks(void)
+{
+    static const struct {
+        const char *event;
+        const char *kind;
+        int         accepted;
+    } cases[] = {
+        { "on_runtime_create",    "socket", 1 },
+        { "on_container_created", "socket", 0 },
+        { "on_container_start",   "socket", 0 },
+        { "on_container_created", "plugin", 0 },
+    };
+    struct oci_conf *conf;
+    char buf[512];
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        snprintf(buf, sizeof(buf), hooks_conf, cases[i].event, cases[i].kind);
+
+        conf = oci_conf_deser(buf);
+        if (!conf != !cases[i].accepted)
+            return log_error_ret(-1, "%s %s hook was %s", cases[i].kind, cases[i].event,
+                                 conf ? "accepted" : "rejected");
+
+        oci_conf_free(conf);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *ok[2] = { "ok", NULL }, *fail[2] = { "fail", NULL };
+    char *slow[2] = { "slow", NULL }, *never[2] = { "never", NULL };
+    struct oci_hook hooks[3] = {
+            { .ohk_path = HOOKSOCK_TEST_PATH, .ohk_kind = OCI_HOOK_SOCKET, .ohk_argv = slow },
+            { .ohk_path = HOOKSOCK_TEST_PATH, .ohk_kind = OCI_HOOK_SOCKET, .ohk_argv = ok },
+            { .ohk_path = HOOKSOCK_TEST_PATH, .ohk_kind = OCI_HOOK_SOCKET, .ohk_argv = ok },
+    };
+    struct oci_hooks list = SLIST_HEAD_INITIALIZER(list);
+    pid_t server;
+    int ret = EXIT_FAILURE;
+
+    if (test_container_hooks() != 0)
+        return EXIT_FAILURE;
+
+    if ((server = start_server()) < 0)
+        return EXIT_FAILURE;
+
+    if (oci_hook_exec(&hooks[1], &test_state) != 0) {
+        LOG_ERROR("hook failed");
+        goto out;
+    }
+
+    hooks[1].ohk_argv = fail;
+    if (oci_hook_exec(&hooks[1], &test_state) == 0) {
+        LOG_ERROR("failing hook succeeded");
+        goto out;
+    }
+
+    /*
+     * Requests share a connection, a slow reply among them
+     * must not get mixed up with the others
+     */
+    hooks[1].ohk_argv = ok;
+    for (int i = 0; i < 3; i++)
+        SLIST_INSERT_HEAD(&list, &hooks[i], ohk_next);
+
+    if (oci_hooks_exec_parallel(&list, &test_state, 0) != 0) {
+        LOG_ERROR("parallel hooks failed");
+        goto out;
+    }
+
+    hooks[0].ohk_argv    = never;
+    hooks[0].ohk_timeout = 1;
+    if (oci_hook_exec(&hooks[0], &test_state) != -ETIMEDOUT) {
+        LOG_ERROR("unanswered hook did not time out");
+        goto out;
+    }
+
+    /*
+     * A restarted server is picked up again
+     */
+    if (stop_server(server) != 0 || (server = start_server()) < 0)
+        goto out;
+
+    if (oci_hook_exec(&hooks[1], &test_state) != 0) {
+        LOG_ERROR("cannot reconnect to the hook server");
+        goto out;
+    }
+
+    ret = EXIT_SUCCESS;
+out:
+    stop_server(server);
+    unlink(HOOKSOCK_TEST_PATH);
+    return ret;
+}
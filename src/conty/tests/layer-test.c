@@ -0,0 +1,192 @@
+#include "layer.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+
+#include "clone.h"
+#include "log.h"
+#include "resource.h"
+#include "safestring.h"
+
+#define LAYER_TEST_DIR    "/tmp/conty-layer-test"
+#define LAYER_TEST_STORE  LAYER_TEST_DIR "/store"
+#define LAYER_TEST_MERGED LAYER_TEST_DIR "/merged"
+
+/*
+ * Builds two images in OCI layouts out of three layers:
+ * v1 is base + update and v2 is base + update + app, where update deletes
+ * /a and replaces the contents of /d. The index of v2 also lists an
+ * attestation for an unknown platform first, like docker does
+ */
+static const char *layout_script =
+    "set -e\n"
+    "cd " LAYER_TEST_DIR "\n"
+    "blob() { d=$(sha256sum \"$1\" | cut -d' ' -f1); mv \"$1\" blobs/sha256/$d; echo $d; }\n"
+    "mkdir -p src/base/d src/update/d src/app/bin v1/blobs/sha256\n"
+    "echo a > src/base/a; echo x > src/base/d/x; echo b > src/base/b\n"
+    "touch src/update/.wh.a src/update/d/.wh..wh..opq; echo y > src/update/d/y\n"
+    "echo app > src/app/bin/app\n"
+    "cd v1\n"
+    "tar -C ../src/base -cf base.tar .; base=$(blob base.tar)\n"
+    "tar -C ../src/update -cf update.tar .; update=$(blob update.tar)\n"
+    "tar -C ../src/app -czf app.tar.gz .; app=$(blob app.tar.gz)\n"
+    "layer() { echo \"{\\\"mediaType\\\": \\\"application/vnd.oci.image.layer.v1.tar\\\", \\\"digest\\\": \\\"sha256:$1\\\"}\"; }\n"
+    "echo \"{\\\"layers\\\": [$(layer $base), $(layer $update)]}\" > m.json; m1=$(blob m.json)\n"
+    "echo \"{\\\"layers\\\": [$(layer $base), $(layer $update), $(layer $app)]}\" > m.json; m2=$(blob m.json)\n"
+    "cp -r ../v1 ../v2\n"
+    "echo \"{\\\"manifests\\\": [{\\\"digest\\\": \\\"sha256:$m1\\\"}]}\" > index.json\n"
+    "echo \"{\\\"manifests\\\": [{\\\"digest\\\": \\\"sha256:$m1\\\", \\\"platform\\\": {\\\"os\\\": \\\"unknown\\\", \\\"architecture\\\": \\\"unknown\\\"}}, "
+    "{\\\"digest\\\": \\\"sha256:$m2\\\"}]}\" > ../v2/index.json\n"
+    "echo sha256:$update > ../update\n";
+
+static int unpack(const struct conty_layer_store *store, const char *image,
+                  char ***layers, int expected)
+{
+    char layout[PATH_MAX];
+    int unpacked;
+
+    snprintf(layout, sizeof(layout), "%s/%s", LAYER_TEST_DIR, image);
+    if ((unpacked = conty_layer_store_unpack(store, layout, layers)) < 0)
+        return log_error_ret(-1, "cannot unpack %s", image);
+
+    if (unpacked != expected)
+        return log_error_ret(-1, "%s: unpacked %d layers instead of %d", image, unpacked, expected);
+
+    return 0;
+}
+
+static int check_whiteouts(const struct conty_layer_store *store, const char *digest)
+{
+    char layer[PATH_MAX], path[PATH_MAX], opaque[2] = { 0 };
+    struct stat sb;
+
+    if (conty_layer_path(store, digest, layer, sizeof(layer)) != 0)
+        return -1;
+
+    if (strnprintf(path, sizeof(path), "%s/a", layer) < 0)
+        return -1;
+    if (lstat(path, &sb) != 0 || !S_ISCHR(sb.st_mode) || sb.st_rdev != makedev(0, 0))
+        return log_error_ret(-1, "whiteout of /a was not converted");
+
+    if (strnprintf(path, sizeof(path), "%s/d", layer) < 0)
+        return -1;
+    if (getxattr(path, "trusted.overlay.opaque", opaque, 1) != 1 || opaque[0] != 'y')
+        return log_error_ret(-1, "/d is not opaque");
+
+    if (strnprintf(path, sizeof(path), "%s/d/.wh..wh..opq", layer) < 0)
+        return -1;
+    if (access(path, F_OK) == 0)
+        return log_error_ret(-1, "opaque marker survived");
+
+    return 0;
+}
+
+static int overlay_mounter(void *arg)
+{
+    char opts[PATH_MAX];
+
+    if (mount("", "/", "", MS_PRIVATE | MS_REC, NULL) != 0)
+        return 1;
+
+    if (strnprintf(opts, sizeof(opts), "lowerdir=%s", (const char *) arg) < 0)
+        return 1;
+
+    if (mount("overlay", LAYER_TEST_MERGED, "overlay", MS_RDONLY, opts) != 0)
+        return log_error_ret(1, "cannot mount overlay: %s", strerror(errno));
+
+    if (access(LAYER_TEST_MERGED "/a", F_OK) == 0 || errno != ENOENT)
+        return log_error_ret(1, "deleted /a is visible");
+
+    if (access(LAYER_TEST_MERGED "/d/x", F_OK) == 0 || errno != ENOENT)
+        return log_error_ret(1, "/d/x of the base layer is visible");
+
+    if (access(LAYER_TEST_MERGED "/b", F_OK) != 0 ||
+        access(LAYER_TEST_MERGED "/d/y", F_OK) != 0 ||
+        access(LAYER_TEST_MERGED "/bin/app", F_OK) != 0)
+        return log_error_ret(1, "layers are missing from the overlay");
+
+    return 0;
+}
+
+static int test_overlay(const struct conty_layer_store *store, char **layers)
+{
+    char lower[PATH_MAX];
+    int status;
+    pid_t child;
+
+    if (conty_layer_lowerdir(store, layers, lower, sizeof(lower)) != 0)
+        return log_error_ret(-1, "cannot construct lowerdir");
+
+    if (mkdir(LAYER_TEST_MERGED, 0755) != 0)
+        return log_error_ret(-1, "cannot create %s", LAYER_TEST_MERGED);
+
+    child = clone3_cb(overlay_mounter, lower, CLONE_NEWNS, NULL);
+    if (child < 0)
+        return log_error_ret(-1, "cannot clone");
+
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    STRINGLIST_RESOURCE char **v1 = NULL;
+    STRINGLIST_RESOURCE char **v2 = NULL;
+    struct conty_layer_store store = { 0 };
+    char update[CONTY_LAYER_DIGEST_MAX + 2] = { 0 };
+    FILE *fp;
+    int ret = EXIT_FAILURE;
+
+    if (system("rm -rf " LAYER_TEST_DIR " && mkdir -p " LAYER_TEST_DIR) != 0 ||
+        system(layout_script) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot build image layouts");
+
+    if (!(fp = fopen(LAYER_TEST_DIR "/update", "r")) || !fgets(update, sizeof(update), fp))
+        return log_error_ret(EXIT_FAILURE, "cannot read digest of the update layer");
+    fclose(fp);
+    update[strcspn(update, "\n")] = '\0';
+
+    if (conty_layer_store_init(&store, "/tmp/bad:store") != -EINVAL)
+        return log_error_ret(EXIT_FAILURE, "store path with ':' accepted");
+
+    if (conty_layer_present(&store, "sha256:../../etc") != -EINVAL)
+        return log_error_ret(EXIT_FAILURE, "digest with a path accepted");
+
+    if (conty_layer_store_init(&store, LAYER_TEST_STORE) != 0)
+        return EXIT_FAILURE;
+
+    if (unpack(&store, "v1", &v1, 2) != 0)
+        goto out;
+
+    if (check_whiteouts(&store, update) != 0)
+        goto out;
+
+    /*
+     * v2 shares everything but its top layer with v1
+     */
+    if (unpack(&store, "v2", &v2, 1) != 0)
+        goto out;
+
+    if (!v2[0] || !v2[1] || !v2[2] || v2[3] || strcmp(v2[1], update) != 0)
+        goto out;
+
+    if (test_overlay(&store, v2) != 0)
+        goto out;
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " LAYER_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", LAYER_TEST_DIR);
+
+    return ret;
+}
@@ -0,0 +1,159 @@
+#include "lazy.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "resource.h"
+
+#define LAZY_TEST_DIR  "/tmp/conty-lazy-test"
+#define LAZY_TEST_SRC  LAZY_TEST_DIR "/src"
+#define LAZY_TEST_MNT  LAZY_TEST_DIR "/mnt"
+#define LAZY_TEST_LONG "a-directory-with-a-name-long-enough-to-need-an-extension-of-the-header/" \
+                       "and-a-file-in-it-that-pushes-the-path-past-one-hundred-characters"
+
+/*
+ * A small tree next to a large file, most containers only ever read
+ * a fraction of their image
+ */
+static const char *tree_script =
+    "set -e\n"
+    "cd " LAZY_TEST_DIR "\n"
+    "mkdir -p src/etc src/usr/bin src/empty \"src/$(dirname " LAZY_TEST_LONG ")\"\n"
+    "echo conty > src/etc/hostname; chmod 0640 src/etc/hostname\n"
+    "ln -s ../etc/hostname src/usr/hostname\n"
+    "ln src/etc/hostname src/usr/bin/hardlink\n"
+    "echo long > src/" LAZY_TEST_LONG "\n"
+    "for i in $(seq 1 300); do echo $i > src/usr/bin/tool-$i; done\n"
+    "dd if=/dev/urandom of=src/large bs=1M count=64 status=none\n"
+    "tar -C src -cf gnu.tar .\n"
+    "tar -C src --format=pax -cf pax.tar .\n";
+
+static int read_file(const char *path, char *buf, size_t len, off_t off)
+{
+    int fd, rx;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return log_error_ret(-1, "cannot open %s", path);
+
+    rx = (int) pread(fd, buf, len, off);
+    close(fd);
+
+    return rx;
+}
+
+static int check_tree(void)
+{
+    char buf[4096], expected[4096], link[64];
+    struct dirent *ent;
+    struct stat sb;
+    DIR *dir;
+    int n = 0;
+
+    if (read_file(LAZY_TEST_MNT "/etc/hostname", buf, sizeof(buf), 0) != 6 ||
+        memcmp(buf, "conty\n", 6) != 0)
+        return log_error_ret(-1, "invalid contents of /etc/hostname");
+
+    if (stat(LAZY_TEST_MNT "/etc/hostname", &sb) != 0 || (sb.st_mode & 07777) != 0640)
+        return log_error_ret(-1, "invalid mode of /etc/hostname");
+
+    if (readlink(LAZY_TEST_MNT "/usr/hostname", link, sizeof(link)) != 15 ||
+        memcmp(link, "../etc/hostname", 15) != 0)
+        return log_error_ret(-1, "invalid symbolic link");
+
+    if (read_file(LAZY_TEST_MNT "/usr/bin/hardlink", buf, sizeof(buf), 0) != 6)
+        return log_error_ret(-1, "invalid hard link");
+
+    if (read_file(LAZY_TEST_MNT "/" LAZY_TEST_LONG, buf, sizeof(buf), 0) != 5)
+        return log_error_ret(-1, "long name missing");
+
+    if (access(LAZY_TEST_MNT "/etc/missing", F_OK) == 0 || errno != ENOENT)
+        return log_error_ret(-1, "missing file exists");
+
+    if (!(dir = opendir(LAZY_TEST_MNT "/usr/bin")))
+        return log_error_ret(-1, "cannot open /usr/bin");
+
+    while ((ent = readdir(dir)))
+        n++;
+    closedir(dir);
+
+    if (n != 303)
+        return log_error_ret(-1, "/usr/bin has %d entries", n);
+
+    if (open(LAZY_TEST_MNT "/etc/hostname", O_WRONLY) >= 0 || errno != EROFS)
+        return log_error_ret(-1, "archive is writable");
+
+    /*
+     * Somewhere in the middle of the large file
+     */
+    if (read_file(LAZY_TEST_MNT "/large", buf, sizeof(buf), 40 << 20) != sizeof(buf) ||
+        read_file(LAZY_TEST_SRC "/large", expected, sizeof(expected), 40 << 20) != sizeof(expected) ||
+        memcmp(buf, expected, sizeof(buf)) != 0)
+        return log_error_ret(-1, "invalid contents of /large");
+
+    return 0;
+}
+
+static int test_archive(const char *archive)
+{
+    int status, ret = -1;
+    pid_t server;
+
+    if ((server = conty_lazy_mount(archive, LAZY_TEST_MNT, (uid_t) -1, (gid_t) -1)) < 0)
+        return log_error_ret(-1, "cannot mount %s", archive);
+
+    /*
+     * First instruction of a container, more or less
+     */
+    if (access(LAZY_TEST_MNT "/etc/hostname", R_OK) != 0) {
+        LOG_ERROR("cannot access /etc/hostname");
+        goto out;
+    }
+
+    ret = check_tree();
+
+out:
+    if (umount2(LAZY_TEST_MNT, 0) != 0)
+        return log_error_ret(-1, "cannot unmount %s", archive);
+
+    /*
+     * The server goes away along with the filesystem
+     */
+    if (waitpid(server, &status, 0) != server || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "server of %s did not exit cleanly", archive);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    if (system("rm -rf " LAZY_TEST_DIR " && mkdir -p " LAZY_TEST_MNT) != 0 ||
+        system(tree_script) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot build archives");
+
+    /*
+     * Keep the mounts to ourselves
+     */
+    if (unshare(CLONE_NEWNS) != 0 || mount("", "/", "", MS_PRIVATE | MS_REC, NULL) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create mount namespace");
+
+    if (test_archive(LAZY_TEST_DIR "/gnu.tar") != 0 || test_archive(LAZY_TEST_DIR "/pax.tar") != 0)
+        goto out;
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " LAZY_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", LAZY_TEST_DIR);
+
+    return ret;
+}
@@ -0,0 +1,264 @@
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LOG_TEST_FILE     "/tmp/conty-log-test.log"
+#define LOG_TEST_THREADS  4
+#define LOG_TEST_MESSAGES 20000
+
+static const char *ids[LOG_TEST_THREADS] = { "alpha", "bravo", "charlie", "delta" };
+
+static int saved_stderr = -1;
+
+/*
+ * Messages go to a file until release, which reads it back
+ */
+static int capture(void)
+{
+    int fd = open(LOG_TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (fd < 0)
+        return -1;
+
+    if (saved_stderr < 0)
+        saved_stderr = dup(STDERR_FILENO);
+
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+
+    return 0;
+}
+
+static char *release(size_t *len)
+{
+    struct stat st;
+    char *buf;
+    FILE *file;
+
+    dup2(saved_stderr, STDERR_FILENO);
+
+    if (stat(LOG_TEST_FILE, &st) != 0 || !(buf = malloc((size_t) st.st_size + 1)))
+        return NULL;
+
+    if (!(file = fopen(LOG_TEST_FILE, "r"))) {
+        free(buf);
+        return NULL;
+    }
+
+    *len = fread(buf, 1, (size_t) st.st_size, file);
+    buf[*len] = '\0';
+    fclose(file);
+
+    return buf;
+}
+
+static void *log_thread(void *arg)
+{
+    int n = (int) (long) arg;
+    LOG_CONTAINER_SCOPE(ids[n]);
+
+    for (int i = 0; i < LOG_TEST_MESSAGES; i++)
+        LOG_INFO("thread %d message %d", n, i);
+
+    return NULL;
+}
+
+/*
+ * Every message of every thread is there, whole
+ * and in the order the thread logged them
+ */
+static int check_lines(char *buf)
+{
+    int next[LOG_TEST_THREADS] = { 0 };
+    char expected[64];
+    char *line, *msg, *save;
+    int n, i;
+
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strncmp(line, "INFO ", 5) != 0 || !strstr(line, "log-test.c:"))
+            return log_error_ret(-1, "message is garbled: %s", line);
+
+        if (!(msg = strstr(line, "thread ")) || sscanf(msg, "thread %d message %d", &n, &i) != 2)
+            continue;
+
+        if (n < 0 || n >= LOG_TEST_THREADS || i != next[n]++)
+            return log_error_ret(-1, "thread %d message %d is out of order", n, i);
+
+        snprintf(expected, sizeof(expected), "[%s] thread %d message %d", ids[n], n, i);
+        if (!strstr(line, expected))
+            return log_error_ret(-1, "thread %d message %d isn't tagged with %s", n, i, ids[n]);
+    }
+
+    for (n = 0; n < LOG_TEST_THREADS; n++)
+        if (next[n] != LOG_TEST_MESSAGES)
+            return log_error_ret(-1, "thread %d logged %d messages", n, next[n]);
+
+    return 0;
+}
+
+static int run_threads(int async)
+{
+    pthread_t threads[LOG_TEST_THREADS];
+    size_t len;
+    char *buf;
+    int ret;
+
+    if (capture() != 0)
+        return log_error_ret(-1, "cannot open %s", LOG_TEST_FILE);
+
+    if (async && conty_log_start() != 0) {
+        dup2(saved_stderr, STDERR_FILENO);
+        return log_error_ret(-1, "cannot start logger");
+    }
+
+    for (long n = 0; n < LOG_TEST_THREADS; n++)
+        pthread_create(&threads[n], NULL, log_thread, (void *) n);
+    for (int n = 0; n < LOG_TEST_THREADS; n++)
+        pthread_join(threads[n], NULL);
+
+    if (async)
+        conty_log_stop();
+
+    if (!(buf = release(&len)))
+        return log_error_ret(-1, "cannot read %s", LOG_TEST_FILE);
+
+    ret = check_lines(buf);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * A forked child has no logger thread, its messages are written in place
+ */
+static int run_fork(void)
+{
+    size_t len;
+    char *buf;
+    pid_t pid;
+    int ret = 0;
+
+    if (capture() != 0 || conty_log_start() != 0)
+        return log_error_ret(-1, "cannot start logger");
+
+    LOG_INFO("before fork");
+
+    if ((pid = fork()) == 0) {
+        LOG_INFO("in child");
+        _exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+    conty_log_stop();
+
+    if (!(buf = release(&len)))
+        return log_error_ret(-1, "cannot read %s", LOG_TEST_FILE);
+
+    if (!strstr(buf, "before fork") || !strstr(buf, "in child"))
+        ret = log_error_ret(-1, "messages are missing:\n%s", buf);
+
+    free(buf);
+    return ret;
+}
+
+static int run_binary(void)
+{
+    struct conty_log_record rec;
+    size_t len, off = 0;
+    const char *data;
+    int count = 0;
+    char *buf;
+    int ret = 0;
+
+    if (capture() != 0 || conty_log_start() != 0)
+        return log_error_ret(-1, "cannot start logger");
+
+    conty_log_set_binary(1);
+    LOG_WARN("untagged %d", 1);
+    {
+        LOG_CONTAINER_SCOPE("echo");
+        LOG_ERROR("tagged %s", "message");
+    }
+    conty_log_set_binary(0);
+    conty_log_stop();
+
+    if (!(buf = release(&len)))
+        return log_error_ret(-1, "cannot read %s", LOG_TEST_FILE);
+
+    for (; off + sizeof(rec) <= len; off += rec.lr_len, count++) {
+        memcpy(&rec, buf + off, sizeof(rec));
+        data = buf + off + sizeof(rec);
+
+        if (rec.lr_len % 8 != 0 || off + rec.lr_len > len ||
+            sizeof(rec) + rec.lr_filelen + rec.lr_idlen + rec.lr_msglen > rec.lr_len) {
+            ret = log_error_ret(-1, "record %d is garbled", count);
+            break;
+        }
+
+        if (rec.lr_time == 0 || rec.lr_line == 0 ||
+            strncmp(data, __FILE__, rec.lr_filelen) != 0) {
+            ret = log_error_ret(-1, "record %d lacks its origin", count);
+            break;
+        }
+
+        data += rec.lr_filelen;
+        if ((count == 0 && (rec.lr_level != CONTY_LOG_WARN || rec.lr_idlen != 0 ||
+                            strncmp(data, "untagged 1", rec.lr_msglen) != 0)) ||
+            (count == 1 && (rec.lr_level != CONTY_LOG_ERROR ||
+                            strncmp(data, "echo", rec.lr_idlen) != 0 ||
+                            strncmp(data + rec.lr_idlen, "tagged message", rec.lr_msglen) != 0))) {
+            ret = log_error_ret(-1, "record %d doesn't match what was logged", count);
+            break;
+        }
+    }
+
+    if (ret == 0 && (count != 2 || off != len))
+        ret = log_error_ret(-1, "%d records and %zu stray bytes", count, len - off);
+
+    free(buf);
+    return ret;
+}
+
+/*
+ * From here on, calls below INFO are compiled out
+ */
+#undef CONTY_LOG_LEVEL_MIN
+#define CONTY_LOG_LEVEL_MIN CONTY_LOG_INFO
+
+static int run_cutoff(void)
+{
+    int evaluated = 0;
+
+    conty_log_set_quiet(1);
+    LOG_TRACE("%d", ++evaluated);
+    LOG_DEBUG("%d", ++evaluated);
+    LOG_INFO("%d", ++evaluated);
+    conty_log_set_quiet(0);
+
+    if (evaluated != 1)
+        return log_error_ret(-1, "%d calls were compiled in, expected 1", evaluated);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    if (run_threads(0) != 0 || run_threads(1) != 0 || run_fork() != 0 ||
+        run_binary() != 0 || run_cutoff() != 0)
+        goto out;
+
+    ret = EXIT_SUCCESS;
+out:
+    unlink(LOG_TEST_FILE);
+    return ret;
+}
@@ -0,0 +1,263 @@
+#include "loop.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+/*
+ * A loop that never completes what it was asked for would wait forever
+ */
+#define LOOP_TEST_TIMEOUT 10
+
+struct loop_test {
+    struct conty_rt_event *lt_ev;
+    int                    lt_res;
+};
+
+static int on_event(void *data, struct conty_rt_event *ev, int res)
+{
+    struct loop_test *lt = data;
+
+    lt->lt_ev  = ev;
+    lt->lt_res = res;
+
+    return 0;
+}
+
+/*
+ * Run the loop until ev completed and return its result
+ */
+static int await(conty_rt_loop_t loop, struct conty_rt_event *ev)
+{
+    struct loop_test lt = { 0 };
+    int err;
+
+    while (lt.lt_ev != ev) {
+        err = conty_rt_loop_run_once(loop, on_event, &lt);
+        if (err != 0 && err != -EINTR)
+            return log_error_ret(INT32_MIN, "cannot run loop: %s", strerror(-err));
+    }
+
+    return lt.lt_res;
+}
+
+static int listen_unix(conty_rt_loop_t loop, struct sockaddr_un *addr, socklen_t *len)
+{
+    int fd;
+
+    /*
+     * Abstract, so that nothing is left behind. A multishot accept keeps the
+     * socket open until its ring is closed, so every backend gets its own
+     */
+    addr->sun_family = AF_UNIX;
+    *len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 +
+                        snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                                 "conty-loop-test-%d-%s", getpid(),
+                                 conty_rt_loop_backend(loop)));
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(fd, (struct sockaddr *) addr, *len) != 0 || listen(fd, 4) != 0)
+        return log_error_ret(-1, "cannot listen");
+
+    return fd;
+}
+
+/*
+ * Connections: accept, receive, reply and receive again, including a request
+ * that arrives while the connection isn't waiting, and the client hanging up
+ */
+static int test_conn(conty_rt_loop_t loop, int efd)
+{
+    struct conty_rt_event server = { .ev_kind = CONTY_RT_EV_SERVER };
+    struct conty_rt_event conn   = { .ev_kind = CONTY_RT_EV_CONN };
+    struct conty_rt_event sync   = { .ev_kind = CONTY_RT_EV_SYNC, .ev_fd = efd };
+    struct sockaddr_un addr = { 0 };
+    char rx[16], tx[16] = { 0 };
+    uint64_t one = 1;
+    socklen_t len;
+    int client, res;
+
+    if ((server.ev_fd = listen_unix(loop, &addr, &len)) < 0)
+        return -1;
+
+    if (conty_rt_loop_accept(loop, &server) != 0)
+        return log_error_ret(-1, "cannot accept");
+
+    if ((client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(client, (struct sockaddr *) &addr, len) != 0)
+        return log_error_ret(-1, "cannot connect");
+
+    if ((conn.ev_fd = await(loop, &server)) < 0)
+        return log_error_ret(-1, "accept failed: %d", conn.ev_fd);
+
+    if (conty_rt_loop_recv(loop, &conn, rx, sizeof(rx)) != 0 || write(client, "ping", 4) != 4)
+        return log_error_ret(-1, "cannot receive");
+
+    if ((res = await(loop, &conn)) != 4 || memcmp(rx, "ping", 4) != 0)
+        return log_error_ret(-1, "received %d bytes instead of ping", res);
+
+    /*
+     * The send is linked to the receive of the next request
+     */
+    if (conty_rt_loop_reply(loop, &conn, "pong", 4, rx, sizeof(rx)) != 0)
+        return log_error_ret(-1, "cannot reply");
+
+    if (write(client, "again", 5) != 5 || (res = await(loop, &conn)) != 5 ||
+        memcmp(rx, "again", 5) != 0)
+        return log_error_ret(-1, "received %d bytes instead of again", res);
+
+    if (read(client, tx, 4) != 4 || memcmp(tx, "pong", 4) != 0)
+        return log_error_ret(-1, "client did not get pong");
+
+    /*
+     * The next request arrives while the loop waits for something else
+     */
+    if (write(client, "early", 5) != 5 || conty_rt_loop_wait_sync(loop, &sync) != 0 ||
+        write(efd, &one, sizeof(one)) != sizeof(one) || await(loop, &sync) != 0 ||
+        read(efd, &one, sizeof(one)) != sizeof(one))
+        return log_error_ret(-1, "cannot wait for eventfd");
+
+    if (conty_rt_loop_recv(loop, &conn, rx, sizeof(rx)) != 0 || (res = await(loop, &conn)) != 5 ||
+        memcmp(rx, "early", 5) != 0)
+        return log_error_ret(-1, "received %d bytes instead of early", res);
+
+    close(client);
+    if (conty_rt_loop_recv(loop, &conn, rx, sizeof(rx)) != 0 || (res = await(loop, &conn)) != 0)
+        return log_error_ret(-1, "hangup received %d", res);
+
+    close(conn.ev_fd);
+    close(server.ev_fd);
+
+    return 0;
+}
+
+/*
+ * Polls complete once and have to be armed again
+ */
+static int test_poll(conty_rt_loop_t loop, int efd)
+{
+    struct conty_rt_event sync = { .ev_kind = CONTY_RT_EV_SYNC, .ev_fd = efd };
+    uint64_t one = 1;
+
+    for (int i = 0; i < 3; i++) {
+        if (conty_rt_loop_wait_sync(loop, &sync) != 0)
+            return log_error_ret(-1, "cannot wait for eventfd");
+
+        if (write(efd, &one, sizeof(one)) != sizeof(one) || await(loop, &sync) != 0 ||
+            read(efd, &one, sizeof(one)) != sizeof(one))
+            return log_error_ret(-1, "eventfd not reported the %d. time", i + 1);
+    }
+
+    return 0;
+}
+
+/*
+ * The loop itself has no timeouts, the runtime waits for timers
+ * like for anything else that becomes readable
+ */
+static int test_timeout(conty_rt_loop_t loop)
+{
+    struct itimerspec its = { .it_value.tv_nsec = 10000000 };
+    struct conty_rt_event timer = { .ev_kind = CONTY_RT_EV_SYNC };
+    uint64_t expired;
+
+    if ((timer.ev_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0 ||
+        timerfd_settime(timer.ev_fd, 0, &its, NULL) != 0)
+        return log_error_ret(-1, "cannot create timer");
+
+    if (conty_rt_loop_wait_sync(loop, &timer) != 0 || await(loop, &timer) != 0)
+        return log_error_ret(-1, "timer not reported");
+
+    if (read(timer.ev_fd, &expired, sizeof(expired)) != sizeof(expired) || expired != 1)
+        return log_error_ret(-1, "timer reported before it expired");
+
+    close(timer.ev_fd);
+
+    return 0;
+}
+
+/*
+ * Exits are reported and the process is left alone
+ */
+static int test_exit(conty_rt_loop_t loop)
+{
+    struct conty_rt_event ev = { .ev_kind = CONTY_RT_EV_EXIT };
+    int status;
+    pid_t pid;
+
+    if ((pid = fork()) == 0)
+        _exit(42);
+
+    if ((ev.ev_fd = (int) syscall(SYS_pidfd_open, pid, 0)) < 0)
+        return log_error_ret(-1, "cannot open pidfd");
+
+    if (conty_rt_loop_wait_exit(loop, &ev) != 0 || await(loop, &ev) != 0)
+        return log_error_ret(-1, "exit not reported");
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 42)
+        return log_error_ret(-1, "exited process was reaped by the loop");
+
+    close(ev.ev_fd);
+
+    return 0;
+}
+
+static int test_backend(char uring)
+{
+    conty_rt_loop_t loop;
+    int efd, err = -1;
+
+    if (!(loop = conty_rt_loop_open(uring)))
+        return log_error_ret(-1, "cannot open loop");
+
+    /*
+     * The kernel may not let us have io_uring, then the fallback is all we get
+     */
+    if (uring && strcmp(conty_rt_loop_backend(loop), "io_uring") != 0) {
+        LOG_WARN("io_uring not available, skipping it");
+        conty_rt_loop_close(loop);
+        return 0;
+    }
+
+    if ((efd = eventfd(0, EFD_CLOEXEC)) < 0)
+        goto out;
+
+    if (test_conn(loop, efd) != 0 || test_poll(loop, efd) != 0 || test_timeout(loop) != 0 ||
+        test_exit(loop) != 0) {
+        LOG_ERROR("%s backend failed", conty_rt_loop_backend(loop));
+        goto out;
+    }
+
+    err = 0;
+
+out:
+    if (efd >= 0)
+        close(efd);
+    conty_rt_loop_close(loop);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    alarm(LOOP_TEST_TIMEOUT);
+
+    /*
+     * Not asking for io_uring forces the epoll fallback
+     */
+    if (test_backend(1) != 0 || test_backend(0) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
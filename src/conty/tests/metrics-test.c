@@ -0,0 +1,110 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define METRICS_TEST_HISTS 64
+
+/*
+ * Bucket of the sample whose le is closest to the duration without being smaller
+ */
+static long long bucket_of(const char *text, const char *le)
+{
+    char needle[64];
+    const char *line;
+
+    snprintf(needle, sizeof(needle), "le=\"%s\"} ", le);
+    if (!(line = strstr(text, needle)))
+        return -1;
+
+    return strtoll(line + strlen(needle), NULL, 10);
+}
+
+static int run_hist(void)
+{
+    struct conty_rt_text text = { 0 };
+    struct conty_rt_hist hist;
+    int ret = -1;
+
+    memset(&hist, 0, sizeof(hist));
+
+    /*
+     * 1 us, 100 us, 10 ms and 2 min
+     */
+    conty_rt_hist_add(&hist, 1000);
+    conty_rt_hist_add(&hist, 100 * 1000);
+    conty_rt_hist_add(&hist, 10 * 1000 * 1000);
+    conty_rt_hist_add(&hist, 120ULL * 1000 * 1000 * 1000);
+
+    if (conty_rt_metric_header(&text, "test_seconds", "histogram", "Test.") != 0 ||
+        conty_rt_metric_hist(&text, "test_seconds", "op=\"test\"", &hist) != 0)
+        goto out;
+
+    if (!strstr(text.tx_buf, "# HELP test_seconds Test.\n# TYPE test_seconds histogram\n")) {
+        LOG_ERROR("header is missing");
+        goto out;
+    }
+
+    if (bucket_of(text.tx_buf, "1.023e-06") != 1 ||
+        bucket_of(text.tx_buf, "0.000262143") != 2 ||
+        bucket_of(text.tx_buf, "0.016777215") != 3 ||
+        bucket_of(text.tx_buf, "68.7194767") != 3 ||
+        bucket_of(text.tx_buf, "+Inf") != 4) {
+        LOG_ERROR("buckets are not cumulative:\n%s", text.tx_buf);
+        goto out;
+    }
+
+    if (!strstr(text.tx_buf, "test_seconds_sum{op=\"test\"} 120.010101000\n") ||
+        !strstr(text.tx_buf, "test_seconds_count{op=\"test\"} 4\n")) {
+        LOG_ERROR("sum or count is wrong:\n%s", text.tx_buf);
+        goto out;
+    }
+
+    ret = 0;
+out:
+    conty_rt_text_free(&text);
+    return ret;
+}
+
+/*
+ * Writes as many histograms as a scrape of the runtime
+ * does and more, the text has to grow along the way
+ */
+static int run_scrape(void)
+{
+    struct conty_rt_text text = { 0 };
+    struct conty_rt_hist hist;
+    char labels[32];
+    int ret = -1;
+
+    memset(&hist, 0, sizeof(hist));
+    for (uint64_t ns = 1; ns < 1000000000ULL; ns *= 3)
+        conty_rt_hist_add(&hist, ns);
+
+    for (int i = 0; i < METRICS_TEST_HISTS; i++) {
+        snprintf(labels, sizeof(labels), "n=\"%d\"", i);
+        if (conty_rt_metric_hist(&text, "test_seconds", labels, &hist) != 0)
+            goto out;
+    }
+
+    if (text.tx_len != strlen(text.tx_buf) || !strstr(text.tx_buf, "test_seconds_count{n=\"63\"}")) {
+        LOG_ERROR("text was cut short");
+        goto out;
+    }
+
+    ret = 0;
+out:
+    conty_rt_text_free(&text);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    if (run_hist() != 0 || run_scrape() != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -10,7 +10,21 @@
 
 #include "clone.h"
 #include "log.h"
+#include "resource.h"
 #include "safestring.h"
+#include "user.h"
+
+#define MOUNT_TEST_HOST_ID 100000
+#define MOUNT_TEST_ID_RANGE 65536
+
+#define MOUNT_TEST_SCRATCH "/tmp/conty-mount-test-scratch"
+
+static int idmap_pipe[2];
+
+struct overlay_args {
+    const char *oa_lower;
+    char        oa_tmpfs;
+};
 
 static int rootfs_mounter(void *dst)
 {
@@ -54,6 +68,151 @@ static int test_rootfs_mount(char *cro_dst)
     return 0;
 }
 
+static int idmapped_rootfs_mounter(void *dst)
+{
+    const char *cro_dst = (const char *) dst;
+    struct conty_rootfs rfs;
+    struct stat sb;
+    int treefd;
+
+    if (read(idmap_pipe[0], &treefd, sizeof(treefd)) != sizeof(treefd))
+        return 1;
+
+    if (conty_rootfs_init(&rfs, cro_dst, 0) != 0)
+        return 1;
+
+    rfs.cro_treefd = treefd;
+    if (conty_rootfs_mount(&rfs) != 0)
+        return 1;
+
+    /*
+     * The rootfs is owned by the host's root, which is unmapped in our
+     * user namespace. Only the idmapped mount makes it appear as ours
+     */
+    if (stat(cro_dst, &sb) != 0 || sb.st_uid != 0 || sb.st_gid != 0)
+        return log_error_ret(1, "rootfs appears as owned by %u:%u", sb.st_uid, sb.st_gid);
+
+    return 0;
+}
+
+static int test_rootfs_idmap(char *cro_dst)
+{
+    FD_RESOURCE int procfd = -EBADF, usernsfd = -EBADF, treefd = -EBADF;
+    struct conty_id_map map;
+    struct stat sb;
+    char path[32];
+    int status;
+    pid_t child;
+
+    if (stat(cro_dst, &sb) != 0 || sb.st_uid != 0)
+        return log_error_ret(-1, "idmap test needs a rootfs owned by root");
+
+    if (pipe2(idmap_pipe, O_CLOEXEC) != 0)
+        return -1;
+
+    conty_id_map_init(&map);
+    if (conty_id_map_put(&map, 0, MOUNT_TEST_HOST_ID, MOUNT_TEST_ID_RANGE) != 0)
+        return -1;
+
+    /*
+     * Share the file descriptor table, so the child can pick up the tree
+     * that we create after it was spawned
+     */
+    child = clone3_cb(idmapped_rootfs_mounter, cro_dst,
+                      CLONE_NEWUSER | CLONE_NEWNS | CLONE_FILES, NULL);
+    if (child < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/%d", child);
+    if ((procfd = open(path, O_DIRECTORY | O_PATH | O_CLOEXEC)) < 0)
+        goto err_kill;
+
+    if (conty_id_map_write_at(procfd, &map, &map) != 0)
+        goto err_kill;
+
+    if ((usernsfd = openat(procfd, "ns/user", O_RDONLY | O_CLOEXEC)) < 0)
+        goto err_kill;
+
+    if ((treefd = conty_rootfs_idmap_tree(cro_dst, usernsfd, 0)) < 0)
+        goto err_kill;
+
+    if (write(idmap_pipe[1], &treefd, sizeof(treefd)) != sizeof(treefd))
+        goto err_kill;
+
+    if (waitpid(child, &status, 0) != child)
+        return -1;
+
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+
+err_kill:
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    return -1;
+}
+
+static int overlay_mounter(void *arg)
+{
+    struct overlay_args *args = arg;
+    struct conty_rootfs rfs;
+    char p[PATH_MAX];
+    int fd;
+
+    if (conty_rootfs_init_overlay(&rfs, args->oa_lower, MOUNT_TEST_SCRATCH,
+                                  args->oa_tmpfs, 0) != 0)
+        return 1;
+
+    if (conty_rootfs_mount(&rfs) != 0)
+        return 1;
+
+    if (snprintf(p, sizeof(p), "%s/overlay_file", rfs.cro_dst) < 0)
+        return 1;
+
+    if ((fd = creat(p, 0644)) < 0)
+        return 1;
+
+    close(fd);
+    return 0;
+}
+
+static int test_rootfs_overlay(char *lower, char tmpfs)
+{
+    struct overlay_args args = { .oa_lower = lower, .oa_tmpfs = tmpfs };
+    char p[PATH_MAX];
+    struct stat sb;
+    int status;
+    pid_t child;
+
+    if (conty_rootfs_scratch_create(MOUNT_TEST_SCRATCH, tmpfs, (uid_t) -1, (gid_t) -1) != 0)
+        return -1;
+
+    child = clone3_cb(overlay_mounter, &args, CLONE_NEWNS, NULL);
+    if (child < 0)
+        return -1;
+
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+
+    /*
+     * Writes must never reach the shared lower layer. They persist in
+     * the upper layer on disk, and vanish with a tmpfs
+     */
+    snprintf(p, sizeof(p), "%s/overlay_file", lower);
+    if (stat(p, &sb) == 0)
+        return log_error_ret(-1, "write leaked into the lower layer");
+
+    snprintf(p, sizeof(p), "%s/upper/overlay_file", MOUNT_TEST_SCRATCH);
+    if ((stat(p, &sb) == 0) == tmpfs)
+        return log_error_ret(-1, "unexpected upper layer contents");
+
+    if (conty_rootfs_scratch_remove(MOUNT_TEST_SCRATCH) != 0)
+        return -1;
+
+    if (stat(MOUNT_TEST_SCRATCH, &sb) == 0)
+        return log_error_ret(-1, "scratch directory survived removal");
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc != 2) {
@@ -77,5 +236,17 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (test_rootfs_idmap(argv[1]) != 0) {
+        LOG_ERROR("test_rootfs_idmap failed");
+        return EXIT_FAILURE;
+    }
+
+    for (char tmpfs = 0; tmpfs <= 1; tmpfs++) {
+        if (test_rootfs_overlay(argv[1], tmpfs) != 0) {
+            LOG_ERROR("test_rootfs_overlay failed (tmpfs: %d)", tmpfs);
+            return EXIT_FAILURE;
+        }
+    }
+
     return EXIT_SUCCESS;
 }
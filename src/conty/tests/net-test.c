@@ -0,0 +1,202 @@
+#include "net.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <conty/conty.h>
+
+#include "log.h"
+
+#define NET_TEST_PORT 5201
+#define NET_TEST_POOL 4
+
+static char *bridge_addrs[] = { "10.88.0.1/24", NULL };
+static char *addrs[] = { "10.88.0.2/24", "fd00:88::2/64", NULL };
+
+static struct oci_network test_net = {
+        .onet_bridge        = "conty-test0",
+        .onet_bridge_addrs  = bridge_addrs,
+        .onet_addrs         = addrs,
+};
+
+/*
+ * The container: waits for its network and then says hello
+ * to the host through the bridge
+ */
+static int container(int ready)
+{
+    struct sockaddr_in host = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(NET_TEST_PORT),
+    };
+    char go;
+    int fd;
+
+    if (read(ready, &go, 1) != 1)
+        return 1;
+
+    if (if_nametoindex(CONTY_NET_PEER_NAME) == 0)
+        return log_error_ret(2, "%s missing in container", CONTY_NET_PEER_NAME);
+
+    inet_pton(AF_INET, "10.88.0.1", &host.sin_addr);
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *) &host, sizeof(host)) != 0)
+        return log_error_ret(3, "cannot reach host: %s", strerror(errno));
+
+    return write(fd, "hello", 5) == 5 ? 0 : 4;
+}
+
+static int run_container(const char *id, int lfd, char *veth)
+{
+    char buf[8] = { 0 };
+    int ipc[2], pidfd, cfd, status;
+    pid_t child;
+
+    if (pipe(ipc) != 0)
+        return -1;
+
+    if ((child = fork()) == 0) {
+        close(ipc[1]);
+        if (unshare(CLONE_NEWNET) != 0)
+            _exit(1);
+        _exit(container(ipc[0]));
+    }
+    close(ipc[0]);
+
+    if ((pidfd = (int) syscall(SYS_pidfd_open, child, 0)) < 0)
+        return log_error_ret(-1, "cannot open pidfd");
+
+    /*
+     * Let the child get into its namespace
+     */
+    usleep(100000);
+
+    if (conty_net_setup(&test_net, id, pidfd, veth) != 0)
+        return log_error_ret(-1, "cannot set up network");
+
+    if (if_nametoindex(veth) == 0)
+        return log_error_ret(-1, "host end of the pair missing");
+
+    if (write(ipc[1], "x", 1) != 1)
+        return -1;
+
+    if ((cfd = accept(lfd, NULL, NULL)) < 0 || read(cfd, buf, 5) != 5 || strcmp(buf, "hello") != 0)
+        return log_error_ret(-1, "container did not say hello");
+
+    close(cfd);
+    close(ipc[1]);
+    close(pidfd);
+
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "container failed");
+
+    if (conty_net_teardown(&test_net, veth) != 0)
+        return log_error_ret(-1, "cannot tear down network");
+
+    if (if_nametoindex(veth) != 0)
+        return log_error_ret(-1, "host end of the pair survived teardown");
+
+    return 0;
+}
+
+static int await_pool(unsigned int count)
+{
+    for (int i = 0; i < 200 && conty_net_pool_available() != count; i++)
+        usleep(10000);
+
+    return conty_net_pool_available() == count ? 0 : -1;
+}
+
+static int count_links(void)
+{
+    struct if_nameindex *links = if_nameindex(), *cur;
+    int n = 0;
+
+    for (cur = links; cur && cur->if_index; cur++)
+        n++;
+
+    if_freenameindex(links);
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in any = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(NET_TEST_PORT),
+    };
+    char veth[IFNAMSIZ], taken[IFNAMSIZ];
+    struct ifreq ifr = { .ifr_name = "lo" };
+    int lfd, links;
+
+    /*
+     * Play host in a namespace of our own
+     */
+    if (unshare(CLONE_NEWNET) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create network namespace");
+
+    if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        bind(lfd, (struct sockaddr *) &any, sizeof(any)) != 0 || listen(lfd, 1) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot listen");
+
+    if (conty_net_pool_start(test_net.onet_bridge, NET_TEST_POOL) != 0)
+        return EXIT_FAILURE;
+
+    /*
+     * The first container creates the bridge, the pool can't do
+     * anything before that
+     */
+    if (run_container("net-test-1", lfd, veth) != 0)
+        return EXIT_FAILURE;
+
+    if (await_pool(NET_TEST_POOL) != 0)
+        return log_error_ret(EXIT_FAILURE, "veth pool was not filled");
+
+    links = count_links();
+
+    /*
+     * The second one takes its pair from the pool, which is refilled
+     */
+    if (run_container("net-test-2", lfd, veth) != 0)
+        return EXIT_FAILURE;
+
+    if (await_pool(NET_TEST_POOL) != 0 || count_links() != links)
+        return log_error_ret(EXIT_FAILURE, "veth pool was not refilled");
+
+    conty_net_pool_stop();
+    if (count_links() != links - 2 * NET_TEST_POOL)
+        return log_error_ret(EXIT_FAILURE, "veth pool survived");
+
+    /*
+     * Another device has the name of the next container's pair: it gets
+     * one of its own, and the other device survives its teardown
+     */
+    if (conty_net_veth_name("net-test-3", 0, taken, sizeof(taken)) != 0)
+        return EXIT_FAILURE;
+
+    strcpy(ifr.ifr_newname, taken);
+    if (ioctl(lfd, SIOCSIFNAME, &ifr) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot rename loopback device");
+
+    if (run_container("net-test-3", lfd, veth) != 0)
+        return EXIT_FAILURE;
+
+    if (strcmp(veth, taken) == 0 || if_nametoindex(taken) == 0)
+        return log_error_ret(EXIT_FAILURE, "pair took the name of another device");
+
+    test_net.onet_delete_bridge = 1;
+    if (conty_net_teardown(&test_net, veth) != 0 || if_nametoindex(test_net.onet_bridge) != 0)
+        return log_error_ret(EXIT_FAILURE, "bridge survived teardown");
+
+    return EXIT_SUCCESS;
+}
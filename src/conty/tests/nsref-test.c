@@ -0,0 +1,204 @@
+#include "container.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+#define NSREF_TEST_DIR    "/tmp/conty-nsref-test"
+#define NSREF_TEST_ROUNDS 20
+
+/*
+ * Everyone runs on the host's root filesystem
+ */
+static const char *target_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/sleep\", \"60\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\" }, { \"type\": \"uts\" }, { \"type\": \"ipc\" },"
+    "                   { \"type\": \"pid\" }]"
+    "}";
+
+/*
+ * Joiners report where they are, the namespaces are filled in per test
+ */
+static const char *joiner_conf =
+    "{"
+    "  \"process\": {"
+    "    \"args\": [\"/bin/sh\", \"-c\", \"for ns in net uts ipc pid; do "
+    "readlink /proc/self/ns/$ns; done > " NSREF_TEST_DIR "/out-%s\"],"
+    "    \"cwd\": \"/\""
+    "  },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [%s]"
+    "}";
+
+static struct conty_container *target;
+
+static int resolve(const char *id, void *data)
+{
+    if (strcmp(id, "nsref-target") != 0)
+        return -ENOENT;
+
+    return conty_container_pollfd(target);
+}
+
+static int write_joiner(const char *name, const char *namespaces)
+{
+    char path[128];
+    FILE *file;
+
+    snprintf(path, sizeof(path), NSREF_TEST_DIR "/%s.json", name);
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, joiner_conf, name, namespaces);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int namespaces_of(pid_t pid, char *buf, size_t len)
+{
+    static const char *types[] = { "net", "uts", "ipc", "pid" };
+    char path[64], link[64];
+    size_t off = 0;
+    ssize_t rx;
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        snprintf(path, sizeof(path), "/proc/%d/ns/%s", pid, types[i]);
+        if ((rx = readlink(path, link, sizeof(link) - 1)) < 0)
+            return log_error_ret(-1, "cannot read %s", path);
+        link[rx] = '\0';
+
+        off += snprintf(buf + off, len - off, "%s\n", link);
+    }
+
+    return 0;
+}
+
+static int run_joiner(const char *name, const char *expected)
+{
+    char bundle[128], out[256];
+    struct conty_container *cc;
+    FILE *file;
+    size_t rx;
+    int status;
+    pid_t pid;
+
+    snprintf(bundle, sizeof(bundle), NSREF_TEST_DIR "/%s.json", name);
+
+    for (int i = 0; i < NSREF_TEST_ROUNDS; i++) {
+        if (!(cc = conty_container_create(name, bundle)))
+            return log_error_ret(-1, "cannot create %s", name);
+
+        pid = conty_container_pid(cc);
+        if (conty_container_start(cc) != 0)
+            return log_error_ret(-1, "cannot start %s", name);
+
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return log_error_ret(-1, "%s did not exit cleanly", name);
+
+        conty_container_set_status(cc, CONTY_STOPPED);
+        if (conty_container_delete(cc) != 0)
+            return log_error_ret(-1, "cannot delete %s", name);
+    }
+
+    snprintf(bundle, sizeof(bundle), NSREF_TEST_DIR "/out-%s", name);
+    if (!(file = fopen(bundle, "r")))
+        return log_error_ret(-1, "%s left no output", name);
+
+    rx = fread(out, 1, sizeof(out) - 1, file);
+    out[rx] = '\0';
+    fclose(file);
+
+    if (strcmp(out, expected) != 0)
+        return log_error_ret(-1, "%s is in the wrong namespaces:\n%s", name, out);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char expected[512], namespaces[512];
+    int ret = EXIT_FAILURE;
+    FILE *file;
+    pid_t pid;
+
+    if (system("rm -rf " NSREF_TEST_DIR " && mkdir -p " NSREF_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", NSREF_TEST_DIR);
+
+    if (!(file = fopen(NSREF_TEST_DIR "/target.json", "w")))
+        goto out;
+    fputs(target_conf, file);
+    fclose(file);
+
+    if (!(target = conty_container_create("nsref-target", NSREF_TEST_DIR "/target.json")) ||
+        conty_container_start(target) != 0) {
+        LOG_ERROR("cannot run target");
+        goto out;
+    }
+
+    pid = conty_container_pid(target);
+    if (namespaces_of(pid, expected, sizeof(expected)) != 0)
+        goto out_target;
+
+    conty_container_set_resolver(resolve, NULL);
+
+    snprintf(namespaces, sizeof(namespaces),
+             "{ \"type\": \"net\", \"path\": \"/proc/%d/ns/net\" },"
+             "{ \"type\": \"uts\", \"path\": \"/proc/%d/ns/uts\" },"
+             "{ \"type\": \"ipc\", \"path\": \"/proc/%d/ns/ipc\" },"
+             "{ \"type\": \"pid\", \"path\": \"/proc/%d/ns/pid\" }", pid, pid, pid, pid);
+    if (write_joiner("nsref-path", namespaces) != 0)
+        goto out_target;
+
+    if (write_joiner("nsref-container",
+                     "{ \"type\": \"net\", \"container\": \"nsref-target\" },"
+                     "{ \"type\": \"uts\", \"container\": \"nsref-target\" },"
+                     "{ \"type\": \"ipc\", \"container\": \"nsref-target\" },"
+                     "{ \"type\": \"pid\", \"container\": \"nsref-target\" }") != 0)
+        goto out_target;
+
+    /*
+     * The mount namespace is entered by the container process itself
+     */
+    snprintf(namespaces, sizeof(namespaces),
+             "{ \"type\": \"net\", \"pid\": %d }, { \"type\": \"uts\", \"pid\": %d },"
+             "{ \"type\": \"ipc\", \"pid\": %d }, { \"type\": \"pid\", \"pid\": %d },"
+             "{ \"type\": \"mnt\", \"pid\": %d }", pid, pid, pid, pid, pid);
+    if (write_joiner("nsref-pid", namespaces) != 0)
+        goto out_target;
+
+    snprintf(namespaces, sizeof(namespaces),
+             "{ \"type\": \"net\", \"pid\": %d }, { \"type\": \"uts\", \"container\": \"nsref-target\" }",
+             pid);
+    if (write_joiner("nsref-mixed", namespaces) != 0)
+        goto out_target;
+
+    if (run_joiner("nsref-path", expected) != 0 ||
+        run_joiner("nsref-container", expected) != 0 ||
+        run_joiner("nsref-pid", expected) != 0)
+        goto out_target;
+
+    if (conty_container_create("nsref-mixed", NSREF_TEST_DIR "/nsref-mixed.json")) {
+        LOG_ERROR("namespaces referring to two processes were accepted");
+        goto out_target;
+    }
+
+    ret = EXIT_SUCCESS;
+
+out_target:
+    conty_container_kill(target, SIGKILL);
+    waitpid(conty_container_pid(target), NULL, 0);
+    conty_container_set_status(target, CONTY_STOPPED);
+    conty_container_delete(target);
+out:
+    if (system("rm -rf " NSREF_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", NSREF_TEST_DIR);
+
+    return ret;
+}
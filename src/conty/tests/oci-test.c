@@ -1,6 +1,19 @@
 #include "oci.h"
 
+#include <stdlib.h>
+
 #include "log.h"
+#include "test.h"
+
+#define OCI_TEST_MARKER  "/tmp/conty-oci-test-marker"
+#define OCI_TEST_BARRIER "/tmp/conty-oci-test-barrier"
+
+static struct oci_process_state test_state = {
+        .opst_container_id = "some-container",
+        .opst_pid = 50,
+        .opst_rootfs = "/path/to/bundle",
+        .opst_status = "created"
+};
 
 int test_hook_exec_timeout()
 {
@@ -48,6 +61,111 @@ int test_hook_exec()
     return 0;
 }
 
+/*
+ * Every hook waits for the other two to show up,
+ * so one after the other the first runs into its timeout
+ */
+int test_hooks_exec_parallel()
+{
+    char *argv[4] = {
+            "/bin/sh", "-c",
+            "touch " OCI_TEST_BARRIER "/$$; "
+            "while [ $(ls " OCI_TEST_BARRIER " | wc -l) -lt 3 ]; do sleep 0.01; done",
+            (char *) NULL
+    };
+    struct oci_hook hooks[3] = {
+            { .ohk_path = "/bin/sh", .ohk_argv = argv, .ohk_timeout = 2 },
+            { .ohk_path = "/bin/sh", .ohk_argv = argv, .ohk_timeout = 2 },
+            { .ohk_path = "/bin/sh", .ohk_argv = argv, .ohk_timeout = 2 },
+    };
+    struct oci_hooks list = SLIST_HEAD_INITIALIZER(list);
+    int err;
+
+    for (int i = 0; i < 3; i++)
+        SLIST_INSERT_HEAD(&list, &hooks[i], ohk_next);
+
+    if (system("rm -rf " OCI_TEST_BARRIER " && mkdir " OCI_TEST_BARRIER) != 0)
+        return -1;
+
+    if ((err = oci_hooks_exec_parallel(&list, &test_state, 0)) != 0)
+        LOG_ERROR("hooks did not run concurrently");
+
+    if (system("rm -rf " OCI_TEST_BARRIER) != 0)
+        LOG_WARN("cannot remove %s", OCI_TEST_BARRIER);
+
+    return err;
+}
+
+int test_hooks_exec_after()
+{
+    char *first_argv[4] = { "/bin/sh", "-c", "sleep 1; touch " OCI_TEST_MARKER, (char *) NULL};
+    char *second_argv[4] = { "/bin/sh", "-c", "test -f " OCI_TEST_MARKER, (char *) NULL};
+    char *after[2] = { "first", (char *) NULL};
+    struct oci_hook first = {
+            .ohk_path = "/bin/sh",
+            .ohk_argv = first_argv,
+            .ohk_timeout = 5,
+            .ohk_name = "first"
+    };
+    struct oci_hook second = {
+            .ohk_path = "/bin/sh",
+            .ohk_argv = second_argv,
+            .ohk_timeout = 5,
+            .ohk_after = after
+    };
+    struct oci_hooks list = SLIST_HEAD_INITIALIZER(list);
+    int err;
+
+    unlink(OCI_TEST_MARKER);
+
+    /*
+     * Listed before the hook it depends on
+     */
+    SLIST_INSERT_HEAD(&list, &first, ohk_next);
+    SLIST_INSERT_HEAD(&list, &second, ohk_next);
+
+    err = oci_hooks_exec_parallel(&list, &test_state, 0);
+    unlink(OCI_TEST_MARKER);
+
+    return err;
+}
+
+int test_hooks_exec_parallel_failure()
+{
+    char *sleep_argv[3] = { "/usr/bin/sleep", "5", (char *) NULL};
+    char *false_argv[2] = { "/bin/false", (char *) NULL};
+    struct oci_hook slow = {
+            .ohk_path = "/usr/bin/sleep",
+            .ohk_argv = sleep_argv,
+            .ohk_timeout = 1
+    };
+    struct oci_hook failing = {
+            .ohk_path = "/bin/false",
+            .ohk_argv = false_argv,
+            .ohk_timeout = 5
+    };
+    struct oci_hooks list = SLIST_HEAD_INITIALIZER(list);
+    double start;
+
+    SLIST_INSERT_HEAD(&list, &slow, ohk_next);
+    SLIST_INSERT_HEAD(&list, &failing, ohk_next);
+
+    /*
+     * The failing hook takes the slow one down with it
+     */
+    if (oci_hooks_exec_parallel(&list, &test_state, 0) == 0)
+        return -1;
+
+    /*
+     * Unless failures don't matter, then the slow one runs into its timeout
+     */
+    start = now_ms();
+    if (oci_hooks_exec_parallel(&list, &test_state, 1) != 0 || now_ms() - start < 1000)
+        return -1;
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (test_hook_exec() != 0) {
@@ -60,5 +178,20 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (test_hooks_exec_parallel() != 0) {
+        LOG_ERROR("test_hooks_exec_parallel failed");
+        return EXIT_FAILURE;
+    }
+
+    if (test_hooks_exec_after() != 0) {
+        LOG_ERROR("test_hooks_exec_after failed");
+        return EXIT_FAILURE;
+    }
+
+    if (test_hooks_exec_parallel_failure() != 0) {
+        LOG_ERROR("test_hooks_exec_parallel_failure failed");
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
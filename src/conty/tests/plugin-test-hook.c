@@ -0,0 +1,19 @@
+#include <conty/hook.h>
+
+#include <string.h>
+
+/*
+ * Fails unless it's handed the state and arguments plugin-test passes
+ */
+static int run(const struct conty_hook_state *state, char *const argv[])
+{
+    if (state->chs_pid != 50 || strcmp(state->chs_container_id, "some-container") != 0)
+        return -1;
+
+    return argv && argv[0] && !strcmp(argv[0], "fail") ? -1 : 0;
+}
+
+const struct conty_hook_plugin conty_hook_plugin = {
+    .chp_version = CONTY_HOOK_ABI_VERSION,
+    .chp_run     = run,
+};
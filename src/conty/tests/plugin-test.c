@@ -0,0 +1,59 @@
+#include "oci.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+
+/*
+ * Path of the shared object built from plugin-test-hook.c
+ */
+#ifndef PLUGIN_TEST_HOOK
+#define PLUGIN_TEST_HOOK "./plugin-test-hook.so"
+#endif
+
+#define PLUGIN_TEST_ROUNDS 200
+
+static struct oci_process_state test_state = {
+        .opst_container_id = "some-container",
+        .opst_pid = 50,
+        .opst_rootfs = "/path/to/bundle",
+        .opst_status = "created"
+};
+
+/*
+ * The plugin stays loaded across calls
+ */
+static int run(struct oci_hook *hook)
+{
+    for (int i = 0; i < PLUGIN_TEST_ROUNDS; i++) {
+        if (oci_hook_exec(hook, &test_state) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *fail_argv[2] = { "fail", (char *) NULL };
+    struct oci_hook plugin = {
+            .ohk_path = PLUGIN_TEST_HOOK,
+            .ohk_kind = OCI_HOOK_PLUGIN
+    };
+    struct oci_hook missing = {
+            .ohk_path = "/nonexistent/hook.so",
+            .ohk_kind = OCI_HOOK_PLUGIN
+    };
+
+    if (run(&plugin) != 0)
+        return log_error_ret(EXIT_FAILURE, "plugin hook failed");
+
+    plugin.ohk_argv = fail_argv;
+    if (oci_hook_exec(&plugin, &test_state) == 0)
+        return log_error_ret(EXIT_FAILURE, "failing plugin hook succeeded");
+
+    if (oci_hook_exec(&missing, &test_state) == 0)
+        return log_error_ret(EXIT_FAILURE, "missing plugin hook succeeded");
+
+    return EXIT_SUCCESS;
+}
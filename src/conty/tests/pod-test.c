@@ -0,0 +1,209 @@
+#include "container.h"
+#include "pod.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+#define POD_TEST_DIR    "/tmp/conty-pod-test"
+#define POD_TEST_BRIDGE "ctpod0"
+
+/*
+ * The pod connects to the network and counts how often its hooks run
+ */
+static const char *pod_conf =
+    "{"
+    "  \"namespaces\": [{ \"type\": \"net\" }, { \"type\": \"uts\" }],"
+    "  \"hostname\": \"pod\","
+    "  \"network\": {"
+    "    \"bridge\": \"" POD_TEST_BRIDGE "\","
+    "    \"bridge_addresses\": [\"10.251.0.1/24\"],"
+    "    \"addresses\": [\"10.251.0.2/24\"],"
+    "    \"delete_bridge\": true"
+    "  },"
+    "  \"hooks\": {"
+    "    \"on_runtime_create\": [{"
+    "      \"path\": \"/bin/sh\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sh\", \"-c\", \"echo created >> " POD_TEST_DIR "/hooks\"]"
+    "    }]"
+    "  }"
+    "}";
+
+/*
+ * Members run on the host's root filesystem and report where they are
+ */
+static const char *member_conf =
+    "{"
+    "  \"process\": {"
+    "    \"args\": [\"/bin/sh\", \"-c\", \"{ hostname; readlink /proc/self/ns/net; "
+    "readlink /proc/self/ns/uts; } > " POD_TEST_DIR "/out-$$\"],"
+    "    \"cwd\": \"/\""
+    "  },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"ipc\" }]"
+    "}";
+
+static const char *intruder_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\" }]"
+    "}";
+
+static int write_file(const char *path, const char *contents)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fputs(contents, file);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int read_file(const char *path, char *buf, size_t len)
+{
+    FILE *file;
+    size_t rx;
+
+    if (!(file = fopen(path, "r")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    rx = fread(buf, 1, len - 1, file);
+    buf[rx] = '\0';
+    fclose(file);
+
+    return (int) rx;
+}
+
+static int run_member(struct conty_pod *pod, const char *id, const char *expected)
+{
+    struct conty_container *cc;
+    char path[128], out[256];
+    int status;
+    pid_t pid;
+
+    if (!(cc = conty_container_create_in(pod, id, POD_TEST_DIR "/member.json")))
+        return log_error_ret(-1, "cannot create %s", id);
+
+    pid = conty_container_pid(cc);
+    if (conty_container_start(cc) != 0)
+        return log_error_ret(-1, "cannot start %s", id);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "%s did not exit cleanly", id);
+
+    conty_container_set_status(cc, CONTY_STOPPED);
+    if (conty_container_delete(cc) != 0)
+        return log_error_ret(-1, "cannot delete %s", id);
+
+    snprintf(path, sizeof(path), POD_TEST_DIR "/out-%d", pid);
+    if (read_file(path, out, sizeof(out)) <= 0 || strcmp(out, expected) != 0)
+        return log_error_ret(-1, "%s is not in the pod: %s", id, out);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char expected[256], netns[64], utsns[64], hooks[64], path[64];
+    struct conty_container *cc;
+    struct conty_pod *pod;
+    int ret = EXIT_FAILURE;
+    ssize_t len;
+    pid_t holder;
+
+    if (system("rm -rf " POD_TEST_DIR " && mkdir -p " POD_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", POD_TEST_DIR);
+
+    if (write_file(POD_TEST_DIR "/pod.json", pod_conf) != 0 ||
+        write_file(POD_TEST_DIR "/member.json", member_conf) != 0 ||
+        write_file(POD_TEST_DIR "/intruder.json", intruder_conf) != 0)
+        goto out;
+
+    if (!(pod = conty_pod_create("pod-test", POD_TEST_DIR "/pod.json"))) {
+        LOG_ERROR("cannot create pod");
+        goto out;
+    }
+
+    holder = conty_pod_pid(pod);
+
+    snprintf(path, sizeof(path), "/proc/%d/ns/net", holder);
+    if ((len = readlink(path, netns, sizeof(netns) - 1)) < 0)
+        goto out_pod;
+    netns[len] = '\0';
+
+    snprintf(path, sizeof(path), "/proc/%d/ns/uts", holder);
+    if ((len = readlink(path, utsns, sizeof(utsns) - 1)) < 0)
+        goto out_pod;
+    utsns[len] = '\0';
+
+    snprintf(expected, sizeof(expected), "pod\n%s\n%s\n", netns, utsns);
+
+    if (run_member(pod, "pod-test-1", expected) != 0 ||
+        run_member(pod, "pod-test-2", expected) != 0)
+        goto out_pod;
+
+    /*
+     * Members can't bring namespaces of their own that the pod shares
+     */
+    if ((cc = conty_container_create_in(pod, "pod-test-3", POD_TEST_DIR "/intruder.json"))) {
+        LOG_ERROR("container with its own network joined the pod");
+        goto out_pod;
+    }
+
+    if (!(cc = conty_container_create_in(pod, "pod-test-4", POD_TEST_DIR "/member.json")))
+        goto out_pod;
+
+    if (conty_pod_delete(pod) != -EBUSY) {
+        LOG_ERROR("pod with members was deleted");
+        goto out_pod;
+    }
+
+    conty_container_kill(cc, SIGKILL);
+    waitpid(conty_container_pid(cc), NULL, 0);
+    conty_container_free(cc);
+
+    /*
+     * Set up once, no matter the number of members
+     */
+    if (read_file(POD_TEST_DIR "/hooks", hooks, sizeof(hooks)) <= 0 ||
+        strcmp(hooks, "created\n") != 0) {
+        LOG_ERROR("pod hooks did not run exactly once");
+        goto out_pod;
+    }
+
+    if (conty_pod_delete(pod) != 0) {
+        LOG_ERROR("cannot delete pod");
+        goto out;
+    }
+
+    if (kill(holder, 0) == 0 || errno != ESRCH) {
+        LOG_ERROR("holder of the pod survived");
+        goto out;
+    }
+
+    if (system("ip link show " POD_TEST_BRIDGE " > /dev/null 2>&1") == 0) {
+        LOG_ERROR("bridge of the pod survived");
+        goto out;
+    }
+
+    ret = EXIT_SUCCESS;
+    goto out;
+
+out_pod:
+    conty_pod_free(pod);
+    system("ip link del " POD_TEST_BRIDGE " > /dev/null 2>&1");
+out:
+    if (system("rm -rf " POD_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", POD_TEST_DIR);
+
+    return ret;
+}
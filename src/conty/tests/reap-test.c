@@ -0,0 +1,318 @@
+#include "container.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+#define REAP_TEST_DIR        "/tmp/conty-reap-test"
+#define REAP_TEST_CONTAINERS 16
+
+static const char *conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/sh\", \"-c\", \"%s\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }]%s"
+    "}";
+
+/*
+ * Stands in for whatever has to be cleaned up after a container,
+ * which the caller would rather not wait for
+ */
+static const char *slow_hooks =
+    ","
+    "  \"hooks\": {"
+    "    \"on_container_stopped\": [{"
+    "      \"path\": \"/bin/sleep\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sleep\", \"0.02\"]"
+    "    }]"
+    "  }";
+
+/*
+ * Hooks that have to stay on the caller's thread
+ */
+static const char *socket_hooks =
+    ","
+    "  \"hooks\": {"
+    "    \"on_container_stopped\": [{"
+    "      \"path\": \"" REAP_TEST_DIR "/hook.sock\","
+    "      \"socket\": true"
+    "    }]"
+    "  }";
+
+static int write_conf(const char *path, const char *script, const char *hooks)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, conf, script, hooks);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int wait_readable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    return poll(&pfd, 1, 5000) == 1 ? 0 : -1;
+}
+
+static struct conty_container *run(const char *id, const char *bundle)
+{
+    struct conty_container *cc;
+
+    if (!(cc = conty_container_create(id, bundle)))
+        return log_error_ret(NULL, "cannot create %s", id);
+
+    if (conty_container_start(cc) != 0) {
+        conty_container_free(cc);
+        return log_error_ret(NULL, "cannot start %s", id);
+    }
+
+    return cc;
+}
+
+static int reap(struct conty_container *cc)
+{
+    if (wait_readable(conty_container_pollfd(cc)) != 0)
+        return log_error_ret(-1, "container %s did not exit", conty_container_id(cc));
+
+    if (conty_container_reap(cc) != 0)
+        return log_error_ret(-1, "cannot reap container %s", conty_container_id(cc));
+
+    conty_container_set_status(cc, CONTY_STOPPED);
+
+    return 0;
+}
+
+static int run_exited(void)
+{
+    struct conty_container *cc;
+    int status, ret = -1;
+
+    if (!(cc = run("exited", REAP_TEST_DIR "/exit.json")))
+        return -1;
+
+    if (conty_container_exit_status(cc) != -1 || conty_container_rusage(cc))
+        goto out;
+
+    if (reap(cc) != 0)
+        goto out;
+
+    status = conty_container_exit_status(cc);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 3) {
+        LOG_ERROR("container exited with status %d", status);
+        goto out;
+    }
+
+    if (!conty_container_rusage(cc)) {
+        LOG_ERROR("container has no resource usage");
+        goto out;
+    }
+
+    ret = 0;
+out:
+    conty_container_delete(cc);
+    return ret;
+}
+
+static int run_killed(void)
+{
+    struct conty_container *cc;
+    int status, ret = -1;
+
+    if (!(cc = run("killed", REAP_TEST_DIR "/sleep.json")))
+        return -1;
+
+    if (conty_container_reap(cc) != -EAGAIN) {
+        LOG_ERROR("running container was reaped");
+        goto out;
+    }
+
+    if (conty_container_kill(cc, SIGKILL) != 0 || reap(cc) != 0)
+        goto out;
+
+    status = conty_container_exit_status(cc);
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL) {
+        LOG_ERROR("container was killed with status %d", status);
+        goto out;
+    }
+
+    ret = 0;
+out:
+    conty_container_delete(cc);
+    return ret;
+}
+
+static int run_stopped(struct conty_container **cc, const char *prefix)
+{
+    char id[32];
+
+    for (int i = 0; i < REAP_TEST_CONTAINERS; i++) {
+        snprintf(id, sizeof(id), "%s-%d", prefix, i);
+        if (!(cc[i] = run(id, REAP_TEST_DIR "/slow.json")) || reap(cc[i]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int delete_blocking(void)
+{
+    struct conty_container *cc[REAP_TEST_CONTAINERS];
+
+    if (run_stopped(cc, "blocking") != 0)
+        return -1;
+
+    for (int i = 0; i < REAP_TEST_CONTAINERS; i++) {
+        if (conty_container_delete(cc[i]) != 0)
+            return log_error_ret(-1, "cannot delete container");
+    }
+
+    return 0;
+}
+
+/*
+ * Calls to a hook server must all come from the same thread,
+ * so the container isn't handed over
+ */
+static int delete_kept(void)
+{
+    struct conty_container *cc;
+
+    if (!(cc = run("kept", REAP_TEST_DIR "/socket.json")) || reap(cc) != 0)
+        return -1;
+
+    if (conty_container_delete_async(cc, NULL) != -EAGAIN) {
+        LOG_ERROR("container with a hook server was handed over");
+        return -1;
+    }
+
+    conty_container_delete(cc);
+
+    return 0;
+}
+
+/*
+ * Every container handed over is deleted exactly once
+ */
+static int delete_async(void)
+{
+    struct conty_container *cc[REAP_TEST_CONTAINERS];
+    int done[REAP_TEST_CONTAINERS] = { 0 };
+    int deleted = 0, err;
+    int *job;
+
+    if (run_stopped(cc, "async") != 0)
+        return -1;
+
+    for (int i = 0; i < REAP_TEST_CONTAINERS; i++) {
+        if (conty_container_delete_async(cc[i], &done[i]) != 0)
+            return log_error_ret(-1, "cannot hand over container");
+    }
+
+    while (deleted < REAP_TEST_CONTAINERS) {
+        if (wait_readable(conty_deleter_fd()) != 0)
+            return log_error_ret(-1, "deleter stopped making progress");
+
+        while ((job = conty_deleter_next(&err))) {
+            if (err != 0 || *job)
+                return log_error_ret(-1, "container was not deleted once");
+            *job = 1;
+            deleted++;
+        }
+    }
+
+    return 0;
+}
+
+static void deleted_late(void *data, int err, void *arg)
+{
+    int *job = data, *late = arg;
+
+    if (err == 0 && !*job)
+        (*late)++;
+    *job = 1;
+}
+
+/*
+ * Stopping without collecting first still hands back every container's data
+ */
+static int delete_stopped(void)
+{
+    struct conty_container *cc[REAP_TEST_CONTAINERS];
+    int done[REAP_TEST_CONTAINERS] = { 0 };
+    int late = 0, err;
+    int *job;
+
+    if (conty_deleter_start() != 0 || run_stopped(cc, "stopped") != 0)
+        return -1;
+
+    for (int i = 0; i < REAP_TEST_CONTAINERS; i++) {
+        if (conty_container_delete_async(cc[i], &done[i]) != 0)
+            return log_error_ret(-1, "cannot hand over container");
+    }
+
+    /*
+     * Some may be collected before, but none twice
+     */
+    if ((job = conty_deleter_next(&err))) {
+        *job = 1;
+        late++;
+    }
+
+    conty_deleter_stop(deleted_late, &late);
+
+    if (late != REAP_TEST_CONTAINERS)
+        return log_error_ret(-1, "%d of %d containers came back", late, REAP_TEST_CONTAINERS);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE, err;
+
+    if (system("rm -rf " REAP_TEST_DIR " && mkdir -p " REAP_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", REAP_TEST_DIR);
+
+    if (write_conf(REAP_TEST_DIR "/exit.json", "exit 3", "") != 0 ||
+        write_conf(REAP_TEST_DIR "/sleep.json", "exec sleep 10", "") != 0 ||
+        write_conf(REAP_TEST_DIR "/slow.json", "exit 0", slow_hooks) != 0 ||
+        write_conf(REAP_TEST_DIR "/socket.json", "exit 0", socket_hooks) != 0)
+        goto out;
+
+    if (run_exited() != 0 || run_killed() != 0)
+        goto out;
+
+    if (delete_blocking() != 0)
+        goto out;
+
+    if (conty_deleter_start() != 0)
+        goto out;
+
+    if (delete_kept() != 0) {
+        conty_deleter_stop(NULL, NULL);
+        goto out;
+    }
+
+    err = delete_async();
+    conty_deleter_stop(NULL, NULL);
+    if (err != 0 || delete_stopped() != 0)
+        goto out;
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " REAP_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", REAP_TEST_DIR);
+
+    return ret;
+}
@@ -0,0 +1,117 @@
+#include "registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define REGISTRY_TEST_ID_FMT "conty-container-%08zu"
+
+static char **make_ids(size_t n, size_t offset)
+{
+    char **ids = calloc(n, sizeof(char *));
+    if (!ids)
+        return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if (asprintf(&ids[i], REGISTRY_TEST_ID_FMT, i + offset) < 0)
+            return NULL;
+    }
+
+    return ids;
+}
+
+static struct conty_rt_hc *find(const struct conty_rt_registry *reg, const char *id)
+{
+    size_t len = strlen(id);
+
+    return conty_rt_registry_find(reg, id, len, conty_rt_registry_hash(id, len));
+}
+
+/*
+ * Starts out small, so the registry grows many times along the way
+ */
+static int run(size_t n)
+{
+    struct conty_rt_registry reg;
+    struct conty_rt_hc *hc;
+    char **ids, **missing;
+    size_t len;
+    int ret = -1;
+
+    ids     = make_ids(n, 0);
+    missing = make_ids(n, n);
+    if (!ids || !missing || conty_rt_registry_init(&reg, 0) != 0)
+        return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        len = strlen(ids[i]);
+        if (conty_rt_registry_insert(&reg, ids[i], len, conty_rt_registry_hash(ids[i], len),
+                                     (struct conty_container *) ids[i]) != 0) {
+            LOG_ERROR("cannot insert %s", ids[i]);
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!(hc = find(&reg, ids[i])) || hc->hc_cc != (struct conty_container *) ids[i]) {
+            LOG_ERROR("lost %s", ids[i]);
+            goto out;
+        }
+
+        if (find(&reg, missing[i])) {
+            LOG_ERROR("found %s, which was never inserted", missing[i]);
+            goto out;
+        }
+    }
+
+    /*
+     * Removing every other container must leave the rest reachable
+     */
+    for (size_t i = 0; i < n; i += 2) {
+        len = strlen(ids[i]);
+        if (conty_rt_registry_remove(&reg, ids[i], len, conty_rt_registry_hash(ids[i], len)) !=
+            (struct conty_container *) ids[i]) {
+            LOG_ERROR("cannot remove %s", ids[i]);
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if ((i % 2 == 0) != (find(&reg, ids[i]) == NULL)) {
+            LOG_ERROR("%s is inconsistent after removal", ids[i]);
+            goto out;
+        }
+    }
+
+    if (conty_rt_registry_len(&reg) != n / 2) {
+        LOG_ERROR("registry holds %zu containers, expected %zu", conty_rt_registry_len(&reg),
+                  n / 2);
+        goto out;
+    }
+
+    ret = 0;
+out:
+    conty_rt_registry_free(&reg);
+    for (size_t i = 0; i < n; i++) {
+        free(ids[i]);
+        free(missing[i]);
+    }
+    free(ids);
+    free(missing);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 1, 1000, 100000 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (run(sizes[i]) != 0)
+            return log_error_ret(EXIT_FAILURE, "failed with %zu containers", sizes[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
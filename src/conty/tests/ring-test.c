@@ -0,0 +1,151 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+#define RING_TEST_MESSAGES (1 << 18)
+#define RING_TEST_CAPACITY 1024
+#define RING_TEST_MAX_PRODUCERS 4
+
+struct ring_test {
+    struct conty_ring *rt_spsc;
+    struct conty_mpsc *rt_mpsc;
+    size_t             rt_messages;
+};
+
+/*
+ * Records are plain integers smuggled through the pointer, starting at 1
+ * because NULL signifies an empty ring
+ */
+static void *spsc_producer(void *arg)
+{
+    struct ring_test *rt = arg;
+
+    for (uintptr_t i = 1; i <= rt->rt_messages; i++) {
+        while (conty_ring_push(rt->rt_spsc, (void *) i) == -EAGAIN)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void *mpsc_producer(void *arg)
+{
+    struct ring_test *rt = arg;
+
+    for (uintptr_t i = 1; i <= rt->rt_messages; i++) {
+        while (conty_mpsc_push(rt->rt_mpsc, (void *) i) == -EAGAIN)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static int run_spsc(int wakeups)
+{
+    struct conty_ring ring;
+    struct ring_test rt = {
+            .rt_spsc     = &ring,
+            .rt_messages = RING_TEST_MESSAGES,
+    };
+    pthread_t producer;
+    uintptr_t record, expected = 1;
+
+    if (conty_ring_init(&ring, RING_TEST_CAPACITY) != 0)
+        return -1;
+
+    if (pthread_create(&producer, NULL, spsc_producer, &rt) != 0)
+        return -1;
+
+    while (expected <= rt.rt_messages) {
+        record = (uintptr_t) conty_ring_pop(&ring);
+        if (!record) {
+            if (wakeups)
+                conty_ring_eventfd_wait(conty_ring_fd(&ring), -1);
+            else
+                sched_yield();
+            continue;
+        }
+
+        /*
+         * Single producer, so records must arrive in order
+         */
+        if (record != expected)
+            return log_error_ret(-1, "spsc: expected %lu got %lu",
+                                 (unsigned long) expected, (unsigned long) record);
+        expected++;
+    }
+
+    pthread_join(producer, NULL);
+    conty_ring_free(&ring);
+
+    return 0;
+}
+
+static int run_mpsc(int producers, int wakeups)
+{
+    struct ring_test rt[RING_TEST_MAX_PRODUCERS];
+    pthread_t threads[RING_TEST_MAX_PRODUCERS];
+    struct conty_mpsc ring;
+    uintptr_t record;
+    uint64_t sum = 0, expected_sum;
+    size_t received = 0, total;
+
+    if (conty_mpsc_init(&ring, RING_TEST_CAPACITY) != 0)
+        return -1;
+
+    total = (size_t) producers * (RING_TEST_MESSAGES / producers);
+    expected_sum = (uint64_t) producers *
+                   ((uint64_t) (RING_TEST_MESSAGES / producers) *
+                    (RING_TEST_MESSAGES / producers + 1) / 2);
+
+    for (int i = 0; i < producers; i++) {
+        rt[i].rt_mpsc     = &ring;
+        rt[i].rt_messages = RING_TEST_MESSAGES / producers;
+
+        if (pthread_create(&threads[i], NULL, mpsc_producer, &rt[i]) != 0)
+            return -1;
+    }
+
+    while (received < total) {
+        record = (uintptr_t) conty_mpsc_pop(&ring);
+        if (!record) {
+            if (wakeups)
+                conty_ring_eventfd_wait(conty_mpsc_fd(&ring), -1);
+            else
+                sched_yield();
+            continue;
+        }
+        sum += record;
+        received++;
+    }
+
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    conty_mpsc_free(&ring);
+
+    if (sum != expected_sum)
+        return log_error_ret(-1, "mpsc: lost records");
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    for (int wakeups = 0; wakeups <= 1; wakeups++) {
+        if (run_spsc(wakeups) != 0)
+            return log_error_ret(EXIT_FAILURE, "run_spsc failed");
+
+        for (int producers = 1; producers <= RING_TEST_MAX_PRODUCERS; producers *= 2) {
+            if (run_mpsc(producers, wakeups) != 0)
+                return log_error_ret(EXIT_FAILURE, "run_mpsc failed");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
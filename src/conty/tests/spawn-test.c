@@ -0,0 +1,173 @@
+#include "container.h"
+#include "clone.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "log.h"
+
+#define SPAWN_TEST_DIR    "/tmp/conty-spawn-test"
+#define SPAWN_TEST_ROUNDS 4
+
+/*
+ * Nothing to set up, conty-init stands in for it until it starts.
+ * Joins our own network namespace, since there has to be one
+ */
+static const char *plain_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"net\", \"pid\": %d }]"
+    "}";
+
+/*
+ * The cheapest namespace there is, but it has to be forked
+ */
+static const char *uts_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }]"
+    "}";
+
+/*
+ * Joins by path, through an intermediate process on a stack of its own
+ */
+static const char *joined_conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\", \"path\": \"/proc/%d/ns/uts\" }]"
+    "}";
+
+static char *true_argv[] = { "/bin/true", NULL };
+static char *true_envp[] = { NULL };
+
+static int write_file(const char *path, const char *contents)
+{
+    FILE *file;
+
+    if (!(file = fopen(path, "w")))
+        return log_error_ret(-1, "cannot open %s", path);
+
+    fprintf(file, contents, getpid());
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int exec_true(void *arg)
+{
+    execve(true_argv[0], true_argv, true_envp);
+    return -errno;
+}
+
+static int exit_now(void *arg)
+{
+    return 0;
+}
+
+static int reap(pid_t pid, int pidfd)
+{
+    int status;
+
+    close(pidfd);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return log_error_ret(-1, "child %d did not exit cleanly", pid);
+
+    return 0;
+}
+
+static int test_clone(void)
+{
+    int pidfd;
+    pid_t pid;
+
+    if ((pid = clone3_cb(exec_true, NULL, CLONE_PIDFD, &pidfd)) < 0)
+        return log_error_ret(-1, "cannot fork");
+
+    if (reap(pid, pidfd) != 0)
+        return -1;
+
+    if ((pid = clone_vfork(exec_true, NULL, CLONE_PIDFD, &pidfd)) < 0)
+        return log_error_ret(-1, "cannot vfork");
+
+    if (reap(pid, pidfd) != 0)
+        return -1;
+
+    if ((pid = clone_old(exit_now, NULL, CLONE_VM | CLONE_VFORK, NULL)) < 0)
+        return log_error_ret(-1, "cannot clone");
+
+    if (waitpid(pid, NULL, 0) != pid)
+        return log_error_ret(-1, "cannot reap %d", pid);
+
+    return 0;
+}
+
+static int spawn_container(const char *bundle)
+{
+    struct conty_container *cc;
+    int status;
+    pid_t pid;
+
+    for (int i = 0; i < SPAWN_TEST_ROUNDS; i++) {
+        if (!(cc = conty_container_create("spawn-test", bundle)))
+            return log_error_ret(-1, "cannot create container from %s", bundle);
+
+        pid = conty_container_pid(cc);
+        if (conty_container_start(cc) != 0)
+            return log_error_ret(-1, "cannot start container from %s", bundle);
+
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return log_error_ret(-1, "container from %s did not exit cleanly", bundle);
+
+        conty_container_set_status(cc, CONTY_STOPPED);
+        if (conty_container_delete(cc) != 0)
+            return log_error_ret(-1, "cannot delete container from %s", bundle);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    if (system("rm -rf " SPAWN_TEST_DIR " && mkdir -p " SPAWN_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", SPAWN_TEST_DIR);
+
+    if (write_file(SPAWN_TEST_DIR "/plain.json", plain_conf) != 0 ||
+        write_file(SPAWN_TEST_DIR "/uts.json", uts_conf) != 0 ||
+        write_file(SPAWN_TEST_DIR "/joined.json", joined_conf) != 0)
+        goto out;
+
+    if (test_clone() != 0 ||
+        spawn_container(SPAWN_TEST_DIR "/plain.json") != 0 ||
+        spawn_container(SPAWN_TEST_DIR "/uts.json") != 0 ||
+        spawn_container(SPAWN_TEST_DIR "/joined.json") != 0)
+        goto out;
+
+    /*
+     * Intermediate processes on stacks from the pool, which go back
+     * to it once the container has been spawned
+     */
+    if (conty_stack_pool_start(2, 256 * 1024) != 0) {
+        LOG_ERROR("cannot start stack pool");
+        goto out;
+    }
+
+    if (spawn_container(SPAWN_TEST_DIR "/joined.json") != 0) {
+        conty_stack_pool_stop();
+        goto out;
+    }
+
+    conty_stack_pool_stop();
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " SPAWN_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", SPAWN_TEST_DIR);
+
+    return ret;
+}
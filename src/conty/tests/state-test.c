@@ -0,0 +1,129 @@
+#include "state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+
+#include "log.h"
+
+#define STATE_TEST_PATH       "/tmp/conty-state-test"
+#define STATE_TEST_CONTAINERS 10000
+
+static int fill(struct conty_rt_state *st, size_t n)
+{
+    char id[CONTY_RT_ID_MAX];
+    int len, slot;
+
+    for (size_t i = 0; i < n; i++) {
+        len = snprintf(id, sizeof(id), "container-%zu", i);
+
+        slot = conty_rt_state_add(st, id, (size_t) len, "/bundles/config.json",
+                                  "vc0badf00d", getpid(), CONTY_RUNNING);
+        if (slot < 0)
+            return log_error_ret(-1, "cannot add %s", id);
+
+        /*
+         * Lower slots are handed out first, even across growth
+         */
+        if ((size_t) slot != i)
+            return log_error_ret(-1, "%s got slot %d", id, slot);
+    }
+
+    return 0;
+}
+
+/*
+ * Does what the runtime does on recovery minus the registry:
+ * visit every record, open a pidfd and check the start time
+ */
+static int recover(struct conty_rt_state *st, size_t *live)
+{
+    const struct conty_rt_record *rec;
+    int pollfd;
+
+    *live = 0;
+    for (size_t i = 0; i < conty_rt_state_slots(st); i++) {
+        if (!(rec = conty_rt_state_record(st, i)))
+            continue;
+
+        if ((pollfd = pidfd_open(rec->rec_pid, 0)) < 0)
+            return log_error_ret(-1, "cannot open pidfd");
+
+        if (conty_rt_proc_starttime(rec->rec_pid) == rec->rec_starttime)
+            (*live)++;
+
+        close(pollfd);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct conty_rt_state st, other;
+    const struct conty_rt_record *rec;
+    size_t live;
+    int fd;
+
+    unlink(STATE_TEST_PATH);
+
+    /*
+     * A crash between sizing a new file and writing its header
+     * leaves zeroes behind, which must not keep us from starting
+     */
+    if ((fd = open(STATE_TEST_PATH, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) < 0 ||
+        ftruncate(fd, 4096) != 0 || close(fd) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create empty state file");
+
+    if (conty_rt_state_open(&st, STATE_TEST_PATH) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create state file");
+
+    if (conty_rt_proc_starttime(getpid()) == 0)
+        return log_error_ret(EXIT_FAILURE, "cannot read start time");
+
+    if (fill(&st, STATE_TEST_CONTAINERS) != 0)
+        return EXIT_FAILURE;
+
+    /*
+     * Only one runtime may use a state file at a time
+     */
+    if (conty_rt_state_open(&other, STATE_TEST_PATH) != -EWOULDBLOCK)
+        return log_error_ret(EXIT_FAILURE, "state file is not locked");
+
+    conty_rt_state_set_status(&st, 42, CONTY_STOPPED);
+    conty_rt_state_release(&st, 7);
+    conty_rt_state_close(&st);
+
+    if (conty_rt_state_open(&st, STATE_TEST_PATH) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot reopen state file");
+
+    if (recover(&st, &live) != 0)
+        return EXIT_FAILURE;
+
+    if (live != STATE_TEST_CONTAINERS - 1)
+        return log_error_ret(EXIT_FAILURE, "recovered %zu containers", live);
+
+    if (conty_rt_state_record(&st, 7))
+        return log_error_ret(EXIT_FAILURE, "released record survived");
+
+    rec = conty_rt_state_record(&st, 42);
+    if (!rec || rec->rec_status != CONTY_STOPPED || strcmp(rec->rec_id, "container-42") != 0 ||
+        strcmp(rec->rec_veth, "vc0badf00d") != 0)
+        return log_error_ret(EXIT_FAILURE, "invalid record after reopen");
+
+    /*
+     * The released slot is the first one to be reused
+     */
+    if (conty_rt_state_add(&st, "reused", sizeof("reused") - 1, "/bundles/config.json",
+                           "", getpid(), CONTY_CREATED) != 7)
+        return log_error_ret(EXIT_FAILURE, "released slot was not reused");
+
+    conty_rt_state_close(&st);
+    unlink(STATE_TEST_PATH);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "container.h"
+#include "log.h"
+
+#define STATS_TEST_DIR     "/tmp/conty-stats-test"
+#define STATS_TEST_SAMPLES 100000
+
+/*
+ * The container_created hooks run inside the container process, so the
+ * runtime only learns how long they took if the child reports it
+ */
+static const char *conf =
+    "{"
+    "  \"process\": { \"args\": [\"/bin/true\"], \"cwd\": \"/\" },"
+    "  \"root\": { \"path\": \"/\" },"
+    "  \"namespaces\": [{ \"type\": \"uts\" }],"
+    "  \"hooks\": {"
+    "    \"on_container_created\": [{"
+    "      \"path\": \"/bin/sleep\","
+    "      \"timeout\": 5,"
+    "      \"args\": [\"sleep\", \"0.05\"]"
+    "    }]"
+    "  }"
+    "}";
+
+static int check_quantile(const struct conty_rt_hist *hist, double q, uint64_t expected)
+{
+    uint64_t got = conty_rt_hist_quantile(hist, q);
+
+    /*
+     * A bucket spans a quarter of its magnitude at most
+     */
+    if (got < expected || got > expected + expected / 4)
+        return log_error_ret(-1, "p%g is %llu, expected about %llu", q * 100,
+                             (unsigned long long) got, (unsigned long long) expected);
+
+    return 0;
+}
+
+static int run_hist(void)
+{
+    struct conty_rt_hist hist;
+    char line[256];
+
+    memset(&hist, 0, sizeof(hist));
+
+    if (conty_rt_hist_quantile(&hist, 0.5) != 0)
+        return log_error_ret(-1, "empty histogram has a median");
+
+    for (uint64_t i = 1; i <= STATS_TEST_SAMPLES; i++)
+        conty_rt_hist_add(&hist, i * 1000);
+
+    if (check_quantile(&hist, 0.50, STATS_TEST_SAMPLES / 2 * 1000) != 0 ||
+        check_quantile(&hist, 0.90, STATS_TEST_SAMPLES / 10 * 9 * 1000) != 0 ||
+        check_quantile(&hist, 0.99, STATS_TEST_SAMPLES / 100 * 99 * 1000) != 0)
+        return -1;
+
+    if (conty_rt_hist_quantile(&hist, 1) != STATS_TEST_SAMPLES * 1000)
+        return log_error_ret(-1, "p100 is not the largest duration");
+
+    conty_rt_hist_add(&hist, 0);
+    conty_rt_hist_add(&hist, UINT64_MAX);
+
+    if (conty_rt_hist_format(&hist, line, sizeof(line)) < 0)
+        return log_error_ret(-1, "cannot format histogram");
+
+    if (conty_rt_hist_format(&hist, line, 8) != -EIO)
+        return log_error_ret(-1, "histogram was truncated");
+
+    return 0;
+}
+
+static int run_phases(void)
+{
+    CONTAINER_RESOURCE struct conty_container *cc = NULL;
+    FILE *file;
+
+    if (!(file = fopen(STATS_TEST_DIR "/config.json", "w")))
+        return log_error_ret(-1, "cannot open config");
+
+    fputs(conf, file);
+    if (fclose(file) != 0)
+        return -1;
+
+    if (!(cc = conty_container_create("stats", STATS_TEST_DIR "/config.json")))
+        return log_error_ret(-1, "cannot create container");
+
+    if (conty_container_start(cc) != 0)
+        return log_error_ret(-1, "cannot start container");
+
+    if (conty_container_phase_ns(cc, CONTY_PHASE_SPAWN) == 0 ||
+        conty_container_phase_ns(cc, CONTY_PHASE_START) == 0)
+        return log_error_ret(-1, "container was not timed");
+
+    if (conty_container_phase_ns(cc, CONTY_PHASE_CREATED_HOOKS) < 50 * 1000 * 1000)
+        return log_error_ret(-1, "container_created hooks were not reported");
+
+    if (conty_container_phase_ns(cc, CONTY_PHASE_CREATE) <
+        conty_container_phase_ns(cc, CONTY_PHASE_CREATED_HOOKS))
+        return log_error_ret(-1, "creation took less than its hooks");
+
+    if (conty_container_phase_ns(cc, CONTY_PHASE_MAX + 1) != 0 ||
+        strcmp(conty_container_phase_str(CONTY_PHASE_MAX + 1), "unknown") != 0)
+        return log_error_ret(-1, "unknown phase was accepted");
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    if (system("rm -rf " STATS_TEST_DIR " && mkdir -p " STATS_TEST_DIR) != 0)
+        return log_error_ret(EXIT_FAILURE, "cannot create %s", STATS_TEST_DIR);
+
+    if (run_hist() != 0 || run_phases() != 0)
+        goto out;
+
+    ret = EXIT_SUCCESS;
+out:
+    if (system("rm -rf " STATS_TEST_DIR) != 0)
+        LOG_WARN("cannot remove %s", STATS_TEST_DIR);
+
+    return ret;
+}
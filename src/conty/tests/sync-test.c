@@ -1,5 +1,8 @@
 #include "sync.h"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdlib.h>
@@ -63,6 +66,140 @@ int test_sync()
     return 0;
 }
 
+int test_sync_fd()
+{
+    int err, status, payload;
+    int fds[2], pipefds[2];
+    char byte = 0;
+    pid_t child;
+
+    if (conty_sync_init(fds) != 0)
+        return -1;
+
+    child = fork();
+    if (child < 0)
+        return -1;
+
+    if (child == 0) {
+        conty_sync_init_container(fds);
+
+        err = conty_sync_await_runtime_fd(fds, EVENT_ID_MAPPED, &payload);
+        if (err != 0)
+            _exit(-1);
+
+        /*
+         * The descriptor didn't exist when we were forked,
+         * so it must have come through the socket
+         */
+        if (write(payload, "x", 1) != 1)
+            _exit(-1);
+
+        _exit(0);
+    }
+
+    conty_sync_init_runtime(fds);
+
+    if (pipe2(pipefds, O_CLOEXEC) != 0)
+        return -1;
+
+    err = conty_sync_wake_container_fd(fds, EVENT_ID_MAPPED, pipefds[1]);
+    close(pipefds[1]);
+    if (err != 0)
+        return -1;
+
+    if (read(pipefds[0], &byte, 1) != 1 || byte != 'x')
+        return -1;
+
+    close(pipefds[0]);
+
+    if (waitpid(child, &status, 0) != child || WEXITSTATUS(status) != 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * The container writes the event and the first half of the data,
+ * then either the rest a little later or nothing at all
+ */
+static int send_halves(int fds[2], const uint64_t *data, size_t len, int rest)
+{
+    int event = EVENT_CONT_CREATED;
+    char msg[sizeof(int) + len];
+
+    memcpy(msg, &event, sizeof(event));
+    memcpy(msg + sizeof(event), data, len);
+
+    if (conty_sync_write(fds[SYNC_FD_CONT], msg, sizeof(int) + len / 2) < 0)
+        return -1;
+
+    if (!rest)
+        return 0;
+
+    usleep(50000);
+    if (conty_sync_write(fds[SYNC_FD_CONT], msg + sizeof(int) + len / 2, len - len / 2) < 0)
+        return -1;
+
+    return 0;
+}
+
+static ssize_t receive_halves(const uint64_t *data, uint64_t *out, size_t len, int rest)
+{
+    struct pollfd pollfd;
+    int fds[2], status;
+    ssize_t rx;
+    pid_t child;
+
+    if (conty_sync_init(fds) != 0)
+        return -1;
+
+    child = fork();
+    if (child < 0)
+        return -1;
+
+    if (child == 0) {
+        conty_sync_init_container(fds);
+        _exit(send_halves(fds, data, len, rest) == 0 ? 0 : 1);
+    }
+
+    conty_sync_init_runtime(fds);
+
+    /*
+     * The runtime's end doesn't block
+     */
+    if (fcntl(fds[SYNC_FD_RT], F_SETFL, O_NONBLOCK) != 0)
+        return -1;
+
+    pollfd = (struct pollfd) { .fd = fds[SYNC_FD_RT], .events = POLLIN };
+    if (poll(&pollfd, 1, 5000) != 1)
+        return -1;
+
+    rx = conty_sync_await_container_data(fds, EVENT_CONT_CREATED, out, len);
+    close(fds[SYNC_FD_RT]);
+
+    if (waitpid(child, &status, 0) != child || WEXITSTATUS(status) != 0)
+        return -1;
+
+    return rx;
+}
+
+int test_sync_data()
+{
+    uint64_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, out[8] = { 0 };
+
+    if (receive_halves(data, out, sizeof(data), 1) != sizeof(data) ||
+        memcmp(data, out, sizeof(data)) != 0)
+        return -1;
+
+    /*
+     * Hanging up halfway through is not a short success
+     */
+    if (receive_halves(data, out, sizeof(data), 0) != -EMSGSIZE)
+        return -1;
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (test_sync() != 0) {
@@ -70,5 +207,15 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (test_sync_fd() != 0) {
+        LOG_ERROR("test_sync_fd failed");
+        return EXIT_FAILURE;
+    }
+
+    if (test_sync_data() != 0) {
+        LOG_ERROR("test_sync_data failed");
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
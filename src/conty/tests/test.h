@@ -0,0 +1,16 @@
+#ifndef CONTY_TEST_H
+#define CONTY_TEST_H
+
+#include <time.h>
+
+/*
+ * Shared by the tests that still need a clock
+ */
+static inline double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+#endif //CONTY_TEST_H
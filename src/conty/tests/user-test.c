@@ -1,6 +1,22 @@
 #include "user.h"
 
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+#include "clone.h"
 #include "log.h"
+#include "resource.h"
+
+#define USER_TEST_ROUNDS 4
+
+/*
+ * Container side of the pipes, [0] for the runtime's go ahead
+ * and [1] to report that the mappings are in place
+ */
+static int to_child[2], to_parent[2];
+static struct conty_id_map uids, gids;
 
 int test_id_map_put()
 {
@@ -14,9 +30,117 @@ int test_id_map_put()
     return 0;
 }
 
+static int report_mapped(void)
+{
+    char ok = (getuid() == 0 && getgid() == 0) ? 1 : 0;
+    return (write(to_parent[1], &ok, 1) == 1) ? 0 : -1;
+}
+
+/*
+ * The way containers used to do it, formatting and writing their own
+ * mappings through /proc/self
+ */
+static int child_maps_itself(void *arg)
+{
+    struct oci_ids *ids = arg;
+
+    if (conty_id_map_write_oci_uids(ids) != 0)
+        return 1;
+
+    if (conty_id_disable_setgroups() != 0)
+        return 1;
+
+    if (conty_id_map_write_oci_gids(ids) != 0)
+        return 1;
+
+    return report_mapped();
+}
+
+static int child_awaits_mapping(void *arg)
+{
+    char go;
+
+    if (read(to_child[0], &go, 1) != 1)
+        return 1;
+
+    return report_mapped();
+}
+
+static int spawn_mapped(int parent_writes)
+{
+    FD_RESOURCE int pollfd = -EBADF;
+    struct oci_id_mapping mapping = {
+            .oid_container = 0,
+            .oid_host      = getuid(),
+            .oid_count     = 1,
+    };
+    struct oci_ids ids = SLIST_HEAD_INITIALIZER(ids);
+    char path[32], ok = 0, go = 1;
+    pid_t child;
+    int status;
+
+    SLIST_INSERT_HEAD(&ids, &mapping, oid_next);
+
+    if (parent_writes) {
+        child = clone3_cb(child_awaits_mapping, NULL, CLONE_NEWUSER | CLONE_PIDFD, &pollfd);
+        if (child < 0)
+            return -1;
+
+        FD_RESOURCE int procfd = -EBADF;
+        snprintf(path, sizeof(path), "/proc/%d", child);
+        if ((procfd = open(path, O_DIRECTORY | O_PATH | O_CLOEXEC)) < 0)
+            return -1;
+
+        if (conty_id_map_write_at(procfd, &uids, &gids) != 0)
+            return -1;
+
+        if (write(to_child[1], &go, 1) != 1)
+            return -1;
+    } else {
+        child = clone3_cb(child_maps_itself, &ids, CLONE_NEWUSER | CLONE_PIDFD, &pollfd);
+        if (child < 0)
+            return -1;
+    }
+
+    if (read(to_parent[0], &ok, 1) != 1)
+        ok = 0;
+
+    if (waitpid(child, &status, 0) != child)
+        return -1;
+
+    return (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int test_id_map_write_at()
+{
+    if (pipe2(to_child, O_CLOEXEC) != 0 || pipe2(to_parent, O_CLOEXEC) != 0)
+        return -1;
+
+    conty_id_map_init(&uids);
+    conty_id_map_init(&gids);
+
+    if (conty_id_map_put(&uids, 0, getuid(), 1) != 0 ||
+        conty_id_map_put(&gids, 0, getgid(), 1) != 0)
+        return -1;
+
+    for (int round = 0; round < USER_TEST_ROUNDS; round++) {
+        for (int parent_writes = 0; parent_writes <= 1; parent_writes++) {
+            if (spawn_mapped(parent_writes) != 0)
+                return log_error_ret(-1, "mapping failed (parent writes: %d)",
+                                     parent_writes);
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (test_id_map_put() != 0)
         return log_error_ret(EXIT_FAILURE, "test_id_map_put failed");
+
+    if (test_id_map_write_at() != 0)
+        return log_error_ret(EXIT_FAILURE, "test_id_map_write_at failed");
+
     return 0;
-}
\ No newline at end of file
+}